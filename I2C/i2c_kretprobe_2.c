@@ -1,63 +1,257 @@
+/*
+ * i2c_kretprobe_2.c - I2C latency profiler
+ *
+ * Times every i2c_transfer() and i2c_transfer_buffer_flags() (which
+ * i2c_master_send/recv are built on) with a kretprobe and files the
+ * durations into per-CPU log2 histograms, one per (adapter, address).
+ * Nothing is printed per call: the handlers only touch this CPU's
+ * counters, so they neither spam dmesg nor hold up the bus they measure.
+ * Results, including probes the kernel missed, are in debugfs:
+ *
+ *   cat /sys/kernel/debug/i2c_latency/stats
+ *
+ * An i2c_master_send shows up under both functions: the outer call and
+ * the i2c_transfer it makes. Reload the module to reset the counters.
+ */
 #include <linux/module.h>
 #include <linux/kprobes.h>
 #include <linux/ktime.h>
 #include <linux/i2c.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
 
-/* Define the structure for shared data between handlers */
-struct my_probe_data {
+/* Filters: -1 = any. E.g. addr=0x70 for the HT16K33, addr=0x50 for the AT24 */
+static int addr = -1;
+module_param(addr, int, 0444);
+MODULE_PARM_DESC(addr, "Only this 7-bit client address (-1 = all)");
+
+static int adapter = -1;
+module_param(adapter, int, 0444);
+MODULE_PARM_DESC(adapter, "Only this adapter number, as in /dev/i2c-N (-1 = all)");
+
+/* Calls in flight at once; beyond that the kernel counts them as missed */
+static int maxactive = 64;
+module_param(maxactive, int, 0444);
+MODULE_PARM_DESC(maxactive, "Concurrent calls tracked per function");
+
+#define LAT_SLOTS   32      /* Distinct (adapter, addr) pairs per function */
+#define LAT_BUCKETS 32      /* Bucket i: [2^i, 2^(i+1)) ns, up to ~4 s */
+
+/* Everything one CPU has seen for one (adapter, addr) */
+struct lat_stats {
+    u64 count;
+    u64 sum_ns;
+    u64 min_ns;
+    u64 max_ns;
+    u64 hist[LAT_BUCKETS];
+};
+
+/*
+ * One probed function. Slots are claimed with cmpxchg on first sight of
+ * a pair and never given back, so the handlers need no lock: after the
+ * lookup they only write this CPU's copy of the slot.
+ */
+struct lat_probe {
+    struct kretprobe krp;
+    bool by_adapter;            /* arg0 is the adapter (i2c_transfer), else the client */
+    u32 keys[LAT_SLOTS];        /* 0 = free, else LAT_KEY() */
+    atomic_t overflow;          /* Calls for pairs that found no free slot */
+    struct lat_stats __percpu *stats;   /* [LAT_SLOTS] per CPU */
+};
+
+#define LAT_KEY(nr, a)  (BIT(31) | ((u32)(nr) << 16) | (a))
+
+/* Shared between entry and return handler */
+struct lat_call {
     ktime_t entry_stamp;
+    int slot;
 };
 
-/* 1. ENTRY HANDLER: Runs when entering the function */
+static int lat_slot(struct lat_probe* lp, u32 key)
+{
+    int i;
+
+    for (i = 0; i < LAT_SLOTS; i++) {
+        u32 cur = READ_ONCE(lp->keys[i]);
+
+        if (cur == key) return i;
+        if (!cur && (cur = cmpxchg(&lp->keys[i], 0, key)) == 0) return i;
+        if (cur == key) return i;   /* Lost the race to the same pair */
+    }
+    atomic_inc(&lp->overflow);
+    return -1;
+}
+
+/* 1. ENTRY HANDLER: filter, find the slot, stamp the time */
 static int entry_handler(struct kretprobe_instance* ri, struct pt_regs* regs)
 {
-    struct my_probe_data* data;
-    struct i2c_client* client = (struct i2c_client*)regs->regs[0]; // x0 on ARM64
+    struct lat_probe* lp = container_of(get_kretprobe(ri), struct lat_probe, krp);
+    struct lat_call* call = (struct lat_call*)ri->data;
+    struct i2c_adapter* adap;
+    u16 a;
+
+    /* Portable: no hard-coded argument registers */
+    if (lp->by_adapter) {
+        struct i2c_msg* msgs = (struct i2c_msg*)regs_get_kernel_argument(regs, 1);
+        int num = (int)regs_get_kernel_argument(regs, 2);
 
-    /* Filter for our specific device */
-    if (!client || client->addr != 0x70)
-        return 1; // Return 1 to skip the return handler for other devices
+        adap = (struct i2c_adapter*)regs_get_kernel_argument(regs, 0);
+        if (!adap || !msgs || num <= 0) return 1;
+        a = msgs[0].addr;
+    } else {
+        struct i2c_client* client = (struct i2c_client*)regs_get_kernel_argument(regs, 0);
 
-    /* Access the automatically allocated data buffer */
-    data = (struct my_probe_data*)ri->data;
-    data->entry_stamp = ktime_get();
+        if (!client) return 1;
+        adap = client->adapter;
+        a = client->addr;
+    }
+    if ((addr >= 0 && a != addr) || (adapter >= 0 && adap->nr != adapter))
+        return 1;   /* Skip the return handler */
+
+    call->slot = lat_slot(lp, LAT_KEY(adap->nr, a));
+    if (call->slot < 0) return 1;
+    call->entry_stamp = ktime_get();
     return 0;
 }
 
-/* 2. RETURN HANDLER: Runs when the function returns */
+/* 2. RETURN HANDLER: into this CPU's histogram (preemption is off here) */
 static int ret_handler(struct kretprobe_instance* ri, struct pt_regs* regs)
 {
-    struct my_probe_data* data = (struct my_probe_data*)ri->data;
-    s64 delta_ns;
-
-    delta_ns = ktime_to_ns(ktime_sub(ktime_get(), data->entry_stamp));
+    struct lat_probe* lp = container_of(get_kretprobe(ri), struct lat_probe, krp);
+    struct lat_call* call = (struct lat_call*)ri->data;
+    struct lat_stats* st = this_cpu_ptr(lp->stats) + call->slot;
+    u64 ns = ktime_to_ns(ktime_sub(ktime_get(), call->entry_stamp));
 
-    pr_info("[DEBUG] i2c_master_send took %lld ns\n", delta_ns);
+    if (!st->count || ns < st->min_ns) st->min_ns = ns;
+    if (ns > st->max_ns) st->max_ns = ns;
+    st->count++;
+    st->sum_ns += ns;
+    st->hist[ns ? min_t(int, ilog2(ns), LAT_BUCKETS - 1) : 0]++;
     return 0;
 }
 
-static struct kretprobe my_kretprobe = {
-    .handler = ret_handler,
-    .entry_handler = entry_handler,
-    /* This tells the kernel how much memory to allocate for ri->data */
-    .data_size = sizeof(struct my_probe_data),
-    .maxactive = 20,
-    .kp.symbol_name = "i2c_transfer_buffer_flags",
+static struct lat_probe lat_probes[] = {
+    {
+        .krp.kp.symbol_name = "i2c_transfer",
+        .by_adapter = true,
+    },
+    {
+        .krp.kp.symbol_name = "i2c_transfer_buffer_flags",
+    },
 };
 
+static struct dentry* lat_dir;
+
+/* Upper bound of the bucket the 'pct' percentile falls in */
+static u64 lat_percentile(const u64* hist, u64 count, unsigned int pct)
+{
+    u64 want = div_u64(count * pct + 99, 100), seen = 0;
+    int i;
+
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen >= want) return (2ULL << i) - 1;
+    }
+    return U64_MAX;
+}
+
+static int lat_stats_show(struct seq_file* m, void* v)
+{
+    int p, i, cpu;
+
+    seq_printf(m, "%-26s %7s %4s %10s %10s %10s %10s %10s %10s\n", "function", "adapter", "addr",
+               "count", "min_ns", "avg_ns", "p50_ns<=", "p99_ns<=", "max_ns");
+    for (p = 0; p < ARRAY_SIZE(lat_probes); p++) {
+        struct lat_probe* lp = &lat_probes[p];
+
+        for (i = 0; i < LAT_SLOTS; i++) {
+            u32 key = READ_ONCE(lp->keys[i]);
+            struct lat_stats sum = { .min_ns = U64_MAX };
+            int b;
+
+            if (!key) break;
+            /* Fold the per-CPU copies; a sample landing meanwhile may be half counted */
+            for_each_possible_cpu(cpu) {
+                struct lat_stats* st = per_cpu_ptr(lp->stats, cpu) + i;
+
+                if (!st->count) continue;
+                sum.count += st->count;
+                sum.sum_ns += st->sum_ns;
+                sum.min_ns = min(sum.min_ns, st->min_ns);
+                sum.max_ns = max(sum.max_ns, st->max_ns);
+                for (b = 0; b < LAT_BUCKETS; b++)
+                    sum.hist[b] += st->hist[b];
+            }
+            if (!sum.count) continue;
+
+            seq_printf(m, "%-26s %7u 0x%02x %10llu %10llu %10llu %10llu %10llu %10llu\n",
+                       lp->krp.kp.symbol_name, (key >> 16) & 0x7fff, key & 0xffff,
+                       sum.count, sum.min_ns, div64_u64(sum.sum_ns, sum.count),
+                       lat_percentile(sum.hist, sum.count, 50),
+                       lat_percentile(sum.hist, sum.count, 99), sum.max_ns);
+            /* Non-empty buckets as <lower bound ns>:<count> */
+            seq_puts(m, "    hist");
+            for (b = 0; b < LAT_BUCKETS; b++)
+                if (sum.hist[b]) seq_printf(m, " %llu:%llu", b ? 1ULL << b : 0, sum.hist[b]);
+            seq_putc(m, '\n');
+        }
+    }
+
+    seq_puts(m, "\nmissed (no free instance / reentered / no free slot):\n");
+    for (p = 0; p < ARRAY_SIZE(lat_probes); p++)
+        seq_printf(m, "%-26s %d / %lu / %d\n", lat_probes[p].krp.kp.symbol_name,
+                   lat_probes[p].krp.nmissed, lat_probes[p].krp.kp.nmissed,
+                   atomic_read(&lat_probes[p].overflow));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lat_stats);
+
+static void lat_unregister(int n)
+{
+    while (n--) {
+        unregister_kretprobe(&lat_probes[n].krp);
+        free_percpu(lat_probes[n].stats);
+    }
+}
+
 static int __init debug_init(void)
 {
-    int ret = register_kretprobe(&my_kretprobe);
-    if (ret < 0) {
-        pr_err("[DEBUG] register_kretprobe failed: %d\n", ret);
-        return ret;
+    int p, ret;
+
+    for (p = 0; p < ARRAY_SIZE(lat_probes); p++) {
+        struct lat_probe* lp = &lat_probes[p];
+
+        lp->stats = __alloc_percpu(sizeof(struct lat_stats) * LAT_SLOTS, __alignof__(struct lat_stats));
+        if (!lp->stats) {
+            lat_unregister(p);
+            return -ENOMEM;
+        }
+        lp->krp.handler = ret_handler;
+        lp->krp.entry_handler = entry_handler;
+        /* This tells the kernel how much memory to allocate for ri->data */
+        lp->krp.data_size = sizeof(struct lat_call);
+        lp->krp.maxactive = maxactive;
+
+        ret = register_kretprobe(&lp->krp);
+        if (ret < 0) {
+            pr_err("[DEBUG] register_kretprobe(%s) failed: %d\n", lp->krp.kp.symbol_name, ret);
+            free_percpu(lp->stats);
+            lat_unregister(p);
+            return ret;
+        }
     }
+
+    lat_dir = debugfs_create_dir("i2c_latency", NULL);
+    debugfs_create_file("stats", 0444, lat_dir, NULL, &lat_stats_fops);
     return 0;
 }
 
 static void __exit debug_exit(void)
 {
-    unregister_kretprobe(&my_kretprobe);
+    debugfs_remove_recursive(lat_dir);
+    lat_unregister(ARRAY_SIZE(lat_probes));
 }
 
 module_init(debug_init);
@@ -65,3 +259,4 @@ module_exit(debug_exit);
 
 /* REQUIRED: Must be exactly "GPL" for kprobes symbols */
 MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Per-client I2C transfer latency histograms");
@@ -16,6 +16,13 @@
 #include <linux/jiffies.h>
 #include <linux/sysfs.h>
 #include <linux/device.h>
+#include <linux/bitmap.h>
+#include <linux/log2.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/uio.h>
+#include <linux/highmem.h>
+#include <linux/nvmem-provider.h>
 #include <linux/version.h>
 #include <linux/property.h> // For firmware-agnostic property API
 
@@ -23,12 +30,46 @@
 #define AT24_DEFAULT_SIZE 32768
 #define AT24_DEFAULT_PAGE 64
 #define AT24_WRITE_TIMEOUT_MS 5
+#define AT24_POLL_MIN_US      20    /* First ACK poll interval, doubling up to ... */
+#define AT24_POLL_MAX_US      320
+#define AT24_CYCLE_US_DEF     3000  /* Write-cycle estimate until one is measured */
+
+/*
+ * Module parameter: RAM shadow of the EEPROM.
+ * 0 (default): every access goes to the bus.
+ * 1: /dev and sysfs reads are served from RAM, each page fetched from
+ *    the chip the first time it is needed. Writes land in RAM and a
+ *    worker programs the dirty pages flush_ms later, one whole page per
+ *    write cycle, however many small writes touched it meanwhile.
+ * 2: as 1, with the whole chip read in at probe.
+ * fsync() on /dev or writing the sysfs "flush" attribute forces the
+ * write-back; "dirty_pages" shows how many pages are still pending.
+ */
+static unsigned int cache;
+module_param(cache, uint, 0444);
+MODULE_PARM_DESC(cache, "RAM shadow: 0 off, 1 filled on demand, 2 filled at probe");
+
+static unsigned int flush_ms = 1000;
+module_param(flush_ms, uint, 0644);
+MODULE_PARM_DESC(flush_ms, "Delay before dirty cached pages are written back (ms)");
 
 struct at24_data {
     struct i2c_client *client;
     struct miscdevice miscdev;
     struct bin_attribute bin_attr;
     struct mutex lock;
+    /* Shadow cache (cache != 0), 'lock' covers all of it */
+    u8 *cache;
+    unsigned long *valid;   /* Pages read from / written to RAM */
+    unsigned long *dirty;   /* Pages newer in RAM than on the chip */
+    u32 nr_pages;
+    struct delayed_work flush_work;
+    /* Page-write engine, ee->lock held */
+    u8 *tx[2];              /* pagesize + 2: one page fills while the other programs */
+    ktime_t write_start;    /* When the last page write went out */
+    unsigned int write_cycle_us; /* Measured write cycle, running average */
+    u16 max_read;           /* Largest read per transfer on this adapter */
+    struct nvmem_device *nvmem;
     char *devname;
     u32 size;      /* Dynamically read from DT "size" */
     u32 pagesize;  /* Dynamically read from DT "pagesize" */
@@ -47,73 +88,373 @@ static int at24_read_combined(struct i2c_client *client, u16 addr, u8 *buf, size
     return (ret == 2) ? 0 : ((ret < 0) ? ret : -EIO);
 }
 
-static int at24_write_page_msg(struct i2c_client *client, u16 addr, const u8 *data, size_t len)
+/*
+ * The largest read one combined transfer can carry on this adapter: the
+ * i2c_msg length limit, lowered by the controller's quirks (a maximum
+ * read length, or a maximum second message of a write+read pair).
+ */
+static u16 at24_max_read(struct i2c_adapter *adap)
 {
-    struct i2c_msg msg;
-    u8 *tx;
-    int ret;
+    const struct i2c_adapter_quirks *q = adap->quirks;
+    u16 max = U16_MAX;
 
-    tx = kmalloc(len + 2, GFP_KERNEL);
-    if (!tx) return -ENOMEM;
+    if (!q) return max;
+    if (q->max_read_len) max = min(max, q->max_read_len);
+    if ((q->flags & I2C_AQ_COMB) && q->max_comb_2nd_msg_len) max = min(max, q->max_comb_2nd_msg_len);
+    return max;
+}
+
+/* Any length (sequential read), in the largest pieces the adapter takes */
+static int at24_read_bulk(struct at24_data *ee, loff_t addr, u8 *buf, size_t len)
+{
+    while (len) {
+        size_t chunk = min_t(size_t, len, ee->max_read);
+        int ret = at24_read_combined(ee->client, (u16)addr, buf, chunk);
 
-    tx[0] = (u8)(addr >> 8);
-    tx[1] = (u8)(addr & 0xFF);
-    memcpy(&tx[2], data, len);
+        if (ret) return ret;
+        addr += chunk; buf += chunk; len -= chunk;
+    }
+    return 0;
+}
 
-    msg.addr = client->addr; 
-    msg.flags = 0; 
-    msg.len = len + 2; 
-    msg.buf = tx;
+/* Sends a page write prepared in a tx buffer: 2 address bytes + data */
+static int at24_write_page_msg(struct at24_data *ee, u8 *tx, size_t len)
+{
+    struct i2c_msg msg = { .addr = ee->client->addr, .flags = 0, .len = len, .buf = tx };
+    int ret = i2c_transfer(ee->client->adapter, &msg, 1);
 
-    ret = i2c_transfer(client->adapter, &msg, 1);
-    kfree(tx);
+    /* The chip starts programming at the STOP */
+    ee->write_start = ktime_get();
     return (ret == 1) ? 0 : ((ret < 0) ? ret : -EIO);
 }
 
-static int at24_wait_ready(struct i2c_client *client)
+/*
+ * ACK POLLING:
+ * While programming, the chip NAKs its own address, so the write cycle
+ * is over when a dummy write is ACKed again. The first poll goes out
+ * at 7/8 of the measured write cycle (write_cycle_us), then the polls
+ * back off from AT24_POLL_MIN_US, doubling, on hrtimer sleeps: no more
+ * rounding every page up to whole milliseconds. Every completed cycle
+ * feeds the running average, so the estimate follows the actual part.
+ */
+static int at24_wait_ready(struct at24_data *ee)
 {
-    unsigned long deadline = jiffies + msecs_to_jiffies(AT24_WRITE_TIMEOUT_MS);
+    ktime_t deadline = ktime_add_ms(ee->write_start, AT24_WRITE_TIMEOUT_MS);
     u8 dummy = 0;
-    struct i2c_msg msg = { .addr = client->addr, .flags = 0, .len = 1, .buf = &dummy };
-    
-    do {
-        if (i2c_transfer(client->adapter, &msg, 1) == 1) return 0;
-        usleep_range(1000, 1500);
-    } while (time_before(jiffies, deadline));
-    
-    return -ETIMEDOUT;
+    struct i2c_msg msg = { .addr = ee->client->addr, .flags = 0, .len = 1, .buf = &dummy };
+    unsigned int delay = AT24_POLL_MIN_US;
+    s64 first = ee->write_cycle_us * 7 / 8 - ktime_us_delta(ktime_get(), ee->write_start);
+
+    if (first > 0) usleep_range(first, first + AT24_POLL_MIN_US);
+    for (;;) {
+        if (i2c_transfer(ee->client->adapter, &msg, 1) == 1) {
+            s64 cycle = ktime_us_delta(ktime_get(), ee->write_start);
+
+            ee->write_cycle_us = (ee->write_cycle_us * 7 + (unsigned int)cycle) / 8;
+            return 0;
+        }
+        if (ktime_after(ktime_get(), deadline)) return -ETIMEDOUT;
+        usleep_range(delay, delay + delay / 2);
+        delay = min_t(unsigned int, delay * 2, AT24_POLL_MAX_US);
+    }
+}
+
+/*
+ * THE PAGE-WRITE ENGINE:
+ * Writes [pos, pos + len) from a user buffer (ubuf) or a kernel one
+ * (kbuf) in page-aligned pieces. The next piece is copied into the
+ * other tx buffer while the chip programs the current one, so only the
+ * ACK wait separates two page writes. Returns the bytes written, or an
+ * error if none were. Called with ee->lock held.
+ */
+static ssize_t at24_write_pages(struct at24_data *ee, loff_t pos, size_t len,
+                                const char __user *ubuf, const u8 *kbuf)
+{
+    size_t written = 0;
+    bool busy = false;  /* A page is programming */
+    int cur = 0;
+    int ret = 0;
+
+    while (written < len) {
+        u16 addr = pos + written;
+        size_t chunk = min_t(size_t, len - written, ee->pagesize - addr % ee->pagesize);
+        u8 *tx = ee->tx[cur];
+
+        tx[0] = (u8)(addr >> 8);
+        tx[1] = (u8)(addr & 0xFF);
+        if (kbuf) memcpy(&tx[2], kbuf + written, chunk);
+        else if (copy_from_user(&tx[2], ubuf + written, chunk)) { ret = -EFAULT; break; }
+
+        if (busy) {
+            ret = at24_wait_ready(ee);
+            if (ret) break;
+        }
+        ret = at24_write_page_msg(ee, tx, chunk + 2);
+        if (ret) break;
+        busy = true;
+        written += chunk;
+        cur ^= 1;
+    }
+    /* Leave the chip idle for whoever comes next */
+    if (busy) at24_wait_ready(ee);
+    return written ? written : ret;
+}
+
+/* ---------- Shadow Cache ---------- */
+
+/*
+ * Brings pages [first, last] into the cache. Each run of missing pages
+ * is one sequential read, in transfers as large as the adapter allows:
+ * the chip's address counter keeps going, so the transfer size is the
+ * only limit. Pages already valid (dirty ones included) are kept.
+ * Called with ee->lock held.
+ */
+static int at24_cache_fill(struct at24_data *ee, u32 first, u32 last)
+{
+    u32 page = first;
+    int ret;
+
+    while (page <= last) {
+        u32 end = page;
+
+        if (test_bit(page, ee->valid)) {
+            page++;
+            continue;
+        }
+        while (end < last && !test_bit(end + 1, ee->valid))
+            end++;
+        ret = at24_read_bulk(ee, page * ee->pagesize, ee->cache + page * ee->pagesize, (end + 1 - page) * ee->pagesize);
+        if (ret) return ret;
+        bitmap_set(ee->valid, page, end + 1 - page);
+        page = end + 1;
+    }
+    return 0;
+}
+
+/* Makes [pos, pos + len) readable from ee->cache. ee->lock held. */
+static int at24_cache_get(struct at24_data *ee, loff_t pos, size_t len)
+{
+    return at24_cache_fill(ee, pos / ee->pagesize, (pos + len - 1) / ee->pagesize);
+}
+
+/*
+ * Prepares [pos, pos + len) for a write into ee->cache: pages the write
+ * only partly covers are read in first, so the whole-page write-back
+ * does not clobber the rest of them. ee->lock held.
+ */
+static int at24_cache_prepare_write(struct at24_data *ee, loff_t pos, size_t len)
+{
+    u32 first = pos / ee->pagesize, last = (pos + len - 1) / ee->pagesize;
+    int ret = 0;
+
+    if (pos % ee->pagesize)
+        ret = at24_cache_fill(ee, first, first);
+    if (!ret && (pos + len) % ee->pagesize && (pos + len) < ee->size)
+        ret = at24_cache_fill(ee, last, last);
+    return ret;
+}
+
+/* The first 'len' bytes at pos are in the cache now: queue them. ee->lock held. */
+static void at24_cache_dirty(struct at24_data *ee, loff_t pos, size_t len)
+{
+    u32 first = pos / ee->pagesize, n = (pos + len - 1) / ee->pagesize - first + 1;
+
+    if (!len) return;
+    bitmap_set(ee->valid, first, n);
+    bitmap_set(ee->dirty, first, n);
+    /* Armed by the first dirty page only: later writes join that flush */
+    schedule_delayed_work(&ee->flush_work, msecs_to_jiffies(flush_ms));
+}
+
+/*
+ * Programs every dirty page, one full aligned page per write cycle. The
+ * lock is dropped between pages, so a reader waits for one write cycle
+ * at most, not for the whole flush.
+ */
+static int at24_cache_flush(struct at24_data *ee)
+{
+    int ret = 0;
+
+    if (!ee->cache) return 0;
+    for (;;) {
+        u32 page;
+
+        mutex_lock(&ee->lock);
+        page = find_first_bit(ee->dirty, ee->nr_pages);
+        if (page >= ee->nr_pages) {
+            mutex_unlock(&ee->lock);
+            break;
+        }
+        clear_bit(page, ee->dirty);
+        ret = at24_write_pages(ee, page * ee->pagesize, ee->pagesize, NULL, ee->cache + page * ee->pagesize);
+        ret = ret < 0 ? ret : 0;
+        if (ret) set_bit(page, ee->dirty);
+        mutex_unlock(&ee->lock);
+        if (ret) break;
+    }
+    return ret;
+}
+
+static void at24_flush_work(struct work_struct *work)
+{
+    struct at24_data *ee = container_of(to_delayed_work(work), struct at24_data, flush_work);
+
+    if (at24_cache_flush(ee)) {
+        dev_warn_ratelimited(&ee->client->dev, "write-back failed, retrying\n");
+        schedule_delayed_work(&ee->flush_work, msecs_to_jiffies(flush_ms));
+    }
+}
+
+static int at24_cache_init(struct at24_data *ee)
+{
+    struct device *dev = &ee->client->dev;
+
+    ee->nr_pages = ee->size / ee->pagesize;
+    ee->cache = devm_kmalloc(dev, ee->size, GFP_KERNEL);
+    ee->valid = devm_bitmap_zalloc(dev, ee->nr_pages, GFP_KERNEL);
+    ee->dirty = devm_bitmap_zalloc(dev, ee->nr_pages, GFP_KERNEL);
+    if (!ee->cache || !ee->valid || !ee->dirty) return -ENOMEM;
+    INIT_DELAYED_WORK(&ee->flush_work, at24_flush_work);
+
+    if (cache == 2) {
+        int ret;
+
+        mutex_lock(&ee->lock);
+        ret = at24_cache_fill(ee, 0, ee->nr_pages - 1);
+        mutex_unlock(&ee->lock);
+        /* Not fatal: whatever is missing is read on demand */
+        if (ret) dev_warn(dev, "cache prefill failed (%d)\n", ret);
+    }
+    return 0;
+}
+
+/* ---------- Kernel-Buffer Access (sysfs, nvmem) ---------- */
+
+/* Reads all of [off, off + count): from the cache, or straight off the bus */
+static int at24_read_buf(struct at24_data *ee, loff_t off, u8 *buf, size_t count)
+{
+    int ret;
+
+    if (!count) return 0;
+    mutex_lock(&ee->lock);
+    if (ee->cache) {
+        ret = at24_cache_get(ee, off, count);
+        if (!ret) memcpy(buf, ee->cache + off, count);
+    } else {
+        ret = at24_read_bulk(ee, off, buf, count);
+    }
+    mutex_unlock(&ee->lock);
+    return ret;
+}
+
+/* Writes all of [off, off + count): into the cache, or through the page engine */
+static int at24_write_buf(struct at24_data *ee, loff_t off, const u8 *buf, size_t count)
+{
+    ssize_t written;
+    int ret = 0;
+
+    if (!count) return 0;
+    mutex_lock(&ee->lock);
+    if (ee->cache) {
+        ret = at24_cache_prepare_write(ee, off, count);
+        if (!ret) {
+            memcpy(ee->cache + off, buf, count);
+            at24_cache_dirty(ee, off, count);
+        }
+    } else {
+        written = at24_write_pages(ee, off, count, NULL, buf);
+        if (written < 0) ret = written;
+        else if (written != count) ret = -EIO;
+    }
+    mutex_unlock(&ee->lock);
+    return ret;
 }
 
 /* ---------- File Operations (/dev) ---------- */
 
-static ssize_t at24_read_file(struct file *f, char __user *ubuf, size_t count, loff_t *ppos)
+/*
+ * Cached write: staged in a kernel copy first, so a fault in the user
+ * buffer leaves the cache untouched rather than half updated.
+ */
+static ssize_t at24_cache_write_user(struct at24_data *ee, const char __user *ubuf, size_t len, loff_t *ppos)
+{
+    u8 *kbuf = memdup_user(ubuf, len);
+    int ret;
+
+    if (IS_ERR(kbuf)) return PTR_ERR(kbuf);
+    ret = at24_write_buf(ee, *ppos, kbuf, len);
+    kfree(kbuf);
+    if (ret) return ret;
+    *ppos += len;
+    return len;
+}
+
+static int at24_fsync(struct file *f, loff_t start, loff_t end, int datasync)
 {
     struct at24_data *ee = container_of(f->private_data, struct at24_data, miscdev);
-    loff_t pos = *ppos;
-    size_t todo;
-    ssize_t done = 0;
+
+    return at24_cache_flush(ee);
+}
+
+
+/*
+ * /dev reads. With the cache, a copy out of RAM. Without, user memory
+ * is read into directly: each user page is pinned and the transfer
+ * lands in it (up to a page, or max_read, per transfer), with no bounce
+ * buffer and no copy_to_user. Kernel iterators (splice, kernel_read)
+ * go through a bounce buffer instead.
+ */
+static ssize_t at24_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct at24_data *ee = container_of(iocb->ki_filp->private_data, struct at24_data, miscdev);
+    loff_t pos = iocb->ki_pos;
+    size_t todo, done = 0;
     int ret = 0;
 
     if (pos >= ee->size) return 0;
-    todo = min_t(size_t, count, (size_t)(ee->size - pos));
-    
+    todo = min_t(size_t, iov_iter_count(to), (size_t)(ee->size - pos));
+    if (!todo) return 0;
+
     mutex_lock(&ee->lock);
-    while (todo > 0) {
-        size_t chunk = min_t(size_t, todo, 128);
-        u8 *kbuf = kmalloc(chunk, GFP_KERNEL);
-        if (!kbuf) { ret = -ENOMEM; break; }
-
-        ret = at24_read_combined(ee->client, (u16)pos, kbuf, chunk);
-        if (!ret && copy_to_user(ubuf + done, kbuf, chunk)) ret = -EFAULT;
-        
+    if (ee->cache) {
+        ret = at24_cache_get(ee, pos, todo);
+        if (!ret) done = copy_to_iter(ee->cache + pos, todo, to);
+        if (!ret && !done) ret = -EFAULT;
+    } else if (user_backed_iter(to)) {
+        while (done < todo) {
+            struct page *page;
+            size_t off;
+            ssize_t n = iov_iter_get_pages2(to, &page, min_t(size_t, todo - done, ee->max_read), 1, &off);
+            u8 *kaddr;
+
+            if (n <= 0) { ret = n ? n : -EFAULT; break; }
+            kaddr = kmap_local_page(page);
+            ret = at24_read_combined(ee->client, (u16)(pos + done), kaddr + off, n);
+            kunmap_local(kaddr);
+            if (!ret) set_page_dirty_lock(page);
+            put_page(page);
+            if (ret) { iov_iter_revert(to, n); break; }
+            done += n;
+        }
+    } else {
+        size_t max = min_t(size_t, todo, ee->max_read);
+        u8 *kbuf = kmalloc(max, GFP_KERNEL);
+
+        if (!kbuf) ret = -ENOMEM;
+        while (kbuf && done < todo) {
+            size_t chunk = min_t(size_t, todo - done, max);
+
+            ret = at24_read_combined(ee->client, (u16)(pos + done), kbuf, chunk);
+            if (!ret && copy_to_iter(kbuf, chunk, to) != chunk) ret = -EFAULT;
+            if (ret) break;
+            done += chunk;
+        }
         kfree(kbuf);
-        if (ret) break;
-        pos += chunk; todo -= chunk; done += chunk;
     }
     mutex_unlock(&ee->lock);
 
-    if (done > 0) { *ppos += done; return done; }
-    return ret;
+    iocb->ki_pos += done;
+    return done ? done : ret;
 }
 
 static ssize_t at24_write_file(struct file *f, const char __user *ubuf, size_t count, loff_t *ppos)
@@ -121,40 +462,29 @@ static ssize_t at24_write_file(struct file *f, const char __user *ubuf, size_t c
     struct at24_data *ee = container_of(f->private_data, struct at24_data, miscdev);
     loff_t pos = *ppos;
     size_t remaining;
-    ssize_t written = 0;
-    int ret = 0;
+    ssize_t written;
 
     if (pos >= ee->size) return -ENOSPC;
     remaining = min_t(size_t, count, (size_t)(ee->size - pos));
 
-    mutex_lock(&ee->lock);
-    while (remaining > 0) {
-        size_t page_off = (size_t)(pos % ee->pagesize);
-        size_t chunk = min_t(size_t, remaining, (size_t)(ee->pagesize - page_off));
-        u8 *kbuf = kmalloc(chunk, GFP_KERNEL);
-        
-        if (!kbuf) { ret = -ENOMEM; break; }
-        if (copy_from_user(kbuf, ubuf + written, chunk)) { kfree(kbuf); ret = -EFAULT; break; }
-
-        ret = at24_write_page_msg(ee->client, (u16)pos, kbuf, chunk);
-        kfree(kbuf);
-        if (ret) break;
+    if (ee->cache && remaining)
+        return at24_cache_write_user(ee, ubuf, remaining, ppos);
 
-        at24_wait_ready(ee->client);
-        pos += chunk; remaining -= chunk; written += chunk;
-    }
+    mutex_lock(&ee->lock);
+    written = at24_write_pages(ee, pos, remaining, ubuf, NULL);
     mutex_unlock(&ee->lock);
 
-    if (written > 0) { *ppos += written; return written; }
-    return ret;
+    if (written > 0) *ppos += written;
+    return written;
 }
 
 static const struct file_operations at24_fops = {
     .owner = THIS_MODULE,
-    .read = at24_read_file,
+    .read_iter = at24_read_iter,
     .write = at24_write_file,
     .llseek = generic_file_llseek,
     .open = nonseekable_open,
+    .fsync = at24_fsync,
 };
 
 /* ---------- Sysfs Operations (/sys) ---------- */
@@ -171,12 +501,92 @@ static ssize_t at24_sysfs_read(struct file *filp, struct kobject *kobj,
     if (off >= ee->size) return 0;
     if (off + count > ee->size) count = ee->size - off;
 
-    mutex_lock(&ee->lock);
-    ret = at24_read_combined(client, (u16)off, (u8 *)buf, count);
-    mutex_unlock(&ee->lock);
+    ret = at24_read_buf(ee, off, (u8 *)buf, count);
+    return ret ? ret : count;
+}
+
+/* ---------- NVMEM Provider ---------- */
+
+/*
+ * Kernel consumers (a MAC address, calibration cells described in DT)
+ * read the EEPROM as nvmem cells instead of through the char device.
+ * With the shadow cache enabled a cell read after the first is a RAM hit.
+ */
+static int at24_nvmem_read(void *priv, unsigned int off, void *val, size_t count)
+{
+    return at24_read_buf(priv, off, val, count);
+}
+
+static int at24_nvmem_write(void *priv, unsigned int off, void *val, size_t count)
+{
+    return at24_write_buf(priv, off, val, count);
+}
+
+static struct nvmem_device *at24_nvmem_register(struct at24_data *ee)
+{
+    struct device *dev = &ee->client->dev;
+    struct nvmem_config config = {
+        .name = dev_name(dev),
+        .id = NVMEM_DEVID_NONE,
+        .dev = dev,
+        .owner = THIS_MODULE,
+        .type = NVMEM_TYPE_EEPROM,
+        .root_only = true,
+        .reg_read = at24_nvmem_read,
+        .reg_write = at24_nvmem_write,
+        .size = ee->size,
+        .word_size = 1,
+        .stride = 1,
+        .priv = ee,
+    };
+
+    return nvmem_register(&config);
+}
+
+/* Pages written to the cache but not yet to the chip */
+static ssize_t dirty_pages_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct at24_data *ee = i2c_get_clientdata(to_i2c_client(dev));
+    unsigned int n = 0;
+
+    if (ee->cache) {
+        mutex_lock(&ee->lock);
+        n = bitmap_weight(ee->dirty, ee->nr_pages);
+        mutex_unlock(&ee->lock);
+    }
+    return sysfs_emit(buf, "%u\n", n);
+}
+static DEVICE_ATTR_RO(dirty_pages);
+
+/* Any write: program the dirty pages now, returns once they are on the chip */
+static ssize_t flush_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct at24_data *ee = i2c_get_clientdata(to_i2c_client(dev));
+    int ret = at24_cache_flush(ee);
 
     return ret ? ret : count;
 }
+static DEVICE_ATTR_WO(flush);
+
+/* Measured page write cycle the ACK polling is timed by */
+static ssize_t write_cycle_us_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct at24_data *ee = i2c_get_clientdata(to_i2c_client(dev));
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(ee->write_cycle_us));
+}
+static DEVICE_ATTR_RO(write_cycle_us);
+
+static struct attribute *at24_attrs[] = {
+    &dev_attr_write_cycle_us.attr,
+    &dev_attr_dirty_pages.attr,
+    &dev_attr_flush.attr,
+    NULL,
+};
+
+static const struct attribute_group at24_group = {
+    .attrs = at24_attrs,
+};
 
 /* ---------- Probe & Remove ---------- */
 
@@ -203,10 +613,32 @@ static int at24_probe(struct i2c_client *client, const struct i2c_device_id *id)
     if (device_property_read_u32(dev, "pagesize", &ee->pagesize))
         ee->pagesize = AT24_DEFAULT_PAGE;
 
+    /*
+     * Page writes wrap at a power-of-two boundary, and the cache splits
+     * the chip into whole pages: a tail page would run off its end.
+     */
+    if (!is_power_of_2(ee->pagesize) || !ee->size || ee->size % ee->pagesize) {
+        dev_err(dev, "invalid geometry: size %u, pagesize %u\n", ee->size, ee->pagesize);
+        return -EINVAL;
+    }
+
     ee->client = client;
     mutex_init(&ee->lock);
     i2c_set_clientdata(client, ee);
 
+    /* Page-write buffers, allocated once instead of per page */
+    ee->tx[0] = devm_kmalloc(dev, ee->pagesize + 2, GFP_KERNEL);
+    ee->tx[1] = devm_kmalloc(dev, ee->pagesize + 2, GFP_KERNEL);
+    if (!ee->tx[0] || !ee->tx[1]) return -ENOMEM;
+    ee->write_cycle_us = AT24_CYCLE_US_DEF;
+    ee->max_read = at24_max_read(client->adapter);
+
+    /* 0. Optional shadow cache, before anything can reach the chip */
+    if (cache) {
+        ret = at24_cache_init(ee);
+        if (ret) return ret;
+    }
+
     /* 1. Register Binary Sysfs node (/sys/bus/i2c/devices/X-XXXX/eeprom) */
     sysfs_bin_attr_init(&ee->bin_attr);
     ee->bin_attr.attr.name = "eeprom";
@@ -215,6 +647,11 @@ static int at24_probe(struct i2c_client *client, const struct i2c_device_id *id)
     ee->bin_attr.size = ee->size;
     ret = device_create_bin_file(dev, &ee->bin_attr);
     if (ret) return ret;
+    ret = sysfs_create_group(&dev->kobj, &at24_group);
+    if (ret) {
+        device_remove_bin_file(dev, &ee->bin_attr);
+        return ret;
+    }
 
     /* 2. Register Misc Device (/dev/at24c256-X-XX) */
     ee->devname = devm_kasprintf(dev, GFP_KERNEL, "at24c256-%d-%02x", 
@@ -226,10 +663,18 @@ static int at24_probe(struct i2c_client *client, const struct i2c_device_id *id)
 
     ret = misc_register(&ee->miscdev);
     if (ret) {
+        sysfs_remove_group(&dev->kobj, &at24_group);
         device_remove_bin_file(dev, &ee->bin_attr);
         return ret;
     }
 
+    /* 3. NVMEM provider (optional: CONFIG_NVMEM may be off) */
+    ee->nvmem = at24_nvmem_register(ee);
+    if (IS_ERR(ee->nvmem)) {
+        dev_warn(dev, "no nvmem provider (%ld)\n", PTR_ERR(ee->nvmem));
+        ee->nvmem = NULL;
+    }
+
     dev_info(dev, "EEPROM bound: %u bytes, %u pgsize -> /dev/%s\n", 
              ee->size, ee->pagesize, ee->devname);
     return 0;
@@ -246,8 +691,16 @@ static int at24_remove(struct i2c_client *client)
 #endif
 {
     struct at24_data *ee = i2c_get_clientdata(client);
+    /* In-kernel users first: they could still dirty the cache */
+    if (ee->nvmem) nvmem_unregister(ee->nvmem);
     misc_deregister(&ee->miscdev);
+    sysfs_remove_group(&client->dev.kobj, &at24_group);
     device_remove_bin_file(&client->dev, &ee->bin_attr);
+    /* Nothing can dirty the cache any more: write back what is left */
+    if (ee->cache) {
+        cancel_delayed_work_sync(&ee->flush_work);
+        at24_cache_flush(ee);
+    }
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 1, 0)
     return 0;
 #endif
@@ -0,0 +1,468 @@
+/*
+ * bh_bench.c - Bottom-half latency benchmark
+ *
+ * tasklet.c, threaded_irq.c, workqueue.c and hybrid.c each show one way
+ * to defer work out of the hard IRQ. This module runs them side by side
+ * on the same interrupts and measures how long each one takes to start:
+ * the top half stamps the time, and every bottom half files (now - stamp)
+ * into its own per-CPU histogram. Nothing is printed per event.
+ *
+ * Paths (bit in the 'paths' mask):
+ *   0 tasklet        tasklet_schedule(), runs in softirq on the same CPU
+ *   1 threaded       IRQ_WAKE_THREAD, the IRQ's own SCHED_FIFO kthread
+ *   2 wq_bound       queue_work() on a per-CPU workqueue
+ *   3 wq_unbound     WQ_UNBOUND, any CPU the scheduler picks
+ *   4 wq_highpri     WQ_HIGHPRI, per-CPU nice -20 workers
+ *   5 wq_bh          WQ_BH, softirq context like a tasklet (6.9+)
+ *
+ * Interrupt source, fired by an hrtimer at 'rate' Hz:
+ *   - default: a software IRQ line (dummy irq chip) raised from the timer,
+ *     so no hardware is needed and the threaded path still gets a thread;
+ *   - gpio_out/gpio_in: a jumper between two pins. The timer toggles
+ *     gpio_out and the edge comes back as a real IRQ on gpio_in, so the
+ *     'hardirq' row then shows the GPIO controller's delivery latency.
+ *
+ *   insmod bh_bench.ko rate=2000
+ *   insmod bh_bench.ko rate=2000 gpio_out=529 gpio_in=539   (GPIO 17 -> 27)
+ *   cat /sys/kernel/debug/bh_bench/stats
+ *   cat /sys/kernel/debug/bh_bench/cpus
+ *
+ * To compare under load, start it (stress-ng, iperf, ...) before reading
+ * the stats, or use paths= to measure one mechanism at a time: with all
+ * of them on, the tasklet and BH work run first and delay the others.
+ * Reload the module to reset the counters. Needs kernel 5.9+.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/interrupt.h>
+#include <linux/irq.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
+#include <linux/gpio.h>
+#include <linux/gpio/consumer.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/version.h>
+
+static unsigned int rate = 1000;
+module_param(rate, uint, 0444);
+MODULE_PARM_DESC(rate, "Interrupts per second (1..100000)");
+
+static unsigned int paths = 0x3f;
+module_param(paths, uint, 0444);
+MODULE_PARM_DESC(paths, "Bottom halves to run, bit mask (see the file header)");
+
+static int gpio_out = -1;
+module_param(gpio_out, int, 0444);
+MODULE_PARM_DESC(gpio_out, "GPIO the timer toggles (-1 = software IRQ)");
+
+static int gpio_in = -1;
+module_param(gpio_in, int, 0444);
+MODULE_PARM_DESC(gpio_in, "GPIO wired to gpio_out whose edges are the IRQ");
+
+/*
+ * Log-linear buckets: 4 per power of two (about 19% wide), so p99.9 is
+ * not rounded up to the next power of two. Values below 4 ns get their
+ * own buckets; the last one takes everything from ~7.5 s up.
+ */
+#define BH_SUB_BITS 2
+#define BH_SUB      (1 << BH_SUB_BITS)
+#define BH_BUCKETS  128
+
+enum bh_path_id {
+    BH_TASKLET,
+    BH_THREADED,
+    BH_WQ_BOUND,
+    BH_WQ_UNBOUND,
+    BH_WQ_HIGHPRI,
+    BH_WQ_BH,
+    BH_NR,
+    BH_HARDIRQ = BH_NR,         /* Timer -> top half, not a bottom half */
+    BH_NR_STATS,
+};
+
+/* What one CPU has seen for one path */
+struct bh_stats {
+    u64 count;
+    u64 sum_ns;
+    u64 max_ns;
+    u64 hist[BH_BUCKETS];
+};
+
+/*
+ * One deferral mechanism. 'pending' is set by the top half when it
+ * schedules the bottom half and cleared by the bottom half once it has
+ * read t0, so each run measures the event that scheduled it. Events that
+ * arrive while it is still pending are merged by the kernel anyway
+ * (a tasklet or work item is queued once); they are counted as coalesced.
+ */
+struct bh_path {
+    unsigned int wq_flags;
+    atomic_t pending;
+    u64 t0;
+    struct workqueue_struct *wq;
+    struct work_struct work;
+};
+
+/* Top-half counters, per CPU */
+struct bh_cpu {
+    u64 irqs;
+    u64 coalesced[BH_NR];
+};
+
+static const char * const bh_names[BH_NR_STATS] = {
+    "tasklet", "threaded", "wq_bound", "wq_unbound", "wq_highpri", "wq_bh", "hardirq",
+};
+
+static struct bh_path bh_paths[BH_NR] = {
+    [BH_WQ_UNBOUND] = { .wq_flags = WQ_UNBOUND },
+    [BH_WQ_HIGHPRI] = { .wq_flags = WQ_HIGHPRI },
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+    [BH_WQ_BH]      = { .wq_flags = WQ_BH },
+#endif
+};
+
+static struct bh_stats __percpu *bh_stats;     /* [BH_NR_STATS] per CPU */
+static struct bh_cpu __percpu *bh_cpu;
+static struct tasklet_struct bh_tasklet;
+static struct hrtimer bh_timer;
+static ktime_t bh_period;
+static u64 bh_fire_ns;                  /* When the timer raised the IRQ */
+static u64 bh_ticks_missed;             /* Timer periods skipped under load */
+static struct gpio_desc *bh_out;
+static int bh_level;
+static int bh_irq = -1;
+static bool bh_soft_irq;
+static int bh_dev_id;
+static struct dentry *bh_dir;
+
+/* ---------- Histograms ---------- */
+
+static unsigned int bh_bucket(u64 ns) {
+    unsigned int e;
+
+    if (ns < BH_SUB) return ns;
+    e = ilog2(ns);
+    return min_t(u64, (e - BH_SUB_BITS + 1) * BH_SUB + ((ns >> (e - BH_SUB_BITS)) & (BH_SUB - 1)),
+                 BH_BUCKETS - 1);
+}
+
+/* Lowest value that lands in bucket i */
+static u64 bh_bucket_lo(unsigned int i) {
+    if (i < BH_SUB) return i;
+    return (u64)(BH_SUB + i % BH_SUB) << (i / BH_SUB - 1);
+}
+
+/* Caller keeps preemption off, and each path has one writer per CPU */
+static void bh_account(struct bh_stats *st, u64 ns) {
+    st->count++;
+    st->sum_ns += ns;
+    if (ns > st->max_ns) st->max_ns = ns;
+    st->hist[bh_bucket(ns)]++;
+}
+
+static void bh_record(enum bh_path_id id) {
+    struct bh_path *p = &bh_paths[id];
+    u64 now = ktime_get_ns();
+    u64 t0 = READ_ONCE(p->t0);
+
+    /* t0 is read; the next event may reuse it */
+    atomic_set_release(&p->pending, 0);
+    bh_account(get_cpu_ptr(bh_stats) + id, now - t0);
+    put_cpu_ptr(bh_stats);
+}
+
+/* ---------- Bottom halves ---------- */
+
+static void bh_tasklet_fn(struct tasklet_struct *t) {
+    bh_record(BH_TASKLET);
+}
+
+static irqreturn_t bh_thread_fn(int irq, void *dev_id) {
+    bh_record(BH_THREADED);
+    return IRQ_HANDLED;
+}
+
+static void bh_work_fn(struct work_struct *work) {
+    struct bh_path *p = container_of(work, struct bh_path, work);
+
+    bh_record(p - bh_paths);
+}
+
+/* ---------- Top half and interrupt source ---------- */
+
+static irqreturn_t bh_top(int irq, void *dev_id) {
+    u64 now = ktime_get_ns();
+    struct bh_cpu *c = this_cpu_ptr(bh_cpu);
+    irqreturn_t ret = IRQ_HANDLED;
+    int i;
+
+    c->irqs++;
+    bh_account(this_cpu_ptr(bh_stats) + BH_HARDIRQ, now - READ_ONCE(bh_fire_ns));
+
+    for (i = 0; i < BH_NR; i++) {
+        struct bh_path *p = &bh_paths[i];
+
+        if (!(paths & BIT(i))) continue;
+        if (atomic_xchg(&p->pending, 1)) {
+            c->coalesced[i]++;
+            continue;
+        }
+        WRITE_ONCE(p->t0, now);
+        if (i == BH_TASKLET)
+            tasklet_schedule(&bh_tasklet);
+        else if (i == BH_THREADED)
+            ret = IRQ_WAKE_THREAD;
+        else
+            queue_work(p->wq, &p->work);
+    }
+    return ret;
+}
+
+/* Hard hrtimer: runs in hardirq context even on PREEMPT_RT */
+static enum hrtimer_restart bh_tick(struct hrtimer *t) {
+    bh_ticks_missed += hrtimer_forward_now(t, bh_period) - 1;
+    WRITE_ONCE(bh_fire_ns, ktime_get_ns());
+
+    if (bh_out)
+        gpiod_set_value(bh_out, bh_level ^= 1);
+    else
+        generic_handle_irq(bh_irq);
+    return HRTIMER_RESTART;
+}
+
+/* A free IRQ number with a chip that does nothing, raised only by us */
+static int bh_soft_irq_alloc(void) {
+    int irq = irq_alloc_desc(numa_node_id());
+
+    if (irq < 0) return irq;
+    irq_set_chip_and_handler(irq, &dummy_irq_chip, handle_simple_irq);
+    irq_clear_status_flags(irq, IRQ_NOREQUEST | IRQ_NOAUTOEN);
+    bh_soft_irq = true;
+    return irq;
+}
+
+/* Claims both lines; bh_out is set once they are ours and configured */
+static int bh_gpio_irq(void) {
+    struct gpio_desc *out, *in;
+    int ret;
+
+    ret = gpio_request(gpio_out, "bh_bench_out");
+    if (ret) return ret;
+    ret = gpio_request(gpio_in, "bh_bench_in");
+    if (ret) goto err_out;
+    out = gpio_to_desc(gpio_out);
+    in = gpio_to_desc(gpio_in);
+
+    /* The timer toggles the pin from hardirq context */
+    if (gpiod_cansleep(out)) {
+        pr_err("BH_BENCH: GPIO %d is on a sleeping controller\n", gpio_out);
+        ret = -EINVAL;
+        goto err_in;
+    }
+    ret = gpiod_direction_output(out, 0);
+    if (!ret) ret = gpiod_direction_input(in);
+    if (!ret) ret = gpiod_to_irq(in);
+    if (ret < 0) goto err_in;
+    bh_out = out;
+    return ret;
+
+err_in:
+    gpio_free(gpio_in);
+err_out:
+    gpio_free(gpio_out);
+    return ret;
+}
+
+static void bh_gpio_free(void) {
+    if (!bh_out) return;
+    gpio_free(gpio_in);
+    gpio_free(gpio_out);
+    bh_out = NULL;
+}
+
+/* ---------- debugfs ---------- */
+
+/* Upper bound of the bucket the permille'th sample falls in */
+static u64 bh_percentile(const u64 *hist, u64 count, unsigned int permille) {
+    u64 want = div_u64(count * permille + 999, 1000), seen = 0;
+    int i;
+
+    for (i = 0; i < BH_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen >= want) return i + 1 < BH_BUCKETS ? bh_bucket_lo(i + 1) - 1 : U64_MAX;
+    }
+    return U64_MAX;
+}
+
+static int bh_stats_show(struct seq_file *m, void *v) {
+    struct bh_stats *sum;
+    u64 irqs = 0;
+    int i, b, cpu;
+
+    sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+    if (!sum) return -ENOMEM;
+
+    for_each_possible_cpu(cpu)
+        irqs += per_cpu_ptr(bh_cpu, cpu)->irqs;
+    seq_printf(m, "source %s irq %d, %u Hz, %llu irqs, %llu timer periods missed\n\n",
+               bh_out ? "gpio" : "soft", bh_irq, rate, irqs, bh_ticks_missed);
+    seq_printf(m, "%-10s %10s %10s %10s %10s %10s %10s %10s\n", "path", "count", "coalesced",
+               "avg_ns", "p50_ns<=", "p99_ns<=", "p999_ns<=", "max_ns");
+
+    for (i = 0; i < BH_NR_STATS; i++) {
+        u64 coalesced = 0;
+
+        if (i < BH_NR && !(paths & BIT(i))) continue;
+        memset(sum, 0, sizeof(*sum));
+        /* Fold the per-CPU copies; a sample landing meanwhile may be half counted */
+        for_each_possible_cpu(cpu) {
+            struct bh_stats *st = per_cpu_ptr(bh_stats, cpu) + i;
+
+            if (i < BH_NR) coalesced += per_cpu_ptr(bh_cpu, cpu)->coalesced[i];
+            sum->count += st->count;
+            sum->sum_ns += st->sum_ns;
+            sum->max_ns = max(sum->max_ns, st->max_ns);
+            for (b = 0; b < BH_BUCKETS; b++)
+                sum->hist[b] += st->hist[b];
+        }
+        if (!sum->count) {
+            seq_printf(m, "%-10s %10d %10llu\n", bh_names[i], 0, coalesced);
+            continue;
+        }
+        seq_printf(m, "%-10s %10llu %10llu %10llu %10llu %10llu %10llu %10llu\n",
+                   bh_names[i], sum->count, coalesced, div64_u64(sum->sum_ns, sum->count),
+                   bh_percentile(sum->hist, sum->count, 500),
+                   bh_percentile(sum->hist, sum->count, 990),
+                   bh_percentile(sum->hist, sum->count, 999), sum->max_ns);
+    }
+    kfree(sum);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bh_stats);
+
+/* Where things ran: top halves per CPU, and each bottom half per CPU */
+static int bh_cpus_show(struct seq_file *m, void *v) {
+    int i, cpu;
+
+    seq_printf(m, "%-4s %10s", "cpu", "irqs");
+    for (i = 0; i < BH_NR; i++)
+        if (paths & BIT(i)) seq_printf(m, " %10s", bh_names[i]);
+    seq_putc(m, '\n');
+
+    for_each_online_cpu(cpu) {
+        seq_printf(m, "%-4d %10llu", cpu, per_cpu_ptr(bh_cpu, cpu)->irqs);
+        for (i = 0; i < BH_NR; i++)
+            if (paths & BIT(i)) seq_printf(m, " %10llu", per_cpu_ptr(bh_stats, cpu)[i].count);
+        seq_putc(m, '\n');
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(bh_cpus);
+
+/* ---------- Module init/exit ---------- */
+
+static void bh_destroy_wqs(void) {
+    int i;
+
+    for (i = 0; i < BH_NR; i++) {
+        if (bh_paths[i].wq) destroy_workqueue(bh_paths[i].wq);
+        bh_paths[i].wq = NULL;
+    }
+}
+
+static int __init bh_bench_init(void) {
+    int i, ret;
+
+    if (!rate || rate > 100000) return -EINVAL;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 9, 0)
+    paths &= ~BIT(BH_WQ_BH);    /* No BH workqueues before 6.9 */
+#endif
+
+    bh_stats = __alloc_percpu(sizeof(struct bh_stats) * BH_NR_STATS, __alignof__(struct bh_stats));
+    bh_cpu = alloc_percpu(struct bh_cpu);
+    if (!bh_stats || !bh_cpu) {
+        ret = -ENOMEM;
+        goto err_free;
+    }
+
+    tasklet_setup(&bh_tasklet, bh_tasklet_fn);
+    for (i = BH_WQ_BOUND; i < BH_NR; i++) {
+        struct bh_path *p = &bh_paths[i];
+
+        INIT_WORK(&p->work, bh_work_fn);
+        if (!(paths & BIT(i))) continue;
+        p->wq = alloc_workqueue("bh_bench_%s", p->wq_flags, 0, bh_names[i]);
+        if (!p->wq) {
+            ret = -ENOMEM;
+            goto err_wq;
+        }
+    }
+
+    bh_irq = gpio_out >= 0 && gpio_in >= 0 ? bh_gpio_irq() : bh_soft_irq_alloc();
+    if (bh_irq < 0) {
+        ret = bh_irq;
+        pr_err("BH_BENCH: no interrupt source: %d\n", ret);
+        goto err_wq;
+    }
+
+    ret = request_threaded_irq(bh_irq, bh_top, bh_thread_fn,
+                               bh_out ? IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING : 0,
+                               "bh_bench", &bh_dev_id);
+    if (ret) {
+        pr_err("BH_BENCH: Failed to register IRQ %d: %d\n", bh_irq, ret);
+        goto err_irq;
+    }
+
+    bh_dir = debugfs_create_dir("bh_bench", NULL);
+    debugfs_create_file("stats", 0444, bh_dir, NULL, &bh_stats_fops);
+    debugfs_create_file("cpus", 0444, bh_dir, NULL, &bh_cpus_fops);
+
+    bh_period = ns_to_ktime(NSEC_PER_SEC / rate);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+    hrtimer_setup(&bh_timer, bh_tick, CLOCK_MONOTONIC, HRTIMER_MODE_REL_HARD);
+#else
+    hrtimer_init(&bh_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_HARD);
+    bh_timer.function = bh_tick;
+#endif
+    hrtimer_start(&bh_timer, bh_period, HRTIMER_MODE_REL_HARD);
+
+    pr_info("BH_BENCH: %u Hz on %s IRQ %d, paths 0x%x\n", rate,
+            bh_out ? "GPIO" : "software", bh_irq, paths);
+    return 0;
+
+err_irq:
+    if (bh_soft_irq) irq_free_desc(bh_irq);
+    bh_gpio_free();
+err_wq:
+    bh_destroy_wqs();
+err_free:
+    free_percpu(bh_cpu);
+    free_percpu(bh_stats);
+    return ret;
+}
+
+static void __exit bh_bench_exit(void) {
+    debugfs_remove_recursive(bh_dir);
+
+    /* Stop the source first, then wait out whatever it already scheduled */
+    hrtimer_cancel(&bh_timer);
+    free_irq(bh_irq, &bh_dev_id);
+    tasklet_kill(&bh_tasklet);
+    bh_destroy_wqs();
+    if (bh_soft_irq) irq_free_desc(bh_irq);
+    bh_gpio_free();
+
+    free_percpu(bh_cpu);
+    free_percpu(bh_stats);
+    pr_info("BH_BENCH: Unloaded.\n");
+}
+
+module_init(bh_bench_init);
+module_exit(bh_bench_exit);
+
+/* GPL: dummy_irq_chip, generic_handle_irq and irq_alloc_desc are GPL-only */
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Tasklet / threaded IRQ / workqueue latency benchmark");
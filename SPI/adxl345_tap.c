@@ -3,6 +3,8 @@
 #include <linux/interrupt.h>
 #include <linux/property.h>
 #include <linux/mod_devicetable.h>
+#include <linux/completion.h>
+#include <linux/slab.h>
 
 /* ADXL345 Register Map */
 #define ADXL345_REG_DEVID        0x00
@@ -17,56 +19,177 @@
 #define ADXL345_REG_INT_SOURCE   0x30
 #define ADXL345_REG_DATA_FORMAT  0x31
 #define ADXL345_REG_TAP_AXES     0x2A
+#define ADXL345_REG_TAP_STATUS   0x2B
+#define ADXL345_REG_DATAX0       0x32
 
+#define ADXL345_READ             0x80
+#define ADXL345_MULTI_BYTE       0x40
+
+/*
+ * Everything the SPI controller may DMA lives in this struct, not on
+ * the stack: TX and RX each start a cache line of their own, so the
+ * CPU never shares a line with a buffer the controller is writing.
+ * The interrupt's two messages are built once in probe:
+ *   event_msg: ACT_TAP_STATUS then INT_SOURCE (which clears the event)
+ *   data_msg:  DATAX0..DATAZ1 in one multi-byte read
+ */
 struct adxl345_data {
 	struct spi_device *spi;
+
+	struct spi_transfer reg_xfer;
+	struct spi_message reg_msg;
+
+	struct spi_transfer event_xfer[2];
+	struct spi_message event_msg;
+	struct completion event_done;
+	struct spi_transfer data_xfer;
+	struct spi_message data_msg;
+	struct completion data_done;
+
+	/* reg: 0-1, event: 2-5, data: 6-12 */
+	u8 tx[16] __aligned(ARCH_DMA_MINALIGN);
+	u8 reg_rx[2] __aligned(ARCH_DMA_MINALIGN);
+	u8 irq_rx[11] __aligned(ARCH_DMA_MINALIGN);
 };
 
+#define EVT_TX(d)	((d)->tx + 2)
+#define DATA_TX(d)	((d)->tx + 6)
+#define EVT_RX(d)	((d)->irq_rx)
+#define DATA_RX(d)	((d)->irq_rx + 4)
+
+static void adxl345_msg_done(void *context)
+{
+	complete(context);
+}
+
+static void adxl345_build_msgs(struct adxl345_data *data)
+{
+	data->reg_xfer.tx_buf = data->tx;
+	data->reg_xfer.rx_buf = data->reg_rx;
+	data->reg_xfer.len = 2;
+	spi_message_init_with_transfers(&data->reg_msg, &data->reg_xfer, 1);
+
+	EVT_TX(data)[0] = ADXL345_READ | ADXL345_REG_TAP_STATUS;
+	EVT_TX(data)[2] = ADXL345_READ | ADXL345_REG_INT_SOURCE;
+	data->event_xfer[0].tx_buf = EVT_TX(data);
+	data->event_xfer[0].rx_buf = EVT_RX(data);
+	data->event_xfer[0].len = 2;
+	data->event_xfer[0].cs_change = 1;	/* Two separate register reads */
+	data->event_xfer[1].tx_buf = EVT_TX(data) + 2;
+	data->event_xfer[1].rx_buf = EVT_RX(data) + 2;
+	data->event_xfer[1].len = 2;
+	spi_message_init_with_transfers(&data->event_msg, data->event_xfer, 2);
+	init_completion(&data->event_done);
+	data->event_msg.complete = adxl345_msg_done;
+	data->event_msg.context = &data->event_done;
+
+	DATA_TX(data)[0] = ADXL345_READ | ADXL345_MULTI_BYTE | ADXL345_REG_DATAX0;
+	data->data_xfer.tx_buf = DATA_TX(data);
+	data->data_xfer.rx_buf = DATA_RX(data);
+	data->data_xfer.len = 7;
+	spi_message_init_with_transfers(&data->data_msg, &data->data_xfer, 1);
+	init_completion(&data->data_done);
+	data->data_msg.complete = adxl345_msg_done;
+	data->data_msg.context = &data->data_done;
+}
+
 /* SPI Helper: Read register */
-static int adxl345_read(struct spi_device *spi, u8 reg)
+static int adxl345_read(struct adxl345_data *data, u8 reg)
 {
-	u8 addr = reg | 0x80;
-	return spi_w8r8(spi, addr);
+	int ret;
+
+	data->tx[0] = reg | ADXL345_READ;
+	data->tx[1] = 0;
+	ret = spi_sync(data->spi, &data->reg_msg);
+	return ret ? ret : data->reg_rx[1];
 }
 
 /* SPI Helper: Write register */
-static int adxl345_write(struct spi_device *spi, u8 reg, u8 val)
+static int adxl345_write(struct adxl345_data *data, u8 reg, u8 val)
 {
-	u8 buf[] = { reg & 0x3F, val };
-	return spi_write(spi, buf, sizeof(buf));
+	data->tx[0] = reg & 0x3F;
+	data->tx[1] = val;
+	return spi_sync(data->spi, &data->reg_msg);
 }
 
-/* Debug Helper: Full register dump */
-static void adxl345_dump_regs(struct spi_device *spi, const char *msg)
+/*
+ * Debug Helper: Full register dump, read in one message. The buffers
+ * are allocated here, as this runs once and not on the event path.
+ */
+static void adxl345_dump_regs(struct adxl345_data *data, const char *msg)
 {
+	static const u8 regs[] = {
+		ADXL345_REG_POWER_CTL, ADXL345_REG_DATA_FORMAT, ADXL345_REG_BW_RATE,
+		ADXL345_REG_THRESH_TAP, ADXL345_REG_DUR, ADXL345_REG_LATENT,
+		ADXL345_REG_INT_ENABLE, ADXL345_REG_INT_SOURCE,
+	};
+	struct spi_device *spi = data->spi;
+	struct spi_transfer xfer[ARRAY_SIZE(regs)] = { };
+	u8 *tx, *rx, v[ARRAY_SIZE(regs)];
+	int i;
+
+	tx = kzalloc(2 * sizeof(regs), GFP_KERNEL);
+	rx = kzalloc(2 * sizeof(regs), GFP_KERNEL);
+	if (!tx || !rx)
+		goto out;
+	for (i = 0; i < ARRAY_SIZE(regs); i++) {
+		tx[2 * i] = ADXL345_READ | regs[i];
+		xfer[i].tx_buf = tx + 2 * i;
+		xfer[i].rx_buf = rx + 2 * i;
+		xfer[i].len = 2;
+		xfer[i].cs_change = i < ARRAY_SIZE(regs) - 1;
+	}
+	if (spi_sync_transfer(spi, xfer, ARRAY_SIZE(regs)))
+		goto out;
+	for (i = 0; i < ARRAY_SIZE(regs); i++)
+		v[i] = rx[2 * i + 1];
+
 	dev_info(&spi->dev, "--- Debug Snapshot: %s ---\n", msg);
 	dev_info(&spi->dev, "POWER: 0x%02x, FORMAT: 0x%02x, BW_RATE: 0x%02x\n",
-		 adxl345_read(spi, ADXL345_REG_POWER_CTL),
-		 adxl345_read(spi, ADXL345_REG_DATA_FORMAT),
-		 adxl345_read(spi, ADXL345_REG_BW_RATE));
+		 v[0], v[1], v[2]);
 	dev_info(&spi->dev, "THRESH: 0x%02x, DUR: 0x%02x, LATENT: 0x%02x\n",
-		 adxl345_read(spi, ADXL345_REG_THRESH_TAP),
-		 adxl345_read(spi, ADXL345_REG_DUR),
-		 adxl345_read(spi, ADXL345_REG_LATENT));
+		 v[3], v[4], v[5]);
 	dev_info(&spi->dev, "INT_EN: 0x%02x, INT_SOURCE: 0x%02x\n",
-		 adxl345_read(spi, ADXL345_REG_INT_ENABLE),
-		 adxl345_read(spi, ADXL345_REG_INT_SOURCE));
+		 v[6], v[7]);
+out:
+	kfree(rx);
+	kfree(tx);
 }
 
-/* Threaded IRQ Handler */
+/*
+ * Threaded IRQ Handler
+ * Both messages are queued with spi_async() before waiting, so the
+ * controller runs them back to back: one round trip per event instead
+ * of a wakeup per register.
+ */
 static irqreturn_t adxl345_irq_thread(int irq, void *dev_id)
 {
 	struct adxl345_data *data = dev_id;
-	int source = adxl345_read(data->spi, ADXL345_REG_INT_SOURCE);
+	bool event_queued, data_queued;
+	const u8 *d = DATA_RX(data);
+	int source;
+
+	reinit_completion(&data->event_done);
+	reinit_completion(&data->data_done);
+	event_queued = !spi_async(data->spi, &data->event_msg);
+	data_queued = event_queued && !spi_async(data->spi, &data->data_msg);
+	if (event_queued)
+		wait_for_completion(&data->event_done);
+	if (data_queued)
+		wait_for_completion(&data->data_done);
 
-	if (source < 0)
+	if (!data_queued || data->event_msg.status || data->data_msg.status)
 		return IRQ_NONE;
+	source = EVT_RX(data)[3];
 
 	/* Debug: Show what triggered the pin */
-	dev_info(&data->spi->dev, "IRQ Event (INT_SOURCE: 0x%02x)\n", source);
+	dev_info(&data->spi->dev, "IRQ Event (INT_SOURCE: 0x%02x, TAP_STATUS: 0x%02x)\n",
+		 source, EVT_RX(data)[1]);
 
 	if (source & 0x40)
-		dev_info(&data->spi->dev, ">>> SUCCESS: SINGLE TAP VALIDATED <<<\n");
+		dev_info(&data->spi->dev, ">>> SUCCESS: SINGLE TAP VALIDATED <<< (%d,%d,%d)\n",
+			 (s16)(d[1] | d[2] << 8), (s16)(d[3] | d[4] << 8),
+			 (s16)(d[5] | d[6] << 8));
 
 	return IRQ_HANDLED;
 }
@@ -79,38 +202,39 @@ static int adxl345_probe(struct spi_device *spi)
 	data = devm_kzalloc(&spi->dev, sizeof(*data), GFP_KERNEL);
 	if (!data) return -ENOMEM;
 	data->spi = spi;
+	adxl345_build_msgs(data);
 
 	/* SPI Communication Sanity Check */
-	id = adxl345_read(spi, ADXL345_REG_DEVID);
+	id = adxl345_read(data, ADXL345_REG_DEVID);
 	if (id != 0xE5) {
 		dev_err(&spi->dev, "Communication Error: ID 0x%02x (Exp 0xE5)\n", id);
 		return -ENODEV;
 	}
 
 	/* Configure Hardware with Anti-Hang Logic */
-	adxl345_write(spi, ADXL345_REG_POWER_CTL, 0x00);
+	adxl345_write(data, ADXL345_REG_POWER_CTL, 0x00);
 	
 	/* BW_RATE: Lowering to 25Hz (0x08) helps stabilize interrupts */
-	adxl345_write(spi, ADXL345_REG_BW_RATE, 0x08);
-	adxl345_write(spi, ADXL345_REG_DATA_FORMAT, 0x00);
+	adxl345_write(data, ADXL345_REG_BW_RATE, 0x08);
+	adxl345_write(data, ADXL345_REG_DATA_FORMAT, 0x00);
 	
 	/* THRESH: 0x28 (approx 2.5g) prevents table bumps from hanging the OS */
-	adxl345_write(spi, ADXL345_REG_THRESH_TAP, 0x28);
-	adxl345_write(spi, ADXL345_REG_DUR, 0x20);        // 20ms hit window
+	adxl345_write(data, ADXL345_REG_THRESH_TAP, 0x28);
+	adxl345_write(data, ADXL345_REG_DUR, 0x20);        // 20ms hit window
 	
 	/* LATENT: 0x50 (~62ms) ensures we ignore the table's resonance "tail" */
-	adxl345_write(spi, ADXL345_REG_LATENT, 0x50);
-	adxl345_write(spi, ADXL345_REG_TAP_AXES, 0x07);    // Enable X, Y, Z
+	adxl345_write(data, ADXL345_REG_LATENT, 0x50);
+	adxl345_write(data, ADXL345_REG_TAP_AXES, 0x07);    // Enable X, Y, Z
 	
-	adxl345_write(spi, ADXL345_REG_INT_MAP, 0x00);     // Everything to INT1
-	adxl345_write(spi, ADXL345_REG_INT_ENABLE, 0x40);  // Enable Single Tap
+	adxl345_write(data, ADXL345_REG_INT_MAP, 0x00);     // Everything to INT1
+	adxl345_write(data, ADXL345_REG_INT_ENABLE, 0x40);  // Enable Single Tap
 	
 	/* Clear state before ARMing */
-	adxl345_read(spi, ADXL345_REG_INT_SOURCE);
-	adxl345_write(spi, ADXL345_REG_POWER_CTL, 0x08);
+	adxl345_read(data, ADXL345_REG_INT_SOURCE);
+	adxl345_write(data, ADXL345_REG_POWER_CTL, 0x08);
 
 	/* Dump state  on load */
-	adxl345_dump_regs(spi, "Anti-Hang Configuration");
+	adxl345_dump_regs(data, "Anti-Hang Configuration");
 
 	/* Register Edge-Rising IRQ (Matches DT <24 1>) */
 	ret = devm_request_threaded_irq(&spi->dev, spi->irq, NULL,
@@ -4,6 +4,16 @@
 #include <linux/of.h>
 #include <linux/gpio/consumer.h>
 #include <linux/property.h>
+#include <linux/interrupt.h>
+#include <linux/miscdevice.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/eventfd.h>
+#include <linux/version.h>
+#include <linux/poll.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/kref.h>
 
 #include "adxl345.h"
 
@@ -17,6 +27,131 @@
 #define ADXL345_READMB_CMD(reg) (ADXL345_CMD_READ | ADXL345_CMD_MULTB \
 					| (reg & 0x3F))
 
+/*
+ * FIFO stream mode (needs the INT1 line in DT): the chip samples at up
+ * to 3200 Hz into its 32-entry FIFO and raises INT1 at the watermark.
+ * The IRQ thread drains the FIFO in one chained spi_message and queues
+ * timestamped samples in the shared ring of /dev/adxl345.
+ */
+#define ADXL345_FIFO_DEPTH	32
+#define ADXL345_SAMPLE_BYTES	7	/* Command byte, then X0 X1 Y0 Y1 Z0 Z1 */
+#define ADXL345_RX_STRIDE	8
+#define ADXL345_RING_SAMPLES	8192	/* Power of two; ~2.5 s at 3200 Hz */
+#define ADXL345_WAKEUP_DEF	256	/* Records waiting before the consumer is woken */
+#define ADXL345_FIFO_DELAY_US	5	/* Between FIFO reads above MAX_FREQ_NO_FIFODELAY */
+
+static unsigned int rate = 3200;
+module_param(rate, uint, 0444);
+MODULE_PARM_DESC(rate, "Output data rate in stream mode, Hz (3200 / 2^n)");
+
+static unsigned int watermark = 16;
+module_param(watermark, uint, 0444);
+MODULE_PARM_DESC(watermark, "FIFO entries per interrupt in stream mode (1..31)");
+
+/* One record in the ring, as read() also returns it */
+struct adxl345_sample {
+	u64 timestamp_ns;	/* CLOCK_MONOTONIC */
+	s16 x, y, z;
+	u16 reserved;
+};
+
+/*
+ * THE RING: one control page, then ring_size records, all mappable
+ * (mmap offset 0 is the control page, PAGE_SIZE the records), as in
+ * chardev/skel.c. The IRQ thread is the only producer and moves head;
+ * the one process that has the device open consumes, by moving tail in
+ * the mapping or by read(). Indices are free-running record counts and
+ * a record lives at index & (ring_size - 1). Each side publishes its
+ * index with a release store after touching the records and reads the
+ * other's with an acquire load.
+ *
+ * The consumer is woken (poll, and the eventfd if one is set) once per
+ * FIFO batch that leaves at least 'wakeup' records waiting, not per
+ * sample. If the ring is full new samples are dropped and counted in
+ * overruns. The kernel keeps its own head and clamps whatever it reads
+ * from the page.
+ *
+ * LIFETIME: an open file or a mapping can outlive the SPI device (unbind
+ * while a reader sleeps in poll, or munmap long after close). The stream
+ * state is refcounted: the driver, every open file and every mapping each
+ * hold a reference, and the ring is freed with the last one. On remove
+ * the stream is marked dead; read/poll/ioctl/mmap then fail with -ENODEV
+ * instead of waiting for samples that will never come.
+ */
+struct adxl345_ring_ctl {
+	__u32 head;		/* Producer index (kernel) */
+	__u32 tail;		/* Consumer index (user) */
+	__u32 ring_size;	/* Records, a power of two */
+	__u32 record_size;	/* sizeof(struct adxl345_sample) */
+	__u32 wakeup;		/* Set by the consumer: records per wakeup */
+	__u32 overruns;		/* Samples dropped on a full ring */
+};
+
+/* Signal this eventfd on each wakeup; -1 stops it */
+#define ADXL345_IOC_SET_EVENTFD	_IOW('x', 1, int)
+
+struct adxl345_stream {
+	struct spi_device *spi;
+	struct miscdevice miscdev;
+	struct adxl345_ring_ctl *ctl;	/* vmalloc_user(): control page + records */
+	struct adxl345_sample *ring;
+	u32 head;			/* The real one; ctl->head is a copy */
+	struct kref ref;
+	bool dead;			/* Device removed; set under evt_lock */
+	struct mutex read_lock;		/* read() against itself */
+	atomic_t users;			/* Open files + mappings: one consumer */
+	struct mutex evt_lock;
+	struct eventfd_ctx *evt;
+	wait_queue_head_t wait;
+	u64 period_ns;
+	unsigned int watermark;
+
+	/*
+	 * Drain message: the entry reads, then INT_SOURCE and FIFO_STATUS,
+	 * so one message both empties a batch and says what is left.
+	 * Transfers are filled in once; only the list is rebuilt per batch.
+	 */
+	struct spi_message msg;
+	struct spi_transfer xfer[ADXL345_FIFO_DEPTH];
+	struct spi_transfer stat_xfer[2];
+	u8 *tx;				/* kmalloc'ed: DMA-safe, unlike the stack */
+	u8 *rx;
+	u8 *stat_tx;
+	u8 *stat_rx;
+	u64 stat_ns;			/* When stat_rx was read */
+
+	u64 samples;
+	unsigned long fifo_overruns;	/* The chip overwrote samples before we drained */
+	unsigned long ring_dropped;	/* Nobody read /dev/adxl345 fast enough */
+};
+
+/* Records waiting, never more than the ring holds whatever tail says */
+static u32 adxl345_ring_used(struct adxl345_stream *st)
+{
+	return min_t(u32, smp_load_acquire(&st->ctl->head) - READ_ONCE(st->ctl->tail),
+		     ADXL345_RING_SAMPLES);
+}
+
+static u32 adxl345_ring_wakeup(struct adxl345_stream *st)
+{
+	return clamp_t(u32, READ_ONCE(st->ctl->wakeup), 1, ADXL345_RING_SAMPLES);
+}
+
+/*
+ * Register access. One full-duplex transfer on buffers of our own,
+ * each on its own cache line, instead of spi_write_then_read() (a copy
+ * through a shared bounce buffer under a global lock) or a stack
+ * buffer, which may not be DMA'd at all. The message is built once.
+ */
+struct adxl345_io {
+	struct mutex lock;
+	struct spi_message msg;
+	struct spi_transfer xfer;
+	u8 tx[8] __aligned(ARCH_DMA_MINALIGN);
+	u8 rx[8] __aligned(ARCH_DMA_MINALIGN);
+};
+
+static struct adxl345_io *g_io;
 struct spi_device *g_spi;
 static const struct adxl34x_platform_data adxl34x_default_init = {
 	.tap_threshold = 35,
@@ -39,32 +174,70 @@ static const struct adxl34x_platform_data adxl34x_default_init = {
 	.watermark = 0,
 };
 
+static struct adxl345_io *adxl345_io_alloc(struct spi_device *spi)
+{
+	struct adxl345_io *io = devm_kzalloc(&spi->dev, sizeof(*io), GFP_KERNEL);
+
+	if (!io)
+		return NULL;
+	mutex_init(&io->lock);
+	io->xfer.tx_buf = io->tx;
+	io->xfer.rx_buf = io->rx;
+	spi_message_init_with_transfers(&io->msg, &io->xfer, 1);
+	return io;
+}
+
+/* Sends len bytes of io->tx, receiving into io->rx; lock held */
+static int adxl345_io_xfer(struct spi_device *spi, unsigned int len)
+{
+	g_io->xfer.len = len;
+	return spi_sync(spi, &g_io->msg);
+}
+
 static inline int adxl345_spi_read(struct spi_device *spi, u8 reg)
 {
-	return spi_w8r8(spi, ADXL345_READCMD(reg));
+	int ret;
+
+	mutex_lock(&g_io->lock);
+	g_io->tx[0] = ADXL345_READCMD(reg);
+	g_io->tx[1] = 0;
+	ret = adxl345_io_xfer(spi, 2);
+	if (!ret)
+		ret = g_io->rx[1];
+	mutex_unlock(&g_io->lock);
+	return ret;
 }
 
 static int adxl345_spi_write(struct spi_device *spi,
 			     unsigned char reg, unsigned char val)
 {
-	unsigned char buf[2];
-
-	buf[0] = reg & CMD_MASK;
-	buf[1] = val;
-
-	return spi_write(spi, buf, sizeof(buf));
+	int ret;
+
+	mutex_lock(&g_io->lock);
+	g_io->tx[0] = reg & CMD_MASK;
+	g_io->tx[1] = val;
+	ret = adxl345_io_xfer(spi, 2);
+	mutex_unlock(&g_io->lock);
+	return ret;
 }
 
 static int adxl345_spi_read_block(struct spi_device *spi,
 				  unsigned char reg, int count,
 				  void *buf)
 {
-	ssize_t status;
-
-	reg = (ADXL345_CMD_READ | ADXL345_CMD_MULTB | (reg & 0x3F));
-	status = spi_write_then_read(g_spi, &reg, 1, buf, count);
+	int status;
 
-	return (status < 0) ? status : 0;
+	if (count > sizeof(g_io->rx) - 1)
+		return -EINVAL;
+	mutex_lock(&g_io->lock);
+	memset(g_io->tx, 0, sizeof(g_io->tx));
+	g_io->tx[0] = ADXL345_READMB_CMD(reg);
+	status = adxl345_io_xfer(spi, count + 1);
+	if (!status)
+		memcpy(buf, g_io->rx + 1, count);
+	mutex_unlock(&g_io->lock);
+
+	return status;
 }
 
 static ssize_t adxl345_devid_show(struct device *dev,
@@ -88,6 +261,7 @@ static ssize_t adxl345_position_show(struct device *dev,
 	__le16 axis[3];
 	int status;
 
+	/* In stream mode this pops the oldest FIFO entry */
 	status = adxl345_spi_read_block(g_spi, ADXL345_DATAX0, ADXL345_DATAZ1 - ADXL345_DATAX0 + 1, axis);
 
         count = sprintf(buf, "(%d,%d,%d)\n", le16_to_cpu(axis[0]), le16_to_cpu(axis[1]), le16_to_cpu(axis[2]));
@@ -111,7 +285,10 @@ static ssize_t adxl345_enable_store(struct device *dev,
 	g_spi->max_speed_hz = MAX_FREQ_NO_FIFODELAY;
 	spi_setup(g_spi);
 
-        if (val) {
+        if (val && spi_get_drvdata(g_spi)) {
+                // Streaming: sleep mode would drop the rate to 8 Hz
+                power_mode = ADXL345_POWER_CTL_MEASURE;
+        } else if (val) {
                 // Use autosleep mode. Page 13 ADXL345 Data Sheet
                 power_mode = ADXL345_POWER_CTL_MEASURE |
                              ADXL345_POWER_CTL_LINK |
@@ -128,10 +305,25 @@ static ssize_t adxl345_enable_store(struct device *dev,
 
 static DEVICE_ATTR(enable, 0664, NULL, adxl345_enable_store);
 
+static ssize_t adxl345_fifo_stats_show(struct device *dev,
+				       struct device_attribute *attr, char *buf)
+{
+	struct adxl345_stream *st = dev_get_drvdata(dev);
+
+	if (!st)
+		return sprintf(buf, "stream mode off\n");
+	return sprintf(buf, "samples %llu fifo_overruns %lu ring_dropped %lu waiting %u\n",
+		       st->samples, st->fifo_overruns, st->ring_dropped,
+		       adxl345_ring_used(st));
+}
+
+static DEVICE_ATTR(fifo_stats, 0444, adxl345_fifo_stats_show, NULL);
+
 static struct attribute *adxl345_attributes[] = {
 	&dev_attr_devid.attr,
         &dev_attr_position.attr,
         &dev_attr_enable.attr,
+        &dev_attr_fifo_stats.attr,
         NULL
 };
 
@@ -139,6 +331,425 @@ static const struct attribute_group adxl345_attr_group = {
         .attrs = adxl345_attributes,
 };
 
+/* ---------- FIFO stream mode ---------- */
+
+/* Reads INT_SOURCE and FIFO_STATUS alone, to start an interrupt */
+static int adxl345_fifo_status(struct adxl345_stream *st)
+{
+	int ret;
+
+	spi_message_init_with_transfers(&st->msg, st->stat_xfer, 2);
+	ret = spi_sync(st->spi, &st->msg);
+	st->stat_ns = ktime_get_ns();
+	return ret;
+}
+
+/*
+ * Reads n FIFO entries and the status after them in one spi_message:
+ * a 7-byte multi-byte read of DATAX0..DATAZ1 per entry, CS released in
+ * between (each release pops the next entry), then INT_SOURCE and
+ * FIFO_STATUS. Above MAX_FREQ_NO_FIFODELAY the chip needs 5 us after
+ * each entry before the next FIFO access. spi_sync() from the IRQ
+ * thread runs the message in this context, so a batch is one trip
+ * through the controller with no message pump in between.
+ */
+static int adxl345_fifo_batch(struct adxl345_stream *st, int n)
+{
+	struct spi_device *spi = st->spi;
+	bool need_delay = spi->max_speed_hz > MAX_FREQ_NO_FIFODELAY;
+	u64 now = st->stat_ns;
+	int i, ret;
+	u32 room;
+
+	spi_message_init(&st->msg);
+	for (i = 0; i < n; i++) {
+		struct spi_transfer *t = &st->xfer[i];
+
+		t->cs_change_delay.value = need_delay ? ADXL345_FIFO_DELAY_US : 0;
+		spi_message_add_tail(t, &st->msg);
+	}
+	spi_message_add_tail(&st->stat_xfer[0], &st->msg);
+	spi_message_add_tail(&st->stat_xfer[1], &st->msg);
+	ret = spi_sync(spi, &st->msg);
+	st->stat_ns = ktime_get_ns();
+	if (ret)
+		return ret;
+
+	/* Room as of now; the consumer only ever makes more */
+	room = ADXL345_RING_SAMPLES - min_t(u32, st->head - smp_load_acquire(&st->ctl->tail),
+					    ADXL345_RING_SAMPLES);
+
+	/* The newest entry was sampled about when FIFO_STATUS was last read */
+	for (i = 0; i < n; i++) {
+		const u8 *rx = st->rx + i * ADXL345_RX_STRIDE;
+		struct adxl345_sample s = {
+			.timestamp_ns = now - (u64)(n - 1 - i) * st->period_ns,
+			.x = (s16)(rx[1] | rx[2] << 8),
+			.y = (s16)(rx[3] | rx[4] << 8),
+			.z = (s16)(rx[5] | rx[6] << 8),
+		};
+
+		if (!room) {
+			st->ring_dropped++;
+			continue;
+		}
+		st->ring[st->head & (ADXL345_RING_SAMPLES - 1)] = s;
+		st->head++;
+		room--;
+	}
+	smp_store_release(&st->ctl->head, st->head);
+	WRITE_ONCE(st->ctl->overruns, st->ring_dropped);
+	st->samples += n;
+	return 0;
+}
+
+/*
+ * INT1 rises when the FIFO reaches the watermark and stays high until
+ * it drops below. The line is edge-triggered, so keep draining until it
+ * has, or no edge would ever come again.
+ */
+static irqreturn_t adxl345_fifo_thread(int irq, void *dev_id)
+{
+	struct adxl345_stream *st = dev_id;
+	int n;
+
+	if (adxl345_fifo_status(st))
+		return IRQ_NONE;
+
+	for (;;) {
+		if (st->stat_rx[1] & OVERRUN)
+			st->fifo_overruns++;
+		n = min_t(int, ENTRIES(st->stat_rx[3]), ADXL345_FIFO_DEPTH);
+		if (!n || adxl345_fifo_batch(st, n))
+			break;
+		if (ENTRIES(st->stat_rx[3]) < st->watermark)
+			break;
+	}
+
+	if (adxl345_ring_used(st) >= adxl345_ring_wakeup(st)) {
+		wake_up_interruptible(&st->wait);
+		mutex_lock(&st->evt_lock);
+		if (st->evt)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+			eventfd_signal(st->evt);
+#else
+			eventfd_signal(st->evt, 1);
+#endif
+		mutex_unlock(&st->evt_lock);
+	}
+	return IRQ_HANDLED;
+}
+
+static ssize_t adxl345_stream_read(struct file *file, char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	struct adxl345_stream *st = container_of(file->private_data,
+						 struct adxl345_stream, miscdev);
+	u32 tail, n, off, len;
+
+	if (count < sizeof(struct adxl345_sample))
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&st->read_lock))
+		return -ERESTARTSYS;
+	while (!(n = adxl345_ring_used(st))) {
+		mutex_unlock(&st->read_lock);
+		if (READ_ONCE(st->dead))
+			return -ENODEV;
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(st->wait, adxl345_ring_used(st) ||
+					     READ_ONCE(st->dead)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&st->read_lock))
+			return -ERESTARTSYS;
+	}
+	/* Whole records only, in at most two pieces around the wrap */
+	n = min_t(size_t, n, count / sizeof(struct adxl345_sample));
+	tail = READ_ONCE(st->ctl->tail);
+	off = tail & (ADXL345_RING_SAMPLES - 1);
+	len = min_t(u32, n, ADXL345_RING_SAMPLES - off);
+	if (copy_to_user(buf, st->ring + off, len * sizeof(struct adxl345_sample)) ||
+	    copy_to_user(buf + len * sizeof(struct adxl345_sample), st->ring,
+			 (n - len) * sizeof(struct adxl345_sample))) {
+		mutex_unlock(&st->read_lock);
+		return -EFAULT;
+	}
+	smp_store_release(&st->ctl->tail, tail + n);
+	mutex_unlock(&st->read_lock);
+
+	return n * sizeof(struct adxl345_sample);
+}
+
+static __poll_t adxl345_stream_poll(struct file *file, poll_table *wait)
+{
+	struct adxl345_stream *st = container_of(file->private_data,
+						 struct adxl345_stream, miscdev);
+
+	poll_wait(file, &st->wait, wait);
+	if (READ_ONCE(st->dead))
+		return EPOLLHUP | EPOLLERR;
+	/* Readable at the wakeup level, so poll() sleeps as long as the IRQ would */
+	return adxl345_ring_used(st) >= adxl345_ring_wakeup(st) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static void adxl345_stream_free(struct kref *ref)
+{
+	struct adxl345_stream *st = container_of(ref, struct adxl345_stream, ref);
+
+	vfree(st->ctl);
+	kfree(st->tx);
+	kfree(st->rx);
+	kfree(st->stat_tx);
+	kfree(st->stat_rx);
+	kfree(st);
+}
+
+static void adxl345_stream_put(struct adxl345_stream *st)
+{
+	kref_put(&st->ref, adxl345_stream_free);
+}
+
+/* Each mapping (and each copy of it after fork or a split) holds a ref */
+static void adxl345_vm_open(struct vm_area_struct *vma)
+{
+	struct adxl345_stream *st = vma->vm_private_data;
+
+	kref_get(&st->ref);
+	atomic_inc(&st->users);
+}
+
+static void adxl345_vm_close(struct vm_area_struct *vma)
+{
+	struct adxl345_stream *st = vma->vm_private_data;
+
+	atomic_dec(&st->users);
+	adxl345_stream_put(st);
+}
+
+static const struct vm_operations_struct adxl345_vm_ops = {
+	.open	= adxl345_vm_open,
+	.close	= adxl345_vm_close,
+};
+
+static int adxl345_stream_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct adxl345_stream *st = container_of(file->private_data,
+						 struct adxl345_stream, miscdev);
+	int ret;
+
+	if (READ_ONCE(st->dead))
+		return -ENODEV;
+	/* Checks the size against the allocation */
+	ret = remap_vmalloc_range(vma, st->ctl, vma->vm_pgoff);
+	if (ret)
+		return ret;
+	vma->vm_ops = &adxl345_vm_ops;
+	vma->vm_private_data = st;
+	adxl345_vm_open(vma);
+	return 0;
+}
+
+static long adxl345_stream_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct adxl345_stream *st = container_of(file->private_data,
+						 struct adxl345_stream, miscdev);
+	struct eventfd_ctx *evt = NULL, *old;
+	int fd;
+
+	if (cmd != ADXL345_IOC_SET_EVENTFD)
+		return -ENOTTY;
+	if (get_user(fd, (int __user *)arg))
+		return -EFAULT;
+	if (fd >= 0) {
+		evt = eventfd_ctx_fdget(fd);
+		if (IS_ERR(evt))
+			return PTR_ERR(evt);
+	}
+
+	mutex_lock(&st->evt_lock);
+	if (st->dead) {
+		mutex_unlock(&st->evt_lock);
+		if (evt)
+			eventfd_ctx_put(evt);
+		return -ENODEV;
+	}
+	old = st->evt;
+	st->evt = evt;
+	mutex_unlock(&st->evt_lock);
+	if (old)
+		eventfd_ctx_put(old);
+	return 0;
+}
+
+static int adxl345_stream_open(struct inode *inode, struct file *file)
+{
+	struct adxl345_stream *st = container_of(file->private_data,
+						 struct adxl345_stream, miscdev);
+
+	/*
+	 * The ring has one tail, so one consumer: a mapping left over from
+	 * an earlier open still counts. misc_open() calls us under misc_mtx,
+	 * which misc_deregister() also takes, so the driver's ref is still
+	 * there to get.
+	 */
+	if (atomic_cmpxchg(&st->users, 0, 1))
+		return -EBUSY;
+	kref_get(&st->ref);
+	return stream_open(inode, file);
+}
+
+static int adxl345_stream_release(struct inode *inode, struct file *file)
+{
+	struct adxl345_stream *st = container_of(file->private_data,
+						 struct adxl345_stream, miscdev);
+	struct eventfd_ctx *old;
+
+	mutex_lock(&st->evt_lock);
+	old = st->evt;
+	st->evt = NULL;
+	mutex_unlock(&st->evt_lock);
+	if (old)
+		eventfd_ctx_put(old);
+	atomic_dec(&st->users);
+	adxl345_stream_put(st);
+	return 0;
+}
+
+static const struct file_operations adxl345_stream_fops = {
+	.owner		= THIS_MODULE,
+	.open		= adxl345_stream_open,
+	.release	= adxl345_stream_release,
+	.read		= adxl345_stream_read,
+	.poll		= adxl345_stream_poll,
+	.mmap		= adxl345_stream_mmap,
+	.unlocked_ioctl	= adxl345_stream_ioctl,
+	.llseek		= noop_llseek,
+};
+
+/*
+ * Programs rate, watermark and interrupts, then takes INT1. The device
+ * stays in standby until "enable" is written, as before.
+ */
+static int adxl345_stream_init(struct spi_device *spi)
+{
+	struct adxl345_stream *st;
+	unsigned int hz = clamp(rate, 1U, 3200U);
+	unsigned int code = 15 - ilog2(3200 / hz);	/* RATE = 3200 Hz / 2^(15 - code) */
+	int i, ret;
+
+	/* Not devm: open files and mappings may outlive the device */
+	st = kzalloc(sizeof(*st), GFP_KERNEL);
+	if (!st)
+		return -ENOMEM;
+	kref_init(&st->ref);
+	st->tx = kzalloc(ADXL345_SAMPLE_BYTES, GFP_KERNEL);
+	st->rx = kzalloc(ADXL345_FIFO_DEPTH * ADXL345_RX_STRIDE, GFP_KERNEL);
+	st->stat_tx = kzalloc(4, GFP_KERNEL);
+	st->stat_rx = kzalloc(4, GFP_KERNEL);
+	if (!st->tx || !st->rx || !st->stat_tx || !st->stat_rx) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+	st->tx[0] = ADXL345_READMB_CMD(ADXL345_DATAX0);
+	st->stat_tx[0] = ADXL345_READCMD(ADXL345_INTRSOURCE);
+	st->stat_tx[2] = ADXL345_READCMD(ADXL345_FIFO_STATUS);
+
+	/* Every entry read ends with CS released; the delay is set per batch */
+	for (i = 0; i < ADXL345_FIFO_DEPTH; i++) {
+		st->xfer[i].tx_buf = st->tx;
+		st->xfer[i].rx_buf = st->rx + i * ADXL345_RX_STRIDE;
+		st->xfer[i].len = ADXL345_SAMPLE_BYTES;
+		st->xfer[i].cs_change = 1;
+		st->xfer[i].cs_change_delay.unit = SPI_DELAY_UNIT_USECS;
+	}
+	st->stat_xfer[0].tx_buf = st->stat_tx;
+	st->stat_xfer[0].rx_buf = st->stat_rx;
+	st->stat_xfer[0].len = 2;
+	st->stat_xfer[0].cs_change = 1;
+	st->stat_xfer[1].tx_buf = st->stat_tx + 2;
+	st->stat_xfer[1].rx_buf = st->stat_rx + 2;
+	st->stat_xfer[1].len = 2;
+
+	st->ctl = vmalloc_user(PAGE_SIZE + ADXL345_RING_SAMPLES * sizeof(struct adxl345_sample));
+	if (!st->ctl) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+	st->ring = (void *)st->ctl + PAGE_SIZE;
+	st->ctl->ring_size = ADXL345_RING_SAMPLES;
+	st->ctl->record_size = sizeof(struct adxl345_sample);
+	st->ctl->wakeup = ADXL345_WAKEUP_DEF;
+	st->spi = spi;
+	st->watermark = clamp(watermark, 1U, 31U);
+	st->period_ns = div_u64((u64)NSEC_PER_SEC << (15 - code), 3200);
+	mutex_init(&st->read_lock);
+	mutex_init(&st->evt_lock);
+	init_waitqueue_head(&st->wait);
+
+	adxl345_spi_write(spi, ADXL345_POWER_CTL, ADXL345_POWER_CTL_STANDBY);
+	adxl345_spi_write(spi, ADXL345_BW_RATE, RATE(code));
+	/* Through bypass to empty the FIFO, then stream */
+	adxl345_spi_write(spi, ADXL345_FIFO_CTRL, FIFO_MODE(FIFO_BYPASS));
+	adxl345_spi_write(spi, ADXL345_FIFO_CTRL, FIFO_MODE(FIFO_STREAM) | SAMPLES(st->watermark));
+	adxl345_spi_write(spi, ADXL345_INTR_MAP, 0x00);	/* Everything to INT1 */
+	adxl345_spi_write(spi, AXDL345_INTR_ENABLE, WATERMARK | OVERRUN);
+	adxl345_spi_read(spi, ADXL345_INTRSOURCE);
+
+	ret = request_threaded_irq(spi->irq, NULL, adxl345_fifo_thread,
+				   IRQF_TRIGGER_RISING | IRQF_ONESHOT,
+				   "adxl345_fifo", st);
+	if (ret)
+		goto err_fifo;
+
+	st->miscdev.minor = MISC_DYNAMIC_MINOR;
+	st->miscdev.name = "adxl345";
+	st->miscdev.fops = &adxl345_stream_fops;
+	st->miscdev.parent = &spi->dev;
+	ret = misc_register(&st->miscdev);
+	if (ret)
+		goto err_irq;
+
+	spi_set_drvdata(spi, st);
+	dev_info(&spi->dev, "stream mode: %u Hz, watermark %u\n",
+		 3200 >> (15 - code), st->watermark);
+	return 0;
+
+err_irq:
+	free_irq(spi->irq, st);
+err_fifo:
+	adxl345_spi_write(spi, AXDL345_INTR_ENABLE, 0);
+err_free:
+	adxl345_stream_put(st);
+	return ret;
+}
+
+static void adxl345_stream_exit(struct spi_device *spi)
+{
+	struct adxl345_stream *st = spi_get_drvdata(spi);
+
+	struct eventfd_ctx *old;
+
+	if (!st)
+		return;
+	/* No new opens; the IRQ thread is done once free_irq() returns */
+	misc_deregister(&st->miscdev);
+	adxl345_spi_write(spi, AXDL345_INTR_ENABLE, 0);
+	adxl345_spi_write(spi, ADXL345_POWER_CTL, ADXL345_POWER_CTL_STANDBY);
+	free_irq(spi->irq, st);
+	spi_set_drvdata(spi, NULL);
+
+	/* Files and mappings still out see -ENODEV; sleepers wake up to it */
+	mutex_lock(&st->evt_lock);
+	WRITE_ONCE(st->dead, true);
+	old = st->evt;
+	st->evt = NULL;
+	mutex_unlock(&st->evt_lock);
+	if (old)
+		eventfd_ctx_put(old);
+	wake_up_interruptible(&st->wait);
+	adxl345_stream_put(st);
+}
 
 static int adxl345_spi_probe(struct spi_device *spi)
 {
@@ -147,8 +758,30 @@ static int adxl345_spi_probe(struct spi_device *spi)
 	struct gpio_desc *cs_gpiod;
 	int status;
 
+        /* Bail out if max_speed_hz exceeds 5 MHz */
+        if (spi->max_speed_hz > ADXL345_MAX_SPI_FREQ_HZ) {
+                dev_err(&spi->dev, "SPI CLK, %d Hz exceeds 5 MHz\n",
+                        spi->max_speed_hz);
+                return -EINVAL;
+        }
+
+	g_io = adxl345_io_alloc(spi);
+	if (!g_io)
+		return -ENOMEM;
 	g_spi = spi;
+
+	/* Batched FIFO sampling when the interrupt line is wired up */
+	if (pdata->fifo_mode == ADXL_FIFO_STREAM && spi->irq > 0) {
+		status = adxl345_stream_init(spi);
+		if (status)
+			dev_warn(&spi->dev, "no stream mode (%d), polling only\n", status);
+	}
+
 	status = sysfs_create_group(&spi->dev.kobj, &adxl345_attr_group);
+	if (status) {
+		adxl345_stream_exit(spi);
+		return status;
+	}
 
 	dev_info(&spi->dev, "adxl345 IRQ = %d\n", spi->irq);
 	dev_info(&spi->dev, "adxl345 mode = %d\n", spi->mode);
@@ -165,19 +798,13 @@ static int adxl345_spi_probe(struct spi_device *spi)
 	 * Accessing them directly is not straightforward, so we skip detailed stats */
 	dev_info(&spi->dev, "SPI device initialized successfully\n");
 
-        /* Bail out if max_speed_hz exceeds 5 MHz */
-        if (spi->max_speed_hz > ADXL345_MAX_SPI_FREQ_HZ) {
-                dev_err(&spi->dev, "SPI CLK, %d Hz exceeds 5 MHz\n",
-                        spi->max_speed_hz);
-                return -EINVAL;
-        }
-
 	return 0;
 }
 
 static void adxl345_spi_remove(struct spi_device *spi)
 {
 	sysfs_remove_group(&spi->dev.kobj, &adxl345_attr_group);
+	adxl345_stream_exit(spi);
 }
 
 static const struct spi_device_id adxl345_spi_id[] = {
@@ -0,0 +1,181 @@
+#!/bin/bash
+#
+# bench.sh - block and mmap benchmark matrix for the ramjam drivers
+#
+# WHAT IT MEASURES:
+# Every driver of the family exposes the same two nodes, /dev/ramjam0
+# (block) and /dev/rramjam (mmap), so they are loaded one at a time and
+# run through the same tests:
+#   blk_modern    blk-mq, sparse xarray store   (this directory)
+#   blk_bio       bio-based, sparse xarray store (this directory)
+#   mmap_fault    vmalloc buffer, fault-time mapping (../mmap)
+#   mmap_nofault  vmalloc buffer, mapped eagerly in mmap() (../mmap)
+# fio on /dev/ramjam0 (O_DIRECT), each with 1/4/8 jobs:
+#   randread-4k-qd1 / randwrite-4k-qd1     4K random, iodepth 1
+#   randread-4k-qd32 / randwrite-4k-qd32   4K random, iodepth 32
+#   read-1m / write-1m                     1M sequential, iodepth 8
+# mmap_bench on /dev/rramjam, with 1/4/8 threads:
+#   fault-write / fault-read         first touch faults every page
+#   populate-write / populate-read   the same, mapped with MAP_POPULATE
+# The device is filled before the fio matrix, and again after each reload
+# for the mmap read tests, so reads hit memory rather than the zero fast
+# path. After every test the driver's resident page count is recorded
+# (blk_modern's sysfs; empty for the others).
+#
+# OUTPUT:
+# CSV on stdout, progress on stderr:
+#   driver,tool,test,jobs,qd,iops,MBps,p50_us,p99_us,faults,faults_per_s,warm_MBps,resident_pages
+# fio rows leave the fault columns empty, mmap rows the I/O ones; for mmap
+# rows MBps covers mmap() plus the first touch, warm_MBps the second pass.
+#
+# USAGE:
+#   sudo ./bench.sh [-d "blk_modern blk_bio"] [-j "1 4 8"] [-s MB] [-r SECONDS]
+#                   [-e ioengine] [-o "blk_modern parameters"] > results.csv
+#   sudo make bench BENCH_ARGS="-d blk_modern -o ramjam_huge=1" > huge.csv
+#
+# Needs the modules built (make all, and make -C ../mmap), fio, python3
+# (to read fio's JSON) and a C compiler. Unloads each driver when done.
+
+set -e  # Exit on any error
+trap 'echo "ERROR at line $LINENO" >&2' ERR  # Show line number on error
+
+# --- Configuration ---
+BLK_DEV="/dev/ramjam0"
+CHR_DEV="/dev/rramjam"
+SYSFS="/sys/block/ramjam0"
+
+DRIVERS="blk_modern blk_bio mmap_fault mmap_nofault"
+JOBS="1 4 8"
+SIZE_MB=256              # Area under test; the device is ramjam_pages (1 GB)
+RUNTIME=10               # Seconds per fio test
+ENGINE="libaio"
+MOD_ARGS=""              # Extra parameters, blk_modern only
+
+while getopts "d:j:s:r:e:o:" opt; do
+    case $opt in
+        d) DRIVERS=$OPTARG ;;
+        j) JOBS=$OPTARG ;;
+        s) SIZE_MB=$OPTARG ;;
+        r) RUNTIME=$OPTARG ;;
+        e) ENGINE=$OPTARG ;;
+        o) MOD_ARGS=$OPTARG ;;
+        *) echo "usage: $0 [-d drivers] [-j jobs] [-s MB] [-r seconds] [-e ioengine] [-o params]" >&2; exit 1 ;;
+    esac
+done
+
+log() {
+    echo "[$(date '+%H:%M:%S')] $*" >&2
+}
+
+cleanup() {
+    for d in $DRIVERS; do
+        rmmod $d 2>/dev/null || true
+    done
+}
+
+module_path() {
+    case $1 in
+        blk_*) echo "./$1.ko" ;;
+        *) echo "../mmap/$1.ko" ;;
+    esac
+}
+
+load_driver() {
+    local drv=$1 args=""
+
+    [ "$drv" = "blk_modern" ] && args=$MOD_ARGS
+    cleanup
+    log "Loading $drv $args..."
+    insmod $(module_path $drv) $args
+    for i in {1..10}; do
+        [ -b $BLK_DEV ] && [ -c $CHR_DEV ] && break
+        sleep 0.5
+    done
+}
+
+# Writes the area under test through the block node
+fill() {
+    log "Filling ${SIZE_MB} MB of $BLK_DEV..."
+    fio --name=fill --filename=$BLK_DEV --direct=1 --rw=write --bs=1M \
+        --size=${SIZE_MB}M --output-format=json > /dev/null
+}
+
+resident() {
+    cat $SYSFS/resident_pages 2>/dev/null || true
+}
+
+# iops,MBps,p50_us,p99_us from fio's JSON on stdin (reads and writes summed)
+fio_fields() {
+    python3 -c '
+import json, sys
+job = json.load(sys.stdin)["jobs"][0]
+iops = bw = p50 = p99 = 0
+for d in ("read", "write"):
+    s = job[d]
+    if not s["io_bytes"]:
+        continue
+    iops += s["iops"]
+    bw += s["bw_bytes"]
+    pct = s["clat_ns"].get("percentile", {})
+    p50 = max(p50, pct.get("50.000000", 0))
+    p99 = max(p99, pct.get("99.000000", 0))
+print("%.0f,%.1f,%.1f,%.1f" % (iops, bw / 1e6, p50 / 1e3, p99 / 1e3))'
+}
+
+# One fio test: name rw bs iodepth jobs; each job gets its own slice
+run_fio() {
+    local name=$1 rw=$2 bs=$3 qd=$4 jobs=$5
+    local slice=$((SIZE_MB / jobs))
+
+    fio --name=$name --filename=$BLK_DEV --direct=1 --ioengine=$ENGINE \
+        --rw=$rw --bs=$bs --iodepth=$qd --numjobs=$jobs --group_reporting \
+        --size=${slice}M --offset_increment=${slice}M \
+        --time_based --runtime=$RUNTIME --output-format=json | fio_fields
+}
+
+# --- 1. Build the mmap stress tool and any missing module ---
+log "Compiling mmap_bench.c..."
+cc -O2 -Wall -pthread -o mmap_bench mmap_bench.c || {
+    echo "ERROR: Failed to compile mmap_bench.c" >&2
+    exit 1
+}
+for d in $DRIVERS; do
+    [ -f $(module_path $d) ] || {
+        echo "ERROR: $(module_path $d) not built" >&2
+        exit 1
+    }
+done
+
+trap cleanup EXIT
+
+echo "driver,tool,test,jobs,qd,iops,MBps,p50_us,p99_us,faults,faults_per_s,warm_MBps,resident_pages"
+
+for drv in $DRIVERS; do
+    # --- 2. Fresh driver, area under test filled once ---
+    load_driver $drv
+    fill
+
+    # --- 3. fio matrix ---
+    for jobs in $JOBS; do
+        for t in "randread-4k-qd1 randread 4k 1" "randwrite-4k-qd1 randwrite 4k 1" \
+                 "randread-4k-qd32 randread 4k 32" "randwrite-4k-qd32 randwrite 4k 32" \
+                 "read-1m read 1m 8" "write-1m write 1m 8"; do
+            set -- $t
+            log "$drv: fio $1 x $jobs"
+            echo "$drv,fio,$1,$jobs,$4,$(run_fio $1 $2 $3 $4 $jobs),,,,$(resident)"
+        done
+    done
+
+    # --- 4. mmap matrix (a fresh module each time: nothing mapped yet) ---
+    for jobs in $JOBS; do
+        for t in "fault-write" "fault-read -r" "populate-write -p" "populate-read -p -r"; do
+            set -- $t
+            load_driver $drv
+            case "$*" in *-r*) fill ;; esac    # Reads need data behind them
+            log "$drv: mmap $1 x $jobs"
+            IFS=, read -r _ _ _ _ _ _ _ faults fps cold warm <<< \
+                "$(./mmap_bench -d $CHR_DEV -s $SIZE_MB -t $jobs ${@:2})"
+            echo "$drv,mmap,$1,$jobs,,,$cold,,,$faults,$fps,$warm,$(resident)"
+        done
+    done
+done
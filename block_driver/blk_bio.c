@@ -1,29 +1,38 @@
 #include <linux/module.h>
 #include <linux/blkdev.h>
-#include <linux/blk-mq.h>
 #include <linux/cdev.h>
 #include <linux/mm.h>
 #include <linux/slab.h>
-#include <linux/vmalloc.h>
-#include <linux/mutex.h>
+#include <linux/xarray.h>
+#include <linux/highmem.h>
+#include <linux/workqueue.h>
 #include <linux/device.h>
 
 #define RAMJAM_NAME "ramjam0"
 #define RRAMJAM_NAME "rramjam"
 
 /*
- * PILLAR 1: THE DATA STORE (Sparse Array)
- * We simulate a large disk (1GB) by allocating an array of pointers.
- * No actual RAM is consumed for the data until a page is "touched."
+ * PILLAR 1: THE DATA STORE (Sparse Index)
+ * We simulate a large disk (1GB) with an xarray keyed by page offset.
+ * Neither data pages nor index nodes consume RAM until a page is "touched,"
+ * so the device size is only limited by what is actually written.
+ *
+ * There is no lock. Pages are only ever added (never removed before
+ * module exit), so a page returned by xa_load() stays valid without one,
+ * and concurrent first touches of a page race through xa_cmpxchg(): one
+ * page wins, the others are freed. Any number of CPUs can submit I/O.
  */
 static unsigned int ramjam_pages = 262144;
 module_param(ramjam_pages, uint, 0644);
 
 struct general_ramjam {
     struct gendisk* disk;
-    struct blk_mq_tag_set tag_set;
-    struct mutex mutex;
-    struct page** pages;
+    struct xarray pages;
+
+    /* Plugged bios whose unplug happened in schedule() (see below) */
+    spinlock_t deferred_lock;
+    struct bio_list deferred;
+    struct work_struct deferred_work;
 
     struct cdev cdev;
     struct class* chr_class;
@@ -32,48 +41,152 @@ struct general_ramjam {
     int chr_major;
 } ramjam_dev;
 
+/* Installs a zeroed page at pg_idx unless there is one; returns the page in the table */
+static struct page* ramjam_get_page(unsigned long pg_idx, gfp_t gfp) {
+    struct page* page = alloc_page(gfp | __GFP_ZERO);
+    struct page* old;
+
+    if (!page) return NULL;
+
+    old = xa_cmpxchg(&ramjam_dev.pages, pg_idx, NULL, page, gfp);
+    if (!old) return page;
+
+    /* Lost the race (or no memory for the index node) */
+    __free_page(page);
+    return xa_is_err(old) ? NULL : old;
+}
+
 /* --- 2. THE BLOCK INTERFACE (bio-based) --- */
 /* This demonstrates how the OS communicates with a disk at the sector level */
-static void ramjam_submit_bio(struct bio* bio) {
-    struct bio_vec bvec;
-    struct bvec_iter iter;
-    sector_t sector = bio->bi_iter.bi_sector;
 
-    mutex_lock(&ramjam_dev.mutex);
+/*
+ * Copies one bvec to or from the store. A bvec may be multi-page (it can
+ * cover several contiguous pages of a large folio) and start anywhere, so
+ * each step is cut at the next device-page and the next bvec-page
+ * boundary, whichever comes first: one lookup and one memcpy per step.
+ * With REQ_NOWAIT a first-touch allocation must not sleep; when it cannot
+ * be satisfied that way the bio is failed with -EAGAIN for a retry.
+ */
+static int ramjam_do_bvec(struct bio_vec* bvec, u64 pos, bool write, bool nowait) {
+    unsigned int done = 0;
+
+    while (done < bvec->bv_len) {
+        unsigned long pg_idx = pos >> PAGE_SHIFT;
+        unsigned int dev_off = offset_in_page(pos);
+        unsigned int bv_off = bvec->bv_offset + done;
+        struct page* bv_page = nth_page(bvec->bv_page, bv_off >> PAGE_SHIFT);
+        unsigned int len = min3(bvec->bv_len - done, (unsigned int)PAGE_SIZE - dev_off,
+                                (unsigned int)PAGE_SIZE - offset_in_page(bv_off));
+        struct page* page;
+
+        if (pg_idx >= ramjam_pages) return -EIO;
+        bv_off = offset_in_page(bv_off);
 
-    /* bio_for_each_segment iterates through the memory buffers in the I/O request */
-    bio_for_each_segment(bvec, bio, iter) {
-        uint32_t pg_idx = (sector << SECTOR_SHIFT) >> PAGE_SHIFT;
-        struct page* page = (pg_idx < ramjam_pages) ? ramjam_dev.pages[pg_idx] : NULL;
+        page = xa_load(&ramjam_dev.pages, pg_idx);
 
         /* DEMAND ALLOCATION: Allocate physical RAM only when a WRITE occurs */
-        if (!page && bio_data_dir(bio) == WRITE && pg_idx < ramjam_pages) {
-            page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-            ramjam_dev.pages[pg_idx] = page;
+        if (!page && write) {
+            /* GFP_NOIO: allocating must not recurse into block I/O */
+            page = ramjam_get_page(pg_idx, nowait ? GFP_NOWAIT : GFP_NOIO);
+            if (!page) return nowait ? -EAGAIN : -ENOMEM;
         }
 
-        if (page) {
-            void* vaddr = kmap_local_page(page);
-            void* src_dst = kmap_local_page(bvec.bv_page) + bvec.bv_offset;
+        if (!page)
+            memzero_page(bv_page, bv_off, len); /* Unallocated regions return zeros (Simulates a fresh disk) */
+        else if (write)
+            memcpy_page(page, dev_off, bv_page, bv_off, len);
+        else
+            memcpy_page(bv_page, bv_off, page, dev_off, len);
 
-            if (bio_data_dir(bio) == WRITE)
-                memcpy(vaddr + (bvec.bv_offset % PAGE_SIZE), src_dst, bvec.bv_len);
-            else
-                memcpy(src_dst, vaddr + (bvec.bv_offset % PAGE_SIZE), bvec.bv_len);
+        done += len;
+        pos += len;
+    }
+    return 0;
+}
 
-            kunmap_local(src_dst);
-            kunmap_local(vaddr);
-        }
-        else if (bio_data_dir(bio) == READ) {
-            /* Unallocated regions return zeros (Simulates a fresh disk) */
-            memzero_page(bvec.bv_page, bvec.bv_offset, bvec.bv_len);
-        }
-        sector += (bvec.bv_len >> SECTOR_SHIFT);
+static void ramjam_handle_bio(struct bio* bio) {
+    bool write = op_is_write(bio_op(bio));
+    bool nowait = bio->bi_opf & REQ_NOWAIT;
+    u64 pos = (u64)bio->bi_iter.bi_sector << SECTOR_SHIFT;
+    struct bio_vec bvec;
+    struct bvec_iter iter;
+    int err = 0;
+
+    if (bio_op(bio) != REQ_OP_READ && bio_op(bio) != REQ_OP_WRITE) {
+        bio->bi_status = BLK_STS_NOTSUPP;
+        bio_endio(bio);
+        return;
+    }
+
+    /* bio_for_each_bvec: whole (multi-page) bvecs, not single-page segments */
+    bio_for_each_bvec(bvec, bio, iter) {
+        err = ramjam_do_bvec(&bvec, pos, write, nowait);
+        if (err) break;
+        pos += bvec.bv_len;
+    }
+
+    if (err == -EAGAIN) {
+        bio_wouldblock_error(bio);
+        return;
     }
-    mutex_unlock(&ramjam_dev.mutex);
+    if (err) bio->bi_status = errno_to_blk_status(err);
     bio_endio(bio); // Signal I/O completion
 }
 
+/*
+ * PLUGGING:
+ * A submitter that holds a plug (io_uring and the AIO paths do, around a
+ * batch of submissions) gets its bios collected on a per-plug list here
+ * and handled together when the plug is released, back to back in the
+ * submitting task. blk_check_plugged() finds or creates our callback on
+ * the current plug. An unplug from schedule() may not sleep, so that
+ * batch goes to a worker instead.
+ */
+struct ramjam_plug {
+    struct blk_plug_cb cb;
+    struct bio_list bios;
+};
+
+static void ramjam_unplug(struct blk_plug_cb* cb, bool from_schedule) {
+    struct ramjam_plug* plug = container_of(cb, struct ramjam_plug, cb);
+    struct bio* bio;
+
+    if (from_schedule) {
+        spin_lock(&ramjam_dev.deferred_lock);
+        bio_list_merge(&ramjam_dev.deferred, &plug->bios);
+        spin_unlock(&ramjam_dev.deferred_lock);
+        queue_work(system_unbound_wq, &ramjam_dev.deferred_work);
+    }
+    else {
+        while ((bio = bio_list_pop(&plug->bios)))
+            ramjam_handle_bio(bio);
+    }
+    kfree(plug);
+}
+
+static void ramjam_deferred_work(struct work_struct* work) {
+    struct bio_list bios;
+    struct bio* bio;
+
+    spin_lock(&ramjam_dev.deferred_lock);
+    bios = ramjam_dev.deferred;
+    bio_list_init(&ramjam_dev.deferred);
+    spin_unlock(&ramjam_dev.deferred_lock);
+
+    while ((bio = bio_list_pop(&bios)))
+        ramjam_handle_bio(bio);
+}
+
+static void ramjam_submit_bio(struct bio* bio) {
+    struct blk_plug_cb* cb = blk_check_plugged(ramjam_unplug, &ramjam_dev, sizeof(struct ramjam_plug));
+
+    if (cb) {
+        bio_list_add(&container_of(cb, struct ramjam_plug, cb)->bios, bio);
+        return;
+    }
+    ramjam_handle_bio(bio);
+}
+
 static const struct block_device_operations ramjam_blk_ops = {
     .owner = THIS_MODULE,
     .submit_bio = ramjam_submit_bio,
@@ -84,28 +197,22 @@ static const struct block_device_operations ramjam_blk_ops = {
 /* The Fault Handler: This is called by the CPU when a process touches a null PTE */
 static vm_fault_t ramjam_vm_fault(struct vm_fault* vmf) {
     struct general_ramjam* dev = vmf->vma->vm_private_data;
-    uint32_t pg_idx = vmf->pgoff;
+    unsigned long pg_idx = vmf->pgoff;
     struct page* page;
 
     if (pg_idx >= ramjam_pages)
         return VM_FAULT_SIGBUS;
 
-    mutex_lock(&dev->mutex);
-    page = dev->pages[pg_idx];
+    page = xa_load(&dev->pages, pg_idx);
 
     /* DEMAND PAGING: If the page isn't in RAM, allocate it now */
     if (!page) {
-        page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-        if (!page) {
-            mutex_unlock(&dev->mutex);
-            return VM_FAULT_OOM;
-        }
-        dev->pages[pg_idx] = page;
+        page = ramjam_get_page(pg_idx, GFP_KERNEL);
+        if (!page) return VM_FAULT_OOM;
     }
 
     get_page(page);    // Increment refcount for the hardware mapping
     vmf->page = page;  // "Plug" the page into the process's page table
-    mutex_unlock(&dev->mutex);
 
     return 0;
 }
@@ -141,11 +248,6 @@ static char* rramjam_devnode(const struct device* dev, umode_t* mode) {
     return NULL;
 }
 
-static blk_status_t ramjam_queue_rq(struct blk_mq_hw_ctx* hctx, const struct blk_mq_queue_data* bd) {
-    return BLK_STS_IOERR;
-}
-static const struct blk_mq_ops ramjam_mq_ops = { .queue_rq = ramjam_queue_rq };
-
 static int __init ramjam_init(void) {
     int ret;
     dev_t devt;
@@ -156,15 +258,18 @@ static int __init ramjam_init(void) {
         .io_opt = PAGE_SIZE,
         .max_hw_sectors = 1024,
         .max_segments = 64,
+        /* REQ_NOWAIT bios are accepted (and failed with -EAGAIN rather than block) */
+        .features = BLK_FEAT_NOWAIT,
     };
 
-    ramjam_dev.pages = vcalloc(ramjam_pages, sizeof(struct page*));
-    if (!ramjam_dev.pages) return -ENOMEM;
-    mutex_init(&ramjam_dev.mutex);
+    xa_init(&ramjam_dev.pages);
+    spin_lock_init(&ramjam_dev.deferred_lock);
+    bio_list_init(&ramjam_dev.deferred);
+    INIT_WORK(&ramjam_dev.deferred_work, ramjam_deferred_work);
 
     /* --- Char Node Setup --- */
     ret = alloc_chrdev_region(&devt, 0, 1, RRAMJAM_NAME);
-    if (ret) goto out_free_pages;
+    if (ret) return ret;
     ramjam_dev.chr_major = MAJOR(devt);
 
     ramjam_dev.chr_class = class_create(RRAMJAM_NAME);
@@ -189,19 +294,11 @@ static int __init ramjam_init(void) {
     if (ret < 0) goto out_destroy_device;
     ramjam_dev.blk_major = ret;
 
-    memset(&ramjam_dev.tag_set, 0, sizeof(ramjam_dev.tag_set));
-    ramjam_dev.tag_set.ops = &ramjam_mq_ops;
-    ramjam_dev.tag_set.nr_hw_queues = 1;
-    ramjam_dev.tag_set.queue_depth = 128;
-    ramjam_dev.tag_set.numa_node = NUMA_NO_NODE;
-
-    ret = blk_mq_alloc_tag_set(&ramjam_dev.tag_set);
-    if (ret) goto out_unregister_blk;
-
-    ramjam_dev.disk = blk_mq_alloc_disk(&ramjam_dev.tag_set, &lim, NULL);
+    /* bio-based: no tag set or request queue, submit_bio sees every bio */
+    ramjam_dev.disk = blk_alloc_disk(&lim, NUMA_NO_NODE);
     if (IS_ERR(ramjam_dev.disk)) {
         ret = PTR_ERR(ramjam_dev.disk);
-        goto out_free_tags;
+        goto out_unregister_blk;
     }
 
     ramjam_dev.disk->major = ramjam_dev.blk_major;
@@ -219,8 +316,6 @@ static int __init ramjam_init(void) {
 
 out_put_disk:
     put_disk(ramjam_dev.disk);
-out_free_tags:
-    blk_mq_free_tag_set(&ramjam_dev.tag_set);
 out_unregister_blk:
     unregister_blkdev(ramjam_dev.blk_major, RAMJAM_NAME);
 out_destroy_device:
@@ -231,24 +326,26 @@ out_destroy_class:
     class_destroy(ramjam_dev.chr_class);
 out_unregister_chr:
     unregister_chrdev_region(MKDEV(ramjam_dev.chr_major, 0), 1);
-out_free_pages:
-    vfree(ramjam_dev.pages);
     return ret;
 }
 
 static void __exit ramjam_exit(void) {
+    struct page* page;
+    unsigned long idx;
+
     del_gendisk(ramjam_dev.disk);
+    flush_work(&ramjam_dev.deferred_work); /* Plugged bios handed to the worker */
     put_disk(ramjam_dev.disk);
-    blk_mq_free_tag_set(&ramjam_dev.tag_set);
     unregister_blkdev(ramjam_dev.blk_major, RAMJAM_NAME);
     device_destroy(ramjam_dev.chr_class, MKDEV(ramjam_dev.chr_major, 0));
     cdev_del(&ramjam_dev.cdev);
     class_destroy(ramjam_dev.chr_class);
     unregister_chrdev_region(MKDEV(ramjam_dev.chr_major, 0), 1);
 
-    for (int i = 0; i < ramjam_pages; i++)
-        if (ramjam_dev.pages[i]) __free_page(ramjam_dev.pages[i]);
-    vfree(ramjam_dev.pages);
+    /* Visit only the populated entries, then drop the index nodes */
+    xa_for_each(&ramjam_dev.pages, idx, page)
+        __free_page(page);
+    xa_destroy(&ramjam_dev.pages);
 }
 
 module_init(ramjam_init);
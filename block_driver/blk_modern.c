@@ -3,10 +3,21 @@
 #include <linux/blkdev.h>   /* Generic Block Device structures (gendisk, etc.) */
 #include <linux/cdev.h>     /* Character Device support for the mmap interface */
 #include <linux/mm.h>       /* Memory Management for demand paging logic */
-#include <linux/slab.h>     /* Kernel memory allocation (kzalloc/vcalloc) */
-#include <linux/vmalloc.h>  /* Virtual memory allocation for the page table */
+#include <linux/slab.h>     /* Kernel memory allocation (kzalloc) */
+#include <linux/xarray.h>   /* Sparse page index keyed by page offset */
 #include <linux/hdreg.h>    /* Block device geometry support (HDIO_GETGEO) */
+#include <linux/highmem.h>  /* memcpy_page/memzero_page for the data copies */
 #include <linux/device.h>   /* Driver model support (classes and automatic /dev) */
+#include <linux/crypto.h>   /* Compression transforms for the compressed tier */
+#include <linux/zsmalloc.h> /* Allocator for the compressed objects */
+#include <linux/local_lock.h> /* Per-CPU compression stream ownership */
+#include <linux/huge_mm.h>  /* PMD mappings for the huge-page backing */
+#include <linux/pfn_t.h>    /* pfn_t for vmf_insert_pfn_pmd */
+#include <linux/uaccess.h>  /* copy_from_user for the prefault ioctl */
+#include <linux/fs.h>       /* Backing file I/O (ramjam_file) */
+#include <linux/uio.h>      /* iov_iter over bvecs for the file I/O */
+#include <linux/sched/mm.h> /* memalloc_noio_save around the file I/O */
+#include <linux/workqueue.h> /* Background writeback worker */
 
 #define CHR_NAME "rramjam"  /* Name for the character device (mmap interface) */
 #define BLK_NAME "ramjam"   /* Name for the block device (/dev/ramjam0) */
@@ -15,18 +26,143 @@
 static unsigned int ramjam_pages = 262144;
 module_param(ramjam_pages, uint, 0644);
 
+/*
+ * Module parameter: Compression algorithm for the compressed tier
+ * ("lz4", "zstd", ...). Empty (the default) keeps plain pages.
+ */
+static char* ramjam_comp = "";
+module_param(ramjam_comp, charp, 0444);
+
+/*
+ * Module parameter: Back the device with 2 MB folios instead of 4 KB
+ * pages, and map them into /dev/rramjam with PMDs. Not combinable with
+ * ramjam_comp; the size is rounded up to whole folios.
+ */
+static bool ramjam_huge;
+module_param(ramjam_huge, bool, 0444);
+
+/*
+ * Module parameter: Backing file for a persistent image. Empty (the
+ * default) keeps the device RAM-only. Units are read in from the file on
+ * first touch, changed ones are written back to it. Not combinable with
+ * ramjam_comp.
+ */
+static char* ramjam_file = "";
+module_param(ramjam_file, charp, 0444);
+
+/* Module parameter: Seconds between background writebacks (0 = only on flush/sync) */
+static unsigned int ramjam_wb_secs = 5;
+module_param(ramjam_wb_secs, uint, 0644);
+
+/* Module parameter: Read-ahead from the backing file, in pages */
+#define RAMJAM_RA_MAX 64            /* Units per read, at most */
+#define RAMJAM_WB_BATCH 64          /* Pages per write, at least */
+static unsigned int ramjam_readahead = 64;
+module_param(ramjam_readahead, uint, 0644);
+
+/*
+ * Module parameter: NUMA placement of the backing pages.
+ * "local" (default): the node of the CPU that first touches the page.
+ *   For block I/O that is the submitting hardware queue's node, since
+ *   each queue serves (and is dispatched on) the CPUs of one node.
+ * "interleave": units spread round robin over the online nodes.
+ * A node number: everything on that node.
+ */
+static char* ramjam_numa = "local";
+module_param(ramjam_numa, charp, 0444);
+
+#define RAMJAM_NUMA_LOCAL NUMA_NO_NODE
+#define RAMJAM_NUMA_INTERLEAVE (-2)
+
+/*
+ * Module parameter: Fault-around window in pages (power of two, at most
+ * RAMJAM_MAP_BATCH). 0 maps exactly one page per fault.
+ */
+#define RAMJAM_MAP_BATCH 64
+static unsigned int ramjam_fault_around = 16;
+module_param(ramjam_fault_around, uint, 0644);
+
+/*
+ * Module parameter: Extra hardware queues of type HCTX_TYPE_POLL, for
+ * polled I/O (io_uring IORING_SETUP_IOPOLL, preadv2 RWF_HIPRI). 0 = none.
+ */
+static unsigned int ramjam_poll_queues;
+module_param(ramjam_poll_queues, uint, 0444);
+
+/*
+ * PREFAULT IOCTL (/dev/rramjam):
+ * Populates and maps [addr, addr + len) of the caller's mapping of the
+ * device in one call, instead of one fault per page (or per fault-around
+ * window). addr and len are rounded out to pages.
+ */
+struct ramjam_prefault {
+    __u64 addr;
+    __u64 len;
+};
+#define RAMJAM_IOC_PREFAULT _IOW('j', 1, struct ramjam_prefault)
+
+/* Compressed-tier entries are tagged pointers in the page table */
+#define RAMJAM_ZTAG 1
+
+/*
+ * COMPRESSED PAGE: what the table holds instead of a struct page
+ * - handle == 0: same-filled page, every word equals 'fill'
+ * - otherwise 'len' bytes in the zsmalloc pool (len == PAGE_SIZE: stored
+ *   raw because it did not compress)
+ * The table owns one reference; readers take their own under RCU.
+ */
+struct ramjam_zentry {
+    refcount_t ref;
+    unsigned int len;
+    unsigned long handle;
+    unsigned long fill;
+    struct rcu_head rcu;
+};
+
+/* Per-CPU compression stream: tfm plus a page and an output buffer */
+struct ramjam_zstrm {
+    local_lock_t lock;
+    struct crypto_comp* tfm;
+    void* page;                     /* Uncompressed working copy */
+    void* buf;                      /* Compression output (2 pages) */
+};
+
 /* Device Private Structure: Groups all resources for this specific instance */
 struct general_ramjam {
     struct gendisk* disk;           /* Block device representation */
     struct blk_mq_tag_set tag_set;  /* blk-mq framework requirements */
-    struct mutex mutex;             /* Synchronizes page table access */
-    struct page** pages;            /* THE SPARSE PAGE TABLE (pointer to page ptrs) */
+    struct xarray pages;            /* THE SPARSE PAGE TABLE (folio index -> folio) */
+    unsigned int order;             /* Backing folio order: 0, or PMD_ORDER (ramjam_huge) */
+    atomic_long_t resident;         /* Pages currently in the table */
+    atomic_long_t* node_resident;   /* ... per node, nr_node_ids entries */
+    int numa_node;                  /* Pinned node, or RAMJAM_NUMA_LOCAL/_INTERLEAVE */
+    struct list_head nodes;         /* mmapped /dev/rramjam inodes, zapped on discard */
+    struct mutex nodes_lock;        /* ... protects the list */
+    struct zs_pool* zpool;          /* Compressed tier (NULL when disabled) */
+    struct ramjam_zstrm __percpu* zstrm;
+    atomic_long_t zpages;           /* Compressed-tier entries (incl. same-filled) */
+    atomic_long_t same_pages;       /* ... of which same-filled, no storage */
+    atomic_long_t compr_bytes;      /* Compressed bytes stored in the pool */
+    struct file* file;              /* Backing file (NULL when disabled) */
+    unsigned long* loaded;          /* Units read in from the file (or overwritten) */
+    unsigned long* dirty;           /* Units changed since their last writeback */
+    struct mutex load_lock;         /* One lazy load at a time */
+    struct mutex wb_lock;           /* One writeback at a time, owns wb_bvec */
+    struct bio_vec* wb_bvec;        /* Writeback bounce pages */
+    unsigned int wb_nr;             /* ... and how many */
+    struct delayed_work wb_work;
     struct cdev cdev;               /* Character device object */
     struct class* class;            /* Sysfs class for automatic /dev node creation */
     int major_blk;
     int major_chr;
 } ramjam_dev;
 
+/* One inode mmapped through: mknod can give the char device several */
+struct ramjam_node {
+    struct list_head list;
+    struct inode* inode;            /* Referenced until module exit */
+};
+
 /*
  * PERMISSIONS CALLBACK:
  * Modern 6.12 kernels use 'const struct device' for this signature.
@@ -40,96 +176,1435 @@ static char* rramjam_devnode(const struct device* dev, umode_t* mode) {
 /*
  * CORE DEMAND PAGING LOGIC:
  * Physical RAM is ONLY allocated here when first touched.
- * If 'allocate' is false, it returns NULL (read-from-empty returns zero).
+ * ramjam_lookup() returns NULL for a page never written (or discarded
+ * since), and reading it returns zeros. Otherwise it returns the folio
+ * holding the page or, with the compressed tier, a tagged ramjam_zentry.
+ *
+ * FOLIOS:
+ * The table is indexed by folio, not by page: with 4 KB backing that is
+ * the same thing, with ramjam_huge one entry (and one allocation) covers
+ * 512 pages. The "unit" below is the size of one backing folio.
+ *
+ * SPARSE PAGE TABLE:
+ * Folios live in an xarray keyed by offset, so the index only grows
+ * with the pages actually touched: a 1 TB thin device costs nothing until
+ * it is written, where a flat pointer table would cost 2 GB up front.
+ *
+ * LOCK-FREE LOOKUP:
+ * No driver lock protects the table.
+ * - Lookup is xa_load() inside an RCU read-side section. The caller stays
+ *   in that section for as long as it touches the page.
+ * - Install allocates a zeroed page first and publishes it with
+ *   xa_cmpxchg(). When two writers fault the same slot, one wins and the
+ *   loser frees its page and uses the winner's.
+ * - Discard erases the entry and frees the page only after an RCU grace
+ *   period, when no reader can still hold it.
+ * Every hardware queue and every mmap fault can therefore run in parallel.
  */
-static struct page* ramjam_get_page(unsigned long pgoff, bool allocate) {
+#define RAMJAM_UNIT (PAGE_SIZE << ramjam_dev.order)
+
+static void* ramjam_lookup(unsigned long pgoff) {
+    RCU_LOCKDEP_WARN(!rcu_read_lock_held(), "ramjam page lookup outside RCU");
+
     if (pgoff >= ramjam_pages) return NULL;
+    return xa_load(&ramjam_dev.pages, pgoff >> ramjam_dev.order);
+}
+
+/* Backing-file mode: the unit holding pgoff has not been read in yet */
+static inline bool ramjam_unloaded(unsigned long pgoff) {
+    return ramjam_dev.loaded && !test_bit(pgoff >> ramjam_dev.order, ramjam_dev.loaded);
+}
+
+/* Backing-file mode: call after the unit's new contents are in place */
+static inline void ramjam_mark_dirty(unsigned long pgoff) {
+    if (ramjam_dev.dirty) set_bit(pgoff >> ramjam_dev.order, ramjam_dev.dirty);
+}
+
+static int ramjam_load(unsigned long pgoff, gfp_t gfp);
+
+/* The node the backing for pgoff should come from (ramjam_numa) */
+static int ramjam_node_for(unsigned long pgoff) {
+    int nid, k;
+
+    if (ramjam_dev.numa_node >= 0) return ramjam_dev.numa_node;
+    if (ramjam_dev.numa_node == RAMJAM_NUMA_LOCAL) return numa_mem_id();
+
+    /* Interleave by unit index: placement does not depend on access order */
+    nid = first_online_node;
+    for (k = (pgoff >> ramjam_dev.order) % num_online_nodes(); k; k--)
+        nid = next_online_node(nid);
+    return nid;
+}
+
+/*
+ * Allocates a zeroed backing folio for pgoff on its policy node. A full
+ * node falls back to the nearest others rather than failing the I/O.
+ */
+static struct folio* ramjam_alloc_folio(unsigned long pgoff, gfp_t gfp) {
+    return __folio_alloc_node(gfp | __GFP_ZERO | (ramjam_dev.order ? __GFP_NOWARN : 0),
+                              ramjam_dev.order, ramjam_node_for(pgoff));
+}
+
+/* Resident-page counters, total and per node */
+static void ramjam_account(struct folio* folio, int sign) {
+    long nr = sign * (long)folio_nr_pages(folio);
+
+    atomic_long_add(nr, &ramjam_dev.resident);
+    atomic_long_add(nr, &ramjam_dev.node_resident[folio_nid(folio)]);
+}
+
+/*
+ * Installs a zeroed folio covering pgoff unless one is already there (in
+ * backing-file mode, a first touch reads the unit in instead). May sleep.
+ */
+static int ramjam_insert_folio(unsigned long pgoff, gfp_t gfp) {
+    struct folio* folio;
+    void* old;
+
+    if (pgoff >= ramjam_pages) return -EIO;
+    if (ramjam_unloaded(pgoff)) return ramjam_load(pgoff, gfp);
+
+    /*
+     * Allocate a zeroed physical folio on demand. A huge one can fail on a
+     * fragmented system; the I/O fails then rather than mixing folio sizes
+     * in the table.
+     */
+    folio = ramjam_alloc_folio(pgoff, gfp);
+    if (!folio) return -ENOMEM;
+
+    /* gfp also covers the tree nodes the insert may need */
+    old = xa_cmpxchg(&ramjam_dev.pages, pgoff >> ramjam_dev.order, NULL, folio, gfp);
+    if (old) {
+        /* Lost the race (or no memory for the index node) */
+        folio_put(folio);
+        return xa_err(old);
+    }
+    ramjam_account(folio, 1);
+    return 0;
+}
+
+static void ramjam_free_folio_rcu(struct rcu_head* head) {
+    folio_put(page_folio(container_of(head, struct page, rcu_head)));
+}
+
+static inline bool ramjam_is_zentry(void* entry) {
+    return entry && xa_pointer_tag(entry) == RAMJAM_ZTAG;
+}
+
+static inline struct ramjam_zentry* ramjam_to_zentry(void* entry) {
+    return xa_untag_pointer(entry);
+}
+
+static void ramjam_zput(struct ramjam_zentry* z);
+static void ramjam_zaccount(struct ramjam_zentry* z, int sign);
+
+/* Zaps [pos, pos + len) from every /dev/rramjam mapping; may sleep */
+static void ramjam_zap(loff_t pos, loff_t len) {
+    struct ramjam_node* node;
+
+    mutex_lock(&ramjam_dev.nodes_lock);
+    list_for_each_entry(node, &ramjam_dev.nodes, list)
+        unmap_mapping_range(node->inode->i_mapping, pos, len, 1);
+    mutex_unlock(&ramjam_dev.nodes_lock);
+}
+
+/*
+ * Removes the folio covering pgoff; it is freed once current readers are
+ * done. Its /dev/rramjam mappings are zapped first, so the next access
+ * faults in the new (zero) contents. PTE mappings hold a page reference
+ * and would keep the folio alive anyway; PMD mappings do not, so the zap
+ * must complete before the folio can go.
+ */
+static void ramjam_free_folio(unsigned long pgoff) {
+    unsigned long index = pgoff >> ramjam_dev.order;
+    void* entry = xa_erase(&ramjam_dev.pages, index);
+    struct folio* folio = entry;
+
+    if (!entry) return;
+
+    ramjam_zap((loff_t)index * RAMJAM_UNIT, RAMJAM_UNIT);
+
+    if (ramjam_is_zentry(entry)) {
+        ramjam_zaccount(ramjam_to_zentry(entry), -1);
+        ramjam_zput(ramjam_to_zentry(entry));
+        return;
+    }
+    ramjam_account(folio, -1);
+    call_rcu(&folio->page.rcu_head, ramjam_free_folio_rcu);
+}
+
+/*
+ * One chunk of a bvec: the part that falls into one backing unit. Both
+ * sides may span several pages (multi-page bvecs, huge folios), so the
+ * copies below walk them a page at a time for kmap_local.
+ */
+struct ramjam_chunk {
+    unsigned int off;               /* Offset in the backing unit */
+    unsigned int len;
+    struct page* bv_page;           /* NULL on write: zero the range */
+    unsigned int bv_offset;         /* May exceed PAGE_SIZE */
+    bool write;
+};
+
+/* Copies between the chunk's bvec pages and a linear buffer */
+static void ramjam_bvec_copy(struct ramjam_chunk* c, void* buf, bool to_bvec) {
+    unsigned int done = 0;
+
+    while (done < c->len) {
+        unsigned int bv_off = c->bv_offset + done;
+        struct page* page = nth_page(c->bv_page, bv_off >> PAGE_SHIFT);
+        unsigned int n = min_t(unsigned int, c->len - done, PAGE_SIZE - offset_in_page(bv_off));
+
+        if (to_bvec)
+            memcpy_to_page(page, offset_in_page(bv_off), buf + done, n);
+        else
+            memcpy_from_page(buf + done, page, offset_in_page(bv_off), n);
+        done += n;
+    }
+}
+
+/* Plain-folio copy for a chunk; folio == NULL means "not written yet" */
+static void ramjam_chunk_copy(struct folio* folio, void* arg) {
+    struct ramjam_chunk* c = arg;
+    unsigned int done = 0;
+
+    if (c->write && !folio) return;
+
+    while (done < c->len) {
+        unsigned int off = c->off + done;
+        unsigned int bv_off = c->bv_offset + done;
+        struct page* bv_page = c->bv_page ? nth_page(c->bv_page, bv_off >> PAGE_SHIFT) : NULL;
+        struct page* page = folio ? folio_page(folio, off >> PAGE_SHIFT) : NULL;
+        unsigned int n = min3(c->len - done,
+                              (unsigned int)(PAGE_SIZE - offset_in_page(off)),
+                              (unsigned int)(PAGE_SIZE - offset_in_page(bv_off)));
+
+        if (c->write && bv_page)
+            memcpy_page(page, offset_in_page(off), bv_page, offset_in_page(bv_off), n);
+        else if (c->write)
+            memzero_page(page, offset_in_page(off), n);
+        else if (page)
+            memcpy_page(bv_page, offset_in_page(bv_off), page, offset_in_page(off), n);
+        else
+            memzero_page(bv_page, offset_in_page(bv_off), n);
+        done += n;
+    }
+}
+
+/*
+ * COMPRESSED TIER (ramjam_comp=<alg>):
+ * Written pages are kept compressed in a zsmalloc pool instead of as
+ * whole physical pages, zram style:
+ * - Same-filled pages (all zeros, or one repeated word) need no storage
+ *   at all; the fill word lives in the entry.
+ * - Pages that do not compress below PAGE_SIZE are stored raw in the pool.
+ * - Every CPU owns a compression stream (tfm + buffers) held under a
+ *   local lock, so compression never contends across CPUs.
+ * - Writes are read-modify-write of the whole page and publish the new
+ *   entry with xa_cmpxchg(); a writer that loses a race redoes its update
+ *   on top of the winner's contents. Readers stay lock-free.
+ * - mmap needs real pages: a fault decompresses the entry into a page and
+ *   swaps it into the table, and that page stays uncompressed from then on.
+ */
+static struct ramjam_zstrm* ramjam_zstrm_get(void) {
+    local_lock(&ramjam_dev.zstrm->lock);
+    return this_cpu_ptr(ramjam_dev.zstrm);
+}
+
+static void ramjam_zstrm_put(struct ramjam_zstrm* zs) {
+    local_unlock(&ramjam_dev.zstrm->lock);
+}
+
+/* Takes a reference on a table entry found under RCU; NULL if dying */
+static struct ramjam_zentry* ramjam_zget(struct ramjam_zentry* z) {
+    return refcount_inc_not_zero(&z->ref) ? z : NULL;
+}
+
+/* Drops a reference; the last one frees the pool object (process context) */
+static void ramjam_zput(struct ramjam_zentry* z) {
+    if (!refcount_dec_and_test(&z->ref)) return;
+    if (z->handle) zs_free(ramjam_dev.zpool, z->handle);
+    kfree_rcu(z, rcu);
+}
+
+/* Statistics for an entry entering (+1) or leaving (-1) the table */
+static void ramjam_zaccount(struct ramjam_zentry* z, int sign) {
+    atomic_long_add(sign, &ramjam_dev.zpages);
+    if (z->handle)
+        atomic_long_add(sign * (long)z->len, &ramjam_dev.compr_bytes);
+    else
+        atomic_long_add(sign, &ramjam_dev.same_pages);
+}
+
+static bool ramjam_same_filled(const void* buf, unsigned long* fill) {
+    const unsigned long* word = buf;
+    unsigned int i;
+
+    for (i = 1; i < PAGE_SIZE / sizeof(*word); i++)
+        if (word[i] != word[0]) return false;
+    *fill = word[0];
+    return true;
+}
+
+/* Expands an entry into dst (PAGE_SIZE bytes). Caller owns the stream. */
+static int ramjam_zload(struct ramjam_zstrm* zs, struct ramjam_zentry* z, void* dst) {
+    unsigned int dlen = PAGE_SIZE;
+    void* src;
+    int err = 0;
+
+    if (!z->handle) {
+        memset_l(dst, z->fill, PAGE_SIZE / sizeof(unsigned long));
+        return 0;
+    }
+
+    src = zs_map_object(ramjam_dev.zpool, z->handle, ZS_MM_RO);
+    if (z->len == PAGE_SIZE)
+        memcpy(dst, src, PAGE_SIZE);
+    else
+        err = crypto_comp_decompress(zs->tfm, src, z->len, dst, &dlen);
+    zs_unmap_object(ramjam_dev.zpool, z->handle);
+
+    if (!err && dlen != PAGE_SIZE) err = -EIO;
+    return err;
+}
+
+/*
+ * Looks up pgoff for the compressed-tier paths. Returns a referenced
+ * zentry in *z, or NULL with *z == NULL when the slot is empty or holds a
+ * struct page; then copy() runs on that page (or NULL) under RCU.
+ */
+static void* ramjam_zlookup(unsigned long pgoff, struct ramjam_zentry** z,
+                            void (*copy)(struct folio* folio, void* arg), void* arg) {
+    void* entry;
+
+    for (;;) {
+        rcu_read_lock();
+        entry = ramjam_lookup(pgoff);
+        if (!ramjam_is_zentry(entry)) {
+            copy(entry, arg);
+            rcu_read_unlock();
+            *z = NULL;
+            return entry;
+        }
+        *z = ramjam_zget(ramjam_to_zentry(entry));
+        rcu_read_unlock();
+        if (*z) return entry;
+        /* Entry is being replaced: look again */
+    }
+}
+
+static int ramjam_zread(unsigned long pgoff, struct ramjam_chunk* c) {
+    struct ramjam_zstrm* zs;
+    struct ramjam_zentry* z;
+    int err;
+
+    ramjam_zlookup(pgoff, &z, ramjam_chunk_copy, c);
+    if (!z) return 0;
+
+    zs = ramjam_zstrm_get();
+    err = ramjam_zload(zs, z, zs->page);
+    if (!err) ramjam_bvec_copy(c, zs->page + c->off, true);
+    ramjam_zstrm_put(zs);
+
+    ramjam_zput(z);
+    return err;
+}
+
+static int ramjam_zwrite(unsigned long pgoff, struct ramjam_chunk* c) {
+    struct ramjam_zentry* old = NULL;   /* Current entry, referenced */
+    struct ramjam_zentry* z = NULL;     /* New entry, allocated once */
+    unsigned long handle = 0;           /* Pool object reserved for it */
+    size_t handle_size = 0;
+    int err = 0;
+
+    if (pgoff >= ramjam_pages) return -EIO;
+
+    for (;;) {
+        struct ramjam_zstrm* zs;
+        unsigned int dlen = 2 * PAGE_SIZE;
+        unsigned long fill = 0;
+        void* entry;
+        void* cur;
+        void* dst;
+        bool same;
+
+        entry = ramjam_zlookup(pgoff, &old, ramjam_chunk_copy, c);
+        if (entry && !old) break;       /* Plain page: written in place */
+        if (!entry && !c->bv_page) break; /* Zeroing an empty slot */
+
+        if (!z) {
+            z = kmalloc(sizeof(*z), GFP_NOIO);
+            if (!z) {
+                err = -ENOMEM;
+                goto put_old;
+            }
+        }
+
+        /* Build the new page: old contents plus this chunk */
+        zs = ramjam_zstrm_get();
+        if (old) {
+            err = ramjam_zload(zs, old, zs->page);
+            if (err) {
+                ramjam_zstrm_put(zs);
+                goto put_old;
+            }
+        }
+        else {
+            memset(zs->page, 0, PAGE_SIZE);
+        }
+        if (c->bv_page)
+            ramjam_bvec_copy(c, zs->page + c->off, false);
+        else
+            memset(zs->page + c->off, 0, c->len);
+
+        same = ramjam_same_filled(zs->page, &fill);
+        if (!same) {
+            cur = zs->buf;
+            if (crypto_comp_compress(zs->tfm, zs->page, PAGE_SIZE, zs->buf, &dlen) || dlen >= PAGE_SIZE) {
+                /* Incompressible: store it raw */
+                dlen = PAGE_SIZE;
+                cur = zs->page;
+            }
+
+            if (handle && handle_size < dlen) {
+                zs_free(ramjam_dev.zpool, handle);
+                handle = 0;
+            }
+            if (!handle) {
+                handle = zs_malloc(ramjam_dev.zpool, dlen,
+                                   GFP_NOWAIT | __GFP_NOWARN | __GFP_HIGHMEM | __GFP_MOVABLE);
+                if (IS_ERR_VALUE(handle)) {
+                    /* Slow path: reclaim outside the stream, then redo */
+                    ramjam_zstrm_put(zs);
+                    if (old) ramjam_zput(old);
+                    handle = zs_malloc(ramjam_dev.zpool, dlen, GFP_NOIO | __GFP_HIGHMEM | __GFP_MOVABLE);
+                    if (IS_ERR_VALUE(handle)) {
+                        handle = 0;
+                        err = -ENOMEM;
+                        break;
+                    }
+                    handle_size = dlen;
+                    continue;
+                }
+                handle_size = dlen;
+            }
+
+            dst = zs_map_object(ramjam_dev.zpool, handle, ZS_MM_WO);
+            memcpy(dst, cur, dlen);
+            zs_unmap_object(ramjam_dev.zpool, handle);
+        }
+        ramjam_zstrm_put(zs);
+
+        refcount_set(&z->ref, 1);
+        z->len = same ? 0 : dlen;
+        z->handle = same ? 0 : handle;
+        z->fill = fill;
+
+        cur = xa_cmpxchg(&ramjam_dev.pages, pgoff, entry, xa_tag_pointer(z, RAMJAM_ZTAG), GFP_NOIO);
+        if (cur == entry) {
+            /* Published: the pool object now belongs to the entry */
+            ramjam_zaccount(z, 1);
+            if (!same) handle = 0;
+            z = NULL;
+            if (old) {
+                ramjam_zaccount(old, -1);
+                ramjam_zput(old);       /* The table's reference */
+            }
+            goto put_old;
+        }
+        if (xa_is_err(cur)) err = xa_err(cur);
+        if (old) ramjam_zput(old);
+        if (err) break;
+        /* Lost a race with another writer: redo on top of its data */
+    }
+    goto out;
+
+put_old:
+    if (old) ramjam_zput(old);
+out:
+    if (handle) zs_free(ramjam_dev.zpool, handle);
+    kfree(z);
+    return err;
+}
+
+/*
+ * Replaces a compressed entry by a plain page holding its contents, for
+ * mmap. Returns 0 when the slot no longer holds 'entry' (the caller looks
+ * again) as well as on success.
+ */
+static int ramjam_zpromote(unsigned long pgoff, void* entry, struct ramjam_zentry* z) {
+    struct ramjam_zstrm* zs;
+    struct folio* folio;
+    struct page* page;
+    void* vaddr;
+    void* cur;
+    int err;
+
+    folio = ramjam_alloc_folio(pgoff, GFP_KERNEL);
+    if (!folio) return -ENOMEM;
+    page = &folio->page;
+
+    zs = ramjam_zstrm_get();
+    vaddr = kmap_local_page(page);
+    err = ramjam_zload(zs, z, vaddr);
+    kunmap_local(vaddr);
+    ramjam_zstrm_put(zs);
+    if (err) goto free;
+
+    cur = xa_cmpxchg(&ramjam_dev.pages, pgoff, entry, page, GFP_KERNEL);
+    if (cur == entry) {
+        ramjam_account(folio, 1);
+        ramjam_zaccount(z, -1);
+        ramjam_zput(z);                 /* The table's reference */
+        return 0;
+    }
+    err = xa_err(cur);
+free:
+    folio_put(folio);
+    return err;
+}
+
+/* Sets up the pool and one compression stream per possible CPU */
+static int ramjam_zinit(void) {
+    int cpu;
+
+    if (!ramjam_comp[0]) return 0;
+    if (!crypto_has_comp(ramjam_comp, 0, 0)) {
+        pr_err("ramjam: compression '%s' not available\n", ramjam_comp);
+        return -ENOENT;
+    }
+
+    ramjam_dev.zstrm = alloc_percpu(struct ramjam_zstrm);
+    if (!ramjam_dev.zstrm) return -ENOMEM;
+
+    for_each_possible_cpu(cpu) {
+        struct ramjam_zstrm* zs = per_cpu_ptr(ramjam_dev.zstrm, cpu);
+
+        local_lock_init(&zs->lock);
+        zs->tfm = crypto_alloc_comp(ramjam_comp, 0, 0);
+        zs->page = kmalloc_node(PAGE_SIZE, GFP_KERNEL, cpu_to_node(cpu));
+        zs->buf = kmalloc_node(2 * PAGE_SIZE, GFP_KERNEL, cpu_to_node(cpu));
+        if (IS_ERR(zs->tfm)) zs->tfm = NULL;
+        if (!zs->tfm || !zs->page || !zs->buf) goto err;
+    }
+
+    ramjam_dev.zpool = zs_create_pool(BLK_NAME);
+    if (!ramjam_dev.zpool) goto err;
+
+    pr_info("ramjam: compressed tier enabled (%s)\n", ramjam_comp);
+    return 0;
+
+err:
+    for_each_possible_cpu(cpu) {
+        struct ramjam_zstrm* zs = per_cpu_ptr(ramjam_dev.zstrm, cpu);
+
+        if (zs->tfm) crypto_free_comp(zs->tfm);
+        kfree(zs->page);
+        kfree(zs->buf);
+    }
+    free_percpu(ramjam_dev.zstrm);
+    return -ENOMEM;
+}
+
+/* Frees every compressed entry and the pool; the table must be quiet */
+static void ramjam_zexit(void) {
+    int cpu;
+
+    if (!ramjam_dev.zpool) return;
+    zs_destroy_pool(ramjam_dev.zpool);
+
+    for_each_possible_cpu(cpu) {
+        struct ramjam_zstrm* zs = per_cpu_ptr(ramjam_dev.zstrm, cpu);
+
+        crypto_free_comp(zs->tfm);
+        kfree(zs->page);
+        kfree(zs->buf);
+    }
+    free_percpu(ramjam_dev.zstrm);
+}
+
+/* Plain-folio chunk copy; a write to an empty slot installs a folio first */
+static int ramjam_copy(unsigned long pgoff, struct ramjam_chunk* c) {
+    struct folio* folio;
+    int err;
+
+    for (;;) {
+        rcu_read_lock();
+        folio = ramjam_lookup(pgoff);
+        if (folio || (!c->write && !ramjam_unloaded(pgoff))) {
+            ramjam_chunk_copy(folio, c);
+            rcu_read_unlock();
+            return 0;
+        }
+        /* First touch: install (or read in) a folio outside RCU, then look again */
+        rcu_read_unlock();
+        /* GFP_NOIO: allocating must not recurse into block I/O */
+        err = ramjam_insert_folio(pgoff, GFP_NOIO);
+        if (err) return err;
+    }
+}
+
+/*
+ * BVEC COPY:
+ * Copies one (multi-page) bvec to or from the backing folios. pos is the
+ * byte offset on the device. The bvec is cut where it crosses a backing
+ * unit, so each piece needs one table lookup: with 2 MB folios a whole
+ * 512 KB bvec is usually a single lookup and copy.
+ */
+static int ramjam_do_bvec(struct bio_vec* bvec, u64 pos, bool write) {
+    unsigned int done = 0;
+    int err;
+
+    while (done < bvec->bv_len) {
+        unsigned long pgoff = pos >> PAGE_SHIFT;
+        struct ramjam_chunk c = {
+            .off = pos & (RAMJAM_UNIT - 1),
+            .bv_page = bvec->bv_page,
+            .bv_offset = bvec->bv_offset + done,
+            .write = write,
+        };
+
+        c.len = min_t(unsigned int, bvec->bv_len - done, RAMJAM_UNIT - c.off);
+        if (ramjam_dev.zpool)
+            err = write ? ramjam_zwrite(pgoff, &c) : ramjam_zread(pgoff, &c);
+        else
+            err = ramjam_copy(pgoff, &c);
+        if (err) return err;
+        if (write) ramjam_mark_dirty(pgoff);
+
+        done += c.len;
+        pos += c.len;
+    }
+    return 0;
+}
+
+/*
+ * DISCARD / WRITE ZEROES:
+ * Both leave the range reading back as zeros. Whole units are removed
+ * from the table, which hands their memory back to the system (this is
+ * what fstrim is for). The partial units at either end are zeroed in
+ * place. REQ_NOUNMAP write-zeroes keeps the memory allocated and zeroes
+ * it all. In backing-file mode the zeros reach the file through writeback.
+ */
+static int ramjam_discard(u64 start, u64 len, bool unmap) {
+    u64 pos = start, end = start + len;
+    int err = 0;
+
+    while (pos < end && !err) {
+        unsigned long pgoff = pos >> PAGE_SHIFT;
+        /* bv_page == NULL: the chunk is zeroed rather than copied */
+        struct ramjam_chunk c = { .off = pos & (RAMJAM_UNIT - 1), .write = true };
+
+        c.len = min_t(u64, end - pos, RAMJAM_UNIT - c.off);
+        if (c.len == RAMJAM_UNIT && unmap) {
+            if (ramjam_unloaded(pgoff)) {
+                /* Whole unit: its file contents are never needed */
+                mutex_lock(&ramjam_dev.load_lock);
+                set_bit(pgoff >> ramjam_dev.order, ramjam_dev.loaded);
+                mutex_unlock(&ramjam_dev.load_lock);
+            }
+            ramjam_free_folio(pgoff);
+        }
+        else if (ramjam_unloaded(pgoff)) {
+            /* Partial unit still in the file: read it in, zero on the next pass */
+            err = ramjam_insert_folio(pgoff, GFP_NOIO);
+            continue;
+        }
+        else if (ramjam_dev.zpool)
+            err = ramjam_zwrite(pgoff, &c);
+        else {
+            rcu_read_lock();
+            ramjam_chunk_copy(ramjam_lookup(pgoff), &c);
+            rcu_read_unlock();
+        }
+        if (!err) ramjam_mark_dirty(pgoff);
+        pos += c.len;
+    }
+    return err;
+}
+
+/*
+ * BACKING FILE (ramjam_file):
+ * The file holds the device image at the same offsets. Nothing is read
+ * at load time: 'loaded' tracks which units have come in from the file,
+ * and the first touch of any other unit reads it (plus read-ahead). The
+ * 'dirty' bitmap, set by the block write path and by the first write
+ * through an mmap, drives writeback of just the changed units, from a
+ * background worker every ramjam_wb_secs, on REQ_OP_FLUSH and when
+ * /sys/block/ramjam0/sync is written. Flush and sync end with fsync, so
+ * once they complete the file is a consistent checkpoint of everything
+ * written before them.
+ *
+ * The file is accessed like the loop driver does it: bvec iterators and
+ * vfs_iter_read/write, with memalloc_noio so its allocations cannot
+ * recurse into block I/O.
+ */
+
+/*
+ * LAZY LOAD:
+ * Reads the unit at pgoff from the file, together with the following
+ * units that are still unloaded (ramjam_readahead pages in all), in one
+ * read straight into new folios. Loads are serialized, so a unit is read
+ * only once even when several CPUs fault on it.
+ */
+static int ramjam_load(unsigned long pgoff, gfp_t gfp) {
+    unsigned long unit = pgoff >> ramjam_dev.order;
+    unsigned long nunits = ramjam_pages >> ramjam_dev.order;
+    unsigned long ra = clamp_t(unsigned long, ramjam_readahead >> ramjam_dev.order, 1, RAMJAM_RA_MAX);
+    loff_t pos = (loff_t)unit * RAMJAM_UNIT;
+    struct iov_iter iter;
+    struct bio_vec* bv;
+    unsigned long i, n;
+    unsigned int noio;
+    ssize_t ret;
+    int err = 0;
+
+    bv = kmalloc_array(ra, sizeof(*bv), gfp);
+    if (!bv) return -ENOMEM;
+
+    mutex_lock(&ramjam_dev.load_lock);
 
-    if (!ramjam_dev.pages[pgoff] && allocate) {
-        /* Allocate a zeroed physical page on demand */
-        ramjam_dev.pages[pgoff] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+    /* The window: this unit and the next ones still in the file only */
+    for (n = 0; n < ra && unit + n < nunits && !test_bit(unit + n, ramjam_dev.loaded); n++) {
+        struct folio* folio = ramjam_alloc_folio((unit + n) << ramjam_dev.order, gfp);
+
+        if (!folio) break;
+        bvec_set_folio(&bv[n], folio, RAMJAM_UNIT, 0);
+    }
+    if (!n) {
+        /* Someone else read it in, or no memory */
+        err = test_bit(unit, ramjam_dev.loaded) ? 0 : -ENOMEM;
+        goto out;
+    }
+
+    iov_iter_bvec(&iter, ITER_DEST, bv, n, n * RAMJAM_UNIT);
+    noio = memalloc_noio_save();
+    ret = vfs_iter_read(ramjam_dev.file, &iter, &pos, 0);
+    memalloc_noio_restore(noio);
+    /* A short read is the end of the file: the rest of the folios stay zero */
+    if (ret < 0) err = ret;
+
+    for (i = 0; i < n; i++) {
+        struct folio* folio = page_folio(bv[i].bv_page);
+        void* old = NULL;
+
+        if (!err) old = xa_cmpxchg(&ramjam_dev.pages, unit + i, NULL, folio, gfp);
+        if (!err && xa_is_err(old)) err = xa_err(old);
+
+        if (err || old)
+            folio_put(folio);
+        else
+            ramjam_account(folio, 1);
+        /* Published before the bit: a reader that sees the bit sees the folio */
+        if (!err) set_bit(unit + i, ramjam_dev.loaded);
+    }
+
+out:
+    mutex_unlock(&ramjam_dev.load_lock);
+    kfree(bv);
+    return err;
+}
+
+/* Copies n units starting at 'unit' into the bounce pages and writes them out */
+static int ramjam_write_units(unsigned long unit, unsigned long n) {
+    unsigned long nr = n << ramjam_dev.order;
+    loff_t pos = (loff_t)unit * RAMJAM_UNIT;
+    struct iov_iter iter;
+    unsigned int noio;
+    unsigned long i;
+    ssize_t ret;
+    int err;
+
+    /* Later writes through /dev/rramjam fault again and re-dirty the unit */
+    ramjam_zap(pos, n * RAMJAM_UNIT);
+
+    /* The block read path: empty slots come out as zeros */
+    for (i = 0; i < nr; i++) {
+        err = ramjam_do_bvec(&ramjam_dev.wb_bvec[i], pos + (i << PAGE_SHIFT), false);
+        if (err) return err;
+    }
+
+    iov_iter_bvec(&iter, ITER_SOURCE, ramjam_dev.wb_bvec, nr, nr << PAGE_SHIFT);
+    noio = memalloc_noio_save();
+    file_start_write(ramjam_dev.file);
+    ret = vfs_iter_write(ramjam_dev.file, &iter, &pos, 0);
+    file_end_write(ramjam_dev.file);
+    memalloc_noio_restore(noio);
+
+    if (ret < 0) return ret;
+    return ret == nr << PAGE_SHIFT ? 0 : -EIO;
+}
+
+/*
+ * WRITEBACK:
+ * Writes every dirty unit to the file, in runs of up to wb_nr pages, then
+ * fsyncs it. A unit's dirty bit is cleared before its contents are copied
+ * out, and writers set it only after their data is in place, so a write
+ * racing with the copy leaves the unit dirty for the next round. A run
+ * that fails is marked dirty again.
+ */
+static int ramjam_sync(void) {
+    unsigned long nunits = ramjam_pages >> ramjam_dev.order;
+    unsigned long batch = ramjam_dev.wb_nr >> ramjam_dev.order;
+    unsigned long unit = 0;
+    int err = 0;
+
+    mutex_lock(&ramjam_dev.wb_lock);
+    while (!err && (unit = find_next_bit(ramjam_dev.dirty, nunits, unit)) < nunits) {
+        unsigned long n = 0;
+
+        while (n < batch && unit + n < nunits && test_and_clear_bit(unit + n, ramjam_dev.dirty))
+            n++;
+
+        err = ramjam_write_units(unit, n);
+        if (err) bitmap_set(ramjam_dev.dirty, unit, n);
+        unit += n;
+        cond_resched();
+    }
+    if (!err) err = vfs_fsync(ramjam_dev.file, 0);
+    mutex_unlock(&ramjam_dev.wb_lock);
+    return err;
+}
+
+static void ramjam_wb_work(struct work_struct* work) {
+    unsigned int secs = READ_ONCE(ramjam_wb_secs);
+    int err;
+
+    if (secs) {
+        err = ramjam_sync();
+        if (err) pr_warn_ratelimited("ramjam: writeback failed (%d)\n", err);
+    }
+    /* With 0, keep checking once a second for the parameter to change */
+    schedule_delayed_work(&ramjam_dev.wb_work, (secs ?: 1) * HZ);
+}
+
+static void ramjam_file_exit(void) {
+    unsigned int i;
+
+    if (!ramjam_dev.file) return;
+
+    cancel_delayed_work_sync(&ramjam_dev.wb_work);
+    /* Final writeback (a setup that failed half-way has nothing dirty) */
+    if (ramjam_dev.dirty && !bitmap_empty(ramjam_dev.dirty, ramjam_pages >> ramjam_dev.order) &&
+        ramjam_sync())
+        pr_err("ramjam: final writeback to %s failed\n", ramjam_file);
+
+    for (i = 0; ramjam_dev.wb_bvec && i < ramjam_dev.wb_nr; i++)
+        __free_page(ramjam_dev.wb_bvec[i].bv_page);
+    kfree(ramjam_dev.wb_bvec);
+    bitmap_free(ramjam_dev.dirty);
+    bitmap_free(ramjam_dev.loaded);
+    filp_close(ramjam_dev.file, NULL);
+    ramjam_dev.file = NULL;
+}
+
+static int ramjam_file_init(void) {
+    unsigned long nunits = ramjam_pages >> ramjam_dev.order;
+    unsigned int nr = max_t(unsigned int, RAMJAM_WB_BATCH, 1U << ramjam_dev.order);
+    struct file* file;
+
+    if (!ramjam_file[0]) return 0;
+
+    file = filp_open(ramjam_file, O_RDWR | O_CREAT | O_LARGEFILE, 0600);
+    if (IS_ERR(file)) {
+        pr_err("ramjam: cannot open %s\n", ramjam_file);
+        return PTR_ERR(file);
+    }
+    ramjam_dev.file = file;
+    mutex_init(&ramjam_dev.load_lock);
+    mutex_init(&ramjam_dev.wb_lock);
+    INIT_DELAYED_WORK(&ramjam_dev.wb_work, ramjam_wb_work);
+
+    ramjam_dev.loaded = bitmap_zalloc(nunits, GFP_KERNEL);
+    ramjam_dev.dirty = bitmap_zalloc(nunits, GFP_KERNEL);
+    ramjam_dev.wb_bvec = kcalloc(nr, sizeof(*ramjam_dev.wb_bvec), GFP_KERNEL);
+    if (!ramjam_dev.loaded || !ramjam_dev.dirty || !ramjam_dev.wb_bvec)
+        goto err;
+
+    for (; ramjam_dev.wb_nr < nr; ramjam_dev.wb_nr++) {
+        struct page* page = alloc_page(GFP_KERNEL);
+
+        if (!page) goto err;
+        bvec_set_page(&ramjam_dev.wb_bvec[ramjam_dev.wb_nr], page, PAGE_SIZE, 0);
+    }
+
+    schedule_delayed_work(&ramjam_dev.wb_work, (ramjam_wb_secs ?: 1) * HZ);
+    pr_info("ramjam: backed by %s\n", ramjam_file);
+    return 0;
+
+err:
+    ramjam_file_exit();
+    return -ENOMEM;
+}
+
+/* Does the data transfer (or discard) of one request */
+static int ramjam_do_rq(struct request* rq) {
+    bool write = rq_data_dir(rq) == WRITE;
+    struct bio_vec bvec;
+    struct req_iterator iter;
+    /* Translate sector-based position to byte offset (64-bit: > 4 GB disks) */
+    u64 pos = (u64)blk_rq_pos(rq) << SECTOR_SHIFT;
+    int err = 0;
+
+    switch (req_op(rq)) {
+    case REQ_OP_READ:
+    case REQ_OP_WRITE:
+        break;
+    case REQ_OP_DISCARD:
+        return ramjam_discard(pos, blk_rq_bytes(rq), true);
+    case REQ_OP_WRITE_ZEROES:
+        return ramjam_discard(pos, blk_rq_bytes(rq), !(rq->cmd_flags & REQ_NOUNMAP));
+    case REQ_OP_FLUSH:
+        /* Only sent in backing-file mode (BLK_FEAT_WRITE_CACHE) */
+        return ramjam_dev.file ? ramjam_sync() : 0;
+    default:
+        return -EOPNOTSUPP;
+    }
+
+    /* Iterate through the (multi-page) data segments in this block request */
+    rq_for_each_bvec(bvec, rq, iter) {
+        err = ramjam_do_bvec(&bvec, pos, write);
+        if (err) break;
+        pos += bvec.bv_len;
+    }
+    return err;
+}
+
+/*
+ * POLL QUEUES:
+ * Requests on an HCTX_TYPE_POLL queue are not completed in queue_rq.
+ * queue_rq still does the copy (it may sleep: BLK_MQ_F_BLOCKING), then
+ * parks the finished request, with its status in the PDU, on the queue's
+ * list. The submitter reaps it from ->poll (io_uring IOPOLL spins there
+ * instead of sleeping for an interrupt), completing everything it found
+ * as one batch through blk_mq_add_to_batch(), which frees tags and wakes
+ * waiters in one go. ->poll runs under rcu_read_lock(), so it must never
+ * touch the data path.
+ */
+struct ramjam_poll_queue {
+    spinlock_t lock;
+    struct list_head list;          /* Transferred, not yet completed */
+};
+
+/* Per-request PDU (tag_set.cmd_size) */
+struct ramjam_cmd {
+    blk_status_t status;            /* Result of ramjam_do_rq() */
+};
+
+static int ramjam_init_hctx(struct blk_mq_hw_ctx* hctx, void* data, unsigned int hctx_idx) {
+    struct ramjam_poll_queue* pq;
+
+    if (hctx->type != HCTX_TYPE_POLL) return 0;
+
+    pq = kzalloc_node(sizeof(*pq), GFP_KERNEL, hctx->numa_node);
+    if (!pq) return -ENOMEM;
+    spin_lock_init(&pq->lock);
+    INIT_LIST_HEAD(&pq->list);
+    hctx->driver_data = pq;
+    return 0;
+}
+
+static void ramjam_exit_hctx(struct blk_mq_hw_ctx* hctx, unsigned int hctx_idx) {
+    kfree(hctx->driver_data);
+    hctx->driver_data = NULL;
+}
+
+static int ramjam_poll(struct blk_mq_hw_ctx* hctx, struct io_comp_batch* iob) {
+    struct ramjam_poll_queue* pq = hctx->driver_data;
+    struct request* rq;
+    LIST_HEAD(list);
+    int nr = 0;
+
+    spin_lock(&pq->lock);
+    list_splice_init(&pq->list, &list);
+    list_for_each_entry(rq, &list, queuelist)
+        blk_mq_set_request_complete(rq);
+    spin_unlock(&pq->lock);
+
+    while (!list_empty(&list)) {
+        blk_status_t status;
+
+        rq = list_first_entry(&list, struct request, queuelist);
+        list_del_init(&rq->queuelist);
+
+        status = ((struct ramjam_cmd*)blk_mq_rq_to_pdu(rq))->status;
+        /* Batched completion; falls back when the poller has no batch */
+        if (!blk_mq_add_to_batch(rq, iob, status != BLK_STS_OK, blk_mq_end_request_batch))
+            blk_mq_end_request(rq, status);
+        nr++;
+    }
+    return nr;
+}
+
+/* Default queues first, then the poll queues; no separate read queues */
+static void ramjam_map_queues(struct blk_mq_tag_set* set) {
+    unsigned int qoff = 0;
+    int i;
+
+    for (i = 0; i < set->nr_maps; i++) {
+        struct blk_mq_queue_map* map = &set->map[i];
+
+        switch (i) {
+        case HCTX_TYPE_DEFAULT:
+            map->nr_queues = set->nr_hw_queues - ramjam_poll_queues;
+            break;
+        case HCTX_TYPE_POLL:
+            map->nr_queues = ramjam_poll_queues;
+            break;
+        default:
+            map->nr_queues = 0;
+            continue;
+        }
+        map->queue_offset = qoff;
+        qoff += map->nr_queues;
+        blk_mq_map_queues(map);
     }
-    return ramjam_dev.pages[pgoff];
 }
 
 /*
  * MODERN BLK-MQ REQUEST HANDLER:
  * Replaces the old 'request' or 'bio' handlers.
  * It processes a list of segments provided by the block layer.
+ * Runs without any driver lock, so requests on different hardware
+ * queues (one per CPU) proceed concurrently.
  */
 static blk_status_t ramjam_queue_rq(struct blk_mq_hw_ctx* hctx, const struct blk_mq_queue_data* bd) {
     struct request* rq = bd->rq;
-    struct bio_vec bvec;
-    struct req_iterator iter;
-    /* Translate sector-based position to byte offset */
-    uint32_t pos = blk_rq_pos(rq) << SECTOR_SHIFT;
+    blk_status_t status;
 
     blk_mq_start_request(rq);
-    mutex_lock(&ramjam_dev.mutex);
+    status = errno_to_blk_status(ramjam_do_rq(rq));
 
-    /* Iterate through the data segments in this block request */
-    rq_for_each_segment(bvec, rq, iter) {
-        unsigned long pgoff = (pos + bvec.bv_offset) >> PAGE_SHIFT;
-        struct page* page = ramjam_get_page(pgoff, rq_data_dir(rq) == WRITE);
-        void* vaddr;
+    if (hctx->type == HCTX_TYPE_POLL) {
+        struct ramjam_poll_queue* pq = hctx->driver_data;
+        struct ramjam_cmd* cmd = blk_mq_rq_to_pdu(rq);
 
-        if (page) {
-            /* kmap_local_page is the 6.x standard for short-term mappings */
-            vaddr = kmap_local_page(page) + (pos % PAGE_SIZE);
-            if (rq_data_dir(rq) == WRITE)
-                memcpy(vaddr, page_address(bvec.bv_page) + bvec.bv_offset, bvec.bv_len);
-            else
-                memcpy(page_address(bvec.bv_page) + bvec.bv_offset, vaddr, bvec.bv_len);
-            kunmap_local(vaddr);
-        }
-        else if (rq_data_dir(rq) == READ) {
-            /* Page doesn't exist yet? Return zeros for the read request */
-            memzero_page(bvec.bv_page, bvec.bv_offset, bvec.bv_len);
-        }
-        pos += bvec.bv_len;
+        /* Done; ramjam_poll() only completes it */
+        cmd->status = status;
+        spin_lock(&pq->lock);
+        list_add_tail(&rq->queuelist, &pq->list);
+        spin_unlock(&pq->lock);
+        return BLK_STS_OK;
     }
 
-    mutex_unlock(&ramjam_dev.mutex);
-    blk_mq_end_request(rq, BLK_STS_OK);
+    blk_mq_end_request(rq, status);
     return BLK_STS_OK;
 }
 
-static const struct blk_mq_ops ramjam_mq_ops = { .queue_rq = ramjam_queue_rq };
+static const struct blk_mq_ops ramjam_mq_ops = {
+    .queue_rq = ramjam_queue_rq,
+    .init_hctx = ramjam_init_hctx,
+    .exit_hctx = ramjam_exit_hctx,
+    .map_queues = ramjam_map_queues,
+    .poll = ramjam_poll,
+};
+
+/*
+ * BATCH MAPPING:
+ * Maps a run of consecutive pages with vm_insert_pages(), which takes the
+ * page-table lock once for the whole run. It stops at a page that is
+ * already mapped; the rest of the run is then done one page at a time.
+ * Drops the caller's page references (the PTEs take their own).
+ */
+static void ramjam_insert_run(struct vm_area_struct* vma, unsigned long addr,
+                              struct page** pages, unsigned long n) {
+    unsigned long left = n;
+    unsigned long i;
+
+    if (n && vm_insert_pages(vma, addr, pages, &left))
+        for (i = n - left + 1; i < n; i++)
+            vm_insert_page(vma, addr + (i << PAGE_SHIFT), pages[i]);
+
+    for (i = 0; i < n; i++)
+        put_page(pages[i]);
+}
+
+/*
+ * Maps the populated plain pages among the nr pages at addr/pgoff, except
+ * 'skip' (the page the caller maps itself). Never allocates: empty and
+ * compressed slots are left for their own fault.
+ */
+static void ramjam_map_range(struct vm_area_struct* vma, unsigned long addr, pgoff_t pgoff,
+                             unsigned long nr, pgoff_t skip) {
+    struct page* pages[RAMJAM_MAP_BATCH];
+    unsigned long run = addr;
+    unsigned long n = 0;
+    unsigned long i;
+
+    for (i = 0; i < nr; i++, pgoff++) {
+        struct page* page = NULL;
+        void* entry;
+
+        if (pgoff != skip) {
+            rcu_read_lock();
+            entry = ramjam_lookup(pgoff);
+            if (entry && !ramjam_is_zentry(entry)) {
+                page = folio_page((struct folio*)entry, pgoff & ((1UL << ramjam_dev.order) - 1));
+                get_page(page);
+            }
+            rcu_read_unlock();
+        }
+
+        /* A hole or a full batch ends the current run */
+        if (!page || n == RAMJAM_MAP_BATCH) {
+            ramjam_insert_run(vma, run, pages, n);
+            n = 0;
+        }
+        if (page) {
+            if (!n) run = addr + (i << PAGE_SHIFT);
+            pages[n++] = page;
+        }
+    }
+    ramjam_insert_run(vma, run, pages, n);
+}
+
+/*
+ * FAULT-AROUND:
+ * A fault also maps the already-populated pages around it, an aligned
+ * window of ramjam_fault_around pages clipped to the VMA, so a sequential
+ * scan takes one fault per window instead of one per page.
+ *
+ * The kernel's own hook for this, .map_pages, runs under RCU and relies
+ * on page-table helpers that only the page cache can use, so the window
+ * is mapped from the fault handler with vm_insert_pages() instead (this
+ * is why mmap sets VM_MIXEDMAP).
+ */
+static void ramjam_fault_around_map(struct vm_fault* vmf) {
+    struct vm_area_struct* vma = vmf->vma;
+    unsigned long nr = min_t(unsigned int, ramjam_fault_around, RAMJAM_MAP_BATCH);
+    unsigned long addr = vmf->address & PAGE_MASK;
+    unsigned long start, end;
+
+    if (nr <= 1 || !is_power_of_2(nr)) return;
+
+    start = max(ALIGN_DOWN(addr, nr << PAGE_SHIFT), vma->vm_start);
+    end = min(ALIGN_DOWN(addr, nr << PAGE_SHIFT) + (nr << PAGE_SHIFT), vma->vm_end);
+
+    ramjam_map_range(vma, start, linear_page_index(vma, start), (end - start) >> PAGE_SHIFT, vmf->pgoff);
+}
 
 /*
  * MMAP FAULT HANDLER:
  * Invoked when user-space accesses a memory-mapped address not yet in the MMU.
  */
 static vm_fault_t ramjam_vma_fault(struct vm_fault* vmf) {
+    struct ramjam_zentry* z = NULL;
     struct page* page;
-    mutex_lock(&ramjam_dev.mutex);
+    void* entry;
+    int err;
 
-    /* Fetch or allocate physical page at the requested offset */
-    page = ramjam_get_page(vmf->pgoff, true);
-    if (!page) {
-        mutex_unlock(&ramjam_dev.mutex);
-        return VM_FAULT_SIGBUS;
+    /* Fetch or allocate physical page at the requested offset (lock-free) */
+    for (;;) {
+        rcu_read_lock();
+        entry = ramjam_lookup(vmf->pgoff);
+        page = NULL;
+        if (ramjam_is_zentry(entry)) {
+            z = ramjam_zget(ramjam_to_zentry(entry));
+        }
+        else if (entry) {
+            /* The page within its folio (the folio itself for 4 KB backing) */
+            page = folio_page((struct folio*)entry, vmf->pgoff & ((1UL << ramjam_dev.order) - 1));
+            get_page(page); /* Increment reference count for the MMU */
+        }
+        rcu_read_unlock();
+        if (page) break;
+
+        if (z) {
+            /* Compressed: swap in a plain page, then look again */
+            err = ramjam_zpromote(vmf->pgoff, entry, z);
+            ramjam_zput(z);
+            z = NULL;
+        }
+        else if (ramjam_is_zentry(entry)) {
+            continue;
+        }
+        else {
+            err = ramjam_insert_folio(vmf->pgoff, GFP_KERNEL);
+        }
+        if (err) return err == -ENOMEM ? VM_FAULT_OOM : VM_FAULT_SIGBUS;
     }
 
-    get_page(page);     /* Increment reference count for the MMU */
+    ramjam_fault_around_map(vmf);
     vmf->page = page;   /* Link physical page to user virtual address */
-
-    mutex_unlock(&ramjam_dev.mutex);
     return 0;
 }
 
-static const struct vm_operations_struct ramjam_vm_ops = { .fault = ramjam_vma_fault };
+/*
+ * HUGE (PMD) FAULT HANDLER:
+ * With ramjam_huge every 2 MB-aligned run of the device is one folio, so
+ * a fault anywhere in it maps the whole folio with a single PMD: 512x
+ * fewer faults and one TLB entry instead of 512. Anything that does not
+ * line up (VMA edges, unaligned offsets) falls back to ramjam_vma_fault,
+ * which maps the same folio's pages one PTE at a time.
+ */
+static vm_fault_t ramjam_vma_huge_fault(struct vm_fault* vmf, unsigned int order) {
+    struct vm_area_struct* vma = vmf->vma;
+    unsigned long haddr = vmf->address & PMD_MASK;
+    pgoff_t pgoff = linear_page_index(vma, haddr);
+    struct folio* folio;
+    vm_fault_t ret;
+    bool stale;
+    int err;
+
+    if (order != PMD_ORDER || ramjam_dev.order != PMD_ORDER) return VM_FAULT_FALLBACK;
+    if (haddr < vma->vm_start || haddr + PMD_SIZE > vma->vm_end) return VM_FAULT_FALLBACK;
+    if (pgoff & ((1UL << PMD_ORDER) - 1)) return VM_FAULT_FALLBACK;
+
+    for (;;) {
+        rcu_read_lock();
+        folio = ramjam_lookup(pgoff);
+        if (folio) folio_get(folio);    /* Pin it across the insert */
+        rcu_read_unlock();
+        if (folio) break;
+
+        err = ramjam_insert_folio(pgoff, GFP_KERNEL);
+        if (err) return err == -ENOMEM ? VM_FAULT_OOM : VM_FAULT_SIGBUS;
+    }
+
+    ret = vmf_insert_pfn_pmd(vmf, pfn_to_pfn_t(folio_pfn(folio)), vmf->flags & FAULT_FLAG_WRITE);
+    /* PMDs have no page_mkwrite: a writable one dirties its unit here */
+    if (vmf->flags & FAULT_FLAG_WRITE)
+        ramjam_mark_dirty(pgoff);
+
+    /*
+     * The PMD holds no reference. If a discard removed the folio while we
+     * were mapping it, its zap may have run before our insert: zap again.
+     */
+    rcu_read_lock();
+    stale = ramjam_lookup(pgoff) != folio;
+    rcu_read_unlock();
+    if (stale)
+        unmap_mapping_range(vma->vm_file->f_mapping, (loff_t)pgoff << PAGE_SHIFT, PMD_SIZE, 1);
+
+    folio_put(folio);
+    return ret;
+}
+
+/*
+ * WRITE NOTIFY (backing-file mode):
+ * With a page_mkwrite handler the kernel maps shared pages read-only and
+ * calls it on the first write to each one, which is where its unit gets
+ * marked dirty. Writeback zaps the mappings, so the next write after a
+ * writeback comes through here again.
+ */
+static vm_fault_t ramjam_vma_mkwrite(struct vm_fault* vmf) {
+    /* Not page-cache pages: hand the folio back locked ourselves */
+    folio_lock(page_folio(vmf->page));
+    ramjam_mark_dirty(vmf->pgoff);
+    return VM_FAULT_LOCKED;
+}
+
+static const struct vm_operations_struct ramjam_vm_ops = {
+    .fault = ramjam_vma_fault,
+    .huge_fault = ramjam_vma_huge_fault,
+};
+
+static const struct vm_operations_struct ramjam_file_vm_ops = {
+    .fault = ramjam_vma_fault,
+    .huge_fault = ramjam_vma_huge_fault,
+    .page_mkwrite = ramjam_vma_mkwrite,
+};
+
+/* Puts the file's inode on the zap list, holding a reference to it */
+static int ramjam_add_node(struct file* file) {
+    struct inode* inode = file_inode(file);
+    struct ramjam_node* node;
+    int err = 0;
+
+    mutex_lock(&ramjam_dev.nodes_lock);
+    list_for_each_entry(node, &ramjam_dev.nodes, list)
+        if (node->inode == inode) goto out;
+
+    node = kmalloc(sizeof(*node), GFP_KERNEL);
+    if (!node) {
+        err = -ENOMEM;
+        goto out;
+    }
+    ihold(inode);
+    node->inode = inode;
+    list_add_tail(&node->list, &ramjam_dev.nodes);
+out:
+    mutex_unlock(&ramjam_dev.nodes_lock);
+    return err;
+}
+
+static void ramjam_put_nodes(void) {
+    struct ramjam_node* node, * tmp;
+
+    list_for_each_entry_safe(node, tmp, &ramjam_dev.nodes, list) {
+        list_del(&node->list);
+        iput(node->inode);
+        kfree(node);
+    }
+}
 
 /* Standard mmap entry point: Sets the custom fault handler for the VMA */
 static int ramjam_mmap(struct file* file, struct vm_area_struct* vma) {
-    vma->vm_ops = &ramjam_vm_ops;
+    int err = ramjam_add_node(file);
+
+    if (err) return err;
+    /*
+     * MIXEDMAP: fault-around and prefault insert pages from fault/ioctl
+     * context, and PMD mappings are pfn-based next to those PTE pages.
+     */
+    vm_flags_set(vma, VM_MIXEDMAP);
+    if (ramjam_dev.order)
+        vm_flags_set(vma, VM_HUGEPAGE);
+    vma->vm_ops = ramjam_dev.file ? &ramjam_file_vm_ops : &ramjam_vm_ops;
     vma->vm_private_data = &ramjam_dev;
     return 0;
 }
 
-static const struct file_operations ramjam_fops = { .owner = THIS_MODULE, .mmap = ramjam_mmap };
+/* Allocates any missing backing for the nr pages at pgoff */
+static int ramjam_populate(pgoff_t pgoff, unsigned long nr) {
+    unsigned long i;
+    void* entry;
+    int err;
+
+    for (i = 0; i < nr; i++) {
+        rcu_read_lock();
+        entry = ramjam_lookup(pgoff + i);
+        rcu_read_unlock();
+        if (entry) continue;
+
+        err = ramjam_insert_folio(pgoff + i, GFP_KERNEL);
+        if (err) return err;
+    }
+    return 0;
+}
+
+static long ramjam_ioctl(struct file* file, unsigned int cmd, unsigned long arg) {
+    struct ramjam_prefault req;
+    struct vm_area_struct* vma;
+    unsigned long addr, end;
+    int err = 0;
+
+    if (cmd != RAMJAM_IOC_PREFAULT) return -ENOTTY;
+    if (copy_from_user(&req, (void __user*)arg, sizeof(req))) return -EFAULT;
+
+    addr = req.addr & PAGE_MASK;
+    end = PAGE_ALIGN(req.addr + req.len);
+    if (end <= addr) return -EINVAL;
+
+    mmap_read_lock(current->mm);
+    vma = vma_lookup(current->mm, addr);
+    if (!vma || vma->vm_private_data != &ramjam_dev || end > vma->vm_end) {
+        err = -EINVAL;
+        goto out;
+    }
+
+    /* Populate, then map, one batch at a time */
+    while (addr < end) {
+        unsigned long nr = min_t(unsigned long, (end - addr) >> PAGE_SHIFT, RAMJAM_MAP_BATCH);
+        pgoff_t pgoff = linear_page_index(vma, addr);
+
+        err = ramjam_populate(pgoff, nr);
+        if (err) break;
+        ramjam_map_range(vma, addr, pgoff, nr, ULONG_MAX);
+
+        addr += nr << PAGE_SHIFT;
+        if (fatal_signal_pending(current)) {
+            err = -EINTR;
+            break;
+        }
+        cond_resched();
+    }
+
+out:
+    mmap_read_unlock(current->mm);
+    return err;
+}
+
+/* thp_get_unmapped_area: 2 MB-aligned addresses, so PMDs can be used */
+static const struct file_operations ramjam_fops = {
+    .owner = THIS_MODULE,
+    .mmap = ramjam_mmap,
+    .unlocked_ioctl = ramjam_ioctl,
+    .get_unmapped_area = thp_get_unmapped_area,
+};
 static const struct block_device_operations ramjam_blk_ops = { .owner = THIS_MODULE };
 
+/*
+ * SYSFS: /sys/block/ramjam0/resident_pages
+ * Physical pages held by the device right now; drops after fstrim.
+ */
+static ssize_t resident_pages_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    return sysfs_emit(buf, "%ld\n", atomic_long_read(&ramjam_dev.resident));
+}
+static DEVICE_ATTR_RO(resident_pages);
+
+/*
+ * SYSFS: /sys/block/ramjam0/numa_resident
+ * Resident pages per online node, "N<node>=<pages>" as in numa_maps.
+ */
+static ssize_t numa_resident_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    int len = 0;
+    int nid;
+
+    for_each_online_node(nid)
+        len += sysfs_emit_at(buf, len, "%sN%d=%ld", len ? " " : "", nid,
+                             atomic_long_read(&ramjam_dev.node_resident[nid]));
+    len += sysfs_emit_at(buf, len, "\n");
+    return len;
+}
+static DEVICE_ATTR_RO(numa_resident);
+
+/*
+ * SYSFS: /sys/block/ramjam0/mm_stat (compressed tier, zram's layout)
+ * orig_data_size compr_data_size mem_used_total same_pages, in bytes
+ * except the last one.
+ */
+static ssize_t mm_stat_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    unsigned long pool = ramjam_dev.zpool ? zs_get_total_pages(ramjam_dev.zpool) : 0;
+
+    return sysfs_emit(buf, "%8lu %8lu %8lu %8lu\n",
+                      atomic_long_read(&ramjam_dev.zpages) << PAGE_SHIFT,
+                      atomic_long_read(&ramjam_dev.compr_bytes),
+                      pool << PAGE_SHIFT,
+                      atomic_long_read(&ramjam_dev.same_pages));
+}
+static DEVICE_ATTR_RO(mm_stat);
+
+/*
+ * SYSFS: /sys/block/ramjam0/compression_ratio
+ * Data held by the compressed tier over the memory the pool uses for it
+ * (same-filled pages count as data and use none).
+ */
+static ssize_t compression_ratio_show(struct device* dev, struct device_attribute* attr, char* buf) {
+    unsigned long pool = ramjam_dev.zpool ? zs_get_total_pages(ramjam_dev.zpool) : 0;
+    unsigned long orig = atomic_long_read(&ramjam_dev.zpages);
+    unsigned long ratio;
+
+    if (!pool) return sysfs_emit(buf, "%s\n", orig ? "inf" : "0.00");
+    ratio = orig * 100 / pool;
+    return sysfs_emit(buf, "%lu.%02lu\n", ratio / 100, ratio % 100);
+}
+static DEVICE_ATTR_RO(compression_ratio);
+
+/*
+ * SYSFS: /sys/block/ramjam0/sync (write-only, backing-file mode)
+ * Any write flushes all dirty units to the file and fsyncs it; the write
+ * returns when the checkpoint is on disk.
+ */
+static ssize_t sync_store(struct device* dev, struct device_attribute* attr, const char* buf, size_t len) {
+    int err;
+
+    if (!ramjam_dev.file) return -EINVAL;
+    err = ramjam_sync();
+    return err ? err : len;
+}
+static DEVICE_ATTR_WO(sync);
+
+static struct attribute* ramjam_disk_attrs[] = {
+    &dev_attr_resident_pages.attr,
+    &dev_attr_numa_resident.attr,
+    &dev_attr_mm_stat.attr,
+    &dev_attr_compression_ratio.attr,
+    &dev_attr_sync.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(ramjam_disk);
+
 /*
  * INITIALIZATION:
  * Implements the 6.12 "Atomic Queue Limits" and Multi-Major registration.
@@ -143,16 +1618,63 @@ static int __init ramjam_init(void) {
         .logical_block_size = PAGE_SIZE,
         .physical_block_size = PAGE_SIZE,
         .io_min = PAGE_SIZE,
+        /* Discard and write-zeroes of any length, in whole pages */
+        .discard_granularity = PAGE_SIZE,
+        .max_hw_discard_sectors = UINT_MAX,
+        .max_write_zeroes_sectors = UINT_MAX,
     };
 
-    /* Pre-allocate the page table (array of pointers) - sparse, no physical pages yet */
-    ramjam_dev.pages = vcalloc(ramjam_pages, sizeof(struct page*));
-    if (!ramjam_dev.pages) return -ENOMEM;
-    mutex_init(&ramjam_dev.mutex);
+    /* Empty page table: index nodes and physical pages arrive on first touch */
+    xa_init(&ramjam_dev.pages);
+    INIT_LIST_HEAD(&ramjam_dev.nodes);
+    mutex_init(&ramjam_dev.nodes_lock);
+
+    /* Optional huge backing: whole folios only */
+    if (ramjam_huge) {
+        if (ramjam_comp[0]) {
+            pr_err("ramjam: ramjam_huge and ramjam_comp are exclusive\n");
+            return -EINVAL;
+        }
+        ramjam_dev.order = PMD_ORDER;
+        ramjam_pages = round_up(ramjam_pages, 1U << PMD_ORDER);
+        lim.discard_granularity = RAMJAM_UNIT;
+        pr_info("ramjam: %lu KB folio backing\n", RAMJAM_UNIT >> 10);
+    }
+
+    /* Optional backing file: flushes reach the driver as REQ_OP_FLUSH */
+    if (ramjam_file[0]) {
+        if (ramjam_comp[0]) {
+            pr_err("ramjam: ramjam_file needs plain or huge page backing\n");
+            return -EINVAL;
+        }
+        lim.features |= BLK_FEAT_WRITE_CACHE;
+    }
+
+    /* NUMA placement policy */
+    if (!strcmp(ramjam_numa, "local")) {
+        ramjam_dev.numa_node = RAMJAM_NUMA_LOCAL;
+    }
+    else if (!strcmp(ramjam_numa, "interleave")) {
+        ramjam_dev.numa_node = RAMJAM_NUMA_INTERLEAVE;
+    }
+    else if (kstrtoint(ramjam_numa, 10, &ramjam_dev.numa_node) || ramjam_dev.numa_node < 0 ||
+             ramjam_dev.numa_node >= nr_node_ids || !node_online(ramjam_dev.numa_node)) {
+        pr_err("ramjam: ramjam_numa must be local, interleave or an online node\n");
+        return -EINVAL;
+    }
+    ramjam_dev.node_resident = kcalloc(nr_node_ids, sizeof(*ramjam_dev.node_resident), GFP_KERNEL);
+    if (!ramjam_dev.node_resident) return -ENOMEM;
+
+    /* Optional compressed tier: pool and per-CPU streams */
+    ret = ramjam_zinit();
+    if (ret) goto err_numa;
+
+    ret = ramjam_file_init();
+    if (ret) goto err_zpool;
 
     /* --- Character Device Setup (/dev/rramjam) --- */
     ret = alloc_chrdev_region(&devt, 0, 1, CHR_NAME);
-    if (ret < 0) goto err_pages;
+    if (ret < 0) goto err_file;
     ramjam_dev.major_chr = MAJOR(devt);
 
     ramjam_dev.class = class_create(CHR_NAME);
@@ -176,9 +1698,21 @@ static int __init ramjam_init(void) {
     /* blk-mq Framework configuration */
     ramjam_dev.tag_set.ops = &ramjam_mq_ops;
     ramjam_dev.tag_set.nr_hw_queues = num_online_cpus(); /* Utilize all RPi 5 cores */
+    if (ramjam_poll_queues) {
+        /* Poll queues come on top; blk-mq then marks the queue BLK_FEAT_POLL */
+        ramjam_dev.tag_set.nr_hw_queues += ramjam_poll_queues;
+        ramjam_dev.tag_set.nr_maps = HCTX_MAX_TYPES;
+    }
     ramjam_dev.tag_set.queue_depth = 128;
-    ramjam_dev.tag_set.numa_node = NUMA_NO_NODE;
-    ramjam_dev.tag_set.flags = BLK_MQ_F_SHOULD_MERGE;
+    ramjam_dev.tag_set.cmd_size = sizeof(struct ramjam_cmd);
+    /*
+     * blk-mq allocates each hctx and its requests on the node of the CPUs
+     * it serves; numa_node is the fallback. Pinned placement makes that
+     * the data's node.
+     */
+    ramjam_dev.tag_set.numa_node = ramjam_dev.numa_node >= 0 ? ramjam_dev.numa_node : NUMA_NO_NODE;
+    /* BLOCKING: first-touch page allocation in queue_rq may sleep */
+    ramjam_dev.tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
     ret = blk_mq_alloc_tag_set(&ramjam_dev.tag_set);
     if (ret) goto err_blkdev;
 
@@ -200,7 +1734,7 @@ static int __init ramjam_init(void) {
     set_capacity(ramjam_dev.disk, (sector_t)ramjam_pages * (PAGE_SIZE / 512));
 
     /* Add the disk to the system. This triggers the /dev/ramjam0 node creation */
-    ret = add_disk(ramjam_dev.disk);
+    ret = device_add_disk(NULL, ramjam_dev.disk, ramjam_disk_groups);
     if (ret) goto err_disk;
 
     pr_info("rramjam: Nodes /dev/%s and /dev/%s0 initialized (0666)\n", CHR_NAME, BLK_NAME);
@@ -212,12 +1746,15 @@ err_tag:        blk_mq_free_tag_set(&ramjam_dev.tag_set);
 err_blkdev:     unregister_blkdev(ramjam_dev.major_blk, BLK_NAME "_blk");
 err_class:      class_destroy(ramjam_dev.class);
 err_chr_region: unregister_chrdev_region(devt, 1);
-err_pages:      vfree(ramjam_dev.pages);
+err_file:       ramjam_file_exit();
+err_zpool:      ramjam_zexit();
+err_numa:       kfree(ramjam_dev.node_resident);
     return ret;
 }
 
 static void __exit ramjam_exit(void) {
-    int i;
+    void* entry;
+    unsigned long i;
     dev_t devt = MKDEV(ramjam_dev.major_chr, 0);
 
     /* 1. Unregister block device */
@@ -226,17 +1763,32 @@ static void __exit ramjam_exit(void) {
     blk_mq_free_tag_set(&ramjam_dev.tag_set);
     unregister_blkdev(ramjam_dev.major_blk, BLK_NAME "_blk");
 
+    /* Last writeback to the backing file, while the pages and nodes are still here */
+    ramjam_file_exit();
+
     /* 2. Unregister character device and class */
     device_destroy(ramjam_dev.class, devt);
     class_destroy(ramjam_dev.class);
     cdev_del(&ramjam_dev.cdev);
     unregister_chrdev_region(devt, 1);
+    ramjam_put_nodes();
 
-    /* 3. Free all physical pages allocated during demand paging */
-    for (i = 0; i < ramjam_pages; i++) {
-        if (ramjam_dev.pages[i]) __free_page(ramjam_dev.pages[i]);
+    /* 3. Free all physical pages allocated during demand paging (populated entries only) */
+    xa_for_each(&ramjam_dev.pages, i, entry) {
+        if (ramjam_is_zentry(entry)) {
+            struct ramjam_zentry* z = ramjam_to_zentry(entry);
+
+            if (z->handle) zs_free(ramjam_dev.zpool, z->handle);
+            kfree(z);
+        }
+        else {
+            folio_put(entry);
+        }
     }
-    vfree(ramjam_dev.pages); /* Free the pointer table */
+    xa_destroy(&ramjam_dev.pages); /* Free the index nodes */
+    rcu_barrier(); /* Wait for folios still queued by discard */
+    ramjam_zexit();
+    kfree(ramjam_dev.node_resident);
 }
 
 module_init(ramjam_init);
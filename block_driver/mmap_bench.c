@@ -0,0 +1,191 @@
+/*
+ * mmap_bench.c - multi-threaded mmap stress for /dev/rramjam
+ *
+ * Maps SIZE MB of the device MAP_SHARED and splits it into one slice per
+ * thread. All threads start together (barrier) and run two passes:
+ *   cold  touch one byte per page: every touch is a page fault, unless
+ *         MAP_POPULATE (or the driver's fault-around) mapped it already
+ *   warm  write (memset) or read (64-bit loads) the whole slice through
+ *         the now complete mapping: plain memory bandwidth
+ * Faults are the process's minor + major fault count over mmap() and the
+ * cold pass, so MAP_POPULATE runs show the same faults moved into mmap().
+ *
+ * USAGE:
+ *   mmap_bench [-d dev] [-s MB] [-t threads] [-p] [-r] [-H]
+ *     -p  map with MAP_POPULATE
+ *     -r  read instead of write
+ *     -H  print the CSV header first
+ *
+ * OUTPUT (one CSV row):
+ *   dev,threads,populate,op,size_mb,map_ms,cold_ms,faults,faults_per_s,cold_MBps,warm_MBps
+ * cold_MBps covers mmap() plus the cold pass, i.e. the cost of getting
+ * the memory mapped either way.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+struct worker {
+	pthread_t tid;
+	char *base;
+	size_t len;
+};
+
+static pthread_barrier_t barrier;
+static size_t page_size;
+static int do_read;
+static volatile uint64_t sink;	/* Keeps the read loops from being optimized away */
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static long faults(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_minflt + ru.ru_majflt;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t sum = 0;
+	size_t i;
+
+	/* Cold pass: one touch per page */
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < w->len; i += page_size) {
+		if (do_read)
+			sum += ((volatile char *)w->base)[i];
+		else
+			w->base[i] = 1;
+	}
+	pthread_barrier_wait(&barrier);
+
+	/* Warm pass: the whole slice */
+	pthread_barrier_wait(&barrier);
+	if (do_read) {
+		const uint64_t *p = (const uint64_t *)w->base;
+
+		for (i = 0; i < w->len / sizeof(*p); i++)
+			sum += p[i];
+	} else {
+		memset(w->base, 0x5a, w->len);
+	}
+	pthread_barrier_wait(&barrier);
+
+	sink += sum;
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dev = "/dev/rramjam";
+	size_t size_mb = 256;
+	int threads = 1;
+	int populate = 0;
+	int header = 0;
+	struct worker *w;
+	double t0, t_map, t_cold, t_warm;
+	long f0, nflt;
+	size_t len, slice;
+	char *map;
+	int fd, opt, i;
+
+	while ((opt = getopt(argc, argv, "d:s:t:prH")) != -1) {
+		switch (opt) {
+		case 'd': dev = optarg; break;
+		case 's': size_mb = strtoul(optarg, NULL, 0); break;
+		case 't': threads = atoi(optarg); break;
+		case 'p': populate = 1; break;
+		case 'r': do_read = 1; break;
+		case 'H': header = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-d dev] [-s MB] [-t threads] [-p] [-r] [-H]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (threads < 1 || !size_mb) {
+		fprintf(stderr, "threads and size must be positive\n");
+		exit(EXIT_FAILURE);
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	len = size_mb << 20;
+	/* Whole pages per thread */
+	slice = len / threads / page_size * page_size;
+
+	fd = open(dev, O_RDWR);
+	if (fd == -1) {
+		perror("Error opening device");
+		exit(EXIT_FAILURE);
+	}
+
+	w = calloc(threads, sizeof(*w));
+	if (!w) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	pthread_barrier_init(&barrier, NULL, threads + 1);
+
+	f0 = faults();
+	t0 = now_ms();
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		perror("Error mmapping the device");
+		exit(EXIT_FAILURE);
+	}
+	t_map = now_ms() - t0;
+
+	for (i = 0; i < threads; i++) {
+		w[i].base = map + (size_t)i * slice;
+		w[i].len = slice;
+		if (pthread_create(&w[i].tid, NULL, worker_fn, &w[i])) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	pthread_barrier_wait(&barrier);
+	t0 = now_ms();
+	pthread_barrier_wait(&barrier);
+	t_cold = now_ms() - t0;
+	nflt = faults() - f0;
+
+	pthread_barrier_wait(&barrier);
+	t0 = now_ms();
+	pthread_barrier_wait(&barrier);
+	t_warm = now_ms() - t0;
+
+	for (i = 0; i < threads; i++)
+		pthread_join(w[i].tid, NULL);
+
+	if (header)
+		printf("dev,threads,populate,op,size_mb,map_ms,cold_ms,faults,faults_per_s,cold_MBps,warm_MBps\n");
+	len = slice * threads;
+	printf("%s,%d,%d,%s,%zu,%.2f,%.2f,%ld,%.0f,%.1f,%.1f\n",
+	       dev, threads, populate, do_read ? "read" : "write", size_mb,
+	       t_map, t_cold, nflt,
+	       nflt / ((t_map + t_cold) / 1e3),
+	       len / 1e6 / ((t_map + t_cold) / 1e3),
+	       len / 1e6 / (t_warm / 1e3));
+
+	munmap(map, size_mb << 20);
+	close(fd);
+	free(w);
+	return 0;
+}
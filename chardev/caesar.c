@@ -3,28 +3,78 @@
 #include <linux/device.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/rcupdate.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
 
 #define DEVICE_NAME "modern_encryptor"
 #define CLASS_NAME  "encrypt_class"
-#define BUF_SIZE    1024
+#define BUF_SIZE    (64 * 1024)  // Pending output per open file
+#define CHUNK_SIZE  4096         // Bytes copied in and encrypted per pass
+#define BENCH_SIZE  (1024 * 1024)
 
 static dev_t dev_num;
 static struct cdev my_cdev;
 static struct class *my_class;
 static struct device *my_device;
-static char *kernel_buffer;
-static int shift_key = 3; // Adjustable via sysfs
+
+/**
+* The cipher as a 256-entry lookup table: every byte maps to its output,
+* letters shifted, everything else to itself. Published through RCU so
+* a key change swaps the whole table at once.
+*/
+struct caesar_table {
+    int key;
+    u8 map[256];
+    struct rcu_head rcu;
+};
+
+static struct caesar_table __rcu *cur_table;
+static DEFINE_MUTEX(key_lock); // Serializes key changes
+static int shift_key = 3; // Initial key; adjustable via sysfs
+
+/**
+* Per-open state: a snapshot of the table and the encrypted bytes not
+* read back yet, buffer[head..len). Each open file is its own stream.
+*/
+struct caesar_ctx {
+    struct mutex lock;
+    u8 map[256];
+    size_t head;
+    size_t len;
+    u8 *buffer;
+};
 
 /**
 * Caesar Cipher Logic
 */
-static void encrypt_data(char *data, size_t len) {
+static void build_table(struct caesar_table *t, int key) {
     int i;
+    t->key = key;
+    for (i = 0; i < 256; i++)
+        t->map[i] = i;
+    for (i = 0; i < 26; i++) {
+        t->map['a' + i] = 'a' + (i + key) % 26;
+        t->map['A' + i] = 'A' + (i + key) % 26;
+    }
+}
+
+/* Branch-free: one table load per byte */
+static void encrypt_data(const u8 *map, u8 *data, size_t len) {
+    size_t i;
+    for (i = 0; i < len; i++)
+        data[i] = map[data[i]];
+}
+
+/* The original per-byte version, kept as the benchmark baseline */
+static void encrypt_scalar(u8 *data, size_t len, int key) {
+    size_t i;
     for (i = 0; i < len; i++) {
         if (data[i] >= 'a' && data[i] <= 'z')
-            data[i] = ((data[i] - 'a' + shift_key) % 26) + 'a';
+            data[i] = ((data[i] - 'a' + key) % 26) + 'a';
         else if (data[i] >= 'A' && data[i] <= 'Z')
-            data[i] = ((data[i] - 'A' + shift_key) % 26) + 'A';
+            data[i] = ((data[i] - 'A' + key) % 26) + 'A';
     }
 }
 
@@ -32,51 +82,171 @@ static void encrypt_data(char *data, size_t len) {
 * Sysfs "Show" Routine - Reads current shift_key
 */
 static ssize_t key_show(struct device *dev, struct device_attribute *attr, char *buf) {
-    return sprintf(buf, "%d\n", shift_key);
+    int key;
+    rcu_read_lock();
+    key = rcu_dereference(cur_table)->key;
+    rcu_read_unlock();
+    return sprintf(buf, "%d\n", key);
 }
 
 /**
 * Sysfs "Store" Routine - Sets new shift_key
+* Builds a new table and swaps it in; writers already running keep the
+* table they started with.
 */
 static ssize_t key_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
+    struct caesar_table *t, *old;
     int val;
     if (kstrtoint(buf, 10, &val) < 0) return -EINVAL;
-    shift_key = val % 26; 
+
+    t = kmalloc(sizeof(*t), GFP_KERNEL);
+    if (!t) return -ENOMEM;
+    build_table(t, ((val % 26) + 26) % 26); // Negative keys shift backwards
+
+    mutex_lock(&key_lock);
+    old = rcu_replace_pointer(cur_table, t, lockdep_is_held(&key_lock));
+    mutex_unlock(&key_lock);
+    kfree_rcu(old, rcu);
     return count;
 }
 
 // Macro to create the dev_attr_key structure
 static DEVICE_ATTR_RW(key);
 
+/**
+* Sysfs "Show" Routine - Throughput of the table against the scalar loop
+* on BENCH_SIZE bytes of text, current key.
+*/
+static ssize_t bench_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct caesar_table *t;
+    u64 scalar_ns, lut_ns;
+    ktime_t start;
+    u8 *data;
+    size_t i;
+
+    t = kmalloc(sizeof(*t), GFP_KERNEL);
+    data = kvmalloc(BENCH_SIZE, GFP_KERNEL);
+    if (!t || !data) {
+        kfree(t);
+        kvfree(data);
+        return -ENOMEM;
+    }
+    rcu_read_lock();
+    memcpy(t, rcu_dereference(cur_table), sizeof(*t));
+    rcu_read_unlock();
+
+    for (i = 0; i < BENCH_SIZE; i++)
+        data[i] = "The quick brown fox jumps over the lazy dog. "[i % 45];
+
+    start = ktime_get();
+    encrypt_scalar(data, BENCH_SIZE, t->key);
+    scalar_ns = ktime_to_ns(ktime_sub(ktime_get(), start)) ?: 1;
+
+    start = ktime_get();
+    encrypt_data(t->map, data, BENCH_SIZE);
+    lut_ns = ktime_to_ns(ktime_sub(ktime_get(), start)) ?: 1;
+
+    kvfree(data);
+    kfree(t);
+    // Bytes per ns * 1000 = MB/s
+    return sprintf(buf, "scalar %llu MB/s, table %llu MB/s\n",
+                   BENCH_SIZE * 1000ULL / scalar_ns, BENCH_SIZE * 1000ULL / lut_ns);
+}
+
+static DEVICE_ATTR_RO(bench);
+
 /**
 * File Operations
 */
-static ssize_t dev_read(struct file *f, char __user *buf, size_t len, loff_t *off) {
-    size_t datalen = strlen(kernel_buffer);
-    if (*off >= datalen) return 0;
-    if (copy_to_user(buf, kernel_buffer, datalen)) return -EFAULT;
-    *off += datalen;
-    return datalen;
+static int dev_open(struct inode *inode, struct file *f) {
+    struct caesar_ctx *ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+    if (!ctx) return -ENOMEM;
+    ctx->buffer = kvmalloc(BUF_SIZE, GFP_KERNEL);
+    if (!ctx->buffer) {
+        kfree(ctx);
+        return -ENOMEM;
+    }
+    mutex_init(&ctx->lock);
+    f->private_data = ctx;
+    // Reads consume what writes produced: no file position
+    return stream_open(inode, f);
+}
+
+static int dev_release(struct inode *inode, struct file *f) {
+    struct caesar_ctx *ctx = f->private_data;
+    kvfree(ctx->buffer);
+    kfree(ctx);
+    return 0;
 }
 
-static ssize_t dev_write(struct file *f, const char __user *buf, size_t len, loff_t *off) {
-    size_t to_copy = min(len, (size_t)BUF_SIZE - 1);
-    memset(kernel_buffer, 0, BUF_SIZE);
-    if (copy_from_user(kernel_buffer, buf, to_copy)) return -EFAULT;
-    encrypt_data(kernel_buffer, to_copy);
-    return to_copy;
+/* Hands back encrypted bytes, any value including NUL; 0 once drained */
+static ssize_t dev_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct caesar_ctx *ctx = iocb->ki_filp->private_data;
+    size_t n;
+
+    mutex_lock(&ctx->lock);
+    n = copy_to_iter(ctx->buffer + ctx->head, ctx->len - ctx->head, to);
+    ctx->head += n;
+    if (ctx->head == ctx->len)
+        ctx->head = ctx->len = 0;
+    mutex_unlock(&ctx->lock);
+    return n;
+}
+
+/*
+* Encrypts in CHUNK_SIZE passes, each copied in and transformed while
+* still in cache. Takes what fits in the pending buffer; -ENOSPC when
+* nothing does, until the output is read.
+*/
+static ssize_t dev_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct caesar_ctx *ctx = iocb->ki_filp->private_data;
+    size_t done = 0;
+    ssize_t ret;
+
+    mutex_lock(&ctx->lock);
+    // One key for the whole write, even if it changes meanwhile
+    rcu_read_lock();
+    memcpy(ctx->map, rcu_dereference(cur_table)->map, sizeof(ctx->map));
+    rcu_read_unlock();
+
+    if (ctx->head) {
+        memmove(ctx->buffer, ctx->buffer + ctx->head, ctx->len - ctx->head);
+        ctx->len -= ctx->head;
+        ctx->head = 0;
+    }
+    while (iov_iter_count(from) && ctx->len < BUF_SIZE) {
+        size_t n = min3(iov_iter_count(from), (size_t)CHUNK_SIZE, BUF_SIZE - ctx->len);
+        n = copy_from_iter(ctx->buffer + ctx->len, n, from);
+        if (!n) break;
+        encrypt_data(ctx->map, ctx->buffer + ctx->len, n);
+        ctx->len += n;
+        done += n;
+    }
+    if (done || !iov_iter_count(from))
+        ret = done;
+    else
+        ret = ctx->len == BUF_SIZE ? -ENOSPC : -EFAULT;
+    mutex_unlock(&ctx->lock);
+    return ret;
 }
 
 static struct file_operations fops = {
     .owner = THIS_MODULE,
-    .read = dev_read,
-    .write = dev_write,
+    .open = dev_open,
+    .release = dev_release,
+    .read_iter = dev_read_iter,
+    .write_iter = dev_write_iter,
 };
 
 /**
 * Module Init
 */
 static int __init mod_init(void) {
+    struct caesar_table *t = kmalloc(sizeof(*t), GFP_KERNEL);
+    if (!t) return -ENOMEM;
+    build_table(t, shift_key);
+    RCU_INIT_POINTER(cur_table, t);
+
     alloc_chrdev_region(&dev_num, 0, 1, DEVICE_NAME);
     
     cdev_init(&my_cdev, &fops);
@@ -85,12 +255,12 @@ static int __init mod_init(void) {
     my_class = class_create(CLASS_NAME);
     my_device = device_create(my_class, NULL, dev_num, NULL, DEVICE_NAME);
     
-    // Create the sysfs file /sys/class/encrypt_class/modern_encryptor/key
-    if (device_create_file(my_device, &dev_attr_key) < 0) {
+    // Create the sysfs files /sys/class/encrypt_class/modern_encryptor/{key,bench}
+    if (device_create_file(my_device, &dev_attr_key) < 0 ||
+        device_create_file(my_device, &dev_attr_bench) < 0) {
         pr_err("Failed to create sysfs file\n");
     }
 
-    kernel_buffer = kmalloc(BUF_SIZE, GFP_KERNEL);
     pr_info("Encryptor Loaded. Key: %d\n", shift_key);
     return 0;
 }
@@ -99,12 +269,14 @@ static int __init mod_init(void) {
 * Module Exit
 */
 static void __exit mod_exit(void) {
+    device_remove_file(my_device, &dev_attr_bench);
     device_remove_file(my_device, &dev_attr_key);
     device_destroy(my_class, dev_num);
     class_destroy(my_class);
     cdev_del(&my_cdev);
     unregister_chrdev_region(dev_num, 1);
-    kfree(kernel_buffer);
+    // No readers are left; a replaced table is freed by kfree_rcu on its own
+    kfree(rcu_dereference_protected(cur_table, 1));
 }
 
 module_init(mod_init);
@@ -4,12 +4,18 @@
 #include <linux/cdev.h>
 #include <linux/slab.h>
 #include <linux/kobject.h>
+#include <linux/percpu-refcount.h>
 #include <linux/device.h>
 #include <linux/uaccess.h>
 
 #define DEVICE_NAME "kobj_example"
 #define BUF_SIZE 4096
 
+/* Count opens with a percpu_ref instead of the kobject (LESSON 6) */
+static bool use_percpu;
+module_param(use_percpu, bool, 0444);
+MODULE_PARM_DESC(use_percpu, "Count opens with a percpu_ref instead of the kobject");
+
 /* 
  * LESSON 1: Embedding the kobject.
  * By putting the kobject inside our custom struct, we can use container_of()
@@ -20,6 +26,7 @@ struct kobj_example_dev {
     char *buffer;
     size_t data_len;
     struct kobject kobj; 
+    struct percpu_ref open_ref; /* Opens, with use_percpu */
 };
 
 static dev_t dev_num;
@@ -38,6 +45,7 @@ static void kobj_example_release(struct kobject *kobj)
     struct kobj_example_dev *dev = container_of(kobj, struct kobj_example_dev, kobj);
     
     pr_info("%s: Final reference released. Cleaning up memory.\n", DEVICE_NAME);
+    percpu_ref_exit(&dev->open_ref);
     kfree(dev->buffer);
     kfree(dev);
 }
@@ -47,6 +55,21 @@ static struct kobj_type kobj_example_ktype = {
     .release = kobj_example_release,
 };
 
+/*
+ * LESSON 6: percpu_ref for the hot path.
+ * kobject_get/put is a kref: one atomic cache line that every opening
+ * CPU has to pull over. The percpu_ref counts opens per CPU instead and
+ * holds a single kobject reference for all of them, dropped here once
+ * percpu_ref_kill() has switched it to atomic mode and the last open
+ * file is closed. See kref.c for the benchmark (bench_threads).
+ */
+static void kobj_example_open_ref_release(struct percpu_ref *ref)
+{
+    struct kobj_example_dev *dev = container_of(ref, struct kobj_example_dev, open_ref);
+
+    kobject_put(&dev->kobj);
+}
+
 // --- File Operations ---
 
 static int kobj_example_open(struct inode *inode, struct file *file) {
@@ -58,7 +81,10 @@ static int kobj_example_open(struct inode *inode, struct file *file) {
      * LESSON 2: Increment reference count on Open.
      * This ensures the memory isn't freed while a user is using the file.
      */
-    kobject_get(&dev->kobj);
+    if (use_percpu)
+        percpu_ref_get(&dev->open_ref);
+    else
+        kobject_get(&dev->kobj);
     
     pr_info("%s: Device opened, kobj refcount incremented\n", DEVICE_NAME);
     return 0;
@@ -72,7 +98,10 @@ static int kobj_example_release_file(struct inode *inode, struct file *file) {
      * If the module was unloaded while this file was open, this put()
      * will finally trigger the release() function.
      */
-    kobject_put(&dev->kobj);
+    if (use_percpu)
+        percpu_ref_put(&dev->open_ref);
+    else
+        kobject_put(&dev->kobj);
     
     pr_info("%s: Device closed, kobj refcount decremented\n", DEVICE_NAME);
     return 0;
@@ -159,15 +188,23 @@ static int __init kobj_init_module(void) {
         goto err_class; 
     }
 
+    /* Starts at 1 in per-CPU mode and owns one kobject reference */
+    ret = percpu_ref_init(&global_dev->open_ref, kobj_example_open_ref_release, 0, GFP_KERNEL);
+    if (ret) goto err_kobj;
+    kobject_get(&global_dev->kobj);
+
     cdev_init(&global_dev->cdev, &kobj_example_fops);
     ret = cdev_add(&global_dev->cdev, dev_num, 1);
-    if (ret) goto err_kobj;
+    if (ret) goto err_ref;
 
     device_create(kobject_example_class, NULL, dev_num, NULL, DEVICE_NAME);
 
     pr_info("%s: Module loaded with kobject management\n", DEVICE_NAME);
     return 0;
 
+err_ref:
+    percpu_ref_kill(&global_dev->open_ref);
+    rcu_barrier();
 err_kobj:
     kobject_del(&global_dev->kobj);
     kobject_put(&global_dev->kobj);
@@ -196,6 +233,10 @@ static void __exit kobj_exit_module(void) {
      * until they close it.
      */
     if (global_dev) {
+        /* Back to atomic mode; no file is open (fops.owner), so it drops to 0 */
+        percpu_ref_kill(&global_dev->open_ref);
+        /* The switch finishes in an RCU callback that calls back into us */
+        rcu_barrier();
         kobject_put(&global_dev->kobj);
     }
     
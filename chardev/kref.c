@@ -5,11 +5,33 @@
 #include <linux/uaccess.h>
 #include <linux/slab.h>
 #include <linux/kref.h>
+#include <linux/percpu-refcount.h>
 #include <linux/device.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
 
 #define DEVICE_NAME "kref_example"
 #define BUF_SIZE 4096
 
+/*
+ * Module parameters.
+ * use_percpu: count opens with the percpu_ref (LESSON 6) instead of the kref.
+ * bench_threads: at load, run N kthreads doing open/close reference
+ *   pairs for bench_ms with each counter and log ops/sec. 0 = no benchmark.
+ */
+static bool use_percpu;
+module_param(use_percpu, bool, 0444);
+MODULE_PARM_DESC(use_percpu, "Count opens with a percpu_ref instead of the kref");
+
+static unsigned int bench_threads;
+module_param(bench_threads, uint, 0444);
+MODULE_PARM_DESC(bench_threads, "kthreads for the load-time refcount benchmark (0 = off)");
+
+static unsigned int bench_ms = 1000;
+module_param(bench_ms, uint, 0444);
+MODULE_PARM_DESC(bench_ms, "Duration of each benchmark run (ms)");
+
 /*
  * LESSON 1: The kref structure.
  * Unlike kobject, kref does not provide sysfs visibility. It is a 
@@ -21,6 +43,7 @@ struct kref_example_dev {
     char *name;
     char *buffer;
     struct kref refcount; /* The reference counter */
+    struct percpu_ref open_ref; /* Opens, with use_percpu (LESSON 6) */
 };
 
 static dev_t dev_num;
@@ -39,11 +62,49 @@ static void my_data_release(struct kref *kref)
     struct kref_example_dev *data = container_of(kref, struct kref_example_dev, refcount);
 
     pr_info("%s: kref: Final reference released. Freeing memory.\n", data->name);
+    percpu_ref_exit(&data->open_ref);
     kfree(data->name);
     kfree(data->buffer);
     kfree(data);
 }
 
+/*
+ * LESSON 6: percpu_ref for the hot path.
+ * Every kref_get/kref_put is an atomic on ONE cache line. With many
+ * CPUs opening and closing at once that line bounces between them and
+ * each open waits its turn. A percpu_ref counts on a per-CPU counter
+ * instead - no shared line, no bouncing - which is only possible because
+ * nobody needs to know whether the sum is zero while the object is live.
+ * At teardown percpu_ref_kill() folds the per-CPU counts into one atomic
+ * (after an RCU grace period) and from then on it behaves like a kref:
+ * the last put calls open_ref_release().
+ * The whole percpu_ref holds a single reference on the kref, so the
+ * object still goes away only when both are done with it.
+ */
+static void open_ref_release(struct percpu_ref *ref)
+{
+    struct kref_example_dev *data = container_of(ref, struct kref_example_dev, open_ref);
+
+    kref_put(&data->refcount, my_data_release);
+}
+
+/* The reference an open file holds, taken the configured way */
+static void kref_example_hold(struct kref_example_dev *dev, bool percpu)
+{
+    if (percpu)
+        percpu_ref_get(&dev->open_ref);
+    else
+        kref_get(&dev->refcount);
+}
+
+static void kref_example_unhold(struct kref_example_dev *dev, bool percpu)
+{
+    if (percpu)
+        percpu_ref_put(&dev->open_ref);
+    else
+        kref_put(&dev->refcount, my_data_release);
+}
+
 // --- File Operations ---
 
 static int kref_example_open(struct inode *inode, struct file *file) {
@@ -57,10 +118,12 @@ static int kref_example_open(struct inode *inode, struct file *file) {
      * Every 'file' object created in the kernel now holds a reference
      * to our data structure.
      */
-    kref_get(&dev->refcount);
+    kref_example_hold(dev, use_percpu);
     
-    pr_info("%s: Device opened. Refcount: %u\n", 
-            DEVICE_NAME, kref_read(&dev->refcount));
+    /* A percpu_ref has no cheap count to print: that is the point */
+    if (!use_percpu)
+        pr_info("%s: Device opened. Refcount: %u\n", 
+                DEVICE_NAME, kref_read(&dev->refcount));
 
     return 0;
 }
@@ -75,7 +138,7 @@ static int kref_example_release(struct inode *inode, struct file *file) {
      * We pass the 'my_data_release' function pointer. If this put 
      * results in 0, that function is called immediately.
      */
-    kref_put(&dev->refcount, my_data_release);
+    kref_example_unhold(dev, use_percpu);
 
     return 0;
 }
@@ -110,6 +173,77 @@ static const struct file_operations kref_example_fops = {
     .llseek  = default_llseek,
 };
 
+// --- Benchmark ---
+
+/*
+ * Each kthread, bound to its own CPU, does what open() plus release()
+ * do to the counter, as fast as it can, until stopped. Going through
+ * the real /dev node would add path lookup and file allocation, which
+ * are the same for both counters and would only hide the difference.
+ */
+struct kref_bench {
+    struct task_struct *task;
+    bool percpu;
+    u64 ops;
+    u64 ns;
+};
+
+static int kref_bench_fn(void *arg)
+{
+    struct kref_bench *b = arg;
+    ktime_t start = ktime_get();
+
+    while (!kthread_should_stop()) {
+        int i;
+
+        for (i = 0; i < 1024; i++) {
+            kref_example_hold(global_obj, b->percpu);
+            kref_example_unhold(global_obj, b->percpu);
+        }
+        b->ops += 1024;
+        cond_resched();
+    }
+    b->ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    return 0;
+}
+
+/* Total ops/sec over bench_threads threads, or 0 if they could not start */
+static u64 kref_bench_run(bool percpu)
+{
+    struct kref_bench *b;
+    unsigned int i, cpu = cpumask_first(cpu_online_mask);
+    u64 rate = 0;
+
+    b = kcalloc(bench_threads, sizeof(*b), GFP_KERNEL);
+    if (!b) return 0;
+
+    /* Create them all first, then start them together */
+    for (i = 0; i < bench_threads; i++) {
+        b[i].percpu = percpu;
+        b[i].task = kthread_create(kref_bench_fn, &b[i], "kref_bench/%u", i);
+        if (IS_ERR(b[i].task)) {
+            b[i].task = NULL;
+            break;
+        }
+        get_task_struct(b[i].task);
+        kthread_bind(b[i].task, cpu);
+        cpu = cpumask_next(cpu, cpu_online_mask);
+        if (cpu >= nr_cpu_ids) cpu = cpumask_first(cpu_online_mask);
+    }
+    for (i = 0; i < bench_threads && b[i].task; i++)
+        wake_up_process(b[i].task);
+
+    msleep(bench_ms);
+
+    for (i = 0; i < bench_threads && b[i].task; i++) {
+        kthread_stop(b[i].task);
+        put_task_struct(b[i].task);
+        if (b[i].ns) rate += div64_u64(b[i].ops * NSEC_PER_SEC, b[i].ns);
+    }
+    kfree(b);
+    return rate;
+}
+
 // --- Module Init/Exit ---
 
 static int __init kref_example_init(void) {
@@ -146,14 +280,29 @@ static int __init kref_example_init(void) {
      */
     kref_init(&global_obj->refcount);
 
+    /* The percpu_ref starts at 1 and owns one kref reference (LESSON 6) */
+    ret = percpu_ref_init(&global_obj->open_ref, open_ref_release, 0, GFP_KERNEL);
+    if (ret < 0) goto err_mem;
+    kref_get(&global_obj->refcount);
+
+    if (bench_threads) {
+        u64 kref_rate = kref_bench_run(false);
+        u64 percpu_rate = kref_bench_run(true);
+
+        pr_info("%s: %u threads: kref %llu ops/s, percpu_ref %llu ops/s\n",
+                DEVICE_NAME, bench_threads, kref_rate, percpu_rate);
+    }
+
     cdev_init(&global_obj->cdev, &kref_example_fops);
     ret = cdev_add(&global_obj->cdev, dev_num, 1);
-    if (ret < 0) goto err_mem;
+    if (ret < 0) goto err_ref;
 
     device_create(kref_example_class, NULL, dev_num, NULL, DEVICE_NAME);
     pr_info("%s: Module initialized with kref\n", DEVICE_NAME);
     return 0;
 
+err_ref:
+    percpu_ref_exit(&global_obj->open_ref);
 err_mem:
     /* Manually free if kref was never truly shared */
     kfree(global_obj->buffer);
@@ -179,6 +328,10 @@ static void __exit kref_example_exit(void) {
      * so 'my_data_release' will NOT run yet. The memory stays safe.
      */
     if (global_obj) {
+        /* Back to atomic mode; no file is open (fops.owner), so it drops to 0 */
+        percpu_ref_kill(&global_obj->open_ref);
+        /* The switch finishes in an RCU callback that calls back into us */
+        rcu_barrier();
         kref_put(&global_obj->refcount, my_data_release);
     }
     
@@ -8,11 +8,42 @@
 #include <linux/device.h>
 #include <linux/version.h>
 #include <linux/scatterlist.h>
+#include <linux/mempool.h>
+#include <linux/rwsem.h>
+#include <linux/mm.h>
 #include <crypto/skcipher.h>     /* Symmetric Key Cipher API */
+#include <crypto/algapi.h>       /* crypto_memneq */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+#include <linux/unaligned.h>
+#else
+#include <asm/unaligned.h>
+#endif
 
 #define DRIVER_NAME "l3harris_secure"
 #define MASTER_KEY_SIZE 16       /* AES-128 Block/Key Size */
 #define LUKS_KEY_SIZE   512      /* Standard 4096-bit LUKS key */
+#define SECTOR_SIZE_B   512      /* Bulk decrypt unit */
+#define MAX_SECTORS     256      /* Per ioctl: 128 KB */
+#define REQ_POOL_MIN    16       /* Requests the pool always holds */
+
+/**
+ * ANNOTATION: Bulk Sector Decrypt (ioctl on /dev/l3harris_secure)
+ * --------------------------------------------------------------
+ * Decrypts nr_sectors 512-byte sectors from 'in' to 'out' with the
+ * Session Key, each sector its own CBC chain. The IV is zero, as for
+ * the LUKS blob, or with L3H_IV_PLAIN64 the little-endian sector number
+ * first_sector + i (dm-crypt's plain64). Both buffers must be 512-byte
+ * aligned so no sector straddles a page; 'in' == 'out' decrypts in place.
+ */
+struct l3h_decrypt {
+    __u64 in;
+    __u64 out;
+    __u64 first_sector;
+    __u32 nr_sectors;
+    __u32 flags;
+};
+#define L3H_IV_PLAIN64 0x1
+#define L3H_IOC_DECRYPT _IOW('L', 1, struct l3h_decrypt)
 
 /**
  * ANNOTATION: The Master Key Simulation
@@ -32,62 +63,94 @@ struct l3harris_dev {
     u8 *luks_password;    /* Layer 2: Final 512B LUKS password */
     struct bin_attribute key_attr;
     dev_t dev_num;
+    /* Transforms live as long as the device; see l3harris_probe */
+    struct crypto_skcipher *master_tfm;   /* Keyed once with master_key */
+    struct crypto_skcipher *session_tfm;  /* Rekeyed by Stage 1 only */
+    struct rw_semaphore key_sem;          /* Write: rekey; read: decrypt */
+    bool session_ready;
+    mempool_t *req_pool;                  /* Requests + per-sector state */
 };
 
 static struct l3harris_dev *ldev_ptr;
 
+/**
+ * ANNOTATION: Request Pool
+ * ------------------------
+ * Every pool element is a skcipher request (with the driver context it
+ * asks for) followed by our per-request state. Both tfms are "cbc(aes)"
+ * and normally resolve to the same implementation, but the element is
+ * sized for the larger context anyway. With GFP_KERNEL mempool_alloc()
+ * waits for a free element rather than failing.
+ */
+struct l3h_sector {
+    struct scatterlist sg_in;
+    struct scatterlist sg_out;
+    u8 iv[MASTER_KEY_SIZE];     /* The engine loads it: must not be on the stack */
+    struct l3h_batch *batch;
+};
+
+struct l3h_batch {
+    atomic_t pending;           /* In-flight requests, +1 while submitting */
+    int error;
+    struct completion done;
+};
+
+static size_t l3h_req_size(void) {
+    return ALIGN(sizeof(struct skcipher_request) +
+                 max(crypto_skcipher_reqsize(ldev_ptr->master_tfm),
+                     crypto_skcipher_reqsize(ldev_ptr->session_tfm)),
+                 __alignof__(struct l3h_sector));
+}
+
+static struct l3h_sector *l3h_sector_of(struct skcipher_request *req) {
+    return (void *)req + l3h_req_size();
+}
+
+static struct skcipher_request *l3h_req_get(struct crypto_skcipher *tfm) {
+    struct skcipher_request *req = mempool_alloc(ldev_ptr->req_pool, GFP_KERNEL);
+    skcipher_request_set_tfm(req, tfm);
+    return req;
+}
+
+static void l3h_req_put(struct skcipher_request *req) {
+    memzero_explicit(l3h_sector_of(req)->iv, MASTER_KEY_SIZE);
+    mempool_free(req, ldev_ptr->req_pool);
+}
+
 /**
  * ANNOTATION: Multi-block AES-CBC Decryption
  * -----------------------------------------
  * This function processes 32 blocks (512 bytes) using the Crypto API.
+ * The tfm is allocated and keyed ahead of time (l3harris_probe, Stage 1),
+ * so a call costs one pooled request, not an allocation and key schedule.
  * FIX: We must provide a valid 16-byte IV buffer. Passing NULL causes 
  * a Kernel Oops on Pi 5 hardware (aes_ce_blk).
  */
-static int aes_decrypt_buffer(const u8 *key, size_t key_len, const u8 *input, u8 *output, size_t data_len) {
-    struct crypto_skcipher *tfm;
-    struct skcipher_request *req;
-    struct scatterlist sg_in, sg_out;
-    u8 iv[MASTER_KEY_SIZE]; /* Must be valid memory for Hardware engine */
+static int aes_decrypt_buffer(struct crypto_skcipher *tfm, const u8 *input, u8 *output, size_t data_len) {
+    struct skcipher_request *req = l3h_req_get(tfm);
+    struct l3h_sector *sec = l3h_sector_of(req);
+    DECLARE_CRYPTO_WAIT(wait);
     int ret;
 
     /* Initialize IV to zero to match OpenSSL defaults */
-    memset(iv, 0, sizeof(iv));
-
-    /* 1. Allocate a standard skcipher (AES in CBC mode) */
-    tfm = crypto_alloc_skcipher("cbc(aes)", 0, 0);
-    if (IS_ERR(tfm)) return PTR_ERR(tfm);
-
-    /* 2. Allocate request object (Mandatory for modern skcipher API) */
-    req = skcipher_request_alloc(tfm, GFP_KERNEL);
-    if (!req) {
-        ret = -ENOMEM;
-        goto out_tfm;
-    }
+    memset(sec->iv, 0, sizeof(sec->iv));
 
-    ret = crypto_skcipher_setkey(tfm, key, key_len);
-    if (ret) goto out_req;
-
-    sg_init_one(&sg_in, input, data_len);
-    sg_init_one(&sg_out, output, data_len);
+    sg_init_one(&sec->sg_in, input, data_len);
+    sg_init_one(&sec->sg_out, output, data_len);
 
     /**
      * LESSON: The IV pointer MUST be valid.
      * Even if zeroed, hardware drivers like 'aes_ce_blk' on Pi 5 will 
      * dereference this address to load the IV register.
      */
-    skcipher_request_set_crypt(req, &sg_in, &sg_out, data_len, iv);
+    skcipher_request_set_crypt(req, &sec->sg_in, &sec->sg_out, data_len, sec->iv);
+    skcipher_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG | CRYPTO_TFM_REQ_MAY_SLEEP,
+                                  crypto_req_done, &wait);
 
-    /* 3. Execute Decryption */
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
-    ret = crypto_skcipher_decrypt(req);
-#else
-    ret = crypto_sync_skcipher_decrypt(req);
-#endif
-    
-out_req:
-    skcipher_request_free(req);
-out_tfm:
-    crypto_free_skcipher(tfm);
+    /* Execute Decryption: an async engine completes through 'wait' */
+    ret = crypto_wait_req(crypto_skcipher_decrypt(req), &wait);
+
+    l3h_req_put(req);
     return ret;
 }
 
@@ -100,10 +163,33 @@ out_tfm:
 static ssize_t session_blob_write(struct file *filp, struct kobject *kobj,
                                  struct bin_attribute *bin_attr,
                                  char *buf, loff_t pos, size_t count) {
+    u8 *key;
+    int ret;
+
     if (count != MASTER_KEY_SIZE) return -EINVAL;
 
-    if (aes_decrypt_buffer(master_key, MASTER_KEY_SIZE, (u8 *)buf, ldev_ptr->session_key, MASTER_KEY_SIZE))
+    key = kmalloc(MASTER_KEY_SIZE, GFP_KERNEL);
+    if (!key) return -ENOMEM;
+    if (aes_decrypt_buffer(ldev_ptr->master_tfm, (u8 *)buf, key, MASTER_KEY_SIZE)) {
+        kfree_sensitive(key);
         return -EIO;
+    }
+
+    /*
+     * The only rekey: waits for decrypts still using the old key. The
+     * same blob again leaves the key schedule alone (constant-time compare).
+     */
+    down_write(&ldev_ptr->key_sem);
+    if (ldev_ptr->session_ready && !crypto_memneq(key, ldev_ptr->session_key, MASTER_KEY_SIZE)) {
+        ret = 0;
+    } else {
+        ret = crypto_skcipher_setkey(ldev_ptr->session_tfm, key, MASTER_KEY_SIZE);
+        if (!ret) memcpy(ldev_ptr->session_key, key, MASTER_KEY_SIZE);
+        ldev_ptr->session_ready = !ret;
+    }
+    up_write(&ldev_ptr->key_sem);
+    kfree_sensitive(key);
+    if (ret) return -EIO;
 
     pr_info("%s: Stage 1: Session Key decrypted.\n", DRIVER_NAME);
     return count;
@@ -120,7 +206,6 @@ static ssize_t luks_write(struct file *file, const char __user *buf, size_t coun
     int ret;
 
     if (count != LUKS_KEY_SIZE) return -EINVAL;
-    if (!ldev_ptr->session_key) return -EACCES; /* Require Stage 1 first */
 
     encrypted_luks = kmalloc(LUKS_KEY_SIZE, GFP_KERNEL);
     if (!encrypted_luks) return -ENOMEM;
@@ -130,9 +215,15 @@ static ssize_t luks_write(struct file *file, const char __user *buf, size_t coun
         return -EFAULT;
     }
 
+    down_read(&ldev_ptr->key_sem);
+    if (!ldev_ptr->session_ready) { /* Require Stage 1 first */
+        up_read(&ldev_ptr->key_sem);
+        kfree(encrypted_luks);
+        return -EACCES;
+    }
     /* Decrypt the LUKS key using the laddered Session Key */
-    ret = aes_decrypt_buffer(ldev_ptr->session_key, MASTER_KEY_SIZE, 
-                            encrypted_luks, ldev_ptr->luks_password, LUKS_KEY_SIZE);
+    ret = aes_decrypt_buffer(ldev_ptr->session_tfm, encrypted_luks, ldev_ptr->luks_password, LUKS_KEY_SIZE);
+    up_read(&ldev_ptr->key_sem);
     
     kfree(encrypted_luks);
     if (ret) return -EIO;
@@ -150,11 +241,131 @@ static ssize_t luks_read(struct file *file, char __user *buf, size_t count, loff
     return count;
 }
 
+/**
+ * ANNOTATION: Batched Async Decrypt
+ * ---------------------------------
+ * The user buffers are pinned and each sector's scatterlist points
+ * straight at its page: no copy in or out. All requests are submitted
+ * before any is waited for, so an async engine can work on the whole
+ * batch at once (MAY_BACKLOG queues what it cannot take yet). A request
+ * the driver finishes on the spot returns 0 instead of -EINPROGRESS and
+ * never calls back. The batch counts in-flight requests plus one for the
+ * submitter, and whoever drops the last completes it.
+ */
+static void l3h_sector_done(void *data, int err) {
+    struct skcipher_request *req = data;
+    struct l3h_batch *batch = l3h_sector_of(req)->batch;
+
+    if (err == -EINPROGRESS) return; /* Left the backlog, still running */
+    if (err) WRITE_ONCE(batch->error, err);
+    l3h_req_put(req);
+    if (atomic_dec_and_test(&batch->pending))
+        complete(&batch->done);
+}
+
+static int l3h_pin(u64 uaddr, size_t len, unsigned int gup_flags, struct page ***pages, int *nr) {
+    int want = DIV_ROUND_UP(offset_in_page(uaddr) + len, PAGE_SIZE);
+    int got;
+
+    *pages = kvmalloc_array(want, sizeof(**pages), GFP_KERNEL);
+    if (!*pages) return -ENOMEM;
+    got = pin_user_pages_fast(uaddr & PAGE_MASK, want, gup_flags, *pages);
+    if (got != want) {
+        if (got > 0) unpin_user_pages(*pages, got);
+        kvfree(*pages);
+        return got < 0 ? got : -EFAULT;
+    }
+    *nr = want;
+    return 0;
+}
+
+static long l3h_decrypt_sectors(struct l3h_decrypt __user *argp) {
+    struct l3h_decrypt arg;
+    struct page **in_pages, **out_pages;
+    struct l3h_batch batch;
+    int nr_in, nr_out, ret;
+    size_t len;
+    u32 i;
+
+    if (copy_from_user(&arg, argp, sizeof(arg))) return -EFAULT;
+    if (!arg.nr_sectors || arg.nr_sectors > MAX_SECTORS || arg.flags & ~L3H_IV_PLAIN64 ||
+        (arg.in | arg.out) % SECTOR_SIZE_B)
+        return -EINVAL;
+    len = (size_t)arg.nr_sectors * SECTOR_SIZE_B;
+
+    ret = l3h_pin(arg.in, len, 0, &in_pages, &nr_in);
+    if (ret) return ret;
+    ret = l3h_pin(arg.out, len, FOLL_WRITE, &out_pages, &nr_out);
+    if (ret) goto out_in;
+
+    down_read(&ldev_ptr->key_sem);
+    if (!ldev_ptr->session_ready) {
+        ret = -EACCES;
+        goto out_key;
+    }
+
+    atomic_set(&batch.pending, 1);
+    batch.error = 0;
+    init_completion(&batch.done);
+
+    for (i = 0; i < arg.nr_sectors; i++) {
+        size_t in_off = offset_in_page(arg.in) + (size_t)i * SECTOR_SIZE_B;
+        size_t out_off = offset_in_page(arg.out) + (size_t)i * SECTOR_SIZE_B;
+        struct skcipher_request *req = l3h_req_get(ldev_ptr->session_tfm);
+        struct l3h_sector *sec = l3h_sector_of(req);
+
+        memset(sec->iv, 0, sizeof(sec->iv));
+        if (arg.flags & L3H_IV_PLAIN64)
+            put_unaligned_le64(arg.first_sector + i, sec->iv);
+        sec->batch = &batch;
+
+        sg_init_table(&sec->sg_in, 1);
+        sg_set_page(&sec->sg_in, in_pages[in_off >> PAGE_SHIFT], SECTOR_SIZE_B, offset_in_page(in_off));
+        sg_init_table(&sec->sg_out, 1);
+        sg_set_page(&sec->sg_out, out_pages[out_off >> PAGE_SHIFT], SECTOR_SIZE_B, offset_in_page(out_off));
+
+        skcipher_request_set_crypt(req, &sec->sg_in, &sec->sg_out, SECTOR_SIZE_B, sec->iv);
+        skcipher_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG, l3h_sector_done, req);
+
+        atomic_inc(&batch.pending);
+        ret = crypto_skcipher_decrypt(req);
+        if (ret == -EINPROGRESS || ret == -EBUSY) continue; /* Callback will follow */
+        /* Finished (or failed) synchronously: no callback */
+        l3h_sector_done(req, ret);
+        if (ret) break;
+    }
+
+    /* Drop the submitter's count and wait for the rest of the batch */
+    if (!atomic_dec_and_test(&batch.pending))
+        wait_for_completion(&batch.done);
+    ret = READ_ONCE(batch.error);
+
+out_key:
+    up_read(&ldev_ptr->key_sem);
+    unpin_user_pages_dirty_lock(out_pages, nr_out, !ret);
+    kvfree(out_pages);
+out_in:
+    unpin_user_pages(in_pages, nr_in);
+    kvfree(in_pages);
+    return ret;
+}
+
+static long luks_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    switch (cmd) {
+    case L3H_IOC_DECRYPT:
+        return l3h_decrypt_sectors((struct l3h_decrypt __user *)arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
 static const struct file_operations luks_fops = {
     .owner = THIS_MODULE,
     .write = luks_write,
     .read  = luks_read,
     .llseek = default_llseek,
+    .unlocked_ioctl = luks_ioctl,
+    .compat_ioctl = compat_ptr_ioctl, /* l3h_decrypt has the same layout */
 };
 
 /* --- Platform Driver Lifecycle --- */
@@ -166,9 +377,29 @@ static int l3harris_probe(struct platform_device *pdev) {
     ldev_ptr = devm_kzalloc(dev, sizeof(*ldev_ptr), GFP_KERNEL);
     ldev_ptr->session_key = devm_kzalloc(dev, MASTER_KEY_SIZE, GFP_KERNEL);
     ldev_ptr->luks_password = devm_kzalloc(dev, LUKS_KEY_SIZE, GFP_KERNEL);
+    init_rwsem(&ldev_ptr->key_sem);
+
+    /**
+     * LESSON: Allocate transforms once.
+     * Looking up the algorithm, binding the engine (aes_ce_blk on Pi 5)
+     * and expanding the key costs far more than decrypting 512 bytes.
+     * The Master Key never changes, so its tfm is keyed here for good.
+     */
+    ldev_ptr->master_tfm = crypto_alloc_skcipher("cbc(aes)", 0, 0);
+    if (IS_ERR(ldev_ptr->master_tfm)) return PTR_ERR(ldev_ptr->master_tfm);
+    ldev_ptr->session_tfm = crypto_alloc_skcipher("cbc(aes)", 0, 0);
+    if (IS_ERR(ldev_ptr->session_tfm)) {
+        crypto_free_skcipher(ldev_ptr->master_tfm);
+        return PTR_ERR(ldev_ptr->session_tfm);
+    }
+    if (crypto_skcipher_setkey(ldev_ptr->master_tfm, master_key, MASTER_KEY_SIZE))
+        goto err_tfm;
+    ldev_ptr->req_pool = mempool_create_kmalloc_pool(REQ_POOL_MIN, l3h_req_size() + sizeof(struct l3h_sector));
+    if (!ldev_ptr->req_pool)
+        goto err_tfm;
 
     if (alloc_chrdev_region(&ldev_ptr->dev_num, 0, 1, DRIVER_NAME))
-        return -EBUSY;
+        goto err_pool;
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
     ldev_ptr->cls = class_create(DRIVER_NAME);
@@ -201,6 +432,11 @@ err_clean:
     device_destroy(ldev_ptr->cls, ldev_ptr->dev_num);
     class_destroy(ldev_ptr->cls);
     unregister_chrdev_region(ldev_ptr->dev_num, 1);
+err_pool:
+    mempool_destroy(ldev_ptr->req_pool);
+err_tfm:
+    crypto_free_skcipher(ldev_ptr->session_tfm);
+    crypto_free_skcipher(ldev_ptr->master_tfm);
     return -1;
 }
 
@@ -222,6 +458,9 @@ static int l3harris_remove(struct platform_device *pdev)
         device_destroy(ldev->cls, ldev->dev_num);
         class_destroy(ldev->cls);
         unregister_chrdev_region(ldev->dev_num, 1);
+        mempool_destroy(ldev->req_pool);
+        crypto_free_skcipher(ldev->session_tfm); /* Zeroes the key schedule */
+        crypto_free_skcipher(ldev->master_tfm);
     }
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 11, 0)
     return 0;
@@ -8,15 +8,62 @@
 #include <linux/mutex.h>
 #include <linux/device.h>
 #include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
 
 #define DEVICE_NAME "skeleton_dev"
 #define BUF_SIZE 4096
 
+/*
+ * Module parameter: stream mode.
+ * 0 (default): a BUF_SIZE buffer with file positions, as before.
+ * 1: a producer/consumer pipe. write() appends to a ring, read() consumes
+ *    from it and blocks (or -EAGAIN with O_NONBLOCK) while it is empty,
+ *    poll() reports real readiness, and splice() works both ways.
+ */
+static bool stream;
+module_param(stream, bool, 0444);
+MODULE_PARM_DESC(stream, "Producer/consumer ring instead of the seekable buffer");
+
+/*
+ * THE RING (stream mode):
+ * One control page followed by RING_SIZE bytes of data, both mappable:
+ * mmap() offset 0 is the control page, offset PAGE_SIZE the data. The
+ * indices are free-running and the data offset is index & (size - 1),
+ * as in kfifo. The ring is single-producer, single-consumer: only the
+ * producer moves head and only the consumer moves tail, each publishing
+ * with a release store after touching the data, and each reading the
+ * other's index with an acquire load, so neither side locks the other.
+ * (kfifo itself keeps its indices in kernel memory, which is why the
+ * ring is open-coded: these have to be shared with user space.)
+ *
+ * A process can take either side through the mapping instead of
+ * read()/write(), exchanging data with no system call at all. Having
+ * moved an index it rings the doorbell - a zero-length read() or write()
+ * - if the other side may be asleep. The kernel trusts nothing it reads
+ * from the mapping: the fill level is clamped to the ring size and every
+ * offset is masked.
+ */
+#define RING_ORDER 4
+#define RING_SIZE (PAGE_SIZE << RING_ORDER)
+
+struct skel_ring_ctl {
+    __u32 head;         /* Producer index */
+    __u32 tail;         /* Consumer index */
+    __u32 size;         /* Data bytes, a power of two */
+};
+
 struct skeleton_dev {
     struct cdev cdev;
     char *buffer;
     struct mutex lock;
     wait_queue_head_t wait_queue;
+    /* Stream mode */
+    struct skel_ring_ctl *ctl;  /* vmalloc_user(): control page + data */
+    char *data;
+    struct mutex rd_lock;       /* One consumer at a time */
+    struct mutex wr_lock;       /* One producer at a time */
 };
 
 /* Global pointers for cleanup in module_exit */
@@ -114,6 +161,158 @@ static int skel_mmap(struct file *file, struct vm_area_struct *vma) {
     return 0;
 }
 
+// --- Stream Mode ---
+
+/* Bytes ready for the consumer */
+static u32 skel_ring_used(struct skeleton_dev *dev) {
+    u32 used = smp_load_acquire(&dev->ctl->head) - READ_ONCE(dev->ctl->tail);
+    return min_t(u32, used, RING_SIZE);
+}
+
+/* Bytes free for the producer */
+static u32 skel_ring_free(struct skeleton_dev *dev) {
+    u32 used = READ_ONCE(dev->ctl->head) - smp_load_acquire(&dev->ctl->tail);
+    return RING_SIZE - min_t(u32, used, RING_SIZE);
+}
+
+static int skel_stream_open(struct inode *inode, struct file *file) {
+    skel_open(inode, file);
+    /* No file position: reads and writes are a stream, like a pipe */
+    return stream_open(inode, file);
+}
+
+/*
+ * Consumer. Blocks until there is data, then returns what is there, up
+ * to the request. Also serves splice() to a pipe, via copy_splice_read.
+ */
+static ssize_t skel_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct skeleton_dev *dev = iocb->ki_filp->private_data;
+    size_t count = iov_iter_count(to);
+    u32 tail, used, off, n, len;
+    ssize_t retval;
+
+    /* Doorbell: a user-space producer moved head */
+    if (!count) {
+        wake_up_interruptible(&dev->wait_queue);
+        return 0;
+    }
+
+    if (mutex_lock_interruptible(&dev->rd_lock))
+        return -ERESTARTSYS;
+
+    while (!(used = skel_ring_used(dev))) {
+        mutex_unlock(&dev->rd_lock);
+        if (iocb->ki_flags & IOCB_NOWAIT || iocb->ki_filp->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(dev->wait_queue, skel_ring_used(dev)))
+            return -ERESTARTSYS;
+        if (mutex_lock_interruptible(&dev->rd_lock))
+            return -ERESTARTSYS;
+    }
+
+    tail = READ_ONCE(dev->ctl->tail);
+    n = min_t(size_t, used, count);
+    /* At most two pieces: up to the end of the ring, then from its start */
+    off = tail & (RING_SIZE - 1);
+    len = min_t(u32, n, RING_SIZE - off);
+    retval = copy_to_iter(dev->data + off, len, to);
+    if (retval == len && n > len)
+        retval += copy_to_iter(dev->data, n - len, to);
+
+    if (!retval) {
+        retval = -EFAULT;
+        goto out;
+    }
+    /* Data copied out before the space is handed back */
+    smp_store_release(&dev->ctl->tail, tail + retval);
+    wake_up_interruptible(&dev->wait_queue);
+
+out:
+    mutex_unlock(&dev->rd_lock);
+    return retval;
+}
+
+/*
+ * Producer. Blocks until there is room, then takes what fits: a write
+ * larger than the free space is short, as on a socket. Also serves
+ * splice() from a pipe, via iter_file_splice_write.
+ */
+static ssize_t skel_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct skeleton_dev *dev = iocb->ki_filp->private_data;
+    size_t count = iov_iter_count(from);
+    u32 head, avail, off, n, len;
+    ssize_t retval;
+
+    /* Doorbell: a user-space consumer moved tail */
+    if (!count) {
+        wake_up_interruptible(&dev->wait_queue);
+        return 0;
+    }
+
+    if (mutex_lock_interruptible(&dev->wr_lock))
+        return -ERESTARTSYS;
+
+    while (!(avail = skel_ring_free(dev))) {
+        mutex_unlock(&dev->wr_lock);
+        if (iocb->ki_flags & IOCB_NOWAIT || iocb->ki_filp->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(dev->wait_queue, skel_ring_free(dev)))
+            return -ERESTARTSYS;
+        if (mutex_lock_interruptible(&dev->wr_lock))
+            return -ERESTARTSYS;
+    }
+
+    head = READ_ONCE(dev->ctl->head);
+    n = min_t(size_t, avail, count);
+    off = head & (RING_SIZE - 1);
+    len = min_t(u32, n, RING_SIZE - off);
+    retval = copy_from_iter(dev->data + off, len, from);
+    if (retval == len && n > len)
+        retval += copy_from_iter(dev->data, n - len, from);
+
+    if (!retval) {
+        retval = -EFAULT;
+        goto out;
+    }
+    /* Data in place before the consumer can see it */
+    smp_store_release(&dev->ctl->head, head + retval);
+    wake_up_interruptible(&dev->wait_queue);
+
+out:
+    mutex_unlock(&dev->wr_lock);
+    return retval;
+}
+
+static __poll_t skel_stream_poll(struct file *file, poll_table *wait) {
+    struct skeleton_dev *dev = file->private_data;
+    __poll_t mask = 0;
+
+    poll_wait(file, &dev->wait_queue, wait);
+    if (skel_ring_used(dev))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (skel_ring_free(dev))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    return mask;
+}
+
+/* Control page and data, or any part of them, shared with the process */
+static int skel_stream_mmap(struct file *file, struct vm_area_struct *vma) {
+    struct skeleton_dev *dev = file->private_data;
+    return remap_vmalloc_range(vma, dev->ctl, vma->vm_pgoff);
+}
+
+static const struct file_operations skel_stream_fops = {
+    .owner        = THIS_MODULE,
+    .open         = skel_stream_open,
+    .release      = skel_release,
+    .read_iter    = skel_read_iter,
+    .write_iter   = skel_write_iter,
+    .splice_read  = copy_splice_read,
+    .splice_write = iter_file_splice_write,
+    .poll         = skel_stream_poll,
+    .mmap         = skel_stream_mmap,
+};
+
 static const struct file_operations skel_fops = {
     .owner   = THIS_MODULE,
     .open    = skel_open,
@@ -167,17 +366,32 @@ static int __init skel_init(void) {
         goto fail_all;
     }
 
+    /* Stream mode ring: zeroed, page aligned and mappable (not devres) */
+    if (stream) {
+        skel_dev->ctl = vmalloc_user(PAGE_SIZE + RING_SIZE);
+        if (!skel_dev->ctl) {
+            ret = -ENOMEM;
+            goto fail_all;
+        }
+        skel_dev->ctl->size = RING_SIZE;
+        skel_dev->data = (char *)skel_dev->ctl + PAGE_SIZE;
+    }
+
     /* 5. Init hardware abstraction */
     mutex_init(&skel_dev->lock);
+    mutex_init(&skel_dev->rd_lock);
+    mutex_init(&skel_dev->wr_lock);
     init_waitqueue_head(&skel_dev->wait_queue);
-    cdev_init(&skel_dev->cdev, &skel_fops);
+    cdev_init(&skel_dev->cdev, stream ? &skel_stream_fops : &skel_fops);
 
     ret = cdev_add(&skel_dev->cdev, dev_num, 1);
-    if (ret < 0) goto fail_all;
+    if (ret < 0) goto fail_ring;
 
     pr_info("%s: Initialized successfully\n", DEVICE_NAME);
     return 0;
 
+fail_ring:
+    vfree(skel_dev->ctl);
 fail_all:
     device_destroy(skel_class, dev_num);
 fail_dev:
@@ -194,8 +408,9 @@ static void __exit skel_exit(void) {
      * the device node and sysfs entry from the class. The device 
      * structure is removed by kernel garbage collection 
      */
-    device_destroy(skel_class, dev_num);
     cdev_del(&skel_dev->cdev);
+    vfree(skel_dev->ctl);
+    device_destroy(skel_class, dev_num);
     class_destroy(skel_class);
     /* Free the device numbers */
     unregister_chrdev_region(dev_num, 1);
@@ -4,95 +4,302 @@
 #include <linux/vmalloc.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mutex.h>
-
-struct sim_nor_data {
+#include <linux/bitmap.h>
+#include <linux/delay.h>
+#include <linux/rcupdate.h>
+
+/*
+ * Simulated chip timing, 0 = instant. Sleeps happen with the chip lock
+ * held, like a real chip that is busy until the operation completes.
+ */
+static unsigned int erase_us;
+module_param(erase_us, uint, 0644);
+MODULE_PARM_DESC(erase_us, "Simulated erase time per erase block (us)");
+
+static unsigned int program_us;
+module_param(program_us, uint, 0644);
+MODULE_PARM_DESC(program_us, "Simulated program time per 256-byte page (us)");
+
+#define SIM_NOR_PAGE 256
+#define SIM_NOR_ERASESIZE 4096
+
+/*
+ * THE CHIP:
+ * Buffer, size and erase bitmap together, so a resize can swap all three
+ * in one pointer store. Readers find the chip through RCU and never take
+ * the lock; program, erase, point and resize serialize on data->lock.
+ */
+struct sim_nor_chip {
 	void *buffer;
 	size_t size;
+	unsigned long *erased;	/* One bit per erase block: reads as 0xff, buffer stale */
+};
+
+struct sim_nor_data {
+	struct sim_nor_chip __rcu *chip;
+	atomic_t points;	/* Outstanding point() mappings */
 	struct mtd_info mtd;
 	struct mutex lock;
 };
 
+/* A new chip of 'size' bytes, fully erased (no memset needed, see LAZY ERASE) */
+static struct sim_nor_chip *sim_nor_chip_alloc(size_t size) {
+	struct sim_nor_chip *chip = kzalloc(sizeof(*chip), GFP_KERNEL);
+	if (!chip) return NULL;
+
+	chip->size = size;
+	chip->buffer = vmalloc(size);
+	chip->erased = bitmap_zalloc(size / SIM_NOR_ERASESIZE, GFP_KERNEL);
+	if (!chip->buffer || !chip->erased) {
+		vfree(chip->buffer);
+		bitmap_free(chip->erased);
+		kfree(chip);
+		return NULL;
+	}
+	bitmap_fill(chip->erased, size / SIM_NOR_ERASESIZE);
+	return chip;
+}
+
+static void sim_nor_chip_free(struct sim_nor_chip *chip) {
+	if (!chip) return;
+	bitmap_free(chip->erased);
+	vfree(chip->buffer);
+	kfree(chip);
+}
+
+/* The current chip, for callers holding data->lock */
+static struct sim_nor_chip *sim_nor_chip_locked(struct sim_nor_data *data) {
+	return rcu_dereference_protected(data->chip, lockdep_is_held(&data->lock));
+}
+
+/*
+ * LAZY ERASE:
+ * Erasing a block only sets its bit in 'erased'; reads of such a block
+ * produce 0xff without touching the buffer. The block is filled with
+ * 0xff for real ("materialized") just before the first program into it,
+ * or when a point() mapping has to show it. Erase is O(blocks), and a
+ * block that is erased again before being written costs nothing.
+ * The bit is cleared only after the 0xff is in place (release), and
+ * lock-free readers test it with acquire, so they never see the stale
+ * buffer of a block that reads as erased.
+ */
+static void sim_nor_materialize(struct sim_nor_chip *chip, u32 blk) {
+	if (!test_bit(blk, chip->erased)) return;
+	memset(chip->buffer + (size_t)blk * SIM_NOR_ERASESIZE, 0xff, SIM_NOR_ERASESIZE);
+	clear_bit_unlock(blk, chip->erased);
+}
+
+/* Materializes every erased block in [ofs, ofs + len) */
+static void sim_nor_materialize_range(struct sim_nor_chip *chip, loff_t ofs, size_t len) {
+	u32 blk;
+
+	for (blk = ofs / SIM_NOR_ERASESIZE; blk <= (ofs + len - 1) / SIM_NOR_ERASESIZE; blk++)
+		sim_nor_materialize(chip, blk);
+}
+
 /* --- MTD Callbacks --- */
 
+/*
+ * XIP: hands out the buffer itself for zero-copy reads. Erased blocks in
+ * the range are materialized first, and while any mapping is out erase
+ * writes the 0xff for real (the mapping cannot see the bitmap) and a
+ * resize is refused (it would free the buffer under the mapping).
+ * The buffer is vmalloc memory, so a caller asking for the physical
+ * address (cramfs XIP) only gets the physically contiguous run, like
+ * mtdram; it calls again for the rest.
+ */
 static int sim_nor_point(struct mtd_info *mtd, loff_t from, size_t len,
 			 size_t *retlen, void **virt, resource_size_t *phys) {
 	struct sim_nor_data *data = mtd->priv;
-	if (from + len > mtd->size) return -EINVAL;
-	*virt = data->buffer + from;
+	struct sim_nor_chip *chip;
+	int ret = 0;
+
+	mutex_lock(&data->lock);
+	chip = sim_nor_chip_locked(data);
+	if (from + len > chip->size) {
+		ret = -EINVAL;
+		goto out;
+	}
+	sim_nor_materialize_range(chip, from, len);
+	atomic_inc(&data->points);
+	*virt = chip->buffer + from;
 	*retlen = len;
-	if (phys) *phys = 0;
-	return 0;
+	if (phys) {
+		unsigned long page_ofs = offset_in_page(*virt);
+		void *addr = *virt - page_ofs;
+		phys_addr_t next = page_to_phys(vmalloc_to_page(addr));
+
+		*phys = next + page_ofs;
+		for (len += page_ofs; len > PAGE_SIZE; len -= PAGE_SIZE) {
+			addr += PAGE_SIZE;
+			next += PAGE_SIZE;
+			if (page_to_phys(vmalloc_to_page(addr)) != next) {
+				*retlen = addr - *virt;
+				break;
+			}
+		}
+	}
+out:
+	mutex_unlock(&data->lock);
+	return ret;
 }
 
 static int sim_nor_unpoint(struct mtd_info *mtd, loff_t from, size_t len) {
+	struct sim_nor_data *data = mtd->priv;
+	atomic_dec_if_positive(&data->points);
 	return 0;
 }
 
 static int sim_nor_erase(struct mtd_info *mtd, struct erase_info *instr) {
 	struct sim_nor_data *data = mtd->priv;
-	if (instr->addr + instr->len > mtd->size) return -EINVAL;
+	struct sim_nor_chip *chip;
+	u32 blk, first, nr;
+	int ret = 0;
+
+	if (instr->addr % SIM_NOR_ERASESIZE || instr->len % SIM_NOR_ERASESIZE) return -EINVAL;
+	first = instr->addr / SIM_NOR_ERASESIZE;
+	nr = instr->len / SIM_NOR_ERASESIZE;
+
 	mutex_lock(&data->lock);
-	memset(data->buffer + instr->addr, 0xff, instr->len);
+	chip = sim_nor_chip_locked(data);
+	if (instr->addr + instr->len > chip->size) {
+		ret = -EINVAL;
+		goto out;
+	}
+	if (atomic_read(&data->points)) {
+		memset(chip->buffer + instr->addr, 0xff, instr->len);
+		bitmap_clear(chip->erased, first, nr);
+	} else {
+		bitmap_set(chip->erased, first, nr);
+	}
+	for (blk = 0; erase_us && blk < nr; blk++)
+		fsleep(erase_us);
+out:
 	mutex_unlock(&data->lock);
-	return 0;
+	return ret;
 }
 
+/*
+ * Lock-free: runs entirely under rcu_read_lock(), against whichever chip
+ * is current when it starts. A concurrent resize neither blocks it nor
+ * frees that chip before it is done.
+ */
 static int sim_nor_read(struct mtd_info *mtd, loff_t from, size_t len,
 			size_t *retlen, u_char *buf) {
 	struct sim_nor_data *data = mtd->priv;
-	if (from + len > mtd->size) return -EINVAL;
-	mutex_lock(&data->lock);
-	memcpy(buf, data->buffer + from, len);
+	struct sim_nor_chip *chip;
+	size_t done = 0;
+	int ret = 0;
+
+	rcu_read_lock();
+	chip = rcu_dereference(data->chip);
+	if (from + len > chip->size) {
+		ret = -EINVAL;
+		goto out;
+	}
+	/* Block by block: erased blocks are synthesized */
+	while (done < len) {
+		loff_t ofs = from + done;
+		size_t n = min_t(size_t, len - done, SIM_NOR_ERASESIZE - ofs % SIM_NOR_ERASESIZE);
+
+		if (test_bit_acquire(ofs / SIM_NOR_ERASESIZE, chip->erased))
+			memset(buf + done, 0xff, n);
+		else
+			memcpy(buf + done, chip->buffer + ofs, n);
+		done += n;
+	}
 	*retlen = len;
-	mutex_unlock(&data->lock);
-	return 0;
+out:
+	rcu_read_unlock();
+	return ret;
 }
 
 static int sim_nor_write(struct mtd_info *mtd, loff_t to, size_t len,
 			 size_t *retlen, const u_char *buf) {
 	struct sim_nor_data *data = mtd->priv;
-	if (to + len > mtd->size) return -EINVAL;
+	struct sim_nor_chip *chip;
+	int ret = 0;
+
+	if (!len) {
+		*retlen = 0;
+		return 0;
+	}
 	mutex_lock(&data->lock);
-	memcpy(data->buffer + to, buf, len);
+	chip = sim_nor_chip_locked(data);
+	if (to + len > chip->size) {
+		ret = -EINVAL;
+		goto out;
+	}
+	sim_nor_materialize_range(chip, to, len);
+	memcpy(chip->buffer + to, buf, len);
+	if (program_us)
+		fsleep(program_us * DIV_ROUND_UP(len, SIM_NOR_PAGE));
 	*retlen = len;
+out:
 	mutex_unlock(&data->lock);
-	return 0;
+	return ret;
 }
 
 /* --- Modern Sysfs using  Attribute Groups --- */
 
 static ssize_t flash_size_show(struct device *dev, struct device_attribute *attr, char *buf) {
 	struct sim_nor_data *data = dev_get_drvdata(dev);
-	return sprintf(buf, "%zu\n", data->size);
+	size_t size;
+
+	rcu_read_lock();
+	size = rcu_dereference(data->chip)->size;
+	rcu_read_unlock();
+	return sprintf(buf, "%zu\n", size);
 }
 
+/*
+ * ONLINE RESIZE:
+ * The MTD stays registered and readers keep going. The new chip is built
+ * aside: blocks the two sizes have in common are copied (erased ones just
+ * keep their bit), any extra blocks start erased. Programs and erases
+ * wait on the lock meanwhile, so the copy is exact. The new chip is then
+ * published with one pointer store, and the old one is freed after a
+ * grace period, when no reader can still be using it.
+ * Shrinking is refused while the MTD is opened (a filesystem or UBI may
+ * have data up there), and any resize while point() mappings are out.
+ */
 static ssize_t flash_size_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) {
 	struct sim_nor_data *data = dev_get_drvdata(dev);
-	size_t new_size;
-	void *new_buf;
+	struct sim_nor_chip *old, *new;
+	unsigned long blocks;
+	size_t new_size, keep;
+	u32 blk;
 
-	if (kstrtoul(buf, 10, (unsigned long *)&new_size)) return -EINVAL;
-        new_size = new_size * data->mtd.erasesize;
+	if (kstrtoul(buf, 10, &blocks) || !blocks) return -EINVAL;
+	new_size = blocks * SIM_NOR_ERASESIZE;
 
-	mutex_lock(&data->lock);
-	mtd_device_unregister(&data->mtd);
+	/* Allocated before taking the lock: writers only wait for the copy */
+	new = sim_nor_chip_alloc(new_size);
+	if (!new) return -ENOMEM;
 
-	new_buf = vmalloc(new_size);
-	if (!new_buf) {
-		/* Attempt to restore original MTD if allocation fails */
-		mtd_device_register(&data->mtd, NULL, 0);
+	mutex_lock(&data->lock);
+	old = sim_nor_chip_locked(data);
+	if (atomic_read(&data->points) || (new_size < old->size && data->mtd.usecount)) {
 		mutex_unlock(&data->lock);
-		return -ENOMEM;
+		sim_nor_chip_free(new);
+		return -EBUSY;
 	}
 
-	vfree(data->buffer);
-	data->buffer = new_buf;
-	data->size = new_size;
-	data->mtd.size = new_size;
+	keep = min(old->size, new_size);
+	for (blk = 0; blk < keep / SIM_NOR_ERASESIZE; blk++) {
+		if (test_bit(blk, old->erased)) continue;
+		memcpy(new->buffer + (size_t)blk * SIM_NOR_ERASESIZE,
+		       old->buffer + (size_t)blk * SIM_NOR_ERASESIZE, SIM_NOR_ERASESIZE);
+		clear_bit(blk, new->erased);
+	}
 
-	mtd_device_register(&data->mtd, NULL, 0);
+	rcu_assign_pointer(data->chip, new);
+	WRITE_ONCE(data->mtd.size, new_size);
 	mutex_unlock(&data->lock);
 
+	synchronize_rcu();
+	sim_nor_chip_free(old);
+
 	dev_info(dev, "Simulated flash resized to %zu bytes\n", new_size);
 	return count;
 }
@@ -117,14 +324,15 @@ static const struct attribute_group *sim_nor_groups[] = {
 
 static int sim_nor_probe(struct platform_device *pdev) {
 	struct sim_nor_data *data;
+	struct sim_nor_chip *chip;
 	int ret;
 
 	data = devm_kzalloc(&pdev->dev, sizeof(*data), GFP_KERNEL);
 	if (!data) return -ENOMEM;
 
-	data->size = 64 * 1024; // 64KB Default
-	data->buffer = vmalloc(data->size);
-	if (!data->buffer) return -ENOMEM;
+	chip = sim_nor_chip_alloc(64 * 1024); // 64KB Default
+	if (!chip) return -ENOMEM;
+	RCU_INIT_POINTER(data->chip, chip);
 
 	mutex_init(&data->lock);
 	platform_set_drvdata(pdev, data);
@@ -133,8 +341,8 @@ static int sim_nor_probe(struct platform_device *pdev) {
 	data->mtd.name = "sim_nor_flash";
 	data->mtd.type = MTD_NORFLASH;
 	data->mtd.flags = MTD_CAP_NORFLASH;
-	data->mtd.size = data->size;
-	data->mtd.erasesize = 4096;
+	data->mtd.size = chip->size;
+	data->mtd.erasesize = SIM_NOR_ERASESIZE;
 	data->mtd.writesize = 1;
 	data->mtd.owner = THIS_MODULE;
 	data->mtd.priv = data;
@@ -147,7 +355,7 @@ static int sim_nor_probe(struct platform_device *pdev) {
 
 	ret = mtd_device_register(&data->mtd, NULL, 0);
 	if (ret) {
-		vfree(data->buffer);
+		sim_nor_chip_free(chip);
 		return ret;
 	}
 
@@ -159,7 +367,8 @@ static void sim_nor_remove(struct platform_device *pdev) {
 	struct sim_nor_data *data = platform_get_drvdata(pdev);
 	if (data) {
 		mtd_device_unregister(&data->mtd);
-		vfree(data->buffer);
+		/* No readers left once the MTD is gone */
+		sim_nor_chip_free(rcu_dereference_protected(data->chip, 1));
 	}
 	dev_info(&pdev->dev, "Simulated MTD NOR Released\n");
 }
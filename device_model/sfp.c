@@ -4,12 +4,19 @@
 #include <linux/io.h>
 #include <linux/slab.h>
 #include <linux/delay.h>
+#include <linux/iopoll.h>
+#include <linux/mutex.h>
 
 /* --- Hardware Definitions --- */
 #define SFP_REG_ADDR(off) (sfp_base + (off))
 #define INGR_ERR          0x100
+#define SFP_POLL_US       1000      /* Sleep between INGR polls */
+#define SFP_TIMEOUT_US    3000000   /* Per program operation */
+#define SFP_ARRAY_WORDS   8         /* Largest array: otpmk / srkh */
 static void __iomem *sfp_base;
 static int fuse_armed = 0;
+static DEFINE_MUTEX(sfp_lock);      /* Array shadows and all register writes */
+static unsigned long sfp_gen = 1;   /* Bumped by every write, under sfp_lock */
 
 /* Wrapper for single-register binary files */
 struct sfp_bin_attribute {
@@ -19,6 +26,22 @@ struct sfp_bin_attribute {
 
 #define to_sfp_bin(_attr) container_of(_attr, struct sfp_bin_attribute, bin_attr)
 
+/*
+ * Wrapper for the multi-word fuse arrays. Reads are served from a shadow
+ * copy filled by one bulk read of the whole array. Any write, to an
+ * array or to a single register (INGR starts PROG and READFB cycles),
+ * bumps sfp_gen, which invalidates every shadow at once: the next read
+ * picks up what the fuses now hold.
+ */
+struct sfp_bin_array {
+    struct bin_attribute bin_attr;
+    unsigned int start;
+    unsigned long gen;              /* sfp_gen when filled; 0 = never */
+    u32 shadow[SFP_ARRAY_WORDS];    /* CPU byte order */
+};
+
+#define to_sfp_array(_attr) container_of(_attr, struct sfp_bin_array, bin_attr)
+
 /* --- 1. Standard Attributes (arm, burn) --- */
 static ssize_t sfp_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf) {
     return sysfs_emit(buf, "%d\n", fuse_armed);
@@ -33,35 +56,60 @@ static struct kobj_attribute sfp_arm = __ATTR(arm, 0600, sfp_show, sfp_store);
 static struct kobj_attribute sfp_burn = __ATTR(burn, 0600, sfp_show, sfp_store);
 
 /* --- 2. Logic Helpers --- */
+
+/*
+ * Sleeps between polls instead of spinning in udelay: programming takes
+ * milliseconds, and a CPU burning 3 s per operation is what we can't afford.
+ * INGR (offset 0x00) reads 0 when done; the block is big-endian, hence
+ * read_poll_timeout() with ioread32be rather than readl_poll_timeout().
+ */
 static int wait_for_complete(void) {
-    int cnt = 0;
-    const int LIMIT = 3000;
     u32 reg;
-    // Assuming 0x00 is your INGR register
-    while ((reg = ioread32be(SFP_REG_ADDR(0x00))) != 0 && cnt < LIMIT) {
-        if (reg & INGR_ERR) return -EIO;
-        udelay(1000);
-        cnt++;
-    }
-    return (cnt >= LIMIT) ? -ETIMEDOUT : 0;
+    int ret;
+
+    ret = read_poll_timeout(ioread32be, reg, !reg || (reg & INGR_ERR),
+                            SFP_POLL_US, SFP_TIMEOUT_US, false, SFP_REG_ADDR(0x00));
+    if (ret) return ret;
+    return (reg & INGR_ERR) ? -EIO : 0;
 }
 
-static ssize_t sfp_read_array(char *buf, unsigned int start, unsigned int end) {
-    unsigned int off, i = 0;
-    u32 *words = (u32 *)buf;
-    for (off = start; off <= end; off += 4)
-        words[i++] = ioread32be(SFP_REG_ADDR(off));
-    return i * 4;
+/* One bulk read of the whole array: 32-bit accesses, no barrier per word */
+static void sfp_fill_shadow(struct sfp_bin_array *arr) {
+    size_t i, words = arr->bin_attr.size / 4;
+
+    __ioread32_copy(arr->shadow, SFP_REG_ADDR(arr->start), words);
+    rmb();
+    for (i = 0; i < words; i++)
+        arr->shadow[i] = be32_to_cpu((__force __be32)arr->shadow[i]);
+    arr->gen = sfp_gen;
+}
+
+static ssize_t sfp_read_array(struct sfp_bin_array *arr, char *buf, loff_t off, size_t count) {
+    mutex_lock(&sfp_lock);
+    if (arr->gen != sfp_gen) sfp_fill_shadow(arr);
+    memcpy(buf, (char *)arr->shadow + off, count);
+    mutex_unlock(&sfp_lock);
+    return count;
 }
 
-static ssize_t sfp_write_array(const char *buf, unsigned int start, unsigned int end) {
-    unsigned int off, i = 0;
-    const u32 *words = (const u32 *)buf;
-    for (off = start; off <= end; off += 4, i++) {
-        iowrite32be(words[i], SFP_REG_ADDR(off));
-        if (wait_for_complete() < 0) return -EIO;
-    }
-    return i * 4;
+/* The whole array in one write, then a single wait for the program cycle */
+static ssize_t sfp_write_array(struct sfp_bin_array *arr, const char *buf, loff_t off, size_t count) {
+    size_t i, words = arr->bin_attr.size / 4;
+    __be32 be[SFP_ARRAY_WORDS];
+    const u32 *src = (const u32 *)buf;
+    int ret;
+
+    if (off || count != arr->bin_attr.size) return -EINVAL;
+    for (i = 0; i < words; i++)
+        be[i] = cpu_to_be32(src[i]);
+
+    mutex_lock(&sfp_lock);
+    __iowrite32_copy(SFP_REG_ADDR(arr->start), be, words);
+    wmb();
+    ret = wait_for_complete();
+    sfp_gen++;
+    mutex_unlock(&sfp_lock);
+    return ret < 0 ? ret : count;
 }
 
 /* --- 3. Binary Callbacks --- */
@@ -80,27 +128,27 @@ static ssize_t sfp_bin_reg_write(struct file *f, struct kobject *k, struct bin_a
     u32 val;
     if (c < 4) return -EINVAL;
     memcpy(&val, b, 4);
+    /* Serialized with array programming; may start a cycle that changes them */
+    mutex_lock(&sfp_lock);
     iowrite32be(val, SFP_REG_ADDR(sattr->reg_offset));
+    sfp_gen++;
+    mutex_unlock(&sfp_lock);
     return 4;
 }
 
-/* Macro to generate functions for arrays (drvr, otpmk, etc) */
-#define SFP_ARRAY_HANDLER(_name, _start, _end) \
-static ssize_t sfp_read_##_name(struct file *f, struct kobject *k, struct bin_attribute *a, char *b, loff_t o, size_t c) \
-{ return sfp_read_array(b, _start, _end); } \
-static ssize_t sfp_write_##_name(struct file *f, struct kobject *k, struct bin_attribute *a, char *b, loff_t o, size_t c) \
-{ return sfp_write_array(b, _start, _end); }
+/* Handlers for the arrays (drvr, otpmk, etc); sysfs clamps o + c to the size */
+static ssize_t sfp_bin_array_read(struct file *f, struct kobject *k, struct bin_attribute *a, char *b, loff_t o, size_t c) {
+    return sfp_read_array(to_sfp_array(a), b, o, c);
+}
 
-/* Generates: sfp_read_drvr, sfp_write_drvr, etc. */
-SFP_ARRAY_HANDLER(drvr,  0x20, 0x24) 
-SFP_ARRAY_HANDLER(otpmk, 0x30, 0x4C) 
-SFP_ARRAY_HANDLER(srkh,  0x50, 0x6C) 
-SFP_ARRAY_HANDLER(ouid,  0x70, 0x80) 
+static ssize_t sfp_bin_array_write(struct file *f, struct kobject *k, struct bin_attribute *a, char *b, loff_t o, size_t c) {
+    return sfp_write_array(to_sfp_array(a), b, o, c);
+}
 
 /* --- 4. Attribute Registration --- */
 
 #define BIN_REG_RW(_name, _off) { .bin_attr = { .attr = { .name = #_name, .mode = 0600 }, .size = 4, .read = sfp_bin_reg_read, .write = sfp_bin_reg_write }, .reg_offset = _off }
-#define BIN_ARRAY_RW(_fn_suffix, _sysfs_name, _size) { .attr = { .name = _sysfs_name, .mode = 0600 }, .size = _size, .read = sfp_read_##_fn_suffix, .write = sfp_write_##_fn_suffix }
+#define BIN_ARRAY_RW(_name, _start, _size) { .bin_attr = { .attr = { .name = #_name, .mode = 0600 }, .size = _size, .read = sfp_bin_array_read, .write = sfp_bin_array_write }, .start = _start }
 
 static struct sfp_bin_attribute sfp_regs[] = {
     BIN_REG_RW(sfp_ingr,    0x00),
@@ -113,11 +161,11 @@ static struct sfp_bin_attribute sfp_regs[] = {
     BIN_REG_RW(sfp_dcvr1,   0x1C),
 };
 
-static struct bin_attribute sfp_arrays[] = {
-    BIN_ARRAY_RW(drvr,  "sfp_drvr",  8),
-    BIN_ARRAY_RW(otpmk, "sfp_otpmk", 32),
-    BIN_ARRAY_RW(srkh,  "sfp_srkh",  32),
-    BIN_ARRAY_RW(ouid,  "sfp_ouid",  20),
+static struct sfp_bin_array sfp_arrays[] = {
+    BIN_ARRAY_RW(sfp_drvr,  0x20, 8),
+    BIN_ARRAY_RW(sfp_otpmk, 0x30, 32),
+    BIN_ARRAY_RW(sfp_srkh,  0x50, 32),
+    BIN_ARRAY_RW(sfp_ouid,  0x70, 20),
 };
 
 /* --- 5. Grouping and Initialization --- */
@@ -144,7 +192,7 @@ static int __init sfp_init(void) {
     for (i = 0; i < ARRAY_SIZE(sfp_regs); i++) 
         sfp_bin_list[j++] = &sfp_regs[i].bin_attr;
     for (i = 0; i < ARRAY_SIZE(sfp_arrays); i++) 
-        sfp_bin_list[j++] = &sfp_arrays[i];
+        sfp_bin_list[j++] = &sfp_arrays[i].bin_attr;
     sfp_bin_list[j] = NULL;
 
     // Create /sys/sfp/
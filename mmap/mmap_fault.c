@@ -10,6 +10,11 @@
 static unsigned int ramjam_pages = DEFAULT_PAGES;
 module_param(ramjam_pages, uint, 0644);
 
+/* Fault-around window: pages mapped per fault (power of two, 1 = off) */
+#define FAULT_AROUND_MAX 64
+static unsigned int fault_around = 16;
+module_param(fault_around, uint, 0644);
+
 struct general_ramjam {
 	struct gendisk* disk;
 	struct blk_mq_tag_set tag_set;
@@ -48,6 +53,56 @@ static const struct block_device_operations ramjam_bdops = { .owner = THIS_MODUL
 
 /* --- VMA Operations (Demand Paging) --- */
 
+/*
+ * Maps the buffer pages for [start, end) of the VMA in one batch.
+ * vm_insert_pages takes its own page references and the page-table lock
+ * once per batch; it stops early at a page that is already mapped. The
+ * rest of the run after that page is then done one page at a time.
+ */
+static void ramjam_map_run(struct vm_area_struct* vma, struct general_ramjam* dev,
+			   unsigned long start, unsigned long end)
+{
+	struct page* pages[FAULT_AROUND_MAX];
+	unsigned long offset, n = 0, left, i;
+
+	for (; start + (n << PAGE_SHIFT) < end; n++) {
+		offset = start + (n << PAGE_SHIFT) - vma->vm_start + (vma->vm_pgoff << PAGE_SHIFT);
+		if (offset >= dev->size)
+			break;
+		pages[n] = vmalloc_to_page(dev->buffer + offset);
+	}
+	left = n;
+	if (n && vm_insert_pages(vma, start, pages, &left))
+		for (i = n - left + 1; i < n; i++)
+			vm_insert_page(vma, start + (i << PAGE_SHIFT), pages[i]);
+}
+
+/*
+ * Fault-around: a fault also maps the rest of its aligned window of
+ * fault_around pages, so a sequential scan faults once per window.
+ * The kernel's .map_pages hook only works for page-cache files, so the
+ * window is inserted from the fault handler (hence VM_MIXEDMAP in mmap).
+ * Unlike mmap_nofault.c nothing is mapped before it is touched.
+ */
+static void ramjam_fault_around(struct vm_fault* vmf, struct general_ramjam* dev)
+{
+	struct vm_area_struct* vma = vmf->vma;
+	unsigned long nr = min_t(unsigned int, fault_around, FAULT_AROUND_MAX);
+	unsigned long addr = vmf->address & PAGE_MASK;
+	unsigned long win, start, end;
+
+	if (nr <= 1 || !is_power_of_2(nr))
+		return;
+
+	win = ALIGN_DOWN(addr, nr << PAGE_SHIFT);
+	start = max(win, vma->vm_start);
+	end = min(win + (nr << PAGE_SHIFT), vma->vm_end);
+
+	/* Everything but the faulting page; finish_fault maps that one */
+	ramjam_map_run(vma, dev, start, addr);
+	ramjam_map_run(vma, dev, addr + PAGE_SIZE, end);
+}
+
 static vm_fault_t ramjam_vma_fault(struct vm_fault* vmf)
 {
 	struct vm_area_struct* vma = vmf->vma;
@@ -74,6 +129,8 @@ static vm_fault_t ramjam_vma_fault(struct vm_fault* vmf)
 	get_page(page);
 	vmf->page = page;
 
+	ramjam_fault_around(vmf, dev);
+
 	pr_debug("ramjam: Faulted page at offset %lu\n", offset);
 
 	return 0;
@@ -92,6 +149,8 @@ static int ramjam_mmap(struct file* filp, struct vm_area_struct* vma) {
 	 */
 	vma->vm_ops = &ramjam_vm_ops;
 	vma->vm_private_data = &ramjam_dev;
+	/* Fault-around inserts pages from the fault handler */
+	vm_flags_set(vma, VM_MIXEDMAP);
 
 	pr_info("ramjam: VMA initialized for demand paging\n");
 	return 0;
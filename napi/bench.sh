@@ -0,0 +1,140 @@
+#!/bin/bash
+#
+# bench.sh - l3loop0 throughput/latency benchmark matrix
+#
+# WHAT IT MEASURES:
+# Traffic comes from the driver's own packet generator
+# (/sys/kernel/debug/l3loop0/pktgen), so no veth, namespace or userspace
+# sender is in the path. For every combination of
+#   queues  (module parameter num_queues)
+#   mode    drop      xdp_frames, XDP_DROP
+#           tx        xdp_frames, XDP_TX (bounced once back into the queue)
+#           redirect  xdp_frames, XDP_REDIRECT to l3loop0 itself (devmap)
+#           loopback  skbs through ndo_start_xmit, XDP_DROP on return
+#   size    frame size in bytes (the MTU is raised to 9000 for jumbo
+#           frames, which travel as XDP multi-buffer packets)
+# it prints one row with Mpps and Gbps (from pktgen) and the p50/p99
+# enqueue-to-verdict latency (from ethtool -S, latency_stats=1).
+#
+# USAGE:
+#   sudo ./bench.sh [-q "1 2 4"] [-s "64 512 1500"] [-m "drop tx"] [-n FRAMES]
+#   sudo make bench BENCH_ARGS="-q 4 -n 5000000"
+#
+# Needs napi_xdp.ko built in this directory, clang, bpftool, ethtool and
+# a mounted debugfs. Unloads napi_xdp when done.
+
+set -e  # Exit on any error
+trap 'echo "ERROR at line $LINENO"' ERR  # Show line number on error
+
+# --- Configuration ---
+DRIVER_IF="l3loop0"
+MODULE_NAME="napi_xdp"
+BPF_INC="-I/usr/include/$(uname -m)-linux-gnu -I/usr/include"
+BPF_PIN_DIR="/sys/fs/bpf"
+DBG_DIR="/sys/kernel/debug/$DRIVER_IF"
+
+QUEUES="1 2 4"
+MODES="drop tx redirect loopback"
+SIZES="64 512 1500 9000"
+FRAMES=1000000           # Per CPU; one CPU injects per queue
+
+while getopts "q:s:m:n:" opt; do
+    case $opt in
+        q) QUEUES=$OPTARG ;;
+        s) SIZES=$OPTARG ;;
+        m) MODES=$OPTARG ;;
+        n) FRAMES=$OPTARG ;;
+        *) echo "usage: $0 [-q queues] [-s sizes] [-m modes] [-n frames]"; exit 1 ;;
+    esac
+done
+
+log() {
+    echo "[$(date '+%H:%M:%S')] $*" >&2
+}
+
+cleanup() {
+    ip link set dev $DRIVER_IF xdp off 2>/dev/null || true
+    rm -rf $BPF_PIN_DIR/xdp_bench $BPF_PIN_DIR/bench_maps 2>/dev/null || true
+    rmmod $MODULE_NAME 2>/dev/null || true
+}
+
+# Write a u32 into a pinned map (bpftool takes little-endian bytes)
+map_set_u32() {
+    local map=$1 val=$2
+    bpftool map update pinned $map key 0 0 0 0 value \
+        $((val & 0xff)) $(((val >> 8) & 0xff)) $(((val >> 16) & 0xff)) $(((val >> 24) & 0xff))
+}
+
+# One value from "ethtool -S"
+ethtool_stat() {
+    ethtool -S $DRIVER_IF | awk -v k="$1:" '$1 == k { print $2 }'
+}
+
+# One value from the pktgen result
+pktgen_get() {
+    awk -v k="$1:" '$1 == k { print $2 }' $DBG_DIR/pktgen
+}
+
+# --- 1. Compile the benchmark program ---
+log "Compiling xdp_bench.c..."
+clang -O2 -g -Wall -target bpf $BPF_INC \
+    -c xdp_bench.c -o xdp_bench.o || {
+    echo "ERROR: Failed to compile xdp_bench.c"
+    exit 1
+}
+
+trap cleanup EXIT
+mountpoint -q /sys/kernel/debug || mount -t debugfs none /sys/kernel/debug
+
+printf "%-7s %-9s %6s %10s %10s %10s %10s %9s\n" \
+    "queues" "mode" "size" "Mpps" "Gbps" "p50_ns" "p99_ns" "retries"
+
+for q in $QUEUES; do
+    # --- 2. Load the driver with Q queues and latency recording on ---
+    cleanup
+    log "Loading $MODULE_NAME with num_queues=$q..."
+    insmod ${MODULE_NAME}.ko num_queues=$q latency_stats=1
+    for i in {1..10}; do
+        ip link show $DRIVER_IF &>/dev/null && break
+        sleep 0.5
+    done
+    ip link set $DRIVER_IF mtu 9000 up
+
+    # --- 3. Attach xdp_bench and point tx_port at l3loop0 itself ---
+    mkdir -p $BPF_PIN_DIR/bench_maps
+    bpftool prog load xdp_bench.o $BPF_PIN_DIR/xdp_bench \
+        pinmaps $BPF_PIN_DIR/bench_maps/
+    ip link set dev $DRIVER_IF xdp pinned $BPF_PIN_DIR/xdp_bench
+    map_set_u32 $BPF_PIN_DIR/bench_maps/tx_port $(cat /sys/class/net/$DRIVER_IF/ifindex)
+
+    # One injector per queue, but never more than there are CPUs
+    cpus=$(( q < $(nproc) ? q : $(nproc) ))
+
+    for mode in $MODES; do
+        case $mode in
+            drop)     action=0; pg_mode=xdp ;;
+            tx)       action=1; pg_mode=xdp ;;
+            redirect) action=2; pg_mode=xdp ;;
+            loopback) action=0; pg_mode=skb ;;
+            *) echo "ERROR: unknown mode $mode"; exit 1 ;;
+        esac
+        map_set_u32 $BPF_PIN_DIR/bench_maps/bench_cfg $action
+
+        for size in $SIZES; do
+            # --- 4. Run and report ---
+            echo 1 > $DBG_DIR/reset
+            # ttl=2: tx/redirect bounce each frame once, then drop it
+            echo "frames=$FRAMES size=$size cpus=$cpus mode=$pg_mode ttl=2" > $DBG_DIR/pktgen
+
+            printf "%-7s %-9s %6s %10s %10s %10s %10s %9s\n" \
+                $q $mode $size \
+                $(pktgen_get mpps) $(pktgen_get gbps) \
+                $(ethtool_stat lat_enqueue_to_verdict_p50_ns) \
+                $(ethtool_stat lat_enqueue_to_verdict_p99_ns) \
+                $(pktgen_get retries)
+
+            result=$(pktgen_get result)
+            [ "$result" = "0" ] || log "WARNING: run ended with error $result"
+        done
+    done
+done
@@ -5,28 +5,44 @@
 #include <linux/interrupt.h>
 #include <linux/slab.h>
 #include <linux/timer.h>
+#include <linux/ethtool.h>
+#include <linux/log2.h>
 
-#define NUM_DESC    64
+/* Ring sizes: powers of two, changed with "ethtool -G l3loop0 rx N tx N" */
+#define L3_RING_MIN     64
+#define L3_RING_MAX     4096
+#define L3_RING_DEFAULT 256
 #define L3_OWN_CPU  1
 
+/* 16 bytes: four descriptors per cache line */
 struct l3_packet {
-	u32 status;
 	struct sk_buff *skb;
+	u32 status;
 };
 
 struct l3_napi_adapter {
 	struct napi_struct napi;
 	struct net_device *netdev;
-	spinlock_t lock;
 
-	/* Descriptor Rings */
-	struct l3_packet rx_ring[NUM_DESC];
-	struct l3_packet tx_ring[NUM_DESC];
-	
-	u32 cur_rx, dirty_rx;
-	u32 cur_tx, dirty_tx;
+	/* Descriptor Rings (allocated in ndo_open, index & mask = slot) */
+	struct l3_packet *rx_ring;
+	struct l3_packet *tx_ring;
+	u32 rx_ring_size, tx_ring_size;
+	u32 rx_mask, tx_mask;
 
 	struct timer_list irq_timer;
+
+	/*
+	 * Producer side (ndo_start_xmit, under lock) and consumer side
+	 * (NAPI) each get their own cache line, so the two CPUs do not
+	 * bounce one line on every packet.
+	 */
+	spinlock_t lock ____cacheline_aligned_in_smp;
+	u32 cur_rx;             /* RX producer (loopback) */
+	u32 cur_tx;             /* TX producer */
+
+	u32 dirty_rx ____cacheline_aligned_in_smp;  /* RX consumer (NAPI) */
+	u32 dirty_tx;                               /* TX consumer (NAPI) */
 };
 
 /* --- Simulated Interrupt (The Hardware Trigger) --- */
@@ -50,13 +66,15 @@ static int l3_napi_poll(struct napi_struct *napi, int budget)
 
 	/* 1. Process RX (The looped-back packets) */
 	while (work_done < budget) {
-		entry = priv->cur_rx % NUM_DESC;
-		if (priv->rx_ring[entry].status != L3_OWN_CPU)
+		entry = priv->dirty_rx & priv->rx_mask;
+		if (READ_ONCE(priv->rx_ring[entry].status) != L3_OWN_CPU)
 			break;
 
+		smp_rmb();
 		struct sk_buff *skb = priv->rx_ring[entry].skb;
-		priv->rx_ring[entry].skb = NULL;
 		priv->rx_ring[entry].status = 0;
+		smp_wmb();
+		WRITE_ONCE(priv->rx_ring[entry].skb, NULL);
 
 		/* Push to stack */
 		skb->protocol = eth_type_trans(skb, dev);
@@ -65,26 +83,29 @@ static int l3_napi_poll(struct napi_struct *napi, int budget)
 		dev->stats.rx_packets++;
 		dev->stats.rx_bytes += skb->len;
 		
-		priv->cur_rx++;
+		priv->dirty_rx++;
 		work_done++;
 	}
 
 	/* Process TX Completions (Cleaning the original buffers) */
 	while (priv->dirty_tx != priv->cur_tx) {
-		entry = priv->dirty_tx % NUM_DESC;
-		if (priv->tx_ring[entry].status != L3_OWN_CPU)
+		entry = priv->dirty_tx & priv->tx_mask;
+		if (READ_ONCE(priv->tx_ring[entry].status) != L3_OWN_CPU)
 			break;
 
+		smp_rmb();
 		if (priv->tx_ring[entry].skb) {
 			struct sk_buff *skb = priv->tx_ring[entry].skb;
 			dev->stats.tx_packets++;
 			dev->stats.tx_bytes += skb->len;
 			
 			dev_consume_skb_any(skb);
-			priv->tx_ring[entry].skb = NULL;
 		}
 		
+		/* Clear status before freeing the slot to ndo_start_xmit */
 		priv->tx_ring[entry].status = 0;
+		smp_wmb();
+		WRITE_ONCE(priv->tx_ring[entry].skb, NULL);
 		priv->dirty_tx++;
 	}
 
@@ -108,8 +129,8 @@ static netdev_tx_t l3_napi_start_xmit(struct sk_buff *skb, struct net_device *de
 
 	spin_lock_irqsave(&priv->lock, flags);
 
-	tx_entry = priv->cur_tx % NUM_DESC;
-	rx_entry = priv->cur_rx % NUM_DESC;
+	tx_entry = priv->cur_tx & priv->tx_mask;
+	rx_entry = priv->cur_rx & priv->rx_mask;
 
 	/* If TX ring is full, stop the stack */
 	if (priv->tx_ring[tx_entry].skb) {
@@ -120,15 +141,18 @@ static netdev_tx_t l3_napi_start_xmit(struct sk_buff *skb, struct net_device *de
 
 	/* Place original in TX ring for completion cleaning */
 	priv->tx_ring[tx_entry].skb = skb;
-	priv->tx_ring[tx_entry].status = L3_OWN_CPU;
+	smp_wmb();
+	WRITE_ONCE(priv->tx_ring[tx_entry].status, L3_OWN_CPU);
 	priv->cur_tx++;
 
-	/* LOOPBACK: Clone for the RX path */
+	/* LOOPBACK: Clone for the RX path (dropped if the RX ring is full) */
 	if (!priv->rx_ring[rx_entry].skb) {
 		struct sk_buff *rx_skb = skb_clone(skb, GFP_ATOMIC);
 		if (rx_skb) {
 			priv->rx_ring[rx_entry].skb = rx_skb;
-			priv->rx_ring[rx_entry].status = L3_OWN_CPU;
+			smp_wmb();
+			WRITE_ONCE(priv->rx_ring[rx_entry].status, L3_OWN_CPU);
+			priv->cur_rx++;
 		}
 	}
 
@@ -140,9 +164,51 @@ static netdev_tx_t l3_napi_start_xmit(struct sk_buff *skb, struct net_device *de
 	return NETDEV_TX_OK;
 }
 
+/* --- Ring memory: allocated on open at the sizes set with ethtool -G --- */
+static int l3_alloc_rings(struct l3_napi_adapter *priv)
+{
+	priv->rx_ring = kvcalloc(priv->rx_ring_size, sizeof(*priv->rx_ring), GFP_KERNEL);
+	priv->tx_ring = kvcalloc(priv->tx_ring_size, sizeof(*priv->tx_ring), GFP_KERNEL);
+	if (!priv->rx_ring || !priv->tx_ring) {
+		kvfree(priv->rx_ring);
+		kvfree(priv->tx_ring);
+		priv->rx_ring = priv->tx_ring = NULL;
+		return -ENOMEM;
+	}
+
+	priv->rx_mask = priv->rx_ring_size - 1;
+	priv->tx_mask = priv->tx_ring_size - 1;
+	priv->cur_rx = priv->dirty_rx = 0;
+	priv->cur_tx = priv->dirty_tx = 0;
+	return 0;
+}
+
+static void l3_free_rings(struct l3_napi_adapter *priv)
+{
+	u32 i;
+
+	/* Drop whatever NAPI did not get to */
+	for (i = 0; i < priv->rx_ring_size; i++)
+		if (priv->rx_ring[i].skb)
+			dev_kfree_skb_any(priv->rx_ring[i].skb);
+	for (i = 0; i < priv->tx_ring_size; i++)
+		if (priv->tx_ring[i].skb)
+			dev_kfree_skb_any(priv->tx_ring[i].skb);
+
+	kvfree(priv->rx_ring);
+	kvfree(priv->tx_ring);
+	priv->rx_ring = priv->tx_ring = NULL;
+}
+
 static int l3_napi_open(struct net_device *dev)
 {
 	struct l3_napi_adapter *priv = netdev_priv(dev);
+	int err;
+
+	err = l3_alloc_rings(priv);
+	if (err)
+		return err;
+
 	napi_enable(&priv->napi);
 	netif_start_queue(dev);
 	return 0;
@@ -154,9 +220,75 @@ static int l3_napi_stop(struct net_device *dev)
 	netif_stop_queue(dev);
 	napi_disable(&priv->napi);
 	del_timer_sync(&priv->irq_timer);
+	l3_free_rings(priv);
 	return 0;
 }
 
+/* --- ethtool -g / -G: ring size query and resize --- */
+static void l3_get_ringparam(struct net_device *dev, struct ethtool_ringparam *ring,
+			     struct kernel_ethtool_ringparam *kring,
+			     struct netlink_ext_ack *extack)
+{
+	struct l3_napi_adapter *priv = netdev_priv(dev);
+
+	ring->rx_max_pending = L3_RING_MAX;
+	ring->tx_max_pending = L3_RING_MAX;
+	ring->rx_pending = priv->rx_ring_size;
+	ring->tx_pending = priv->tx_ring_size;
+}
+
+static int l3_set_ringparam(struct net_device *dev, struct ethtool_ringparam *ring,
+			    struct kernel_ethtool_ringparam *kring,
+			    struct netlink_ext_ack *extack)
+{
+	struct l3_napi_adapter *priv = netdev_priv(dev);
+	u32 old_rx = priv->rx_ring_size, old_tx = priv->tx_ring_size;
+	bool running = netif_running(dev);
+	int err;
+
+	if (ring->rx_mini_pending || ring->rx_jumbo_pending)
+		return -EINVAL;
+
+	/* Mask indexing needs powers of two */
+	if (ring->rx_pending < L3_RING_MIN || ring->tx_pending < L3_RING_MIN ||
+	    !is_power_of_2(ring->rx_pending) || !is_power_of_2(ring->tx_pending)) {
+		NL_SET_ERR_MSG_MOD(extack, "ring sizes must be powers of two, 64 to 4096");
+		return -EINVAL;
+	}
+
+	if (ring->rx_pending == old_rx && ring->tx_pending == old_tx)
+		return 0;
+
+	/*
+	 * Rings are (re)allocated by ndo_open, so bounce the device.
+	 * dev_close() waits for any start_xmit still running before
+	 * ndo_stop frees the old rings.
+	 */
+	if (running)
+		dev_close(dev);
+
+	priv->rx_ring_size = ring->rx_pending;
+	priv->tx_ring_size = ring->tx_pending;
+
+	if (!running)
+		return 0;
+
+	err = dev_open(dev, extack);
+	if (err) {
+		/* Not enough memory for the new size: come back with the old one */
+		priv->rx_ring_size = old_rx;
+		priv->tx_ring_size = old_tx;
+		if (dev_open(dev, NULL))
+			netdev_err(dev, "could not reopen after ring resize\n");
+	}
+	return err;
+}
+
+static const struct ethtool_ops l3_ethtool_ops = {
+	.get_ringparam = l3_get_ringparam,
+	.set_ringparam = l3_set_ringparam,
+};
+
 static const struct net_device_ops l3_ops = {
 	.ndo_open = l3_napi_open,
 	.ndo_stop = l3_napi_stop,
@@ -171,10 +303,13 @@ static void l3_setup(struct net_device *dev)
 
 	ether_setup(dev);
 	dev->netdev_ops = &l3_ops;
+	dev->ethtool_ops = &l3_ethtool_ops;
 	
 	/* Setup private pointers */
 	priv->netdev = dev;
 	spin_lock_init(&priv->lock);
+	priv->rx_ring_size = L3_RING_DEFAULT;
+	priv->tx_ring_size = L3_RING_DEFAULT;
 	
 	/* Initialize Timer and NAPI *BEFORE* registration */
 	timer_setup(&priv->irq_timer, l3_fake_irq_handler, 0);
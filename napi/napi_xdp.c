@@ -5,12 +5,21 @@
  * This kernel module demonstrates how to build a network device driver that:
  * 1. Implements NAPI (New API) for efficient packet processing
  * 2. Supports XDP (eXpress Data Path) for high-performance packet filtering
- * 3. Handles XDP redirect operations manually (ndo_xdp_xmit)
+ * 3. Handles XDP redirect natively (xdp_do_redirect + xdp_do_flush) or
+ *    manually (ndo_xdp_xmit)
  * 4. Uses ring buffers to simulate hardware DMA descriptors
  * 5. Implements a workqueue-based doorbell mechanism (simulates hardware DMA)
  * 6. Uses tasklet for interrupt simulation (called by workqueue after DMA)
- * 7. Includes detailed timing debug for performance analysis
+ * 7. Keeps per-stage latency histograms and drop counters (debugfs, ethtool -S)
  * 8. Uses XDP_XMIT_FLUSH for immediate packet transmission
+ * 9. Spreads traffic over multiple RX/TX queue pairs (one per CPU by default)
+ * 10. Recycles RX buffers through a per-queue page_pool
+ * 11. Lets AF_XDP sockets bind to a queue in zero-copy mode
+ * 12. Resizes its rings at runtime with "ethtool -G"
+ * 13. Moderates its fake IRQ like a NIC (ethtool -C, optionally DIM)
+ * 14. Supports threaded NAPI and socket busy polling
+ * 15. Generates its own test traffic for benchmarking (debugfs pktgen)
+ * 16. Carries jumbo frames (MTU up to 9000) as XDP multi-buffer packets
  *
  * ARCHITECTURE:
  * This driver creates a virtual "l3loop0" device that acts as a software router.
@@ -29,19 +38,127 @@
  * - XDP frame handling and conversion
  * - Manual XDP redirect implementation
  * - Proper XDP flush for low latency
- * - Performance timing analysis
+ * - Low-overhead latency instrumentation (per-CPU log2 histograms)
+ * - Multi-queue operation with per-queue rings, locks and NAPI instances
+ * - page_pool buffer recycling (MEM_TYPE_PAGE_POOL memory model)
+ * - AF_XDP zero-copy: XSK fill/completion rings (MEM_TYPE_XSK_BUFF_POOL)
+ *
+ * MULTI-QUEUE:
+ * The device owns num_queues independent queue pairs (struct l3_queue).
+ * Each queue has its own RX/TX rings, spinlock, NAPI instance, fake-IRQ
+ * tasklet and xdp_rxq_info, so queues never share a lock or a cache line.
+ * - ndo_xdp_xmit picks the queue of the CPU it is running on (the same
+ *   convention real NICs use for their XDP TX queues)
+ * - ndo_start_xmit uses the queue chosen by the stack's flow hash
+ *   (skb->queue_mapping), so a flow always stays on one queue
+ *
+ * ZERO-COPY REDIRECT:
+ * With xdp_zero_copy (the default), a frame redirected to us is not copied:
+ * its buffer moves onto our RX ring, our XDP program runs on it in place,
+ * and on XDP_REDIRECT the same frame is passed on. A frame that crosses
+ * l3loop on its way from v-cbr to v-lbr is therefore never copied by the
+ * driver. Pages only leave their owner's pool again on drop or completion.
+ *
+ * RING SIZING:
+ * "ethtool -g l3loop0" shows and "ethtool -G l3loop0 rx N tx N" sets the
+ * descriptors per ring, any power of two from 64 to 4096 (default 256).
+ * The rings, and a doorbell at least as large as the RX ring, are
+ * allocated in ndo_open, so a resize briefly bounces the device. Indexing
+ * is a mask instead of a modulo; an RX descriptor is 32 bytes and a TX
+ * descriptor 16, and each ring index lives on a cache line written only
+ * by its own side (doorbell worker, transmitters, NAPI).
+ *
+ * INTERRUPT COALESCING:
+ * The doorbell worker does not raise the fake IRQ for every batch it
+ * copies. An IRQ fires once rx-frames frames have completed or rx-usecs
+ * after the first one (an hrtimer), whichever comes first, and then stays
+ * masked until NAPI completes, so frames arriving during a poll cost no
+ * tasklet at all. "ethtool -C l3loop0 rx-usecs 50 rx-frames 64" trades
+ * up to 50 us of latency for fewer softirq round trips; "adaptive-rx on"
+ * hands the choice to DIM. rx-usecs 0, the default, keeps the old
+ * one-IRQ-per-batch behaviour (masking still applies).
+ *
+ * THREADED NAPI AND BUSY POLLING:
+ * Each queue's NAPI has its own NAPI ID (carried by every skb it
+ * delivers, and reported per queue through the netdev netlink family).
+ * - "echo 1 > /sys/class/net/l3loop0/threaded" (or napi_threaded=1) moves
+ *   the polls out of softirq into kthreads that can be pinned with
+ *   taskset and prioritized with chrt.
+ * - A socket with SO_BUSY_POLL (or net.core.busy_read/busy_poll set)
+ *   that receives l3loop traffic polls the queue from recvmsg()/poll()
+ *   itself, and so does an AF_XDP socket bound to the queue. While it
+ *   does, the doorbell worker raises no fake IRQ for that queue, so the
+ *   tasklet and softirq are out of the path altogether.
+ *
+ * JUMBO FRAMES:
+ * The MTU goes up to 9000. A copied frame that does not fit one page
+ * (L3_RX_DATA_ROOM) is scattered by the doorbell worker over a head page
+ * and whole-page frags chained in the head page's skb_shared_info, the
+ * XDP multi-buffer layout; zero-copy frames keep the frags they came
+ * with. A program loaded as SEC("xdp.frags") sees the whole frame
+ * (bpf_xdp_load_bytes, bpf_xdp_get_buff_len); XDP_PASS turns the frags
+ * into skb page frags without copying, and XDP_TX/REDIRECT forward them
+ * (we advertise NDO_XMIT_SG). A single-buffer program can only be
+ * attached while the MTU fits one page, and vice versa.
+ *
+ * PACKET GENERATOR AND BENCHMARK:
+ * "echo 'frames=1000000 size=64 cpus=4' > /sys/kernel/debug/l3loop0/pktgen"
+ * injects frames from kthreads pinned to 4 CPUs, either as xdp_frames
+ * into the doorbells (mode=xdp, the ndo_xdp_xmit path) or as skbs
+ * through ndo_start_xmit (mode=skb, the loopback path); reading the file
+ * gives Mpps and Gbps for the run. XDP_TX sends a frame back out of the
+ * queue it arrived on. "make bench" loads xdp_bench.o and runs
+ * XDP_DROP, XDP_TX, XDP_REDIRECT and loopback over a matrix of frame
+ * sizes and queue counts, printing Mpps, Gbps and p50/p99 latency.
+ *
+ * RX BUFFER RECYCLING:
+ * RX pages come from a page_pool owned by the queue and registered with
+ * its xdp_rxq_info (MEM_TYPE_PAGE_POOL). Dropped and copied-out pages go
+ * straight back to the pool, and frames we redirect to another device are
+ * handed back to our pool by that device's xdp_return_frame(), so in steady
+ * state no RX page touches the buddy allocator. The pool's alloc/recycle
+ * counters are reported with "ethtool -S l3loop0" (needs
+ * CONFIG_PAGE_POOL_STATS).
+ *
+ * AF_XDP (XSK) ZERO-COPY:
+ * An AF_XDP socket can bind to any l3loop queue with XDP_ZEROCOPY. While
+ * bound, that queue's RX descriptors are filled from the socket's fill
+ * ring: NAPI posts umem buffers to free descriptors and the doorbell
+ * worker "DMAs" the packet straight into them, so an XDP program that
+ * redirects into an XSKMAP hands the buffer to userspace without a copy.
+ * Descriptors from the socket's TX ring are picked up by NAPI, placed on
+ * the queue's TX ring and looped back through the doorbell like any other
+ * transmitted packet; TX completion returns them on the completion ring.
+ * Userspace kicks the queue with sendto()/poll(), which ends up in
+ * ndo_xsk_wakeup() and raises the queue's fake IRQ.
+ *
+ * LATENCY INSTRUMENTATION:
+ * With latency_stats=1 (module parameter, or "enable" in debugfs, both
+ * writable at runtime) every packet is timestamped on entry and four
+ * stages are recorded into per-CPU log2(ns) histograms:
+ * - xmit_to_doorbell:    ndo_xdp_xmit/ndo_start_xmit -> doorbell worker
+ * - doorbell_to_tasklet: worker raises the fake IRQ -> tasklet runs
+ * - tasklet_to_napi:     tasklet schedules NAPI -> poll runs
+ * - enqueue_to_verdict:  ndo_xdp_xmit/ndo_start_xmit -> XDP verdict done
+ * Recording is a this_cpu_inc(), so nothing is shared between CPUs and no
+ * printk disturbs the measurement. Drop/stall counters are always on.
+ * Full histograms: /sys/kernel/debug/l3loop0/latency; percentiles, drop
+ * counters and ring occupancy: "ethtool -S l3loop0".
  *
  * PACKET FLOW:
  * 1. Packet arrives via ndo_xdp_xmit() from another device [TIMESTAMP]
- * 2. Packet queued to workqueue (doorbell rings) [TIMESTAMP]
- * 3. Workqueue copies packet data to RX ring (simulates DMA) [TIMESTAMP]
- * 4. Workqueue schedules tasklet (simulates DMA completion interrupt) [TIMESTAMP]
+ * 2. Packet posted to the queue's doorbell ring (doorbell rings) [TIMESTAMP]
+ * 3. Doorbell worker copies a batch of packets to RX ring (simulates DMA) [TIMESTAMP]
+ * 4. Worker schedules tasklet once per batch (DMA completion interrupt) [TIMESTAMP]
  * 5. Tasklet runs (fake IRQ handler) [TIMESTAMP]
  * 6. Tasklet schedules NAPI poll [TIMESTAMP]
  * 7. NAPI poll processes RX ring, runs XDP program [TIMESTAMP]
  * 8. XDP program returns routing decision (PASS or REDIRECT)
- * 9. If REDIRECT: manually call target device's ndo_xdp_xmit() with FLUSH flag
- * 10. If PASS: convert to skb and deliver to network stack
+ * 9. If REDIRECT: xdp_do_redirect() queues the frame on the devmap bulk
+ *    queue and xdp_do_flush() sends the batch at the end of the poll
+ *    (legacy mode: manually call target ndo_xdp_xmit() with FLUSH flag)
+ * 10. If PASS (or no program): wrap the buffer in an skb without copying
+ *     (napi_build_skb) and deliver it to the stack through GRO
  * 11. NAPI poll cleans up TX ring (completes transmissions)
  */
 
@@ -54,84 +171,426 @@
 #include <linux/workqueue.h>
 #include <linux/bpf.h>
 #include <linux/filter.h>
+#include <linux/bpf_trace.h>
 #include <net/xdp.h>
+#include <net/checksum.h>
+#include <net/page_pool/helpers.h>
+#include <net/xdp_sock_drv.h>
+#include <linux/dma-mapping.h>
+#include <linux/ethtool.h>
 #include <linux/ip.h>
 #include <linux/if_arp.h>
 #include <linux/ktime.h>
+#include <linux/cpumask.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/hrtimer.h>
+#include <linux/dim.h>
+#include <linux/kthread.h>
+#include <linux/udp.h>
+#include <linux/if_vlan.h>
 
  /* Ring buffer configuration */
-#define NUM_DESC    64                  /* Number of descriptors in each ring */
+#define L3_RING_MIN     64              /* Smallest ring ethtool -G accepts */
+#define L3_RING_MAX     4096            /* Largest ring ethtool -G accepts */
+#define L3_RING_DEFAULT 256             /* Ring size at module load */
 #define L3_OWN_CPU  1                   /* Descriptor owned by CPU (ready to process) */
 #define XDP_PACKET_HEADROOM 256         /* Headroom before packet data for XDP */
 
-/* Debug timing configuration */
-#define TIMING_DEBUG 0                  /* Enable/disable timing debug (0=off, 1=on) */
+/*
+ * Largest packet a copied RX page can hold: the page minus the XDP
+ * headroom in front and the skb_shared_info that napi_build_skb() puts at
+ * the end, so the same page can become an skb head without a copy.
+ */
+#define L3_RX_DATA_ROOM (PAGE_SIZE - XDP_PACKET_HEADROOM - \
+			 SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
+
+/*
+ * Jumbo frames: what does not fit L3_RX_DATA_ROOM continues in whole-page
+ * frags listed in the head page's skb_shared_info (XDP multi-buffer). An
+ * XDP program not loaded as SEC("xdp.frags") only ever sees one buffer,
+ * so while one is attached the MTU stays within L3_XDP_MAX_MTU.
+ */
+#define L3_MAX_MTU      9000
+#define L3_MAX_FRAME    (ETH_HLEN + L3_MAX_MTU)
+#define L3_XDP_MAX_MTU  (L3_RX_DATA_ROOM - VLAN_ETH_HLEN)
+#define L3_MAX_QUEUES 16                /* Upper bound for the num_queues parameter */
+#define L3_DB_SIZE  256                 /* Minimum doorbell slots per queue (power of two) */
+#define L3_DB_BATCH 64                  /* Slots drained per fake IRQ */
+
+/* Interrupt coalescing (ethtool -C) */
+#define L3_COAL_USECS_MAX      1000     /* Longest rx-usecs accepted */
+#define L3_COAL_FRAMES_DEFAULT 32       /* rx-frames at module load */
+#define L3_IRQ_MASKED          0        /* irq_state bit: fake IRQ raised, NAPI not done */
+
+/*
+ * Number of RX/TX queue pairs. 0 (the default) means one queue per online
+ * CPU, capped at L3_MAX_QUEUES.
+ */
+static unsigned int num_queues;
+module_param(num_queues, uint, 0444);
+MODULE_PARM_DESC(num_queues, "Number of RX/TX queue pairs (0 = num_online_cpus())");
+
+/*
+ * Zero-copy XDP receive: redirected frames are placed on the RX ring as-is
+ * instead of being copied into a fresh page. Set to 0 to get the original
+ * copying DMA simulation back (e.g. to compare the two).
+ */
+static bool xdp_zero_copy = true;
+module_param(xdp_zero_copy, bool, 0644);
+MODULE_PARM_DESC(xdp_zero_copy, "Move redirected XDP frames onto the RX ring without copying");
+
+/*
+ * Native XDP_REDIRECT: act on the target the program picked with
+ * bpf_redirect_map() via xdp_do_redirect()/xdp_do_flush(), like a real
+ * driver. Set to 0 for the legacy mode that re-parses the headers and
+ * routes 10.0.0.1/10.0.0.2 by hand (l3_get_redirect_ifindex()).
+ */
+static bool xdp_native_redirect = true;
+module_param(xdp_native_redirect, bool, 0644);
+MODULE_PARM_DESC(xdp_native_redirect, "Use xdp_do_redirect() with devmap bulking (0 = legacy manual routing)");
+
+/*
+ * Latency histograms. Off by default: when off, the hot paths skip the
+ * clock reads entirely. Also writable as /sys/kernel/debug/l3loop0/enable.
+ */
+static bool latency_stats;
+module_param(latency_stats, bool, 0644);
+MODULE_PARM_DESC(latency_stats, "Record per-stage latency histograms (runtime switch)");
+
+/*
+ * Run every queue's NAPI in its own kthread ("napi/l3loop0-<id>") from
+ * the start, instead of in softirq context. The kthreads can then be
+ * pinned and given a real-time priority like any other thread. Same as
+ * "echo 1 > /sys/class/net/l3loop0/threaded", which works at any time.
+ */
+static bool napi_threaded;
+module_param(napi_threaded, bool, 0444);
+MODULE_PARM_DESC(napi_threaded, "Run NAPI polls in per-queue kthreads (threaded NAPI)");
+
+#define L3_LAT_BUCKETS 32               /* log2(ns) buckets, the last one is >= 2^30 ns */
+
+/* Stages timed by the latency histograms (see LATENCY INSTRUMENTATION) */
+enum l3_lat_stage {
+	L3_LAT_XMIT_DOORBELL,
+	L3_LAT_DOORBELL_TASKLET,
+	L3_LAT_TASKLET_NAPI,
+	L3_LAT_ENQUEUE_VERDICT,
+	L3_LAT_NUM_STAGES,
+};
+
+static const char* const l3_lat_stage_names[L3_LAT_NUM_STAGES] = {
+	[L3_LAT_XMIT_DOORBELL] = "xmit_to_doorbell",
+	[L3_LAT_DOORBELL_TASKLET] = "doorbell_to_tasklet",
+	[L3_LAT_TASKLET_NAPI] = "tasklet_to_napi",
+	[L3_LAT_ENQUEUE_VERDICT] = "enqueue_to_verdict",
+};
+
+/* Drop and stall counters (always enabled) */
+enum l3_event {
+	L3_EV_XDP_DOORBELL_FULL,        /* ndo_xdp_xmit: frame refused, doorbell full */
+	L3_EV_TX_DOORBELL_FULL,         /* ndo_start_xmit/AF_XDP TX: dropped, doorbell full */
+	L3_EV_RX_RING_FULL,             /* Worker stalled on a full RX ring (not a drop) */
+	L3_EV_RX_NO_BUFFER,             /* Worker: no page_pool page */
+	L3_EV_RX_OVERSIZE,              /* Worker: packet larger than the RX buffer */
+	L3_EV_RX_SKB_ALLOC,             /* XDP_PASS: no skb */
+	L3_EV_XDP_REDIRECT_ERR,         /* XDP_REDIRECT failed or had no route */
+	L3_EV_XDP_TX_ERR,               /* XDP_TX: no frame, or doorbell full */
+	L3_EV_XDP_DROP,                 /* XDP_DROP, XDP_ABORTED or unsupported verdict */
+	L3_NUM_EVENTS,
+};
+
+static const char* const l3_event_names[L3_NUM_EVENTS] = {
+	[L3_EV_XDP_DOORBELL_FULL] = "xdp_xmit_doorbell_full",
+	[L3_EV_TX_DOORBELL_FULL] = "tx_doorbell_full",
+	[L3_EV_RX_RING_FULL] = "rx_ring_full",
+	[L3_EV_RX_NO_BUFFER] = "rx_no_buffer",
+	[L3_EV_RX_OVERSIZE] = "rx_oversize",
+	[L3_EV_RX_SKB_ALLOC] = "rx_skb_alloc_fail",
+	[L3_EV_XDP_REDIRECT_ERR] = "xdp_redirect_err",
+	[L3_EV_XDP_TX_ERR] = "xdp_tx_err",
+	[L3_EV_XDP_DROP] = "xdp_drop",
+};
 
 /*
  * Packet Descriptor Structure
  *
- * Represents a single entry in the RX or TX ring buffer.
+ * Represents a single entry in the RX ring buffer.
  * Simulates a hardware DMA descriptor that would be used in a real NIC.
  *
+ * A descriptor carries exactly one kind of buffer, so the buffer pointers
+ * share a union tagged by buf_type. That keeps the descriptor at 32 bytes
+ * on 64-bit machines - two descriptors per cache line - instead of the 64+
+ * bytes of one pointer per buffer kind, which matters once the ring grows
+ * to thousands of entries.
+ *
  * Fields:
  * - status: Ownership flag (0=free, L3_OWN_CPU=ready for processing)
- * - skb: Socket buffer (for normal network stack packets and TX tracking)
- * - xdpf: XDP frame (for XDP-redirected packets in workqueue)
- * - page: Page containing packet data (used for XDP processing)
- * - data_len: Length of packet data in bytes
+ * - buf_type: Which union member is valid (L3_RXBUF_*)
+ * - data_len: Length of packet data in bytes (the head buffer only)
  * - data_offset: Offset from page start to packet data (for headroom)
- * - timestamp: When packet was placed in ring (for timing debug)
+ * - frags_len: Bytes in frags after the head buffer (jumbo frames; the
+ *   frags are listed in the head buffer's skb_shared_info), 0 if none
+ * - page: Page containing packet data (copied receive, from our page_pool)
+ * - xdpf: XDP frame owned by the descriptor (zero-copy XDP receive)
+ * - xsk: AF_XDP fill-ring buffer posted to this RX descriptor
+ * - timestamp: When the packet entered the driver (0 if latency_stats was off)
  */
-struct l3_packet {
-	u32 status;
-	struct sk_buff* skb;
-	struct xdp_frame* xdpf;
-	struct page* page;
+struct l3_rx_desc {
+	u16 status;
+	u16 buf_type;
 	u32 data_len;
 	u32 data_offset;
+	u32 frags_len;
+	union {
+		struct page* page;
+		struct xdp_frame* xdpf;
+		struct xdp_buff* xsk;
+	};
 	ktime_t timestamp;
 };
 
+#define L3_RXBUF_NONE   0               /* Descriptor holds no buffer */
+#define L3_RXBUF_PAGE   1               /* page is valid */
+#define L3_RXBUF_XDPF   2               /* xdpf is valid */
+#define L3_RXBUF_XSK    3               /* xsk is valid */
+
 /*
- * Workqueue Item Structure (for XDP redirected packets)
+ * TX Descriptor Structure
  *
- * Represents a packet waiting to be transferred from TX to RX ring.
- * This simulates hardware DMA operation for XDP redirected packets.
+ * Represents a single entry in the TX ring buffer. Only tracks what the
+ * simulated DMA engine has to complete; the packet data itself travels
+ * through the doorbell. 16 bytes, four descriptors per cache line.
  *
  * Fields:
- * - work: Work structure for workqueue
- * - priv: Pointer to device private data
- * - xdpf: XDP frame to be processed
- * - ts_queued: Timestamp when queued to workqueue
+ * - status: Ownership flag (0=in flight, L3_OWN_CPU=ready to complete)
+ * - buf_type: Which union member is valid (L3_TXBUF_*); L3_TXBUF_NONE
+ *   means the descriptor is free for ndo_start_xmit / AF_XDP TX
+ * - data_len: Length of an AF_XDP TX buffer in bytes
+ * - skb: Socket buffer to free on completion
+ * - xsk_data: AF_XDP TX ring buffer carried by this TX descriptor
  */
-struct l3_work_item {
-	struct work_struct work;
-	struct l3_napi_adapter* priv;
-	struct xdp_frame* xdpf;
-	ktime_t ts_queued;
+struct l3_tx_desc {
+	u16 status;
+	u16 buf_type;
+	u32 data_len;
+	union {
+		struct sk_buff* skb;
+		void* xsk_data;
+	};
 };
 
+#define L3_TXBUF_NONE   0               /* Descriptor is free */
+#define L3_TXBUF_SKB    1               /* skb is valid */
+#define L3_TXBUF_XSK    2               /* xsk_data is valid */
+
 /*
- * Loopback Work Item Structure (for locally transmitted packets)
+ * Doorbell Slot Structure
  *
- * For loopback traffic (ndo_start_xmit), we don't use xdp_frame.
- * Instead, we just copy the skb data directly.
+ * One entry of a queue's doorbell ring. The doorbell ring is how the
+ * "host" side (ndo_xdp_xmit / ndo_start_xmit) hands packets to the
+ * simulated DMA engine (the doorbell worker) without allocating memory.
  *
  * Fields:
- * - work: Work structure for workqueue
- * - priv: Pointer to device private data
- * - data: Packet data
- * - len: Packet length
- * - ts_queued: Timestamp when queued to workqueue
- */
-struct l3_loopback_item {
-	struct work_struct work;
-	struct l3_napi_adapter* priv;
-	unsigned char* data;
-	u32 len;
+ * - seq: Slot sequence number; tells producers and the consumer whose
+ *        turn it is to use the slot (see l3_doorbell_push)
+ * - ptr: The xdp_frame, sk_buff or AF_XDP buffer carried by this slot
+ * - type: L3_DB_XDP_FRAME, L3_DB_SKB or L3_DB_XSK
+ * - tx_entry: TX ring descriptor to complete once an skb or AF_XDP
+ *             buffer has been copied
+ * - ts_queued: Timestamp when the packet was handed to the doorbell
+ */
+struct l3_db_slot {
+	unsigned long seq;
+	void* ptr;
+	u32 type;
+	u32 tx_entry;
 	ktime_t ts_queued;
 };
 
+#define L3_DB_XDP_FRAME 0               /* ptr is a struct xdp_frame */
+#define L3_DB_SKB       1               /* ptr is a struct sk_buff on the TX ring */
+#define L3_DB_XSK       2               /* ptr is AF_XDP TX data, length in tx_ring */
+
+/*
+ * Doorbell Ring Structure
+ *
+ * A preallocated, bounded multi-producer / single-consumer ring.
+ * Producers (any CPU transmitting to this queue) claim a slot with one
+ * cmpxchg on head and publish it by bumping the slot's seq; the single
+ * consumer (this queue's doorbell worker) owns tail and needs no atomics.
+ * head and tail sit on separate cache lines so producers and the consumer
+ * do not false-share. The slot array is allocated in ndo_open, sized to
+ * the RX ring (but at least L3_DB_SIZE), and its pointer and mask sit on
+ * a third, read-mostly line.
+ */
+struct l3_doorbell {
+	atomic_long_t head ____cacheline_aligned_in_smp;     /* Next slot to claim (producers) */
+	unsigned long tail ____cacheline_aligned_in_smp;     /* Next slot to drain (consumer) */
+	struct l3_db_slot* slots ____cacheline_aligned_in_smp;
+	unsigned long mask;                                  /* Number of slots - 1 */
+};
+
+/*
+ * Per-Queue Statistics
+ *
+ * Written only by the queue's own NAPI poll (single writer), read by
+ * ndo_get_stats64 on any CPU. The u64_stats_sync makes 64-bit reads
+ * consistent on 32-bit machines and compiles away on 64-bit ones.
+ */
+struct l3_queue_stats {
+	u64 rx_packets;
+	u64 rx_bytes;
+	u64 tx_packets;
+	u64 tx_bytes;
+	struct u64_stats_sync syncp;
+};
+
+/*
+ * Per-CPU Instrumentation
+ *
+ * Latency histograms and event counters. Every context updates the copy
+ * of the CPU it runs on with this_cpu_inc()/this_cpu_add(), which needs
+ * neither locks nor atomics; readers sum over all CPUs. Reads are not
+ * synchronized against updates, which is fine for statistics.
+ *
+ * lat[stage][b] counts samples with fls64(ns) == b, i.e. latencies in
+ * [2^(b-1), 2^b) ns (bucket 0 holds 0 ns).
+ */
+struct l3_pcpu_stats {
+	u64 lat[L3_LAT_NUM_STAGES][L3_LAT_BUCKETS];
+	u64 events[L3_NUM_EVENTS];
+};
+
+/*
+ * Packet Generator State (debugfs "pktgen")
+ *
+ * The parameters and the result of the most recent run. lock serializes
+ * runs and protects the fields against a concurrent read.
+ *
+ * Fields:
+ * - skb_mode: Inject skbs through ndo_start_xmit (loopback) instead of
+ *   xdp_frames into the doorbell (the ndo_xdp_xmit path)
+ * - frames/size/cpus/ttl: Frames per CPU, frame size, CPUs, IP TTL
+ * - sent: Frames actually injected (all CPUs)
+ * - retries: Times an injector found the doorbell/TX ring full
+ * - elapsed_ns: First injection to last frame consumed by NAPI
+ * - err: 0, or why the run stopped early
+ * - abort: Set to stop the injector threads
+ */
+struct l3_pktgen {
+	struct mutex lock;
+	bool skb_mode;
+	u64 frames;
+	u32 size;
+	u32 cpus;
+	u32 ttl;
+	u64 sent;
+	u64 retries;
+	u64 elapsed_ns;
+	int err;
+	bool abort;
+};
+
+/*
+ * Queue Pair Structure
+ *
+ * One RX/TX ring pair together with everything needed to service it
+ * independently of the other queues. Aligned to a cache line so that
+ * two queues processed on different CPUs never false-share.
+ *
+ * Within a queue, the ring indices are grouped by the context that writes
+ * them and each group starts a new cache line: the doorbell worker
+ * (RX producer), the transmit paths (TX producer, under lock) and NAPI
+ * (RX and TX consumer). Each side only ever reads the other sides' lines,
+ * so a producer bumping its index no longer invalidates the line holding
+ * the consumer's. The ring sizes and pointers above them are written only
+ * in ndo_open and are shared read-only by everyone.
+ *
+ * Fields:
+ * - napi: NAPI structure for efficient polling
+ * - priv: Back pointer to the owning adapter
+ * - index: Queue number (matches the netdev TX queue and xdp_rxq index)
+ * - rx_ring/tx_ring: Descriptor rings, allocated in ndo_open
+ * - rx_mask/tx_mask: Ring size - 1; ring sizes are powers of two, so an
+ *   index maps to its descriptor with a single AND
+ * - xdp_rxq: XDP RX queue info (required for XDP)
+ * - xdp_rxq_zc: Unregistered copy of xdp_rxq whose memory info is set per
+ *   zero-copy frame before its XDP program runs (NAPI use only)
+ * - page_pool: Source of RX ring pages (created in ndo_open)
+ * - xsk_pool: AF_XDP buffer pool bound to this queue, or NULL
+ * - doorbell: MPSC ring of packets waiting for "DMA"
+ * - doorbell_work: Long-lived worker draining the doorbell (DMA engine)
+ * - irq_tasklet: Tasklet for interrupt simulation (simulates hardware IRQ)
+ * - stats: Packet/byte counters for this queue
+ * - coal_usecs/coal_frames: Effective interrupt coalescing for this queue
+ *   (from ethtool -C, or picked by DIM with adaptive-rx on)
+ * - coal_timer: Fires the fake IRQ rx-usecs after the first frame of a
+ *   coalescing window
+ * - rx_dim: Dynamic interrupt moderation state (adaptive-rx)
+ * - cur_rx: RX ring producer index (doorbell worker)
+ * - db_used_max: Doorbell occupancy high watermark (doorbell worker)
+ * - ts_last_tasklet: When the worker last raised the fake IRQ (latency_stats)
+ * - irq_state: L3_IRQ_MASKED while a raised fake IRQ has not been
+ *   followed by NAPI completing (see l3_irq_fire)
+ * - coal_count: Frames completed since the last fake IRQ (doorbell worker)
+ * - irqs: Fake IRQs raised
+ * - lock: Spinlock serializing TX ring reservation in ndo_start_xmit
+ * - cur_tx: TX ring producer index (under lock)
+ * - dirty_rx/dirty_tx: RX/TX ring consumer indices (NAPI)
+ * - xsk_posted: AF_XDP mode only; RX descriptors before this index have
+ *   a fill-ring buffer posted (written by NAPI, read by the worker)
+ * - rx_used_max: RX ring occupancy high watermark (NAPI)
+ * - ts_last_napi: When the tasklet scheduled NAPI, 0 once the poll saw it
+ * - dim_frames: RX descriptors processed, the packet count fed to DIM
+ */
+struct l3_queue {
+	struct napi_struct napi;
+	struct l3_napi_adapter* priv;
+	u32 index;
+	struct l3_rx_desc* rx_ring;
+	struct l3_tx_desc* tx_ring;
+	u32 rx_mask;
+	u32 tx_mask;
+	struct xdp_rxq_info xdp_rxq;
+	struct xdp_rxq_info xdp_rxq_zc;
+	struct page_pool* page_pool;
+	struct xsk_buff_pool* xsk_pool;
+
+	struct l3_doorbell doorbell;           /* Host → DMA engine hand-off */
+	struct work_struct doorbell_work;      /* Simulated DMA engine */
+	struct tasklet_struct irq_tasklet;     /* Tasklet for fake IRQ */
+	struct l3_queue_stats stats;
+
+	u32 coal_usecs;            /* Written by ethtool -C / DIM only */
+	u32 coal_frames;
+	struct hrtimer coal_timer;
+	struct dim rx_dim;
+
+	/* RX producer: doorbell worker */
+	u32 cur_rx ____cacheline_aligned_in_smp;   /* Next RX descriptor to fill */
+	u32 db_used_max;
+	ktime_t ts_last_tasklet;   /* Latency stats */
+	unsigned long irq_state;   /* Also cleared by NAPI */
+	u32 coal_count;
+	u32 irqs;
+
+	/* TX producer: ndo_start_xmit and AF_XDP TX */
+	spinlock_t lock ____cacheline_aligned_in_smp;
+	u32 cur_tx;                /* Next TX descriptor to fill */
+
+	/* Consumer: NAPI poll */
+	u32 dirty_rx ____cacheline_aligned_in_smp; /* Next RX descriptor to process */
+	u32 dirty_tx;              /* Next TX descriptor to complete */
+	u32 xsk_posted;            /* AF_XDP: next RX descriptor to post a buffer to */
+	u32 rx_used_max;
+	ktime_t ts_last_napi;      /* Latency stats */
+	u64 dim_frames;
+} ____cacheline_aligned_in_smp;
+
 /*
  * Device Private Data Structure
  *
@@ -139,39 +598,288 @@ struct l3_loopback_item {
  * This is allocated when the device is created and freed when destroyed.
  *
  * Fields:
- * - napi: NAPI structure for efficient polling
  * - netdev: Pointer to the network device structure
- * - lock: Spinlock for protecting ring buffer access
- * - xdp_prog: Attached XDP program (if any)
- * - xdp_rxq: XDP RX queue info (required for XDP)
- * - rx_ring/tx_ring: Ring buffers for packet descriptors
- * - cur_rx/dirty_rx: RX ring producer/consumer indices
- * - cur_tx/dirty_tx: TX ring producer/consumer indices
+ * - xdp_prog: Attached XDP program (if any), shared by all queues
  * - doorbell_wq: Workqueue for doorbell processing (simulates hardware DMA)
- * - irq_tasklet: Tasklet for interrupt simulation (simulates hardware IRQ)
- * - ts_last_tasklet: Timestamp of last tasklet schedule
- * - ts_last_napi: Timestamp of last NAPI schedule
+ * - num_queues: Number of entries in queues[]
+ * - queues: Array of queue pairs
+ * - rx_ring_size/tx_ring_size: Descriptors per ring (ethtool -g/-G)
+ * - rx_coalesce_usecs/rx_max_frames: ethtool -C rx-usecs / rx-frames
+ * - rx_dim_enabled: ethtool -C adaptive-rx (DIM picks per-queue values)
+ * - pktgen: Built-in traffic source, see l3_pktgen_run()
+ * - rings_ready: Set once ndo_open has set up every queue. netif_running()
+ *   is already true while ndo_open runs, so ndo_xdp_xmit must not rely
+ *   on it alone to know the doorbells exist.
+ * - pcpu: Per-CPU latency histograms and event counters
+ * - debugfs_dir: /sys/kernel/debug/<ifname>
  */
 struct l3_napi_adapter {
-	struct napi_struct napi;
 	struct net_device* netdev;
-	spinlock_t lock;
 	struct bpf_prog* xdp_prog;
-	struct xdp_rxq_info xdp_rxq;
-
-	struct l3_packet rx_ring[NUM_DESC];
-	struct l3_packet tx_ring[NUM_DESC];
+	struct workqueue_struct* doorbell_wq;  /* Workqueue for doorbell processing */
 
-	u32 cur_rx, dirty_rx;      /* RX ring: cur_rx=next to fill, dirty_rx=next to process */
-	u32 cur_tx, dirty_tx;      /* TX ring: cur_tx=next to fill, dirty_tx=next to complete */
+	u32 num_queues;
+	struct l3_queue* queues;
+	u32 rx_ring_size;
+	u32 tx_ring_size;
+	u32 rx_coalesce_usecs;
+	u32 rx_max_frames;
+	bool rx_dim_enabled;
+	bool rings_ready;
 
-	struct workqueue_struct* doorbell_wq;  /* Workqueue for doorbell processing */
-	struct tasklet_struct irq_tasklet;     /* Tasklet for fake IRQ */
+	struct l3_pktgen pktgen;
 
-	ktime_t ts_last_tasklet;   /* Timing debug */
-	ktime_t ts_last_napi;      /* Timing debug */
+	struct l3_pcpu_stats __percpu* pcpu;
+	struct dentry* debugfs_dir;
 };
 
+/*
+ * Instrumentation Helpers
+ *
+ * l3_lat_now() returns 0 while latency_stats is off, and l3_lat_record()
+ * ignores samples whose start or end is 0, so a disabled build of the
+ * hot path costs one load and branch per timestamp and never reads the
+ * clock. Toggling at runtime only loses the samples in flight.
+ */
+static inline ktime_t l3_lat_now(void)
+{
+	return READ_ONCE(latency_stats) ? ktime_get() : 0;
+}
+
+static void l3_lat_record(struct l3_napi_adapter* priv, enum l3_lat_stage stage,
+	ktime_t start, ktime_t end)
+{
+	s64 ns;
+
+	if (!start || !end)
+		return;
+
+	ns = ktime_to_ns(ktime_sub(end, start));
+	if (ns < 0)
+		ns = 0;
+
+	this_cpu_inc(priv->pcpu->lat[stage][min_t(u32, fls64(ns), L3_LAT_BUCKETS - 1)]);
+}
+
+static inline void l3_count(struct l3_napi_adapter* priv, enum l3_event ev, u32 n)
+{
+	this_cpu_add(priv->pcpu->events[ev], n);
+}
+
+/*
+ * RX Page Allocation
+ *
+ * Takes a page from the queue's page_pool. The pool's allocation cache is
+ * lockless and assumes a single consumer; that consumer is the queue's
+ * doorbell worker, which is the only context that fills the RX ring.
+ */
+static struct page* l3_rx_alloc_page(struct l3_queue* q)
+{
+	return page_pool_alloc_pages(q->page_pool, GFP_KERNEL | __GFP_NOWARN);
+}
+
+/*
+ * RX Page Recycling
+ *
+ * Returns a page to the queue's page_pool once we are done with it.
+ * allow_direct is false because the pool's lockless cache belongs to the
+ * allocator (the doorbell worker), not to NAPI; the page goes into the
+ * pool's ptr_ring and is picked up by the next allocation.
+ */
+static void l3_rx_recycle_page(struct l3_queue* q, struct page* page)
+{
+	page_pool_put_full_page(q->page_pool, page, false);
+}
+
+/*
+ * RX Frags
+ *
+ * A copied jumbo frame is a head page plus whole pages chained as frags
+ * in the skb_shared_info at the end of the head page - the same place
+ * xdp_get_shared_info_from_buff() and napi_build_skb() look for it, since
+ * a head page is one PAGE_SIZE frame. The doorbell worker builds the
+ * chain like a NIC scattering a frame over several RX buffers.
+ */
+static struct skb_shared_info* l3_rx_shinfo(struct page* page)
+{
+	return page_address(page) + PAGE_SIZE -
+		SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+}
+
+static void l3_rx_free_frags(struct l3_queue* q, struct skb_shared_info* sinfo)
+{
+	u32 i;
+
+	for (i = 0; i < sinfo->nr_frags; i++)
+		l3_rx_recycle_page(q, skb_frag_page(&sinfo->frags[i]));
+	sinfo->nr_frags = 0;
+}
+
+/* Chain pages for the @len bytes that follow the head buffer */
+static int l3_rx_alloc_frags(struct l3_queue* q, struct skb_shared_info* sinfo, u32 len)
+{
+	sinfo->nr_frags = 0;
+	sinfo->xdp_frags_size = len;
+
+	while (len) {
+		u32 size = min_t(u32, len, PAGE_SIZE);
+		struct page* page;
+
+		if (sinfo->nr_frags == MAX_SKB_FRAGS) {
+			l3_rx_free_frags(q, sinfo);
+			return -EMSGSIZE;
+		}
+
+		page = l3_rx_alloc_page(q);
+		if (!page) {
+			l3_rx_free_frags(q, sinfo);
+			return -ENOMEM;
+		}
+		skb_frag_fill_page_desc(&sinfo->frags[sinfo->nr_frags++], page, 0, size);
+		len -= size;
+	}
+	return 0;
+}
+
+/*
+ * RX Buffer Release
+ *
+ * Drops the buffer behind an RX descriptor once NAPI has built @xdp from
+ * it: a zero-copy descriptor owns the sender's xdp_frame, which goes back
+ * to the sender's memory model (frags included); a copied descriptor owns
+ * a head page and possibly frags from our own pool. The frags are taken
+ * from the xdp_buff, because the program may have trimmed some of them.
+ */
+static void l3_rx_release(struct l3_queue* q, struct xdp_buff* xdp, struct xdp_frame* xdpf)
+{
+	if (xdpf) {
+		xdp_return_frame(xdpf);
+		return;
+	}
+
+	if (xdp_buff_has_frags(xdp))
+		l3_rx_free_frags(q, xdp_get_shared_info_from_buff(xdp));
+	l3_rx_recycle_page(q, virt_to_page(xdp->data_hard_start));
+}
+
+/*
+ * Doorbell Ring Operations
+ *
+ * PURPOSE:
+ * Lock-free hand-off of packets from the transmit side to the doorbell
+ * worker, replacing the per-packet kmalloc'd work items.
+ *
+ * ALGORITHM (bounded MPSC ring with per-slot sequence numbers):
+ * - Slot i starts with seq == i, meaning "free for position i".
+ * - A producer reads head; if slots[head].seq == head the slot is free and
+ *   it claims it with cmpxchg(head, head + 1). It then fills the slot and
+ *   publishes it with a release store of seq = head + 1.
+ * - The consumer at position tail waits for seq == tail + 1, reads the
+ *   slot and hands it back to producers with seq = tail + size,
+ *   i.e. "free for the position one lap later".
+ * A producer that sees seq < head knows the ring is full and fails
+ * immediately instead of spinning.
+ */
+static void l3_doorbell_init(struct l3_doorbell* db)
+{
+	unsigned long i;
+
+	atomic_long_set(&db->head, 0);
+	db->tail = 0;
+	for (i = 0; i <= db->mask; i++)
+		db->slots[i].seq = i;
+}
+
+/*
+ * l3_doorbell_push - Claim and publish one slot
+ *
+ * Safe against any number of concurrent producers. Returns -ENOSPC if the
+ * ring is full.
+ */
+static int l3_doorbell_push(struct l3_doorbell* db, void* ptr, u32 type,
+	u32 tx_entry, ktime_t ts_queued)
+{
+	unsigned long pos = atomic_long_read(&db->head);
+	struct l3_db_slot* slot;
+
+	for (;;) {
+		long diff;
+
+		slot = &db->slots[pos & db->mask];
+		diff = (long)(smp_load_acquire(&slot->seq) - pos);
+
+		if (diff == 0) {
+			/* Slot is free for this position: try to claim it */
+			if (atomic_long_try_cmpxchg(&db->head, (long*)&pos, pos + 1))
+				break;
+			/* Lost the race, pos now holds the new head */
+		}
+		else if (diff < 0) {
+			/* Consumer has not freed this slot yet: ring full */
+			return -ENOSPC;
+		}
+		else {
+			/* Another producer claimed it, reload head */
+			pos = atomic_long_read(&db->head);
+		}
+	}
+
+	slot->ptr = ptr;
+	slot->type = type;
+	slot->tx_entry = tx_entry;
+	slot->ts_queued = ts_queued;
+
+	/* Publish: the consumer may read the slot once it sees this seq */
+	smp_store_release(&slot->seq, pos + 1);
+	return 0;
+}
+
+/*
+ * l3_doorbell_peek - Return the next published slot, or NULL
+ *
+ * Consumer only. The slot stays owned by the consumer until
+ * l3_doorbell_pop() hands it back, so the caller may still decide to
+ * leave it in the ring (e.g. when the RX ring is full).
+ */
+static struct l3_db_slot* l3_doorbell_peek(struct l3_doorbell* db)
+{
+	struct l3_db_slot* slot = &db->slots[db->tail & db->mask];
+
+	if (smp_load_acquire(&slot->seq) != db->tail + 1)
+		return NULL;  /* Empty, or producer still filling the slot */
+	return slot;
+}
+
+static void l3_doorbell_pop(struct l3_doorbell* db, struct l3_db_slot* slot)
+{
+	/* Free the slot for the producer one lap ahead */
+	smp_store_release(&slot->seq, db->tail + db->mask + 1);
+	WRITE_ONCE(db->tail, db->tail + 1);
+}
+
+/*
+ * l3_doorbell_pending - Has anything been posted that is not drained yet?
+ *
+ * May be called from any context (NAPI uses it); only a hint, since
+ * producers can post more at any time.
+ */
+static bool l3_doorbell_pending(struct l3_doorbell* db)
+{
+	return (unsigned long)atomic_long_read(&db->head) != READ_ONCE(db->tail);
+}
+
+/*
+ * l3_doorbell_kick - Ring the doorbell
+ *
+ * Makes sure the queue's doorbell worker runs. queue_work() is a single
+ * test_and_set_bit when the worker is already pending, so calling this
+ * once per batch is cheap.
+ */
+static void l3_doorbell_kick(struct l3_queue* q)
+{
+	queue_work(q->priv->doorbell_wq, &q->doorbell_work);
+}
+
 /*
  * ARP Packet Structure
  *
@@ -197,6 +905,9 @@ struct arp_packet {
  * - 10.0.0.1 → v-cbr (client interface)
  * - 10.0.0.2 → v-lbr (listener interface)
  *
+ * Only used in legacy redirect mode (xdp_native_redirect=0); the native
+ * path trusts the devmap entry chosen by the XDP program instead.
+ *
  * PARAMETERS:
  * @priv: Device private data
  * @data: Pointer to start of packet data
@@ -278,122 +989,762 @@ static int l3_get_redirect_ifindex(struct l3_napi_adapter* priv, void* data, voi
 }
 
 /*
- * NAPI Poll Function
+ * TX Ring Cleanup
  *
  * PURPOSE:
- * This is the heart of the driver's packet processing.
- * Called by the kernel when NAPI is scheduled (after fake IRQ fires).
- * Processes packets from the RX ring and completes TX operations.
+ * Completes, in ring order, the TX descriptors the doorbell worker has
+ * finished with. skbs are freed; AF_XDP descriptors are counted and
+ * returned to the socket's completion ring in a single update, which is
+ * correct because the completion ring expects them in the order they
+ * were taken from the TX ring.
  *
- * NAPI BENEFITS:
- * - Batches packet processing for efficiency
- * - Reduces interrupt overhead
- * - Provides backpressure under load
+ * Called from NAPI, and with NAPI disabled when a queue is reconfigured
+ * or stopped; never concurrently with itself.
  *
  * PARAMETERS:
- * @napi: NAPI structure
- * @budget: Maximum number of packets to process in this poll
- *
- * RETURNS:
- * Number of packets actually processed
- *
- * PROCESSING STEPS:
- * 1. Process RX ring (receive packets)
- *    - Check descriptor ownership
- *    - Run XDP program on packet
- *    - Handle XDP verdict (PASS or REDIRECT)
- * 2. Process TX ring (complete transmissions)
- *    - Free transmitted packets
- *    - Update statistics
- * 3. Re-enable interrupts if work is done
+ * @q: Queue to clean
+ * @packets, @bytes: Incremented by what was completed
  */
-static int l3_napi_poll(struct napi_struct* napi, int budget)
+static void l3_tx_clean(struct l3_queue* q, u64* packets, u64* bytes)
 {
-	struct l3_napi_adapter* priv = container_of(napi, struct l3_napi_adapter, napi);
-	struct net_device* dev = priv->netdev;
-	int work_done = 0;
-	int xdp_redirects = 0;
+	u32 xsk_done = 0;
 	u32 entry;
-	
 
-#if TIMING_DEBUG
-	ktime_t ts_poll_start = ktime_get();
-	{
-		s64 delta_ns = ktime_to_ns(ktime_sub(ts_poll_start, priv->ts_last_napi));
-		if (delta_ns > 1000000) {  /* > 1ms */
-			printk(KERN_INFO "l3loop: NAPI poll called, %lld ns since last NAPI schedule\n", delta_ns);
-		}
-	}
-#endif
+	while (q->dirty_tx != READ_ONCE(q->cur_tx)) {
+		struct l3_tx_desc* txd;
 
-	/*
-	 * RX RING PROCESSING
-	 * Process packets until budget exhausted or ring empty
-	 */
-	while (work_done < budget && priv->dirty_rx != priv->cur_rx) {
-		entry = priv->dirty_rx % NUM_DESC;
+		entry = q->dirty_tx & q->tx_mask;
+		txd = &q->tx_ring[entry];
 
-		/* Check if descriptor is ready (owned by CPU) */
-		if (READ_ONCE(priv->rx_ring[entry].status) != L3_OWN_CPU) {
-			break;  /* No more packets ready */
-		}
+		/* Check if TX completion is ready */
+		if (READ_ONCE(txd->status) != L3_OWN_CPU)
+			break;
 
-		/* Memory barrier: Ensure status read before data access */
 		rmb();
 
-		struct page* page = priv->rx_ring[entry].page;
-		u32 data_len = priv->rx_ring[entry].data_len;
-		u32 data_offset = priv->rx_ring[entry].data_offset;
-		
-
-#if TIMING_DEBUG
-		ktime_t ts_queued = priv->rx_ring[entry].timestamp;
-		{
-			s64 delta_ns = ktime_to_ns(ktime_sub(ts_poll_start, ts_queued));
-			if (delta_ns > 1000000) {  /* > 1ms */
-				printk(KERN_INFO "l3loop: Processing packet queued %lld ns ago (entry %u)\n",
-					delta_ns, entry);
-			}
-		}
-#endif
+		if (txd->buf_type == L3_TXBUF_SKB) {
+			struct sk_buff* skb = txd->skb;
 
-		if (page) {
-			/* Clear descriptor (mark as processed) */
-			priv->rx_ring[entry].page = NULL;
-			priv->rx_ring[entry].data_len = 0;
-			priv->rx_ring[entry].data_offset = 0;
-			priv->rx_ring[entry].status = 0;
+			/* Update statistics */
+			(*packets)++;
+			*bytes += skb->len;
 
-			/*
-			 * XDP PROGRAM EXECUTION
-			 * Build xdp_buff and run attached XDP program
-			 */
-			struct xdp_buff xdp;
-			struct bpf_prog* prog;
-			u32 act;
+			/* Free the sk_buff */
+			dev_consume_skb_any(skb);
+		}
+		else if (txd->buf_type == L3_TXBUF_XSK) {
+			/* AF_XDP buffer: the umem owns it, just report it done */
+			(*packets)++;
+			*bytes += txd->data_len;
+			xsk_done++;
+		}
+
+		/*
+		 * Clear status before handing the descriptor back: once
+		 * buf_type reads NONE a producer may reuse it, and the worker
+		 * may then mark it OWN_CPU again.
+		 */
+		txd->status = 0;
+		txd->skb = NULL;
+		smp_wmb();
+		WRITE_ONCE(txd->buf_type, L3_TXBUF_NONE);
+		q->dirty_tx++;
+	}
+
+	if (xsk_done)
+		xsk_tx_completed(q->xsk_pool, xsk_done);
+}
+
+/*
+ * AF_XDP RX Refill
+ *
+ * PURPOSE:
+ * Posts buffers from the socket's fill ring to free RX descriptors, the
+ * way a NIC driver hands receive buffers to its hardware. The doorbell
+ * worker then writes incoming packets into the posted buffers.
+ *
+ * Only NAPI allocates from and frees to the XSK pool: its free lists are
+ * not locked, so the worker must never call xsk_buff_alloc() itself.
+ *
+ * RETURNS:
+ * Number of buffers posted
+ */
+static int l3_xsk_refill(struct l3_queue* q)
+{
+	struct xsk_buff_pool* pool = q->xsk_pool;
+	u32 posted = q->xsk_posted;
+	int n = 0;
+
+	/* A descriptor is free once NAPI has consumed it (dirty_rx passed it) */
+	while (posted - q->dirty_rx <= q->rx_mask) {
+		struct xdp_buff* xdp = xsk_buff_alloc(pool);
+
+		if (!xdp)
+			break;  /* Fill ring empty */
+
+		q->rx_ring[posted & q->rx_mask].xsk = xdp;
+		q->rx_ring[posted & q->rx_mask].buf_type = L3_RXBUF_XSK;
+		posted++;
+		n++;
+	}
+
+	/* Publish the buffers before the worker may use them */
+	if (n)
+		smp_store_release(&q->xsk_posted, posted);
+
+	/*
+	 * need_wakeup: ask userspace to kick us (XDP_WAKEUP_RX) once it has
+	 * refilled the fill ring, instead of polling the ring ourselves.
+	 */
+	if (xsk_uses_need_wakeup(pool)) {
+		if (posted - q->dirty_rx <= q->rx_mask)
+			xsk_set_rx_need_wakeup(pool);
+		else
+			xsk_clear_rx_need_wakeup(pool);
+	}
+
+	return n;
+}
+
+/*
+ * XDP Verdict Check
+ *
+ * ABORTED and unknown verdicts are drops, but not silent ones: like any
+ * driver we report them through the xdp:xdp_exception tracepoint (and
+ * warn once about an unknown action). Call with the RCU read lock still
+ * held, since both use the program.
+ *
+ * RETURNS:
+ * The verdict to carry out: the program's, or XDP_DROP
+ */
+static u32 l3_xdp_check_act(struct net_device* dev, struct bpf_prog* prog, u32 act)
+{
+	switch (act) {
+	case XDP_PASS:
+	case XDP_DROP:
+	case XDP_TX:
+	case XDP_REDIRECT:
+		return act;
+	default:
+		bpf_warn_invalid_xdp_action(dev, prog, act);
+		fallthrough;
+	case XDP_ABORTED:
+		trace_xdp_exception(dev, prog, act);
+		return XDP_DROP;
+	}
+}
+
+/*
+ * AF_XDP RX Processing
+ *
+ * PURPOSE:
+ * Runs the XDP program on a packet the worker wrote into a fill-ring
+ * buffer and carries out the verdict. XDP_REDIRECT into an XSKMAP only
+ * queues the buffer's address on the socket's RX ring (zero copy);
+ * XDP_PASS copies the packet into an skb and XDP_TX into an xdp_frame of
+ * its own; both free the buffer back to the pool. Without a program the
+ * packet goes to the stack.
+ *
+ * PARAMETERS:
+ * @q: Queue the descriptor belongs to
+ * @xdp: The filled XSK buffer (ownership passes to this function)
+ * @len: Packet length written by the worker
+ *
+ * RETURNS:
+ * XDP_REDIRECT, XDP_TX or XDP_PASS if the packet was delivered, XDP_DROP
+ * if not
+ */
+static u32 l3_xsk_rx(struct l3_queue* q, struct xdp_buff* xdp, u32 len)
+{
+	struct net_device* dev = q->priv->netdev;
+	struct bpf_prog* prog;
+	struct sk_buff* skb;
+	u32 act;
+
+	/*
+	 * The buffer's rxq (set by xsk_pool_set_rxq_info) is our xdp_rxq,
+	 * registered as MEM_TYPE_XSK_BUFF_POOL while the socket is bound.
+	 * No DMA sync is needed: the "DMA" was a CPU copy.
+	 */
+	xsk_buff_set_size(xdp, len);
+
+	rcu_read_lock();
+	prog = READ_ONCE(q->priv->xdp_prog);
+	act = prog ? l3_xdp_check_act(dev, prog, bpf_prog_run_xdp(prog, xdp)) : XDP_PASS;
+
+	if (act == XDP_REDIRECT) {
+		if (!xdp_do_redirect(dev, xdp, prog)) {
+			rcu_read_unlock();
+			return XDP_REDIRECT;
+		}
+		rcu_read_unlock();
+		l3_count(q->priv, L3_EV_XDP_REDIRECT_ERR, 1);
+		xsk_buff_free(xdp);
+		return XDP_DROP;
+	}
+	rcu_read_unlock();
+
+	if (act == XDP_TX) {
+		/*
+		 * The umem buffer can't leave the socket's pool: copy it into a
+		 * page-backed frame (which also frees the buffer) and send that
+		 * the way the copy path sends its frames.
+		 */
+		struct xdp_frame* xdpf = xdp_convert_zc_to_xdp_frame(xdp);
+
+		if (!xdpf) {
+			l3_count(q->priv, L3_EV_XDP_TX_ERR, 1);
+			xsk_buff_free(xdp);
+			return XDP_DROP;
+		}
+		if (l3_doorbell_push(&q->doorbell, xdpf, L3_DB_XDP_FRAME, 0, l3_lat_now())) {
+			l3_count(q->priv, L3_EV_XDP_TX_ERR, 1);
+			xdp_return_frame(xdpf);
+			return XDP_DROP;
+		}
+		return XDP_TX;
+	}
+
+	if (act != XDP_PASS) {
+		l3_count(q->priv, L3_EV_XDP_DROP, 1);
+		xsk_buff_free(xdp);
+		return XDP_DROP;
+	}
+
+	/* The umem buffer must go back to userspace: copy out for the stack */
+	len = xdp->data_end - xdp->data;
+	skb = napi_alloc_skb(&q->napi, len);
+	if (!skb) {
+		l3_count(q->priv, L3_EV_RX_SKB_ALLOC, 1);
+		xsk_buff_free(xdp);
+		return XDP_DROP;
+	}
+	skb_put_data(skb, xdp->data, len);
+	xsk_buff_free(xdp);
+
+	skb->protocol = eth_type_trans(skb, dev);
+	napi_gro_receive(&q->napi, skb);
+	return XDP_PASS;
+}
+
+/*
+ * AF_XDP TX
+ *
+ * PURPOSE:
+ * Moves descriptors from the socket's TX ring onto the queue's TX ring
+ * and posts them to the doorbell, exactly like ndo_start_xmit does with
+ * skbs. The doorbell worker copies the data into the RX ring (loopback)
+ * and marks the TX descriptor complete; l3_tx_clean() then reports the
+ * buffer on the socket's completion ring.
+ *
+ * A descriptor is only peeked once a TX ring entry is known to be free,
+ * because xsk_tx_peek_desc() consumes it from the socket for good.
+ *
+ * RETURNS:
+ * true if the budget ran out (more descriptors may be waiting)
+ */
+static bool l3_xsk_xmit(struct l3_queue* q, int budget)
+{
+	struct xsk_buff_pool* pool = q->xsk_pool;
+	ktime_t ts_xmit = l3_lat_now();
+	struct xdp_desc desc;
+	unsigned long flags;
+	u32 tx_entry;
+	int sent = 0;
+
+	/* Shares the TX ring with ndo_start_xmit */
+	spin_lock_irqsave(&q->lock, flags);
+
+	while (sent < budget) {
+		void* data;
+
+		tx_entry = q->cur_tx & q->tx_mask;
+		if (READ_ONCE(q->tx_ring[tx_entry].buf_type) != L3_TXBUF_NONE)
+			break;  /* TX ring full, completions will bring us back */
+
+		if (!xsk_tx_peek_desc(pool, &desc))
+			break;  /* Socket TX ring empty */
+
+		data = xsk_buff_raw_get_data(pool, desc.addr);
+		q->tx_ring[tx_entry].xsk_data = data;
+		q->tx_ring[tx_entry].data_len = desc.len;
+		q->tx_ring[tx_entry].buf_type = L3_TXBUF_XSK;
+		q->tx_ring[tx_entry].status = 0;
+
+		/*
+		 * The descriptor already left the socket's TX ring, so it must
+		 * be completed even if the doorbell is full: complete it at
+		 * once and let it count as sent-and-lost.
+		 */
+		if (l3_doorbell_push(&q->doorbell, data, L3_DB_XSK, tx_entry, ts_xmit)) {
+			l3_count(q->priv, L3_EV_TX_DOORBELL_FULL, 1);
+			q->tx_ring[tx_entry].status = L3_OWN_CPU;
+		}
+
+		WRITE_ONCE(q->cur_tx, q->cur_tx + 1);
+		sent++;
+	}
+
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	if (sent) {
+		/* Let userspace reuse the TX ring slots, then ring the doorbell */
+		xsk_tx_release(pool);
+		l3_doorbell_kick(q);
+	}
+
+	if (xsk_uses_need_wakeup(pool))
+		xsk_set_tx_need_wakeup(pool);
+
+	return sent == budget;
+}
+
+/*
+ * XDP_PASS skb Construction
+ *
+ * PURPOSE:
+ * Hands an RX buffer to the network stack without copying the packet.
+ * - Copied descriptors (one of our page_pool pages): napi_build_skb()
+ *   wraps the page, skb_reserve() keeps the XDP headroom (including any
+ *   change the program made with bpf_xdp_adjust_head) and the skb is
+ *   marked for page_pool recycling, so freeing it returns the page to
+ *   our pool. A jumbo frame's frag pages become the skb's page frags.
+ * - Zero-copy descriptors (the sender's xdp_frame): the frame is first
+ *   refreshed from the xdp_buff, then xdp_build_skb_from_frame() builds
+ *   the skb around the sender's buffer (it also handles recycling into
+ *   the sender's page_pool)
+ *
+ * RETURNS:
+ * The skb, with protocol set; NULL if it could not be built, in which
+ * case the buffer has been released
+ */
+static struct sk_buff* l3_build_rx_skb(struct l3_queue* q, struct xdp_buff* xdp,
+	struct xdp_frame* xdpf)
+{
+	struct net_device* dev = q->priv->netdev;
+	struct sk_buff* skb;
+	u32 metasize;
+
+	if (xdpf) {
+		if (xdp_update_frame_from_buff(xdp, xdpf))
+			goto drop;
+
+		skb = xdp_build_skb_from_frame(xdpf, dev);
+		if (!skb)
+			goto drop;
+	}
+	else {
+		/*
+		 * The head page's skb_shared_info becomes the skb's. Building
+		 * the skb clears nr_frags but keeps the frag array, so count
+		 * the frags first and put them back afterwards.
+		 */
+		struct skb_shared_info* sinfo = xdp_get_shared_info_from_buff(xdp);
+		u32 nr_frags = xdp_buff_has_frags(xdp) ? sinfo->nr_frags : 0;
+
+		skb = napi_build_skb(xdp->data_hard_start, xdp->frame_sz);
+		if (!skb)
+			goto drop;
+
+		skb_reserve(skb, xdp->data - xdp->data_hard_start);
+		__skb_put(skb, xdp->data_end - xdp->data);
+
+		metasize = xdp->data - xdp->data_meta;
+		if (metasize)
+			skb_metadata_set(skb, metasize);
+
+		if (nr_frags)
+			xdp_update_skb_shared_info(skb, nr_frags, sinfo->xdp_frags_size,
+				nr_frags * PAGE_SIZE, xdp_buff_is_frag_pfmemalloc(xdp));
+
+		skb_mark_for_recycle(skb);
+		skb->protocol = eth_type_trans(skb, dev);
+	}
+
+	skb_record_rx_queue(skb, q->index);
+	return skb;
+
+drop:
+	l3_rx_release(q, xdp, xdpf);
+	return NULL;
+}
+
+/*
+ * Interrupt Coalescing and Masking
+ *
+ * PURPOSE:
+ * Decides when the simulated DMA engine raises its fake IRQ, the way a
+ * NIC's interrupt moderation does:
+ * - The IRQ fires once rx-frames frames have completed, or rx-usecs
+ *   after the first frame of the window, whichever comes first.
+ *   rx-usecs 0 fires for every batch the worker finishes.
+ * - Once fired, the IRQ stays masked (L3_IRQ_MASKED) until NAPI completes.
+ *   Frames arriving meanwhile are picked up by the running poll, so the
+ *   worker does not raise a tasklet that would only find NAPI busy.
+ *
+ * MASK / UNMASK RACE:
+ * The worker publishes descriptors, then tests the mask; NAPI clears the
+ * mask, then looks for descriptors. A full barrier on each side makes
+ * sure at least one of them sees the other, so a frame is never left on
+ * the ring with the IRQ unmasked and nobody polling.
+ */
+static void l3_irq_fire(struct l3_queue* q)
+{
+	/* Raised already: the worker and the coalescing timer may race */
+	if (test_and_set_bit(L3_IRQ_MASKED, &q->irq_state))
+		return;
+
+	WRITE_ONCE(q->irqs, q->irqs + 1);
+	WRITE_ONCE(q->ts_last_tasklet, l3_lat_now());
+	tasklet_schedule(&q->irq_tasklet);
+}
+
+static enum hrtimer_restart l3_coal_timer_fn(struct hrtimer* t)
+{
+	struct l3_queue* q = container_of(t, struct l3_queue, coal_timer);
+
+	l3_irq_fire(q);
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * l3_busy_polled - Is a socket busy polling this queue right now?
+ *
+ * A busy-polling socket (SO_BUSY_POLL / net.core.busy_read, or AF_XDP
+ * with SO_PREFER_BUSY_POLL) owns the NAPI instance and calls
+ * l3_napi_poll() itself from its receive calls. A fake IRQ could only
+ * fail to schedule NAPI, so the worker skips it. When the poller lets go,
+ * busy_poll_stop() runs one more poll (or arms the NAPI's deferral timer)
+ * and that poll's napi_complete_done() unmasks as usual.
+ */
+static bool l3_busy_polled(struct l3_queue* q)
+{
+	return test_bit(NAPI_STATE_IN_BUSY_POLL, &q->napi.state);
+}
+
+/*
+ * l3_irq_coalesce - Account completed frames, fire the IRQ if it is due
+ *
+ * Doorbell worker only. @now forces the IRQ (RX ring full: waiting for
+ * the timer would only stall the DMA engine).
+ */
+static void l3_irq_coalesce(struct l3_queue* q, u32 frames, bool now)
+{
+	u32 usecs = READ_ONCE(q->coal_usecs);
+	u32 max_frames = READ_ONCE(q->coal_frames);
+
+	/* Descriptors written above before the mask test, see l3_irq_unmask() */
+	smp_mb();
+	if (test_bit(L3_IRQ_MASKED, &q->irq_state) || l3_busy_polled(q)) {
+		q->coal_count = 0;  /* NAPI is polling and will find them */
+		return;
+	}
+
+	q->coal_count += frames;
+	if (now || !usecs || (max_frames && q->coal_count >= max_frames)) {
+		q->coal_count = 0;
+		hrtimer_try_to_cancel(&q->coal_timer);  /* Window closed early */
+		l3_irq_fire(q);
+		return;
+	}
+
+	/* First frames of a new window: start the rx-usecs clock */
+	if (!hrtimer_is_queued(&q->coal_timer))
+		hrtimer_start(&q->coal_timer, us_to_ktime(usecs), HRTIMER_MODE_REL);
+}
+
+/*
+ * l3_irq_pending - Has the worker completed anything NAPI has not seen?
+ */
+static bool l3_irq_pending(struct l3_queue* q)
+{
+	if (READ_ONCE(q->rx_ring[q->dirty_rx & q->rx_mask].status) == L3_OWN_CPU)
+		return true;
+	return q->dirty_tx != READ_ONCE(q->cur_tx) &&
+		READ_ONCE(q->tx_ring[q->dirty_tx & q->tx_mask].status) == L3_OWN_CPU;
+}
+
+/*
+ * l3_irq_unmask - Re-enable the fake IRQ after napi_complete_done()
+ *
+ * Like a NIC that raises an interrupt at unmask time for events that
+ * arrived while it was masked, fire at once if the worker completed
+ * frames after the poll stopped looking.
+ */
+static void l3_irq_unmask(struct l3_queue* q)
+{
+	clear_bit(L3_IRQ_MASKED, &q->irq_state);
+	smp_mb__after_atomic();
+	if (l3_irq_pending(q))
+		l3_irq_fire(q);
+}
+
+/*
+ * l3_irq_reset - Unmask without polling; queue resume and ndo_open
+ *
+ * A fake IRQ raised while NAPI was disabled never reached a poll, so the
+ * mask it set would otherwise stay set for good.
+ */
+static void l3_irq_reset(struct l3_queue* q)
+{
+	clear_bit(L3_IRQ_MASKED, &q->irq_state);
+	q->coal_count = 0;
+}
+
+/*
+ * Dynamic Interrupt Moderation (adaptive-rx)
+ *
+ * With adaptive-rx on, every completed poll feeds the queue's event
+ * (fake IRQ) and packet counts to net_dim(), which walks a table of
+ * (usecs, frames) profiles towards the one giving the best packet rate
+ * per interrupt and schedules this work to apply it. Needs the kernel's
+ * DIM library (CONFIG_DIMLIB).
+ */
+#if IS_ENABLED(CONFIG_DIMLIB)
+static void l3_rx_dim_work(struct work_struct* work)
+{
+	struct dim* dim = container_of(work, struct dim, work);
+	struct l3_queue* q = container_of(dim, struct l3_queue, rx_dim);
+	struct dim_cq_moder moder = net_dim_get_rx_moderation(dim->mode, dim->profile_ix);
+
+	WRITE_ONCE(q->coal_usecs, moder.usec);
+	WRITE_ONCE(q->coal_frames, moder.pkts);
+	dim->state = DIM_START_MEASURE;
+}
+
+static void l3_rx_dim_update(struct l3_queue* q)
+{
+	struct dim_sample sample = {};
+
+	/* The simulated DMA has no line rate: packets and events drive it */
+	dim_update_sample(READ_ONCE(q->irqs), q->dim_frames, 0, &sample);
+	net_dim(&q->rx_dim, sample);
+}
+#else
+static void l3_rx_dim_work(struct work_struct* work)
+{
+}
+
+static void l3_rx_dim_update(struct l3_queue* q)
+{
+}
+#endif
+
+/*
+ * NAPI Poll Function
+ *
+ * PURPOSE:
+ * This is the heart of the driver's packet processing.
+ * Called by the kernel when NAPI is scheduled (after fake IRQ fires).
+ * Processes packets from the RX ring and completes TX operations.
+ *
+ * NAPI BENEFITS:
+ * - Batches packet processing for efficiency
+ * - Reduces interrupt overhead
+ * - Provides backpressure under load
+ *
+ * Each queue has its own NAPI instance, so this only ever touches the
+ * rings of the queue that owns @napi and needs no lock against the
+ * other queues' pollers.
+ *
+ * PARAMETERS:
+ * @napi: NAPI structure (embedded in struct l3_queue)
+ * @budget: Maximum number of packets to process in this poll
+ *
+ * RETURNS:
+ * Number of packets actually processed
+ *
+ * PROCESSING STEPS:
+ * 1. Process RX ring (receive packets)
+ *    - Check descriptor ownership
+ *    - Run XDP program on packet
+ *    - Handle XDP verdict (PASS or REDIRECT; PASS builds an skb around
+ *      the RX buffer and feeds it to GRO)
+ * 2. Process TX ring (complete transmissions)
+ *    - Free transmitted packets, complete AF_XDP buffers
+ *    - Update statistics
+ * 3. AF_XDP: post fill-ring buffers, pull descriptors from the socket's
+ *    TX ring
+ * 4. Re-enable interrupts (unmask the fake IRQ) if work is done, and let
+ *    DIM look at the poll when adaptive-rx is on
+ */
+static int l3_napi_poll(struct napi_struct* napi, int budget)
+{
+	struct l3_queue* q = container_of(napi, struct l3_queue, napi);
+	struct l3_napi_adapter* priv = q->priv;
+	struct net_device* dev = priv->netdev;
+	int work_done = 0;
+	int xdp_redirects = 0;
+	int refilled = 0;
+	u64 rx_packets = 0, rx_bytes = 0;
+	u64 tx_packets = 0, tx_bytes = 0;
+	u32 entry;
+
+	/*
+	 * Tasklet -> NAPI latency. Only the first poll after a schedule
+	 * counts; repolls (budget exhausted) find ts_last_napi cleared.
+	 */
+	if (q->ts_last_napi) {
+		l3_lat_record(priv, L3_LAT_TASKLET_NAPI, q->ts_last_napi, l3_lat_now());
+		q->ts_last_napi = 0;
+	}
+
+	/* Occupancy high watermark, readable through ethtool -S */
+	if (READ_ONCE(latency_stats)) {
+		u32 used = READ_ONCE(q->cur_rx) - q->dirty_rx;
+
+		if (used > q->rx_used_max)
+			WRITE_ONCE(q->rx_used_max, used);
+	}
+
+	/*
+	 * Frames on our ring may belong to another device's page_pool (zero
+	 * copy), and our own pool is refilled by the doorbell worker rather
+	 * than by this NAPI. Either way, no buffer returned while we poll may
+	 * go into a page_pool's lockless per-NAPI cache, including returns
+	 * done on our behalf by the devmap flush below.
+	 */
+	xdp_set_return_frame_no_direct();
+
+	/*
+	 * RX RING PROCESSING
+	 * Process packets until budget exhausted or ring empty
+	 */
+	while (work_done < budget && q->dirty_rx != READ_ONCE(q->cur_rx)) {
+		entry = q->dirty_rx & q->rx_mask;
+
+		/* Check if descriptor is ready (owned by CPU) */
+		if (READ_ONCE(q->rx_ring[entry].status) != L3_OWN_CPU) {
+			break;  /* No more packets ready */
+		}
+
+		/* Memory barrier: Ensure status read before data access */
+		rmb();
+
+		u16 buf_type = q->rx_ring[entry].buf_type;
+		struct page* page = buf_type == L3_RXBUF_PAGE ? q->rx_ring[entry].page : NULL;
+		struct xdp_frame* rx_xdpf = buf_type == L3_RXBUF_XDPF ? q->rx_ring[entry].xdpf : NULL;
+		struct xdp_buff* rx_xsk = buf_type == L3_RXBUF_XSK ? q->rx_ring[entry].xsk : NULL;
+		u32 data_len = q->rx_ring[entry].data_len;
+		u32 data_offset = q->rx_ring[entry].data_offset;
+		u32 frags_len = q->rx_ring[entry].frags_len;
+		ktime_t ts_queued = q->rx_ring[entry].timestamp;
+
+		/*
+		 * Clear descriptor (mark as processed). status goes first: once
+		 * buf_type reads NONE the worker may refill the descriptor and
+		 * set status again.
+		 */
+		q->rx_ring[entry].page = NULL;
+		q->rx_ring[entry].data_len = 0;
+		q->rx_ring[entry].data_offset = 0;
+		q->rx_ring[entry].frags_len = 0;
+		q->rx_ring[entry].status = 0;
+		smp_wmb();
+		WRITE_ONCE(q->rx_ring[entry].buf_type, L3_RXBUF_NONE);
+
+		if (rx_xsk) {
+			/* AF_XDP fill-ring buffer written by the worker */
+			switch (l3_xsk_rx(q, rx_xsk, data_len)) {
+			case XDP_REDIRECT:
+				xdp_redirects++;
+				break;
+			case XDP_TX:
+				/* Doorbell kicked after the loop, once per poll */
+				tx_packets++;
+				tx_bytes += data_len;
+				break;
+			case XDP_PASS:
+				rx_packets++;
+				rx_bytes += data_len;
+				break;
+			}
+		}
+		else if (page || rx_xdpf) {
+			/*
+			 * XDP PROGRAM EXECUTION
+			 * Build xdp_buff and run attached XDP program
+			 */
+			struct xdp_buff xdp;
+			struct bpf_prog* prog;
+			u32 act;
 
 			rcu_read_lock();
 			prog = READ_ONCE(priv->xdp_prog);
 
-			if (!prog) {
-				/* No XDP program attached, pass to stack */
+			/*
+			 * Build xdp_buff structure for XDP program
+			 *
+			 * Zero-copy descriptors carry the sender's xdp_frame: the
+			 * program runs directly on the sender's buffer, which keeps
+			 * its own headroom and memory model (and its frags, if
+			 * any). Copied descriptors point into one of our
+			 * page_pool pages; a jumbo frame continues in the frags
+			 * the worker chained to it.
+			 *
+			 * Helpers and verdicts that free part of the buffer
+			 * (bpf_xdp_adjust_tail() shrinking frags, convert to a
+			 * frame for TX/redirect) go through xdp.rxq->mem, so a
+			 * zero-copy frame runs with xdp_rxq_zc carrying the
+			 * frame's own memory model: the sender's pages must
+			 * never be released into our page_pool.
+			 */
+			if (rx_xdpf) {
+				xdp_convert_frame_to_buff(rx_xdpf, &xdp);
+				q->xdp_rxq_zc.mem = rx_xdpf->mem;
+				xdp.rxq = &q->xdp_rxq_zc;              /* RX queue info, sender's memory */
+			}
+			else {
+				xdp_init_buff(&xdp, PAGE_SIZE, &q->xdp_rxq);  /* Total buffer size */
+				xdp_prepare_buff(&xdp, page_address(page),   /* Start of buffer */
+					data_offset, data_len, true);            /* Packet, metadata */
+				if (frags_len)
+					xdp_buff_set_frags_flag(&xdp);           /* Multi-buffer */
+			}
+
+			/*
+			 * A program not loaded as xdp.frags would only see the
+			 * head buffer and could not handle the rest: such frames
+			 * are dropped as oversized, the way a NIC drops frames
+			 * larger than its (single) RX buffer. Only a redirected
+			 * frame can get here; our own MTU is kept small enough.
+			 */
+			if (unlikely(prog && xdp_buff_has_frags(&xdp) && !prog->aux->xdp_has_frags)) {
 				rcu_read_unlock();
-				__free_page(page);
+				l3_count(priv, L3_EV_RX_OVERSIZE, 1);
+				l3_rx_release(q, &xdp, rx_xdpf);
 				goto next_rx;
 			}
 
-			/* Build xdp_buff structure for XDP program */
-			void* data = page_address(page) + data_offset;
+			/* Run XDP program (no program attached: pass to stack) */
+			act = prog ? l3_xdp_check_act(dev, prog, bpf_prog_run_xdp(prog, &xdp)) : XDP_PASS;
 
-			xdp.data_hard_start = page_address(page);  /* Start of buffer */
-			xdp.data = data;                            /* Start of packet */
-			xdp.data_end = data + data_len;            /* End of packet */
-			xdp.data_meta = data;                       /* Metadata (unused) */
-			xdp.rxq = &priv->xdp_rxq;                  /* RX queue info */
-			xdp.frame_sz = PAGE_SIZE;                   /* Total buffer size */
+			if (act == XDP_REDIRECT && xdp_native_redirect) {
+				/*
+				 * XDP_REDIRECT (native): honor the program's own verdict
+				 *
+				 * bpf_redirect_map() already recorded the target in the
+				 * per-CPU redirect info; xdp_do_redirect() acts on it
+				 * exactly as in a hardware driver's RX path. For a devmap
+				 * target the frame is only added to the devmap's bulk
+				 * queue; xdp_do_flush() at the end of the poll hands the
+				 * target up to 16 frames per ndo_xdp_xmit() call.
+				 *
+				 * xdp_do_redirect() builds the outgoing frame with the
+				 * memory model of xdp.rxq, which for a zero-copy frame
+				 * is already the sender's (xdp_rxq_zc, set above).
+				 */
+				if (xdp_do_redirect(dev, &xdp, prog)) {
+					rcu_read_unlock();
+					l3_count(priv, L3_EV_XDP_REDIRECT_ERR, 1);
+					l3_rx_release(q, &xdp, rx_xdpf);
+					goto next_rx;
+				}
+				rcu_read_unlock();
 
-			/* Run XDP program */
-			act = bpf_prog_run_xdp(prog, &xdp);
+				xdp_redirects++;
+				goto next_rx;
+			}
 			rcu_read_unlock();
 
 			/*
@@ -401,13 +1752,12 @@ static int l3_napi_poll(struct napi_struct* napi, int budget)
 			 */
 			if (act == XDP_REDIRECT) {
 				/*
-				 * XDP_REDIRECT: Forward packet to another interface
+				 * XDP_REDIRECT (legacy, xdp_native_redirect=0)
 				 *
-				 * We cannot use xdp_do_redirect() here because we're not
-				 * in the original driver RX path. Instead, we manually:
+				 * Ignore the map the program chose and route by hand:
 				 * 1. Determine target interface from packet headers
 				 * 2. Convert xdp_buff to xdp_frame
-				 * 3. Call target device's ndo_xdp_xmit()
+				 * 3. Call target device's ndo_xdp_xmit(), one frame at a time
 				 */
 				int target_ifindex = l3_get_redirect_ifindex(priv, xdp.data, xdp.data_end);
 
@@ -416,19 +1766,38 @@ static int l3_napi_poll(struct napi_struct* napi, int budget)
 					struct xdp_frame* xdpf;
 					int err;
 
-					/* Convert xdp_buff to xdp_frame for transmission */
-					xdpf = xdp_convert_buff_to_frame(&xdp);
-					if (!xdpf) {
-						__free_page(page);
-						goto next_rx;
-					}
-
+					/*
+					 * Convert xdp_buff to xdp_frame for transmission.
+					 * A zero-copy descriptor already has a frame: just
+					 * refresh it with whatever the program changed and
+					 * pass the same buffer on (page ownership transfer).
+					 */
+					if (rx_xdpf) {
+						if (xdp_update_frame_from_buff(&xdp, rx_xdpf)) {
+							l3_count(priv, L3_EV_XDP_REDIRECT_ERR, 1);
+							xdp_return_frame(rx_xdpf);
+							goto next_rx;
+						}
+						xdpf = rx_xdpf;
+					}
+					else {
+						xdpf = xdp_convert_buff_to_frame(&xdp);
+						if (!xdpf) {
+							l3_count(priv, L3_EV_XDP_REDIRECT_ERR, 1);
+							l3_rx_release(q, &xdp, rx_xdpf);
+							goto next_rx;
+						}
+					}
+
 					/* Look up target device and call its ndo_xdp_xmit */
 					rcu_read_lock();
 					target_dev = dev_get_by_index_rcu(dev_net(dev), target_ifindex);
 
-					if (!target_dev || !target_dev->netdev_ops->ndo_xdp_xmit) {
+					if (!target_dev || !target_dev->netdev_ops->ndo_xdp_xmit ||
+						(xdp_frame_has_frags(xdpf) &&
+						 !(target_dev->xdp_features & NETDEV_XDP_ACT_NDO_XMIT_SG))) {
 						rcu_read_unlock();
+						l3_count(priv, L3_EV_XDP_REDIRECT_ERR, 1);
 						xdp_return_frame(xdpf);
 						goto next_rx;
 					}
@@ -446,759 +1815,2321 @@ static int l3_napi_poll(struct napi_struct* napi, int budget)
 					rcu_read_unlock();
 
 					if (err <= 0) {
-						/* Redirect failed, return frame to pool */
+						/* Redirect failed, return frame to its owner's pool */
+						l3_count(priv, L3_EV_XDP_REDIRECT_ERR, 1);
 						xdp_return_frame(xdpf);
 					}
 					else {
 						xdp_redirects++;
-#if TIMING_DEBUG
-						{
-							s64 total_ns = ktime_to_ns(ktime_sub(ktime_get(), ts_queued));
-							if (total_ns > 1000000) {
-								printk(KERN_INFO "l3loop: Redirected packet, total latency %lld ns\n", total_ns);
-							}
-						}
-#endif
 					}
 				}
 				else {
 					/* No route found, drop packet */
-					__free_page(page);
+					l3_count(priv, L3_EV_XDP_REDIRECT_ERR, 1);
+					l3_rx_release(q, &xdp, rx_xdpf);
+				}
+			}
+			else if (act == XDP_TX) {
+				/*
+				 * XDP_TX: Send the frame back out of this queue
+				 *
+				 * l3loop's "wire" is a loopback, so out means back into
+				 * this queue's own doorbell: the buffer is handed over
+				 * without a copy and comes in again on this RX ring.
+				 * A program that bounces every frame therefore loops it
+				 * forever; xdp_bench.c decrements the IP TTL and drops
+				 * at zero.
+				 */
+				u32 pkt_len = xdp_get_buff_len(&xdp);
+				struct xdp_frame* xdpf;
+
+				if (rx_xdpf)
+					xdpf = xdp_update_frame_from_buff(&xdp, rx_xdpf) ? NULL : rx_xdpf;
+				else
+					xdpf = xdp_convert_buff_to_frame(&xdp);
+
+				if (!xdpf || l3_doorbell_push(&q->doorbell, xdpf, L3_DB_XDP_FRAME, 0,
+					l3_lat_now())) {
+					l3_count(priv, L3_EV_XDP_TX_ERR, 1);
+					l3_rx_release(q, &xdp, rx_xdpf);
+				}
+				else {
+					/* Doorbell kicked after the loop, once per poll */
+					tx_packets++;
+					tx_bytes += pkt_len;
 				}
 			}
 			else if (act == XDP_PASS) {
 				/*
 				 * XDP_PASS: Send packet to normal network stack
 				 *
-				 * Convert packet data to sk_buff and deliver via NAPI
+				 * The RX buffer itself becomes the skb (no copy) and
+				 * goes through GRO, so TCP flows over l3loop get
+				 * coalesced like on a real NIC.
 				 */
-				struct sk_buff* skb = netdev_alloc_skb(dev, data_len);
-				if (skb) {
-					void* pkt_data = page_address(page) + (xdp.data - xdp.data_hard_start);
-					skb_copy_to_linear_data(skb, pkt_data, xdp.data_end - xdp.data);
-					skb_put(skb, xdp.data_end - xdp.data);
-					skb->protocol = eth_type_trans(skb, dev);
+				u32 pkt_len = xdp_get_buff_len(&xdp);
+				struct sk_buff* skb = l3_build_rx_skb(q, &xdp, rx_xdpf);
 
+				if (skb) {
 					/* Deliver to network stack via NAPI */
 					napi_gro_receive(napi, skb);
 
-					/* Update statistics */
-					dev->stats.rx_packets++;
-					dev->stats.rx_bytes += data_len;
-				}
-				__free_page(page);
-			}
-			else {
-				/*
-				 * XDP_DROP or other action: Drop packet
-				 */
-				__free_page(page);
-			}
-		}
-		else {
-			/* NULL page pointer - shouldn't happen */
-			priv->rx_ring[entry].status = 0;
-		}
+					/* Update statistics */
+					rx_packets++;
+					rx_bytes += pkt_len;
+				}
+				else {
+					l3_count(priv, L3_EV_RX_SKB_ALLOC, 1);
+				}
+			}
+			else {
+				/*
+				 * XDP_DROP (ABORTED and unknown verdicts were turned
+				 * into drops, with the exception traced, above)
+				 */
+				l3_count(priv, L3_EV_XDP_DROP, 1);
+				l3_rx_release(q, &xdp, rx_xdpf);
+			}
+		}
+		/* else: empty descriptor - shouldn't happen, already cleared */
+
+	next_rx:
+		/* Verdict carried out: enqueue -> verdict latency */
+		l3_lat_record(priv, L3_LAT_ENQUEUE_VERDICT, ts_queued, l3_lat_now());
+		q->dirty_rx++;
+		work_done++;
+	}
+
+	/*
+	 * XDP FLUSH
+	 * Push out everything xdp_do_redirect() queued during this poll:
+	 * one bulk ndo_xdp_xmit() per target device instead of one per packet.
+	 */
+	if (xdp_redirects)
+		xdp_do_flush();
+	xdp_clear_return_frame_no_direct();
+
+	/*
+	 * TX RING PROCESSING
+	 * Complete transmitted packets and free resources
+	 *
+	 * NOTE: TX ring holds skbs and AF_XDP buffers posted to the doorbell.
+	 * The doorbell worker marks a descriptor complete once it has copied
+	 * the data, and we free the skb / return the buffer to userspace here.
+	 */
+	l3_tx_clean(q, &tx_packets, &tx_bytes);
+
+	/*
+	 * AF_XDP: give the worker fresh fill-ring buffers for the descriptors
+	 * consumed above, then move new socket TX descriptors onto the TX
+	 * ring. If the socket has more to send than one budget, stay in
+	 * polling mode by reporting a full budget.
+	 */
+	if (q->xsk_pool) {
+		refilled = l3_xsk_refill(q);
+		if (l3_xsk_xmit(q, budget))
+			work_done = budget;
+	}
+
+	/*
+	 * The doorbell worker stops when the RX ring is full (or, with
+	 * AF_XDP, when no fill-ring buffer is posted). Now that we have freed
+	 * or posted descriptors, ring the doorbell again if work is left.
+	 */
+	if ((work_done || refilled) && l3_doorbell_pending(&q->doorbell))
+		l3_doorbell_kick(q);
+
+	/* Publish this poll's counters in one update */
+	u64_stats_update_begin(&q->stats.syncp);
+	q->stats.rx_packets += rx_packets;
+	q->stats.rx_bytes += rx_bytes;
+	q->stats.tx_packets += tx_packets;
+	q->stats.tx_bytes += tx_bytes;
+	u64_stats_update_end(&q->stats.syncp);
+
+	/* Wake this queue's TX subqueue if it was stopped */
+	if (__netif_subqueue_stopped(dev, q->index))
+		netif_wake_subqueue(dev, q->index);
+
+	q->dim_frames += work_done;
+
+	/*
+	 * NAPI COMPLETION
+	 * If we processed fewer packets than budget, we're done.
+	 * Tell NAPI to stop polling and re-enable interrupts. If NAPI was
+	 * rescheduled meanwhile (missed), it stays masked and polls again.
+	 */
+	if (work_done < budget && napi_complete_done(napi, work_done)) {
+		if (READ_ONCE(priv->rx_dim_enabled))
+			l3_rx_dim_update(q);
+		l3_irq_unmask(q);
+	}
+
+	return work_done;
+}
+
+/*
+ * Fake IRQ Handler (Tasklet)
+ *
+ * PURPOSE:
+ * Simulates hardware interrupt. Called by workqueue after DMA completes.
+ * This provides the proper interrupt context for scheduling NAPI.
+ *
+ * OPERATION:
+ * Schedules NAPI polling when tasklet runs.
+ * NAPI will then process any pending packets in the RX ring.
+ *
+ * CONTEXT:
+ * Runs in softirq context (tasklet), which is the proper context for
+ * scheduling NAPI. This simulates a real hardware interrupt handler.
+ *
+ * PARAMETERS:
+ * @t: Tasklet structure (embedded in struct l3_queue)
+ */
+static void l3_fake_irq_handler(struct tasklet_struct* t)
+{
+	struct l3_queue* q = from_tasklet(q, t, irq_tasklet);
+	ktime_t ts_now = l3_lat_now();
+
+	/*
+	 * Fake IRQ delivery latency, measured from the most recent raise
+	 * (several raises before the tasklet runs collapse into one run).
+	 * Wakeups from ndo_xsk_wakeup leave ts_last_tasklet at 0. The worker
+	 * may raise again between the read and the clear; losing that one
+	 * sample is cheaper than an atomic 64-bit exchange.
+	 */
+	l3_lat_record(q->priv, L3_LAT_DOORBELL_TASKLET,
+		READ_ONCE(q->ts_last_tasklet), ts_now);
+	WRITE_ONCE(q->ts_last_tasklet, 0);
+
+	/* Schedule NAPI if not already scheduled */
+	if (napi_schedule_prep(&q->napi)) {
+		q->ts_last_napi = ts_now;
+		__napi_schedule(&q->napi);
+	}
+}
+
+/*
+ * TX Checksum Offload
+ *
+ * We advertise NETIF_F_HW_CSUM, so the stack hands us CHECKSUM_PARTIAL
+ * skbs with only the pseudo-header sum seeded in the checksum field. Like
+ * a NIC, the DMA engine completes the checksum on the copy it just made
+ * (the equivalent of skb_checksum_help(), without touching the skb).
+ * The headers are always in the head buffer; the sum runs on through the
+ * frags of a jumbo frame.
+ */
+static void l3_tx_csum(const struct sk_buff* skb, void* head, u32 head_len,
+	struct skb_shared_info* sinfo)
+{
+	u32 start = skb_checksum_start_offset(skb);
+	u32 field = start + skb->csum_offset;
+	u32 off, i;
+	__wsum csum;
+
+	if (field + sizeof(__sum16) > head_len)
+		return;  /* Malformed offsets, leave the packet alone */
+
+	csum = csum_partial(head + start, head_len - start, 0);
+	off = head_len - start;
+
+	for (i = 0; sinfo && i < sinfo->nr_frags; i++) {
+		skb_frag_t* frag = &sinfo->frags[i];
+
+		csum = csum_block_add(csum, csum_partial(skb_frag_address(frag),
+			skb_frag_size(frag), 0), off);
+		off += skb_frag_size(frag);
+	}
+
+	*(__sum16*)(head + field) = csum_fold(csum) ?: CSUM_MANGLED_0;
+}
+
+/* Total length of the packet a doorbell slot carries */
+static u32 l3_db_len(struct l3_queue* q, struct l3_db_slot* slot)
+{
+	switch (slot->type) {
+	case L3_DB_XDP_FRAME:
+		return xdp_get_frame_len(slot->ptr);
+	case L3_DB_SKB:
+		return ((struct sk_buff*)slot->ptr)->len;
+	default:
+		/* L3_DB_XSK: AF_XDP TX buffer, length kept on the TX descriptor */
+		return q->tx_ring[slot->tx_entry].data_len;
+	}
+}
+
+/* skb_copy_bits() for xdp_frames: @len bytes at @off, through the frags */
+static void l3_xdpf_copy_bits(struct xdp_frame* xdpf, u32 off, void* dst, u32 len)
+{
+	struct skb_shared_info* sinfo = xdp_get_shared_info_from_frame(xdpf);
+	void* src = xdpf->data;
+	u32 seg = xdpf->len;
+	u32 i = 0;
+
+	for (;;) {
+		if (off < seg) {
+			u32 n = min(len, seg - off);
+
+			memcpy(dst, src + off, n);
+			dst += n;
+			len -= n;
+			off = 0;
+		}
+		else {
+			off -= seg;
+		}
+
+		if (!len || !xdp_frame_has_frags(xdpf) || i == sinfo->nr_frags)
+			break;
+		src = skb_frag_address(&sinfo->frags[i]);
+		seg = skb_frag_size(&sinfo->frags[i]);
+		i++;
+	}
+}
+
+/* Copy @len bytes at @off of the packet carried by a doorbell slot */
+static void l3_db_read(struct l3_db_slot* slot, u32 off, void* dst, u32 len)
+{
+	switch (slot->type) {
+	case L3_DB_XDP_FRAME:
+		l3_xdpf_copy_bits(slot->ptr, off, dst, len);
+		break;
+	case L3_DB_SKB:
+		skb_copy_bits(slot->ptr, off, dst, len);
+		break;
+	default:
+		memcpy(dst, slot->ptr + off, len);
+		break;
+	}
+}
+
+/*
+ * Doorbell Slot Copy
+ *
+ * The simulated DMA transfer itself: scatters the packet carried by a
+ * doorbell slot over @head (the first @head_len bytes) and, for a jumbo
+ * frame, the frag pages already chained in @sinfo, then completes an
+ * offloaded TX checksum. The caller has sized the buffers to the packet
+ * (l3_db_len()).
+ */
+static void l3_db_copy(struct l3_db_slot* slot, void* head, u32 head_len,
+	struct skb_shared_info* sinfo)
+{
+	u32 off = head_len;
+	u32 i;
+
+	l3_db_read(slot, 0, head, head_len);
+
+	for (i = 0; sinfo && i < sinfo->nr_frags; i++) {
+		skb_frag_t* frag = &sinfo->frags[i];
+
+		l3_db_read(slot, off, skb_frag_address(frag), skb_frag_size(frag));
+		off += skb_frag_size(frag);
+	}
+
+	if (slot->type == L3_DB_SKB) {
+		struct sk_buff* skb = slot->ptr;
+
+		if (skb->ip_summed == CHECKSUM_PARTIAL)
+			l3_tx_csum(skb, head, head_len, sinfo);
+	}
+}
+
+/*
+ * RX Descriptor Fill
+ *
+ * PURPOSE:
+ * Simulates the DMA engine writing one packet into the next RX
+ * descriptor, either by copying it into a page_pool page (plus frag pages
+ * for a jumbo frame) or, for XDP frames in zero-copy mode, by moving the
+ * frame itself onto the ring. Frames larger than the MTU are dropped, as
+ * the MAC of a real NIC would.
+ * With an AF_XDP socket bound, the packet is copied into the fill-ring
+ * buffer NAPI posted to the descriptor instead. The doorbell worker is
+ * the only producer of a queue's RX ring and NAPI is the only consumer,
+ * so no lock is needed; the status write with its barrier is the
+ * hand-off.
+ *
+ * RETURNS:
+ * 0 on success, -ENOSPC if the RX ring is full (or no AF_XDP buffer is
+ * posted), -ENOMEM if no page, -EMSGSIZE if the packet is too big
+ */
+static int l3_rx_fill(struct l3_queue* q, struct l3_db_slot* slot)
+{
+	u32 entry = q->cur_rx & q->rx_mask;
+	u32 len = l3_db_len(q, slot);
+	struct skb_shared_info* sinfo = NULL;
+	struct page* page;
+	u32 head_len;
+
+	if (len > READ_ONCE(q->priv->netdev->mtu) + VLAN_ETH_HLEN)
+		return -EMSGSIZE;
+
+	/*
+	 * AF_XDP: the destination is the umem buffer NAPI took from the
+	 * socket's fill ring. This copy is what the NIC's DMA would do; from
+	 * here on the packet reaches userspace without being copied again.
+	 */
+	if (q->xsk_pool) {
+		struct xdp_buff* xsk;
+
+		if (q->cur_rx == smp_load_acquire(&q->xsk_posted))
+			return -ENOSPC;  /* Wait for NAPI to post a buffer */
+
+		/* One umem chunk per packet: no AF_XDP multi-buffer */
+		if (len > xsk_pool_get_rx_frame_size(q->xsk_pool))
+			return -EMSGSIZE;
+
+		xsk = q->rx_ring[entry].xsk;
+		l3_db_copy(slot, xsk->data, len, NULL);
+
+		q->rx_ring[entry].data_len = len;
+		q->rx_ring[entry].data_offset = 0;  /* Unused, the buffer knows */
+		q->rx_ring[entry].timestamp = slot->ts_queued;
+		goto publish;
+	}
+
+	/* Check if RX ring has space */
+	if (READ_ONCE(q->rx_ring[entry].buf_type) != L3_RXBUF_NONE ||
+		READ_ONCE(q->rx_ring[entry].status) == L3_OWN_CPU)
+		return -ENOSPC;
+
+	/*
+	 * ZERO-COPY: hand the sender's buffer to the RX descriptor
+	 *
+	 * An xdp_frame lives inside its own buffer (in the headroom in front
+	 * of the packet) and remembers which memory model it came from, so
+	 * whoever ends up owning it can return it with xdp_return_frame().
+	 * Instead of copying, the descriptor simply takes ownership. This
+	 * covers frames from another l3loop queue (our page_pool) as well as
+	 * from veth or any other XDP-capable device.
+	 */
+	if (slot->type == L3_DB_XDP_FRAME && xdp_zero_copy) {
+		struct xdp_frame* xdpf = slot->ptr;
+
+		q->rx_ring[entry].xdpf = xdpf;
+		q->rx_ring[entry].buf_type = L3_RXBUF_XDPF;
+		q->rx_ring[entry].data_len = xdpf->len;
+		q->rx_ring[entry].data_offset = xdpf->headroom + sizeof(*xdpf);
+		q->rx_ring[entry].frags_len = len - xdpf->len;
+		q->rx_ring[entry].timestamp = slot->ts_queued;
+		slot->ptr = NULL;  /* Ownership moved to the RX ring */
+		goto publish;
+	}
+
+	/* Allocate page for packet data (simulates DMA buffer allocation) */
+	page = l3_rx_alloc_page(q);
+	if (!page)
+		return -ENOMEM;
+
+	/* A jumbo frame continues in frag pages (simulates scatter DMA) */
+	head_len = min_t(u32, len, L3_RX_DATA_ROOM);
+	if (len > head_len) {
+		int err;
+
+		sinfo = l3_rx_shinfo(page);
+		err = l3_rx_alloc_frags(q, sinfo, len - head_len);
+		if (err) {
+			l3_rx_recycle_page(q, page);
+			return err;
+		}
+	}
+
+	/* Copy packet data to page with headroom (simulates DMA transfer) */
+	l3_db_copy(slot, page_address(page) + XDP_PACKET_HEADROOM, head_len, sinfo);
+
+	/* Place in RX ring */
+	q->rx_ring[entry].page = page;
+	q->rx_ring[entry].buf_type = L3_RXBUF_PAGE;
+	q->rx_ring[entry].data_len = head_len;
+	q->rx_ring[entry].data_offset = XDP_PACKET_HEADROOM;
+	q->rx_ring[entry].frags_len = len - head_len;
+	q->rx_ring[entry].timestamp = slot->ts_queued;  /* Use original queue time */
+
+publish:
+	/* Memory barrier: Ensure data written before status update */
+	smp_wmb();
+
+	/* Mark descriptor as ready for processing */
+	WRITE_ONCE(q->rx_ring[entry].status, L3_OWN_CPU);
+	WRITE_ONCE(q->cur_rx, q->cur_rx + 1);
+
+	return 0;
+}
+
+/*
+ * Doorbell Slot Completion
+ *
+ * Releases what a doorbell slot carried once its data has been copied
+ * (or dropped): copied XDP frames go back to the sender's memory model,
+ * skbs and AF_XDP buffers have their TX descriptor marked complete so
+ * NAPI can free them or hand them back to the socket.
+ */
+static void l3_doorbell_complete(struct l3_queue* q, struct l3_db_slot* slot)
+{
+	if (slot->type == L3_DB_XDP_FRAME) {
+		/* NULL if the RX ring took ownership (zero-copy) */
+		if (slot->ptr)
+			xdp_return_frame(slot->ptr);
+	}
+	else {
+		smp_wmb();
+		WRITE_ONCE(q->tx_ring[slot->tx_entry].status, L3_OWN_CPU);
+	}
+}
+
+/*
+ * Doorbell Workqueue Handler
+ *
+ * PURPOSE:
+ * Simulates the hardware DMA engine of one queue. A single long-lived
+ * work item per queue drains that queue's doorbell ring in batches,
+ * copies each packet into the RX ring and raises the fake IRQ once per
+ * batch instead of once per packet.
+ *
+ * OPERATION:
+ * 1. Take up to L3_DB_BATCH published slots from the doorbell ring
+ * 2. Copy each packet into a page_pool page on the RX ring (DMA transfer)
+ * 3. Return XDP frames to the sender / complete loopback TX descriptors
+ * 4. Raise the fake IRQ for the batch, subject to interrupt coalescing
+ *    (DMA completion interrupt)
+ * 5. Repeat until the doorbell ring is empty or the RX ring is full
+ *
+ * BACKPRESSURE:
+ * If the RX ring is full the worker stops and leaves the remaining slots
+ * in the doorbell ring, like a DMA engine waiting for free descriptors.
+ * NAPI rings the doorbell again after it has freed RX descriptors.
+ *
+ * CONTEXT:
+ * Runs in workqueue context, providing proper separation from ndo_xdp_xmit.
+ * A work item never runs concurrently with itself, so this is the only
+ * consumer of the doorbell ring and the only producer of the RX ring.
+ *
+ * PARAMETERS:
+ * @work: The queue's doorbell_work
+ */
+static void l3_doorbell_work(struct work_struct* work)
+{
+	struct l3_queue* q = container_of(work, struct l3_queue, doorbell_work);
+	struct l3_napi_adapter* priv = q->priv;
+	struct l3_db_slot* slot;
+	bool rx_full = false;
+	int done;
+
+	do {
+		ktime_t ts_work_start = l3_lat_now();
+
+		/* Doorbell occupancy high watermark (we are the only writer) */
+		if (ts_work_start) {
+			u32 used = (unsigned long)atomic_long_read(&q->doorbell.head) -
+				q->doorbell.tail;
+
+			if (used > q->db_used_max)
+				WRITE_ONCE(q->db_used_max, used);
+		}
+
+		done = 0;
+
+		while (done < L3_DB_BATCH && (slot = l3_doorbell_peek(&q->doorbell))) {
+			int err = l3_rx_fill(q, slot);
+
+			if (err == -ENOSPC) {
+				/* RX ring full: leave the slot for the next kick */
+				l3_count(priv, L3_EV_RX_RING_FULL, 1);
+				rx_full = true;
+				break;
+			}
+			if (err == -ENOMEM)
+				l3_count(priv, L3_EV_RX_NO_BUFFER, 1);
+			else if (err == -EMSGSIZE)
+				l3_count(priv, L3_EV_RX_OVERSIZE, 1);
+
+			l3_lat_record(priv, L3_LAT_XMIT_DOORBELL, slot->ts_queued, ts_work_start);
+
+			/* Copied, or dropped (no page, too big): release the slot */
+			l3_doorbell_complete(q, slot);
+			l3_doorbell_pop(&q->doorbell, slot);
+			done++;
+		}
+
+		if (!done)
+			break;
+
+		/*
+		 * TRIGGER FAKE IRQ (Simulates DMA Completion Interrupt)
+		 *
+		 * Now that the DMA transfer of the whole batch is complete,
+		 * the interrupt moderation logic decides whether to schedule
+		 * the tasklet now, arm the rx-usecs timer, or stay quiet
+		 * because NAPI is still polling. The tasklet will then
+		 * schedule NAPI.
+		 *
+		 * This is how real hardware works:
+		 * 1. DMA engine completes transfer
+		 * 2. Hardware raises interrupt (subject to coalescing/masking)
+		 * 3. Interrupt handler (tasklet) schedules NAPI
+		 * 4. NAPI processes packets and unmasks the interrupt
+		 */
+		l3_irq_coalesce(q, done, rx_full);
+
+		cond_resched();
+	} while (!rx_full && done == L3_DB_BATCH);
+}
+
+/*
+ * Doorbell Purge
+ *
+ * Drops everything still sitting in a queue's doorbell ring. Called with
+ * the worker stopped (ndo_stop, AF_XDP pool changes). XDP frames are
+ * returned; loopback TX descriptors are marked complete as if sent, so
+ * l3_tx_clean() can free the skb or complete the AF_XDP buffer.
+ */
+static void l3_doorbell_purge(struct l3_queue* q)
+{
+	struct l3_db_slot* slot;
+
+	while ((slot = l3_doorbell_peek(&q->doorbell))) {
+		l3_doorbell_complete(q, slot);
+		l3_doorbell_pop(&q->doorbell, slot);
+	}
+}
+
+/*
+ * l3_xdp_xmit_queue - Pick the queue for XDP frames sent from this CPU
+ *
+ * ndo_xdp_xmit is always called from the sender's NAPI poll, so the
+ * current CPU is stable and is a natural steering key: with one queue per
+ * CPU every sender gets a private queue, and with fewer queues the CPUs
+ * are folded onto them round-robin.
+ */
+static struct l3_queue* l3_xdp_xmit_queue(struct l3_napi_adapter* priv)
+{
+	return &priv->queues[smp_processor_id() % priv->num_queues];
+}
+
+/*
+ * ndo_xdp_xmit - Receive XDP-redirected packets from other devices
+ *
+ * PURPOSE:
+ * This function is called when another device redirects packets to us
+ * using XDP redirect. It's the entry point for XDP-redirected traffic.
+ *
+ * OPERATION:
+ * 1. Select the queue for the current CPU
+ * 2. Post all XDP frames to the queue's doorbell ring, then kick the
+ *    doorbell worker once for the batch
+ * 3. Workqueue will handle DMA simulation
+ * 4. Workqueue will trigger fake IRQ (tasklet)
+ * 5. Tasklet will schedule NAPI
+ * 6. Return immediately (non-blocking)
+ *
+ * PARAMETERS:
+ * @dev: Our network device
+ * @n: Number of frames being transmitted
+ * @frames: Array of XDP frame pointers
+ * @flags: Transmission flags
+ *
+ * RETURNS:
+ * Number of frames successfully queued (or negative error code)
+ *
+ * DOORBELL MECHANISM:
+ * Instead of directly processing packets or using a timer, we post
+ * them to a doorbell ring drained by a workqueue worker. This simulates
+ * how real hardware works:
+ * 1. Packet arrives at NIC
+ * 2. NIC rings doorbell (signals packet arrival)
+ * 3. DMA engine transfers packet data (workqueue)
+ * 4. DMA completion triggers interrupt (tasklet)
+ * 5. Interrupt handler schedules NAPI (tasklet → NAPI)
+ *
+ * This provides proper context separation and immediate processing.
+ */
+static int l3_ndo_xdp_xmit(struct net_device* dev, int n, struct xdp_frame** frames, u32 flags)
+{
+	struct l3_napi_adapter* priv = netdev_priv(dev);
+	struct l3_queue* q;
+	int nxmit = 0;
+	int i;
+	ktime_t ts_xmit = l3_lat_now();
+
+	/* Validate flags */
+	if (unlikely(flags & ~XDP_XMIT_FLAGS_MASK))
+		return -EINVAL;
+
+	/* Check if device is running (and ndo_open is done with the rings) */
+	if (unlikely(!netif_running(dev) || !smp_load_acquire(&priv->rings_ready)))
+		return -ENETDOWN;
+
+	/* All n frames of this call go to the calling CPU's queue */
+	q = l3_xdp_xmit_queue(priv);
+
+	/*
+	 * DOORBELL: Post the frames to the queue's doorbell ring
+	 *
+	 * No allocation per frame: each frame takes one preallocated slot.
+	 * The doorbell worker will handle the actual DMA simulation.
+	 */
+	for (i = 0; i < n; i++) {
+		if (l3_doorbell_push(&q->doorbell, frames[i], L3_DB_XDP_FRAME, 0, ts_xmit))
+			break;  /* Doorbell ring full */
+		nxmit++;
+	}
+
+	/*
+	 * Frames we couldn't queue stay owned by the caller: ndo_xdp_xmit
+	 * returns the number accepted and the core frees the rest.
+	 */
+	if (nxmit < n)
+		l3_count(priv, L3_EV_XDP_DOORBELL_FULL, n - nxmit);
+
+	/* Ring the doorbell once for the whole batch */
+	if (nxmit)
+		l3_doorbell_kick(q);
+
+	return nxmit;
+}
+
+/*
+ * XDP Program Setup
+ *
+ * PURPOSE:
+ * Attach or detach an XDP program to this device.
+ * Called when userspace loads/unloads an XDP program.
+ *
+ * PARAMETERS:
+ * @dev: Network device
+ * @bpf: BPF program information
+ *
+ * OPERATION:
+ * - Refuses a single-buffer program while the MTU needs frags
+ * - Increments program reference count if attaching
+ * - Atomically swaps old and new programs
+ * - Decrements old program reference count if detaching
+ */
+static int l3_xdp_setup(struct net_device* dev, struct netdev_bpf* bpf)
+{
+	struct l3_napi_adapter* priv = netdev_priv(dev);
+	struct bpf_prog* old_prog, * new_prog = bpf->prog;
+
+	if (new_prog && !new_prog->aux->xdp_has_frags && dev->mtu > L3_XDP_MAX_MTU) {
+		NL_SET_ERR_MSG_MOD(bpf->extack,
+			"MTU too large for a single-buffer XDP program, load it as xdp.frags");
+		return -EOPNOTSUPP;
+	}
+
+	/* Increment reference count for new program */
+	if (new_prog)
+		bpf_prog_add(new_prog, 1);
+
+	/* Atomically swap programs */
+	old_prog = xchg(&priv->xdp_prog, new_prog);
+
+	/* Decrement reference count for old program */
+	if (old_prog)
+		bpf_prog_put(old_prog);
+
+	return 0;
+}
+
+/*
+ * ndo_change_mtu - Set the MTU
+ *
+ * Any MTU up to L3_MAX_MTU can be received: frames that do not fit one
+ * page continue in frags. The one limit is an attached XDP program that
+ * cannot handle frags (see l3_xdp_setup).
+ */
+static int l3_change_mtu(struct net_device* dev, int new_mtu)
+{
+	struct l3_napi_adapter* priv = netdev_priv(dev);
+	struct bpf_prog* prog = priv->xdp_prog;  /* Under RTNL, like XDP setup */
+
+	if (prog && !prog->aux->xdp_has_frags && new_mtu > L3_XDP_MAX_MTU) {
+		netdev_warn(dev, "MTU %d needs an xdp.frags program (single-buffer max %lu)\n",
+			new_mtu, L3_XDP_MAX_MTU);
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(dev->mtu, new_mtu);
+	return 0;
+}
+
+/*
+ * RX Memory Model Registration
+ *
+ * Tells the XDP core who owns the buffers of a queue's RX ring: our
+ * page_pool normally, the AF_XDP socket's umem while one is bound.
+ */
+static int l3_rxq_reg_mem_model(struct l3_queue* q)
+{
+	if (q->xsk_pool)
+		return xdp_rxq_info_reg_mem_model(&q->xdp_rxq,
+			MEM_TYPE_XSK_BUFF_POOL, NULL);
+
+	/*
+	 * page_pool-based: xdp_frames built from our pages then find their
+	 * way back to this pool when any device calls xdp_return_frame().
+	 */
+	return xdp_rxq_info_reg_mem_model(&q->xdp_rxq, MEM_TYPE_PAGE_POOL,
+		q->page_pool);
+}
+
+/*
+ * RX Ring Cleanup
+ *
+ * Releases every buffer still attached to an RX descriptor: filled
+ * descriptors NAPI never got to and, with AF_XDP, fill-ring buffers that
+ * were posted but not written yet. NAPI and the doorbell worker of the
+ * queue must both be stopped.
+ */
+static void l3_rx_ring_clean(struct l3_queue* q)
+{
+	u32 i;
+
+	for (i = 0; i <= q->rx_mask; i++) {
+		switch (q->rx_ring[i].buf_type) {
+		case L3_RXBUF_PAGE:
+			if (q->rx_ring[i].frags_len)
+				l3_rx_free_frags(q, l3_rx_shinfo(q->rx_ring[i].page));
+			l3_rx_recycle_page(q, q->rx_ring[i].page);
+			break;
+		case L3_RXBUF_XDPF:
+			xdp_return_frame(q->rx_ring[i].xdpf);
+			break;
+		case L3_RXBUF_XSK:
+			xsk_buff_free(q->rx_ring[i].xsk);
+			break;
+		}
+		q->rx_ring[i].page = NULL;
+		q->rx_ring[i].buf_type = L3_RXBUF_NONE;
+		q->rx_ring[i].data_len = 0;
+		q->rx_ring[i].frags_len = 0;
+		q->rx_ring[i].status = 0;
+	}
+	q->cur_rx = q->dirty_rx = 0;
+	q->xsk_posted = 0;
+}
+
+/*
+ * Queue Quiesce / Resume
+ *
+ * PURPOSE:
+ * Stops one queue of a running device so its RX ring can change owner
+ * (page_pool <-> AF_XDP umem), the software version of the queue
+ * disable/enable sequence NIC drivers go through for XSK setup.
+ *
+ * OPERATION (disable):
+ * 1. Disable NAPI, then the doorbell worker: nothing touches the rings
+ * 2. Drain the doorbell, completing loopback TX descriptors (whatever is
+ *    posted from now on waits in the doorbell until the queue resumes)
+ * 3. Complete the TX ring, so AF_XDP buffers go back to the socket
+ * 4. Release all RX buffers and unregister the RX memory model
+ *
+ * ndo_start_xmit may keep running on the queue meanwhile; it only posts
+ * new descriptors, which stay behind the ones completed here.
+ */
+static void l3_queue_disable(struct l3_queue* q)
+{
+	u64 tx_packets = 0, tx_bytes = 0;
+
+	napi_disable(&q->napi);
+	disable_work_sync(&q->doorbell_work);
+	hrtimer_cancel(&q->coal_timer);
+
+	l3_doorbell_purge(q);
+	l3_tx_clean(q, &tx_packets, &tx_bytes);
+	l3_rx_ring_clean(q);
+	xdp_rxq_info_unreg_mem_model(&q->xdp_rxq);
+
+	/* NAPI is off, so we are the only writer of the stats */
+	u64_stats_update_begin(&q->stats.syncp);
+	q->stats.tx_packets += tx_packets;
+	q->stats.tx_bytes += tx_bytes;
+	u64_stats_update_end(&q->stats.syncp);
+}
+
+static int l3_queue_enable(struct l3_queue* q)
+{
+	int err = l3_rxq_reg_mem_model(q);
+
+	l3_irq_reset(q);
+	enable_work(&q->doorbell_work);
+	napi_enable(&q->napi);
+
+	/*
+	 * Fake IRQ: NAPI posts fill-ring buffers and picks up socket TX,
+	 * then rings the doorbell for anything that queued up meanwhile.
+	 */
+	tasklet_schedule(&q->irq_tasklet);
+	return err;
+}
+
+/*
+ * AF_XDP Buffer Pool Setup (XDP_SETUP_XSK_POOL)
+ *
+ * PURPOSE:
+ * Binds (@pool != NULL) or unbinds an AF_XDP socket's buffer pool to RX/TX
+ * queue @qid. Called by the XSK core under RTNL when a socket binds with
+ * XDP_ZEROCOPY, and again when it goes away.
+ *
+ * OPERATION:
+ * 1. Map the umem for "DMA". The XSK core insists on it; our DMA engine
+ *    is the CPU, so the device just gets a 64-bit mask to map with
+ * 2. If the device is up, quiesce the queue, switch its RX ring between
+ *    page_pool and umem buffers, and resume it
+ * 3. On unbind, unmap the umem once no descriptor refers to it
+ *
+ * The binding survives ndo_stop/ndo_open.
+ */
+static int l3_xsk_pool_setup(struct net_device* dev, struct xsk_buff_pool* pool, u16 qid)
+{
+	struct l3_napi_adapter* priv = netdev_priv(dev);
+	bool running = netif_running(dev);
+	struct xsk_buff_pool* old;
+	struct l3_queue* q;
+	int err;
+
+	if (qid >= priv->num_queues)
+		return -EINVAL;
+
+	q = &priv->queues[qid];
+	old = q->xsk_pool;
+
+	if (pool) {
+		if (old)
+			return -EBUSY;
+
+		err = dma_coerce_mask_and_coherent(&dev->dev, DMA_BIT_MASK(64));
+		if (err)
+			return err;
+
+		err = xsk_pool_dma_map(pool, &dev->dev, 0);
+		if (err)
+			return err;
+
+		/* Buffers from this pool report our RX queue as their rxq */
+		xsk_pool_set_rxq_info(pool, &q->xdp_rxq);
+	}
+	else if (!old) {
+		return -EINVAL;
+	}
+
+	if (running)
+		l3_queue_disable(q);
+
+	WRITE_ONCE(q->xsk_pool, pool);
+
+	err = running ? l3_queue_enable(q) : 0;
+	if (err)
+		printk(KERN_INFO "l3loop: queue %u: RX memory model registration failed (%d)\n",
+			qid, err);
+
+	if (old)
+		xsk_pool_dma_unmap(old, 0);
+
+	printk(KERN_INFO "l3loop: AF_XDP zero-copy %s on queue %u\n",
+		pool ? "enabled" : "disabled", qid);
+
+	return err;
+}
+
+/*
+ * ndo_xsk_wakeup - Kick a queue on behalf of an AF_XDP socket
+ *
+ * PURPOSE:
+ * Called when userspace does sendto()/recvfrom()/poll() on a socket that
+ * uses need_wakeup: it has queued TX descriptors (XDP_WAKEUP_TX) or
+ * refilled the fill ring (XDP_WAKEUP_RX). Both are handled by NAPI, so we
+ * simply raise the queue's fake IRQ, unless NAPI is already running, in
+ * which case marking it missed makes it poll once more.
+ */
+static int l3_xsk_wakeup(struct net_device* dev, u32 qid, u32 flags)
+{
+	struct l3_napi_adapter* priv = netdev_priv(dev);
+	struct l3_queue* q;
+
+	if (!netif_running(dev))
+		return -ENETDOWN;
+
+	if (qid >= priv->num_queues)
+		return -EINVAL;
+
+	q = &priv->queues[qid];
+	if (!READ_ONCE(q->xsk_pool))
+		return -ENXIO;
+
+	if (!napi_if_scheduled_mark_missed(&q->napi))
+		tasklet_schedule(&q->irq_tasklet);
+
+	return 0;
+}
+
+/*
+ * ndo_bpf - Handle BPF-related operations
+ *
+ * PURPOSE:
+ * Entry point for BPF operations on this device: XDP program setup and
+ * AF_XDP zero-copy buffer pool setup.
+ */
+static int l3_ndo_bpf(struct net_device* dev, struct netdev_bpf* bpf)
+{
+	switch (bpf->command) {
+	case XDP_SETUP_PROG:
+		return l3_xdp_setup(dev, bpf);
+	case XDP_SETUP_XSK_POOL:
+		return l3_xsk_pool_setup(dev, bpf->xsk.pool, bpf->xsk.queue_id);
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * ndo_start_xmit - Transmit a packet
+ *
+ * PURPOSE:
+ * Called by the network stack to transmit a packet.
+ * In this loopback driver, we post the packet to the doorbell ring for
+ * the doorbell worker to process.
+ *
+ * PARAMETERS:
+ * @skb: Socket buffer containing packet to transmit
+ * @dev: Network device
+ *
+ * RETURNS:
+ * NETDEV_TX_OK on success, NETDEV_TX_BUSY if queue full
+ *
+ * OPERATION:
+ * 0. Use the queue the stack selected from the flow hash (queue_mapping)
+ * 1. Place skb in TX ring (for completion tracking by NAPI)
+ * 2. Post the TX descriptor to the doorbell ring
+ * 3. Kick the doorbell worker, unless the stack says more packets follow
+ * 4. The worker copies the skb into the RX ring (the only copy), marks
+ *    the TX descriptor complete and triggers the fake IRQ
+ * 5. NAPI frees the skb when it cleans the TX ring
+ */
+static netdev_tx_t l3_napi_start_xmit(struct sk_buff* skb, struct net_device* dev)
+{
+	struct l3_napi_adapter* priv = netdev_priv(dev);
+	u16 qidx = skb_get_queue_mapping(skb);
+	struct l3_queue* q = &priv->queues[qidx];
+	u32 tx_entry;
+	unsigned long flags;
+	ktime_t ts_xmit = l3_lat_now();
+
+	spin_lock_irqsave(&q->lock, flags);
+
+	tx_entry = q->cur_tx & q->tx_mask;
+
+	/* Check if TX ring has space (AF_XDP TX shares the ring) */
+	if (READ_ONCE(q->tx_ring[tx_entry].buf_type) != L3_TXBUF_NONE) {
+		netif_stop_subqueue(dev, qidx);
+		spin_unlock_irqrestore(&q->lock, flags);
+		return NETDEV_TX_BUSY;
+	}
+
+	/*
+	 * Place in TX ring for completion tracking. The descriptor stays
+	 * owned by the "hardware" until the doorbell worker has copied the
+	 * data, so the TX ring's reference keeps the skb alive until then.
+	 */
+	q->tx_ring[tx_entry].skb = skb;
+	q->tx_ring[tx_entry].buf_type = L3_TXBUF_SKB;
+	q->tx_ring[tx_entry].status = 0;
+
+	/*
+	 * DOORBELL: Post the descriptor for loopback processing
+	 *
+	 * This simulates packet being sent to hardware and looped back.
+	 * If the doorbell ring is full, undo the TX ring reservation (we
+	 * still hold the lock, so it is the newest entry) and drop.
+	 */
+	if (l3_doorbell_push(&q->doorbell, skb, L3_DB_SKB, tx_entry, ts_xmit)) {
+		q->tx_ring[tx_entry].skb = NULL;
+		q->tx_ring[tx_entry].buf_type = L3_TXBUF_NONE;
+		spin_unlock_irqrestore(&q->lock, flags);
+		l3_count(priv, L3_EV_TX_DOORBELL_FULL, 1);
+		dev_kfree_skb_any(skb);
+		return NETDEV_TX_OK;
+	}
+	WRITE_ONCE(q->cur_tx, q->cur_tx + 1);
+
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	/*
+	 * Defer the doorbell while the stack has more packets for us
+	 * (xmit_more), so a burst costs a single worker wakeup.
+	 */
+	if (!netdev_xmit_more() || __netif_subqueue_stopped(dev, qidx))
+		l3_doorbell_kick(q);
+
+	return NETDEV_TX_OK;
+}
+
+/*
+ * Page Pool Setup
+ *
+ * PURPOSE:
+ * Create the page_pool that feeds a queue's RX ring. The pool is sized
+ * for twice the ring so that pages still in flight on another device
+ * (redirected frames) do not force the pool back to the page allocator.
+ *
+ * page_pool_destroy() is deferred by the core until every page handed
+ * out has come back, so it is safe to call while frames are in flight.
+ */
+static int l3_create_page_pool(struct l3_queue* q)
+{
+	struct page_pool_params pp_params = {
+		.order = 0,
+		.pool_size = q->priv->rx_ring_size * 2,
+		.nid = NUMA_NO_NODE,
+		.dev = &q->priv->netdev->dev,
+	};
+	struct page_pool* pool;
+
+	pool = page_pool_create(&pp_params);
+	if (IS_ERR(pool))
+		return PTR_ERR(pool);
+
+	q->page_pool = pool;
+	return 0;
+}
+
+static void l3_destroy_page_pool(struct l3_queue* q)
+{
+	page_pool_destroy(q->page_pool);
+	q->page_pool = NULL;
+}
+
+/*
+ * Ring Allocation
+ *
+ * PURPOSE:
+ * Allocate a queue's RX and TX descriptor rings and its doorbell slots
+ * at the sizes currently configured with ethtool -G. Called from ndo_open,
+ * so a resize takes effect by bouncing the device.
+ *
+ * The doorbell gets at least one slot per RX descriptor: a full RX ring's
+ * worth of packets can then wait for "DMA" without producers being
+ * refused. All sizes are powers of two, so the rings are indexed with
+ * the masks stored here instead of a modulo.
+ *
+ * kvcalloc() falls back to vmalloc for the larger sizes; the rings are
+ * only touched by the CPU, never by a device.
+ */
+static u32 l3_db_size(struct l3_napi_adapter* priv)
+{
+	return max_t(u32, L3_DB_SIZE, priv->rx_ring_size);
+}
 
-	next_rx:
-		priv->dirty_rx++;
-		work_done++;
+static int l3_alloc_rings(struct l3_queue* q)
+{
+	struct l3_napi_adapter* priv = q->priv;
+	u32 db_size = l3_db_size(priv);
+
+	q->rx_ring = kvcalloc(priv->rx_ring_size, sizeof(*q->rx_ring), GFP_KERNEL);
+	q->tx_ring = kvcalloc(priv->tx_ring_size, sizeof(*q->tx_ring), GFP_KERNEL);
+	q->doorbell.slots = kvcalloc(db_size, sizeof(*q->doorbell.slots), GFP_KERNEL);
+	if (!q->rx_ring || !q->tx_ring || !q->doorbell.slots) {
+		kvfree(q->rx_ring);
+		kvfree(q->tx_ring);
+		kvfree(q->doorbell.slots);
+		q->rx_ring = NULL;
+		q->tx_ring = NULL;
+		q->doorbell.slots = NULL;
+		return -ENOMEM;
 	}
 
-	/*
-	 * TX RING PROCESSING
-	 * Complete transmitted packets and free resources
-	 *
-	 * NOTE: TX ring now holds skbs that were queued to workqueue.
-	 * We clean them up here after workqueue has copied the data.
-	 */
-	while (priv->dirty_tx != priv->cur_tx) {
-		entry = priv->dirty_tx % NUM_DESC;
+	q->rx_mask = priv->rx_ring_size - 1;
+	q->tx_mask = priv->tx_ring_size - 1;
+	q->doorbell.mask = db_size - 1;
 
-		/* Check if TX completion is ready */
-		if (READ_ONCE(priv->tx_ring[entry].status) != L3_OWN_CPU)
-			break;
+	q->cur_rx = q->dirty_rx = 0;
+	q->cur_tx = q->dirty_tx = 0;
+	q->xsk_posted = 0;
+	return 0;
+}
 
-		rmb();
+/*
+ * Ring Release
+ *
+ * Frees any skb the TX ring still holds, then the rings themselves. The
+ * RX ring must already be empty (l3_rx_ring_clean) and the doorbell
+ * purged.
+ */
+static void l3_free_rings(struct l3_queue* q)
+{
+	u32 i;
 
-		if (priv->tx_ring[entry].skb) {
-			struct sk_buff* skb = priv->tx_ring[entry].skb;
+	for (i = 0; i <= q->tx_mask; i++) {
+		if (q->tx_ring[i].buf_type == L3_TXBUF_SKB)
+			dev_kfree_skb_any(q->tx_ring[i].skb);
+	}
 
-			/* Update statistics */
-			dev->stats.tx_packets++;
-			dev->stats.tx_bytes += skb->len;
+	kvfree(q->rx_ring);
+	kvfree(q->tx_ring);
+	kvfree(q->doorbell.slots);
+	q->rx_ring = NULL;
+	q->tx_ring = NULL;
+	q->doorbell.slots = NULL;
+	q->cur_tx = q->dirty_tx = 0;
+}
 
-			/* Free the sk_buff */
-			dev_consume_skb_any(skb);
-			priv->tx_ring[entry].skb = NULL;
+/*
+ * ndo_open - Open the network device
+ *
+ * PURPOSE:
+ * Called when device is brought up (e.g., "ip link set l3loop0 up")
+ *
+ * OPERATION:
+ * 1. Create workqueue for doorbell processing
+ * 2. For every queue: allocate the descriptor and doorbell rings,
+ *    initialize the doorbell and tasklet, create the page_pool, register
+ *    XDP RX queue information and enable NAPI
+ * 3. Start all TX queues
+ */
+static int l3_napi_open(struct net_device* dev) {
+	struct l3_napi_adapter* priv = netdev_priv(dev);
+	struct l3_queue* q;
+	int err;
+	u32 i;
+
+	/* Create workqueue for doorbell processing */
+	priv->doorbell_wq = alloc_workqueue("l3loop_doorbell",
+		WQ_UNBOUND | WQ_HIGHPRI,
+		0);
+	if (!priv->doorbell_wq)
+		return -ENOMEM;
+
+	for (i = 0; i < priv->num_queues; i++) {
+		q = &priv->queues[i];
+
+		/* Descriptor rings at the ethtool -G size */
+		err = l3_alloc_rings(q);
+		if (err)
+			goto err_unwind;
+
+		/* Initialize doorbell ring, its worker and the fake IRQ tasklet */
+		l3_doorbell_init(&q->doorbell);
+		INIT_WORK(&q->doorbell_work, l3_doorbell_work);
+		tasklet_setup(&q->irq_tasklet, l3_fake_irq_handler);
+
+		/* No fake IRQ / NAPI schedule in flight yet */
+		q->ts_last_tasklet = 0;
+		q->ts_last_napi = 0;
+		l3_irq_reset(q);
+
+		/* Create the page_pool that backs this queue's RX ring */
+		err = l3_create_page_pool(q);
+		if (err) {
+			l3_free_rings(q);
+			goto err_unwind;
 		}
 
-		/* Clean up XDP frame if present (from workqueue) */
-		if (priv->tx_ring[entry].xdpf) {
-			/* XDP frame was already returned in workqueue */
-			priv->tx_ring[entry].xdpf = NULL;
+		/*
+		 * Register XDP RX queue info (required for XDP). The frag size
+		 * lets bpf_xdp_adjust_tail() grow a jumbo frame's last frag.
+		 */
+		err = __xdp_rxq_info_reg(&q->xdp_rxq, dev, q->index, q->napi.napi_id,
+			PAGE_SIZE);
+		if (err) {
+			l3_destroy_page_pool(q);
+			l3_free_rings(q);
+			goto err_unwind;
 		}
 
-		priv->tx_ring[entry].status = 0;
-		priv->dirty_tx++;
-	}
+		/* Register memory model (page_pool, or the bound AF_XDP umem) */
+		err = l3_rxq_reg_mem_model(q);
+		if (err) {
+			xdp_rxq_info_unreg(&q->xdp_rxq);
+			l3_destroy_page_pool(q);
+			l3_free_rings(q);
+			goto err_unwind;
+		}
 
-	/* Wake TX queue if it was stopped */
-	if (netif_queue_stopped(dev))
-		netif_wake_queue(dev);
+		/* Same device/queue identity, memory info filled in per frame */
+		q->xdp_rxq_zc = q->xdp_rxq;
 
-	/*
-	 * NAPI COMPLETION
-	 * If we processed fewer packets than budget, we're done.
-	 * Tell NAPI to stop polling and re-enable interrupts.
-	 */
-	if (work_done < budget) {
-		napi_complete_done(napi, work_done);
-	}
+		/* Enable NAPI polling */
+		napi_enable(&q->napi);
+
+		/*
+		 * Tell the core which NAPI serves this RX/TX queue pair, so
+		 * "netdev queue-get" reports its NAPI ID alongside the one
+		 * skbs carry for SO_INCOMING_NAPI_ID and busy polling.
+		 */
+		netif_queue_set_napi(dev, q->index, NETDEV_QUEUE_TYPE_RX, &q->napi);
+		netif_queue_set_napi(dev, q->index, NETDEV_QUEUE_TYPE_TX, &q->napi);
 
-#if TIMING_DEBUG
-	if (work_done > 0) {
-		s64 poll_duration_ns = ktime_to_ns(ktime_sub(ktime_get(), ts_poll_start));
-		printk(KERN_INFO "l3loop: NAPI poll processed %d packets in %lld ns\n",
-			work_done, poll_duration_ns);
+		/* AF_XDP socket still bound: let NAPI post fill-ring buffers */
+		if (q->xsk_pool)
+			tasklet_schedule(&q->irq_tasklet);
 	}
-#endif
 
-	return work_done;
+	/* Doorbells are live: let ndo_xdp_xmit in */
+	smp_store_release(&priv->rings_ready, true);
+
+	/* Start transmit queues */
+	netif_tx_start_all_queues(dev);
+
+	printk(KERN_INFO "l3loop: Device opened with %u queues (workqueue doorbell + tasklet IRQ)\n",
+		priv->num_queues);
+
+	return 0;
+
+err_unwind:
+	/* Undo the queues that were fully set up before queue i failed */
+	while (i--) {
+		q = &priv->queues[i];
+		netif_queue_set_napi(dev, i, NETDEV_QUEUE_TYPE_RX, NULL);
+		netif_queue_set_napi(dev, i, NETDEV_QUEUE_TYPE_TX, NULL);
+		napi_disable(&q->napi);
+		tasklet_kill(&q->irq_tasklet);
+		l3_rx_ring_clean(q);
+		xdp_rxq_info_unreg(&q->xdp_rxq);
+		l3_destroy_page_pool(q);
+		l3_free_rings(q);
+	}
+	destroy_workqueue(priv->doorbell_wq);
+	priv->doorbell_wq = NULL;
+	return err;
 }
 
 /*
- * Fake IRQ Handler (Tasklet)
+ * ndo_stop - Close the network device
  *
  * PURPOSE:
- * Simulates hardware interrupt. Called by workqueue after DMA completes.
- * This provides the proper interrupt context for scheduling NAPI.
+ * Called when device is brought down (e.g., "ip link set l3loop0 down")
  *
  * OPERATION:
- * Schedules NAPI polling when tasklet runs.
- * NAPI will then process any pending packets in the RX ring.
- *
- * CONTEXT:
- * Runs in softirq context (tasklet), which is the proper context for
- * scheduling NAPI. This simulates a real hardware interrupt handler.
- *
- * PARAMETERS:
- * @t: Tasklet structure (contains pointer to adapter via container_of)
+ * 1. Stop TX queues
+ * 2. Disable NAPI of every queue (NAPI no longer rings the doorbell)
+ * 3. Flush and destroy workqueue (no more fake IRQs after this)
+ * 4. Cancel the coalescing timers and DIM work, kill the tasklets
+ * 5. Clean up any pending packets in the doorbell and descriptor rings,
+ *    completing AF_XDP TX buffers back to their socket
+ * 6. Unregister XDP info, destroy the page_pools and free the rings
  */
-static void l3_fake_irq_handler(struct tasklet_struct* t)
-{
-	struct l3_napi_adapter* priv = from_tasklet(priv, t, irq_tasklet);
-	ktime_t ts_now = ktime_get();
+static int l3_napi_stop(struct net_device* dev) {
+	struct l3_napi_adapter* priv = netdev_priv(dev);
+	struct l3_queue* q;
+	u64 tx_packets, tx_bytes;
+	u32 qi;
 
-#if TIMING_DEBUG
-	{
-		s64 delta_ns = ktime_to_ns(ktime_sub(ts_now, priv->ts_last_tasklet));
-		if (delta_ns > 1000000) {  /* > 1ms */
-			printk(KERN_INFO "l3loop: Tasklet called, %lld ns since last tasklet\n", delta_ns);
-		}
+	/*
+	 * Stop transmit queues. The core has already cleared the running
+	 * state and waited for an RCU grace period, so no ndo_xdp_xmit is
+	 * still pushing to the doorbells we are about to free.
+	 */
+	WRITE_ONCE(priv->rings_ready, false);
+	netif_tx_stop_all_queues(dev);
+
+	/* Disable NAPI polling */
+	for (qi = 0; qi < priv->num_queues; qi++) {
+		netif_queue_set_napi(dev, qi, NETDEV_QUEUE_TYPE_RX, NULL);
+		netif_queue_set_napi(dev, qi, NETDEV_QUEUE_TYPE_TX, NULL);
+		napi_disable(&priv->queues[qi].napi);
 	}
-#endif
 
-	/* Schedule NAPI if not already scheduled */
-	if (napi_schedule_prep(&priv->napi)) {
-		priv->ts_last_napi = ts_now;
-		__napi_schedule(&priv->napi);
-#if TIMING_DEBUG
-		printk(KERN_INFO "l3loop: NAPI scheduled from tasklet\n");
-#endif
+	/* Flush and destroy workqueue */
+	if (priv->doorbell_wq) {
+		flush_workqueue(priv->doorbell_wq);
+		destroy_workqueue(priv->doorbell_wq);
+		priv->doorbell_wq = NULL;
 	}
-#if TIMING_DEBUG
-	else {
-		printk(KERN_INFO "l3loop: NAPI already scheduled, skipping\n");
+
+	for (qi = 0; qi < priv->num_queues; qi++) {
+		q = &priv->queues[qi];
+
+		/* No coalescing timer or DIM update may outlive the rings */
+		hrtimer_cancel(&q->coal_timer);
+		cancel_work_sync(&q->rx_dim.work);
+
+		/* Kill tasklet */
+		tasklet_kill(&q->irq_tasklet);
+
+		/* Drop frames the worker never got to, complete loopback TX */
+		l3_doorbell_purge(q);
+		tx_packets = tx_bytes = 0;
+		l3_tx_clean(q, &tx_packets, &tx_bytes);
+
+		/*
+		 * CLEANUP: Free any pending packets in rings
+		 * Important to prevent memory leaks
+		 */
+		l3_rx_ring_clean(q);
+
+		/* Unregister XDP info, then release the pool and the rings */
+		xdp_rxq_info_unreg(&q->xdp_rxq);
+		l3_destroy_page_pool(q);
+		l3_free_rings(q);
 	}
-#endif
+
+	return 0;
 }
 
 /*
- * Doorbell Workqueue Handler (for XDP redirected packets)
+ * Instrumentation Readout
  *
  * PURPOSE:
- * Simulates hardware DMA operation for XDP redirected packets.
- * This function runs in workqueue context (different from ndo_xdp_xmit context)
- * and transfers packet data from the "transmit side" to the RX ring for processing.
- *
- * OPERATION:
- * 1. Allocate page for packet data
- * 2. Copy XDP frame data to page (simulates DMA transfer)
- * 3. Place page in RX ring
- * 4. Return XDP frame to sender's pool
- * 5. Schedule tasklet to simulate DMA completion interrupt
+ * Folds the per-CPU histograms and counters into totals for ndo_get_stats64,
+ * ethtool -S and debugfs. Slow path only; the hot paths never read them.
+ */
+static u64 l3_event_sum(struct l3_napi_adapter* priv, enum l3_event ev)
+{
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += READ_ONCE(per_cpu_ptr(priv->pcpu, cpu)->events[ev]);
+	return sum;
+}
+
+/* Sum one stage's histogram over all CPUs into @hist, return the sample count */
+static u64 l3_lat_sum(struct l3_napi_adapter* priv, enum l3_lat_stage stage, u64* hist)
+{
+	u64 total = 0;
+	int cpu;
+	u32 b;
+
+	memset(hist, 0, L3_LAT_BUCKETS * sizeof(*hist));
+	for_each_possible_cpu(cpu) {
+		const u64* h = per_cpu_ptr(priv->pcpu, cpu)->lat[stage];
+
+		for (b = 0; b < L3_LAT_BUCKETS; b++)
+			hist[b] += READ_ONCE(h[b]);
+	}
+
+	for (b = 0; b < L3_LAT_BUCKETS; b++)
+		total += hist[b];
+	return total;
+}
+
+/* Largest latency (ns) that lands in bucket b; the last bucket is open-ended */
+static u64 l3_lat_bucket_max(u32 b)
+{
+	return b ? (1ULL << b) - 1 : 0;
+}
+
+/*
+ * l3_lat_percentile - Upper bound of the bucket holding the given rank
  *
- * CONTEXT:
- * Runs in workqueue context, providing proper separation from ndo_xdp_xmit.
- * This mimics how real hardware works: packet arrives, DMA engine transfers
- * data, then raises interrupt (via tasklet) to schedule NAPI.
+ * @permille: 500 for p50, 990 for p99, 999 for p99.9
  *
- * PARAMETERS:
- * @work: Work structure containing the packet to process
+ * Log2 buckets make this accurate to a factor of two, which is what tail
+ * latency work needs: it tells 10 us from 1 ms, not 10 us from 12 us.
  */
-static void l3_doorbell_work(struct work_struct* work)
+static u64 l3_lat_percentile(const u64* hist, u64 total, u32 permille)
 {
-	struct l3_work_item* item = container_of(work, struct l3_work_item, work);
-	struct l3_napi_adapter* priv = item->priv;
-	struct xdp_frame* xdpf = item->xdpf;
-	struct page* page;
-	void* data;
-	u32 entry;
-	unsigned long flags;
-	
+	u64 rank, seen = 0;
+	u32 b;
 
-#if TIMING_DEBUG
-	ktime_t ts_work_start = ktime_get();
-	{
-		s64 delta_ns = ktime_to_ns(ktime_sub(ts_work_start, item->ts_queued));
-		if (delta_ns > 1000000) {  /* > 1ms */
-			printk(KERN_INFO "l3loop: Workqueue handler called, %lld ns after queueing\n", delta_ns);
-		}
-	}
-#endif
+	if (!total)
+		return 0;
 
-	/* Allocate page for packet data (simulates DMA buffer allocation) */
-	page = alloc_page(GFP_KERNEL);
-	if (!page) {
-		/* Out of memory, drop packet */
-		xdp_return_frame(xdpf);
-		kfree(item);
-		return;
+	rank = div_u64(total * permille + 999, 1000);
+	for (b = 0; b < L3_LAT_BUCKETS; b++) {
+		seen += hist[b];
+		if (seen >= rank)
+			return l3_lat_bucket_max(b);
 	}
+	return l3_lat_bucket_max(L3_LAT_BUCKETS - 1);
+}
 
-	/* Copy frame data to page with headroom (simulates DMA transfer) */
-	data = page_address(page) + XDP_PACKET_HEADROOM;
-	memcpy(data, xdpf->data, xdpf->len);
+static u64 l3_lat_max(const u64* hist)
+{
+	int b;
 
-	/* Place packet in RX ring */
-	spin_lock_irqsave(&priv->lock, flags);
+	for (b = L3_LAT_BUCKETS - 1; b >= 0; b--) {
+		if (hist[b])
+			return l3_lat_bucket_max(b);
+	}
+	return 0;
+}
 
-	entry = priv->cur_rx % NUM_DESC;
+/* Ring occupancy gauges (racy snapshots, for observation only) */
+static u32 l3_rx_used(struct l3_queue* q)
+{
+	return READ_ONCE(q->cur_rx) - READ_ONCE(q->dirty_rx);
+}
 
-	/* Check if RX ring has space */
-	if (priv->rx_ring[entry].status == L3_OWN_CPU ||
-		priv->rx_ring[entry].page != NULL) {
-		/* Ring full, drop packet */
-		spin_unlock_irqrestore(&priv->lock, flags);
-		__free_page(page);
-		xdp_return_frame(xdpf);
-		kfree(item);
-#if TIMING_DEBUG
-		printk(KERN_INFO "l3loop: RX ring full, dropping packet\n");
-#endif
-		return;
-	}
+static u32 l3_tx_used(struct l3_queue* q)
+{
+	return READ_ONCE(q->cur_tx) - READ_ONCE(q->dirty_tx);
+}
 
-	/* Place in RX ring */
-	priv->rx_ring[entry].page = page;
-	priv->rx_ring[entry].data_len = xdpf->len;
-	priv->rx_ring[entry].data_offset = XDP_PACKET_HEADROOM;
-	priv->rx_ring[entry].timestamp = item->ts_queued;  /* Use original queue time */
+static u32 l3_db_used(struct l3_queue* q)
+{
+	return (unsigned long)atomic_long_read(&q->doorbell.head) -
+		READ_ONCE(q->doorbell.tail);
+}
 
-	/* Memory barrier: Ensure data written before status update */
-	smp_wmb();
+/*
+ * debugfs: /sys/kernel/debug/<ifname>/
+ *
+ * - enable:   latency_stats switch (same variable as the module parameter)
+ * - latency:  full per-stage histograms with p50/p99/p99.9
+ * - counters: drop/stall counters and per-queue ring occupancy
+ * - reset:    write anything to clear histograms, counters and watermarks
+ */
+static int l3_dbg_latency_show(struct seq_file* m, void* v)
+{
+	struct l3_napi_adapter* priv = m->private;
+	u64 hist[L3_LAT_BUCKETS];
+	u32 stage, b;
+
+	for (stage = 0; stage < L3_LAT_NUM_STAGES; stage++) {
+		u64 total = l3_lat_sum(priv, stage, hist);
+
+		seq_printf(m, "%s: %llu samples, p50 <= %llu ns, p99 <= %llu ns, p99.9 <= %llu ns\n",
+			l3_lat_stage_names[stage], total,
+			l3_lat_percentile(hist, total, 500),
+			l3_lat_percentile(hist, total, 990),
+			l3_lat_percentile(hist, total, 999));
+
+		for (b = 0; b < L3_LAT_BUCKETS; b++) {
+			if (!hist[b])
+				continue;
+			if (b == L3_LAT_BUCKETS - 1)
+				seq_printf(m, "  %12llu ns and up      : %llu\n",
+					1ULL << (b - 1), hist[b]);
+			else
+				seq_printf(m, "  %12llu - %12llu ns : %llu\n",
+					b ? 1ULL << (b - 1) : 0, l3_lat_bucket_max(b), hist[b]);
+		}
+		seq_putc(m, '\n');
+	}
 
-	/* Mark descriptor as ready for processing */
-	WRITE_ONCE(priv->rx_ring[entry].status, L3_OWN_CPU);
-	priv->cur_rx++;
+	if (!READ_ONCE(latency_stats))
+		seq_puts(m, "(recording is off: echo 1 > enable)\n");
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(l3_dbg_latency);
 
-	spin_unlock_irqrestore(&priv->lock, flags);
+static int l3_dbg_counters_show(struct seq_file* m, void* v)
+{
+	struct l3_napi_adapter* priv = m->private;
+	u32 i;
+
+	for (i = 0; i < L3_NUM_EVENTS; i++)
+		seq_printf(m, "%-24s %llu\n", l3_event_names[i], l3_event_sum(priv, i));
+
+	seq_putc(m, '\n');
+	for (i = 0; i < priv->num_queues; i++) {
+		struct l3_queue* q = &priv->queues[i];
+
+		seq_printf(m, "queue %u: rx_ring %u/%u (max %u), tx_ring %u/%u, doorbell %u/%u (max %u)\n",
+			i, l3_rx_used(q), priv->rx_ring_size, READ_ONCE(q->rx_used_max),
+			l3_tx_used(q), priv->tx_ring_size,
+			l3_db_used(q), l3_db_size(priv), READ_ONCE(q->db_used_max));
+		seq_printf(m, "         irqs %u, coalescing %u us / %u frames\n",
+			READ_ONCE(q->irqs), READ_ONCE(q->coal_usecs), READ_ONCE(q->coal_frames));
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(l3_dbg_counters);
 
-	/* Return XDP frame to sender's pool (we've copied the data) */
-	xdp_return_frame(xdpf);
+static ssize_t l3_dbg_reset_write(struct file* file, const char __user* buf,
+	size_t count, loff_t* ppos)
+{
+	struct l3_napi_adapter* priv = file->private_data;
+	int cpu;
+	u32 i;
 
-	/* Free work item */
-	kfree(item);
+	/* Racing increments on other CPUs may survive; this is statistics */
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(priv->pcpu, cpu), 0, sizeof(struct l3_pcpu_stats));
 
-#if TIMING_DEBUG
-	{
-		s64 work_duration_ns = ktime_to_ns(ktime_sub(ktime_get(), ts_work_start));
-		printk(KERN_INFO "l3loop: Workqueue handler completed in %lld ns, scheduling tasklet\n",
-			work_duration_ns);
+	for (i = 0; i < priv->num_queues; i++) {
+		WRITE_ONCE(priv->queues[i].rx_used_max, 0);
+		WRITE_ONCE(priv->queues[i].db_used_max, 0);
 	}
-#endif
 
-	/*
-	 * TRIGGER FAKE IRQ (Simulates DMA Completion Interrupt)
-	 *
-	 * Now that DMA transfer is complete, schedule the tasklet to
-	 * simulate a hardware interrupt. The tasklet will then schedule NAPI.
-	 *
-	 * This is how real hardware works:
-	 * 1. DMA engine completes transfer
-	 * 2. Hardware raises interrupt
-	 * 3. Interrupt handler (tasklet) schedules NAPI
-	 * 4. NAPI processes packets
-	 */
-	priv->ts_last_tasklet = ktime_get();
-	tasklet_schedule(&priv->irq_tasklet);
+	return count;
 }
 
+static const struct file_operations l3_dbg_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = l3_dbg_reset_write,
+	.llseek = noop_llseek,
+};
+
 /*
- * Loopback Workqueue Handler (for locally transmitted packets)
+ * Built-in Packet Generator (debugfs "pktgen")
  *
  * PURPOSE:
- * Handles loopback traffic from ndo_start_xmit.
- * Simulates DMA operation for locally transmitted packets.
+ * A traffic source inside the driver, so the queues can be measured
+ * without veths, namespaces or a userspace sender in the way:
+ *
+ *   echo "frames=1000000 size=64 cpus=2 mode=xdp" > /sys/kernel/debug/l3loop0/pktgen
+ *   cat /sys/kernel/debug/l3loop0/pktgen
  *
  * OPERATION:
- * 1. Allocate page for packet data
- * 2. Copy packet data to page (simulates DMA transfer)
- * 3. Place page in RX ring
- * 4. Free copied data
- * 5. Schedule tasklet to simulate DMA completion interrupt
+ * The write starts one kthread on each of the first @cpus online CPUs
+ * and returns when the run is over. Each thread injects @frames UDP
+ * frames of @size bytes (10.0.0.1 -> 10.0.0.2, IP TTL @ttl, addressed to
+ * l3loop0's MAC; up to the MTU plus the Ethernet header, so jumbo frames
+ * after "ip link set l3loop0 mtu 9000") into the queue of its CPU:
+ * - mode=xdp: xdp_frames go straight into the doorbell, exactly as
+ *   ndo_xdp_xmit posts them for a device redirecting to us. Buffers come
+ *   from a page_pool owned by the thread and return to it wherever the
+ *   frame ends (XDP_DROP, TX/redirect completion, skb free).
+ * - mode=skb: skbs go through dev_direct_xmit(), i.e. ndo_start_xmit and
+ *   the loopback path, bypassing the qdisc.
+ * A thread that finds the doorbell or TX queue full backs off and
+ * retries, so the injection rate settles at what the driver sustains.
+ * The clock stops once every thread is done and all queues have drained,
+ * and the result is reported as Mpps and Gbps over that time. Latency
+ * percentiles are in ethtool -S and debugfs "latency" as usual.
+ */
+#define L3_PG_BATCH      16     /* Frames per doorbell kick (one devmap bulk) */
+#define L3_PG_POOL_SIZE  1024   /* Pages in each injector's page_pool */
+#define L3_PG_DRAIN_MS   1000   /* Longest wait for the queues to drain */
+
+struct l3_pg_thread {
+	struct l3_napi_adapter* priv;
+	struct l3_queue* q;              /* Queue of the thread's CPU */
+	struct task_struct* task;
+	struct completion done;
+	u64 sent;
+	u64 retries;
+	int err;
+	u8 frame[L3_MAX_FRAME];          /* Template copied into every frame */
+};
+
+static void l3_pg_build_frame(struct l3_napi_adapter* priv, u8* buf)
+{
+	static const u8 src_mac[ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+	struct l3_pktgen* pg = &priv->pktgen;
+	struct ethhdr* eth = (struct ethhdr*)buf;
+	struct iphdr* iph = (struct iphdr*)(eth + 1);
+	struct udphdr* udph = (struct udphdr*)(iph + 1);
+
+	memset(buf, 0, pg->size);
+	ether_addr_copy(eth->h_dest, priv->netdev->dev_addr);
+	ether_addr_copy(eth->h_source, src_mac);
+	eth->h_proto = htons(ETH_P_IP);
+
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->ttl = pg->ttl;
+	iph->protocol = IPPROTO_UDP;
+	iph->tot_len = htons(pg->size - ETH_HLEN);
+	iph->saddr = htonl(0x0a000001);  /* 10.0.0.1 */
+	iph->daddr = htonl(0x0a000002);  /* 10.0.0.2 */
+	iph->check = ip_fast_csum(iph, iph->ihl);
+
+	udph->source = htons(9);         /* discard */
+	udph->dest = htons(9);
+	udph->len = htons(pg->size - ETH_HLEN - sizeof(*iph));
+}
+
+/*
+ * l3_pg_inject_xdp - Post xdp_frames to the doorbell, ndo_xdp_xmit style
  *
- * PARAMETERS:
- * @work: Work structure containing the packet to process
+ * The frames carry the thread's own page_pool as their memory model, so
+ * whoever finishes with a frame (our NAPI, the redirect target, the skb
+ * built for XDP_PASS) recycles the page into it. The pool's page order
+ * fits the frame size, so even a jumbo frame is one linear buffer. Frames
+ * left over when the doorbell is full are kept for the next attempt.
  */
-static void l3_loopback_work(struct work_struct* work)
+static int l3_pg_inject_xdp(struct l3_pg_thread* t)
 {
-	struct l3_loopback_item* item = container_of(work, struct l3_loopback_item, work);
-	struct l3_napi_adapter* priv = item->priv;
-	struct page* page;
-	void* data;
-	u32 entry;
-	unsigned long flags;
-	
+	struct l3_napi_adapter* priv = t->priv;
+	struct l3_pktgen* pg = &priv->pktgen;
+	struct net_device* dev = priv->netdev;
+	struct l3_queue* q = t->q;
+	u32 order = get_order(XDP_PACKET_HEADROOM + pg->size +
+		SKB_DATA_ALIGN(sizeof(struct skb_shared_info)));
+	struct page_pool_params pp_params = {
+		.order = order,
+		.pool_size = L3_PG_POOL_SIZE,
+		.nid = numa_node_id(),
+		.dev = &dev->dev,
+	};
+	struct xdp_frame* frames[L3_PG_BATCH];
+	struct xdp_rxq_info rxq = {};
+	struct page_pool* pool;
+	u32 ready = 0, i;
+	int err;
 
-#if TIMING_DEBUG
-	ktime_t ts_work_start = ktime_get();
-	{
-		s64 delta_ns = ktime_to_ns(ktime_sub(ts_work_start, item->ts_queued));
-		if (delta_ns > 1000000) {  /* > 1ms */
-			printk(KERN_INFO "l3loop: Loopback workqueue handler called, %lld ns after queueing\n", delta_ns);
-		}
-	}
-#endif
+	pool = page_pool_create(&pp_params);
+	if (IS_ERR(pool))
+		return PTR_ERR(pool);
 
-	/* Allocate page for packet data (simulates DMA buffer allocation) */
-	page = alloc_page(GFP_KERNEL);
-	if (!page) {
-		/* Out of memory, drop packet */
-		kfree(item->data);
-		kfree(item);
-		return;
+	err = xdp_reg_mem_model(&rxq.mem, MEM_TYPE_PAGE_POOL, pool);
+	if (err) {
+		page_pool_destroy(pool);
+		return err;
 	}
+	rxq.dev = dev;
+	rxq.queue_index = q->index;
 
-	/* Copy packet data to page with headroom (simulates DMA transfer) */
-	data = page_address(page) + XDP_PACKET_HEADROOM;
-	memcpy(data, item->data, item->len);
+	while (t->sent < pg->frames && !READ_ONCE(pg->abort)) {
+		ktime_t ts_xmit;
 
-	/* Place packet in RX ring */
-	spin_lock_irqsave(&priv->lock, flags);
+		/* Top the batch up */
+		while (ready < L3_PG_BATCH && t->sent + ready < pg->frames) {
+			struct page* page = page_pool_dev_alloc_pages(pool);
+			struct xdp_buff xdp;
 
-	entry = priv->cur_rx % NUM_DESC;
+			if (!page) {
+				err = -ENOMEM;
+				break;
+			}
+			xdp_init_buff(&xdp, PAGE_SIZE << order, &rxq);
+			xdp_prepare_buff(&xdp, page_address(page), XDP_PACKET_HEADROOM,
+				pg->size, false);
+			memcpy(xdp.data, t->frame, pg->size);
+			frames[ready++] = xdp_convert_buff_to_frame(&xdp);
+		}
+		if (err)
+			break;
 
-	/* Check if RX ring has space */
-	if (priv->rx_ring[entry].status == L3_OWN_CPU ||
-		priv->rx_ring[entry].page != NULL) {
-		/* Ring full, drop packet */
-		spin_unlock_irqrestore(&priv->lock, flags);
-		__free_page(page);
-		kfree(item->data);
-		kfree(item);
-#if TIMING_DEBUG
-		printk(KERN_INFO "l3loop: RX ring full (loopback), dropping packet\n");
-#endif
-		return;
+		ts_xmit = l3_lat_now();
+
+		/* Same rule as ndo_xdp_xmit: only a running device has doorbells */
+		rcu_read_lock();
+		if (!netif_running(dev) || !smp_load_acquire(&priv->rings_ready)) {
+			rcu_read_unlock();
+			err = -ENETDOWN;
+			break;
+		}
+		for (i = 0; i < ready; i++) {
+			if (l3_doorbell_push(&q->doorbell, frames[i], L3_DB_XDP_FRAME, 0, ts_xmit))
+				break;
+		}
+		if (i)
+			l3_doorbell_kick(q);
+		rcu_read_unlock();
+
+		t->sent += i;
+		ready -= i;
+		if (ready) {
+			/* Doorbell full: give the worker and NAPI a chance */
+			memmove(frames, frames + i, ready * sizeof(frames[0]));
+			t->retries++;
+		}
+		cond_resched();
 	}
 
-	/* Place in RX ring */
-	priv->rx_ring[entry].page = page;
-	priv->rx_ring[entry].data_len = item->len;
-	priv->rx_ring[entry].data_offset = XDP_PACKET_HEADROOM;
-	priv->rx_ring[entry].timestamp = item->ts_queued;  /* Use original queue time */
+	for (i = 0; i < ready; i++)
+		xdp_return_frame(frames[i]);
 
-	/* Memory barrier: Ensure data written before status update */
-	smp_wmb();
+	/* Frames still in flight keep the pool alive until they come back */
+	xdp_unreg_mem_model(&rxq.mem);
+	page_pool_destroy(pool);
+	return err;
+}
 
-	/* Mark descriptor as ready for processing */
-	WRITE_ONCE(priv->rx_ring[entry].status, L3_OWN_CPU);
-	priv->cur_rx++;
+/*
+ * l3_pg_inject_skb - Transmit skbs through ndo_start_xmit
+ *
+ * dev_direct_xmit() skips the qdisc, so what is measured is the driver's
+ * own TX and loopback path. It frees the skb when the queue is stopped
+ * (NETDEV_TX_BUSY), which is counted as a retry.
+ */
+static int l3_pg_inject_skb(struct l3_pg_thread* t)
+{
+	struct l3_napi_adapter* priv = t->priv;
+	struct l3_pktgen* pg = &priv->pktgen;
+	struct net_device* dev = priv->netdev;
 
-	spin_unlock_irqrestore(&priv->lock, flags);
+	while (t->sent < pg->frames && !READ_ONCE(pg->abort)) {
+		struct sk_buff* skb;
 
-	/* Free copied data */
-	kfree(item->data);
-	kfree(item);
+		if (!netif_running(dev))
+			return -ENETDOWN;
 
-#if TIMING_DEBUG
-	{
-		s64 work_duration_ns = ktime_to_ns(ktime_sub(ktime_get(), ts_work_start));
-		printk(KERN_INFO "l3loop: Loopback workqueue completed in %lld ns, scheduling tasklet\n",
-			work_duration_ns);
+		skb = netdev_alloc_skb(dev, pg->size);
+		if (!skb)
+			return -ENOMEM;
+		skb_put_data(skb, t->frame, pg->size);
+		skb->protocol = htons(ETH_P_IP);
+
+		if (dev_direct_xmit(skb, t->q->index) == NETDEV_TX_OK)
+			t->sent++;
+		else
+			t->retries++;
+		cond_resched();
 	}
-#endif
+	return 0;
+}
+
+static int l3_pg_thread_fn(void* arg)
+{
+	struct l3_pg_thread* t = arg;
+
+	l3_pg_build_frame(t->priv, t->frame);
+	if (t->priv->pktgen.skb_mode)
+		t->err = l3_pg_inject_skb(t);
+	else
+		t->err = l3_pg_inject_xdp(t);
+
+	/* t may be freed as soon as this returns */
+	complete(&t->done);
+	return 0;
+}
+
+/* Nothing posted, nothing on an RX ring and every TX descriptor completed */
+static bool l3_pg_drained(struct l3_napi_adapter* priv)
+{
+	u32 i;
+
+	for (i = 0; i < priv->num_queues; i++) {
+		struct l3_queue* q = &priv->queues[i];
 
-	/* Trigger fake IRQ (simulates DMA completion interrupt) */
-	priv->ts_last_tasklet = ktime_get();
-	tasklet_schedule(&priv->irq_tasklet);
+		if (l3_doorbell_pending(&q->doorbell) || l3_rx_used(q) || l3_tx_used(q))
+			return false;
+	}
+	return true;
 }
 
 /*
- * ndo_xdp_xmit - Receive XDP-redirected packets from other devices
- *
- * PURPOSE:
- * This function is called when another device redirects packets to us
- * using XDP redirect. It's the entry point for XDP-redirected traffic.
- *
- * OPERATION:
- * 1. Queue XDP frames to workqueue (ring doorbell)
- * 2. Workqueue will handle DMA simulation
- * 3. Workqueue will trigger fake IRQ (tasklet)
- * 4. Tasklet will schedule NAPI
- * 5. Return immediately (non-blocking)
- *
- * PARAMETERS:
- * @dev: Our network device
- * @n: Number of frames being transmitted
- * @frames: Array of XDP frame pointers
- * @flags: Transmission flags
- *
- * RETURNS:
- * Number of frames successfully queued (or negative error code)
- *
- * DOORBELL MECHANISM:
- * Instead of directly processing packets or using a timer, we queue
- * work items to a workqueue. This simulates how real hardware works:
- * 1. Packet arrives at NIC
- * 2. NIC rings doorbell (signals packet arrival)
- * 3. DMA engine transfers packet data (workqueue)
- * 4. DMA completion triggers interrupt (tasklet)
- * 5. Interrupt handler schedules NAPI (tasklet → NAPI)
+ * l3_pktgen_run - Run one generator pass with the parameters in priv->pktgen
  *
- * This provides proper context separation and immediate processing.
+ * Caller holds pktgen.lock. All threads are created before any starts,
+ * so the clock covers the parallel part only. A fatal signal while
+ * waiting aborts the threads instead of leaving them behind.
  */
-static int l3_ndo_xdp_xmit(struct net_device* dev, int n, struct xdp_frame** frames, u32 flags)
+static int l3_pktgen_run(struct l3_napi_adapter* priv)
 {
-	struct l3_napi_adapter* priv = netdev_priv(dev);
-	int nxmit = 0;
-	int i;
-	ktime_t ts_xmit = ktime_get();
+	struct l3_pktgen* pg = &priv->pktgen;
+	struct l3_pg_thread* threads;
+	unsigned long deadline;
+	ktime_t start;
+	u32 n = 0, i;
+	int cpu, err = 0;
+
+	if (!netif_running(priv->netdev))
+		return -ENETDOWN;
 
-#if TIMING_DEBUG
-	printk(KERN_INFO "l3loop: ndo_xdp_xmit called with %d frames\n", n);
-#endif
+	threads = kvcalloc(pg->cpus, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
 
-	/* Validate flags */
-	if (unlikely(flags & ~XDP_XMIT_FLAGS_MASK))
-		return -EINVAL;
+	WRITE_ONCE(pg->abort, false);
+	pg->sent = 0;
+	pg->retries = 0;
+	pg->elapsed_ns = 0;
+	pg->err = 0;
 
-	/* Check if device is running */
-	if (unlikely(!netif_running(dev)))
-		return -ENETDOWN;
+	for_each_online_cpu(cpu) {
+		struct l3_pg_thread* t = &threads[n];
 
-	/*
-	 * DOORBELL: Queue packets to workqueue
-	 *
-	 * For each frame, create a work item and queue it.
-	 * The workqueue will handle the actual DMA simulation.
-	 */
-	for (i = 0; i < n; i++) {
-		struct l3_work_item* item;
+		if (n == pg->cpus)
+			break;
 
-		/* Allocate work item */
-		item = kmalloc(sizeof(*item), GFP_ATOMIC);
-		if (!item) {
-			/* Out of memory, stop processing */
+		t->priv = priv;
+		t->q = &priv->queues[cpu % priv->num_queues];
+		init_completion(&t->done);
+		t->task = kthread_create_on_cpu(l3_pg_thread_fn, t, cpu, "l3pktgen/%u");
+		if (IS_ERR(t->task)) {
+			err = PTR_ERR(t->task);
 			break;
 		}
+		n++;
+	}
+
+	if (err) {
+		/* Never woken, so the thread function never runs */
+		for (i = 0; i < n; i++)
+			kthread_stop(threads[i].task);
+		goto out;
+	}
 
-		/* Initialize work item */
-		INIT_WORK(&item->work, l3_doorbell_work);
-		item->priv = priv;
-		item->xdpf = frames[i];
-		item->ts_queued = ts_xmit;
+	start = ktime_get();
+	for (i = 0; i < n; i++)
+		wake_up_process(threads[i].task);
 
-		/* Queue work (ring doorbell) */
-		queue_work(priv->doorbell_wq, &item->work);
-		nxmit++;
+	for (i = 0; i < n; i++) {
+		if (wait_for_completion_killable(&threads[i].done)) {
+			WRITE_ONCE(pg->abort, true);
+			wait_for_completion(&threads[i].done);
+		}
 	}
 
-	/* Return any frames we couldn't queue */
-	for (; i < n; i++)
-		xdp_return_frame(frames[i]);
+	/* Count until the last frame has been through NAPI */
+	deadline = jiffies + msecs_to_jiffies(L3_PG_DRAIN_MS);
+	while (!l3_pg_drained(priv) && time_before(jiffies, deadline))
+		usleep_range(20, 50);
+	pg->elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
 
-#if TIMING_DEBUG
-	printk(KERN_INFO "l3loop: ndo_xdp_xmit queued %d frames to workqueue\n", nxmit);
-#endif
+	for (i = 0; i < n; i++) {
+		pg->sent += threads[i].sent;
+		pg->retries += threads[i].retries;
+		if (!pg->err)
+			pg->err = threads[i].err;
+	}
+	if (!pg->err && READ_ONCE(pg->abort))
+		pg->err = -EINTR;
+	if (!pg->err && !l3_pg_drained(priv))
+		pg->err = -ETIMEDOUT;
+
+out:
+	kvfree(threads);
+	return err;
+}
 
-	return nxmit;
+static int l3_dbg_pktgen_show(struct seq_file* m, void* v)
+{
+	struct l3_napi_adapter* priv = m->private;
+	struct l3_pktgen* pg = &priv->pktgen;
+	u64 ns, mpps, gbps;
+	int err;
+
+	err = mutex_lock_interruptible(&pg->lock);
+	if (err)
+		return err;
+
+	if (!pg->elapsed_ns) {
+		seq_puts(m, "no run yet: echo \"frames=N size=S cpus=K mode=xdp|skb ttl=T\" > pktgen\n");
+		goto out;
+	}
+
+	/* Thousandths: frames/ns * 1e3 is Mpps, bits/ns is Gbps */
+	ns = pg->elapsed_ns;
+	mpps = div64_u64(pg->sent * 1000000, ns);
+	gbps = div64_u64(pg->sent * pg->size * 8 * 1000, ns);
+
+	seq_printf(m, "mode: %s\n", pg->skb_mode ? "skb" : "xdp");
+	seq_printf(m, "cpus: %u\n", pg->cpus);
+	seq_printf(m, "size: %u\n", pg->size);
+	seq_printf(m, "ttl: %u\n", pg->ttl);
+	seq_printf(m, "frames: %llu\n", pg->frames * pg->cpus);
+	seq_printf(m, "sent: %llu\n", pg->sent);
+	seq_printf(m, "retries: %llu\n", pg->retries);
+	seq_printf(m, "elapsed_ns: %llu\n", pg->elapsed_ns);
+	seq_printf(m, "mpps: %llu.%03llu\n", mpps / 1000, mpps % 1000);
+	seq_printf(m, "gbps: %llu.%03llu\n", gbps / 1000, gbps % 1000);
+	seq_printf(m, "result: %d\n", pg->err);
+out:
+	mutex_unlock(&pg->lock);
+	return 0;
+}
+
+static int l3_dbg_pktgen_open(struct inode* inode, struct file* file)
+{
+	return single_open(file, l3_dbg_pktgen_show, inode->i_private);
 }
 
 /*
- * XDP Program Setup
- *
- * PURPOSE:
- * Attach or detach an XDP program to this device.
- * Called when userspace loads/unloads an XDP program.
- *
- * PARAMETERS:
- * @dev: Network device
- * @bpf: BPF program information
- *
- * OPERATION:
- * - Increments program reference count if attaching
- * - Atomically swaps old and new programs
- * - Decrements old program reference count if detaching
+ * Parse "key=value ..." and run. Keys left out take their defaults
+ * (1000000 frames of 64 bytes from one CPU, mode=xdp, ttl=64). The write
+ * blocks for the whole run.
  */
-static int l3_xdp_setup(struct net_device* dev, struct netdev_bpf* bpf)
+static ssize_t l3_dbg_pktgen_write(struct file* file, const char __user* ubuf,
+	size_t count, loff_t* ppos)
 {
-	struct l3_napi_adapter* priv = netdev_priv(dev);
-	struct bpf_prog* old_prog, * new_prog = bpf->prog;
+	struct seq_file* m = file->private_data;
+	struct l3_napi_adapter* priv = m->private;
+	struct l3_pktgen* pg = &priv->pktgen;
+	u32 size = ETH_ZLEN + ETH_FCS_LEN, cpus = 1, ttl = 64;
+	u64 frames = 1000000;
+	bool skb_mode = false;
+	char buf[128], *cur = buf, *tok;
+	int err = 0;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	while (!err && (tok = strsep(&cur, " \t\n"))) {
+		char* val;
+
+		if (!*tok)
+			continue;
+		val = strchr(tok, '=');
+		if (!val)
+			return -EINVAL;
+		*val++ = '\0';
+
+		if (!strcmp(tok, "frames"))
+			err = kstrtou64(val, 0, &frames);
+		else if (!strcmp(tok, "size"))
+			err = kstrtou32(val, 0, &size);
+		else if (!strcmp(tok, "cpus"))
+			err = kstrtou32(val, 0, &cpus);
+		else if (!strcmp(tok, "ttl"))
+			err = kstrtou32(val, 0, &ttl);
+		else if (!strcmp(tok, "mode") && !strcmp(val, "xdp"))
+			skb_mode = false;
+		else if (!strcmp(tok, "mode") && !strcmp(val, "skb"))
+			skb_mode = true;
+		else
+			err = -EINVAL;
+	}
+	if (err)
+		return err;
 
-	/* Increment reference count for new program */
-	if (new_prog)
-		bpf_prog_add(new_prog, 1);
+	if (!frames || size < ETH_ZLEN || size > ETH_HLEN + READ_ONCE(priv->netdev->mtu) ||
+	    !cpus || cpus > num_online_cpus() || !ttl || ttl > 255)
+		return -EINVAL;
 
-	/* Atomically swap programs */
-	old_prog = xchg(&priv->xdp_prog, new_prog);
+	err = mutex_lock_interruptible(&pg->lock);
+	if (err)
+		return err;
 
-	/* Decrement reference count for old program */
-	if (old_prog)
-		bpf_prog_put(old_prog);
+	pg->skb_mode = skb_mode;
+	pg->frames = frames;
+	pg->size = size;
+	pg->cpus = cpus;
+	pg->ttl = ttl;
+	err = l3_pktgen_run(priv);
 
-	return 0;
+	mutex_unlock(&pg->lock);
+	return err ? err : count;
+}
+
+static const struct file_operations l3_dbg_pktgen_fops = {
+	.owner = THIS_MODULE,
+	.open = l3_dbg_pktgen_open,
+	.read = seq_read,
+	.write = l3_dbg_pktgen_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void l3_debugfs_init(struct l3_napi_adapter* priv)
+{
+	struct dentry* dir = debugfs_create_dir(netdev_name(priv->netdev), NULL);
+
+	/* debugfs failures are not fatal; the calls below accept an error dir */
+	priv->debugfs_dir = dir;
+	debugfs_create_bool("enable", 0644, dir, &latency_stats);
+	debugfs_create_file("latency", 0444, dir, priv, &l3_dbg_latency_fops);
+	debugfs_create_file("counters", 0444, dir, priv, &l3_dbg_counters_fops);
+	debugfs_create_file("reset", 0200, dir, priv, &l3_dbg_reset_fops);
+	debugfs_create_file("pktgen", 0600, dir, priv, &l3_dbg_pktgen_fops);
 }
 
 /*
- * ndo_bpf - Handle BPF-related operations
+ * ndo_get_stats64 - Report device statistics
  *
  * PURPOSE:
- * Entry point for BPF operations on this device.
- * Currently only supports XDP program setup.
+ * Sums the per-queue counters. Each queue's counters are only written by
+ * its own NAPI poll, so no lock is needed; the u64_stats retry loop gives
+ * a consistent snapshot of each queue. Drops come from the per-CPU event
+ * counters: frames refused by ndo_xdp_xmit and packets the simulated DMA
+ * or XDP_PASS could not buffer count as RX drops, full-doorbell loopback
+ * transmits as TX drops. XDP_DROP verdicts are policy, not drops.
  */
-static int l3_ndo_bpf(struct net_device* dev, struct netdev_bpf* bpf)
+static void l3_get_stats64(struct net_device* dev, struct rtnl_link_stats64* stats)
 {
-	switch (bpf->command) {
-	case XDP_SETUP_PROG:
-		return l3_xdp_setup(dev, bpf);
-	default:
-		return -EINVAL;
+	struct l3_napi_adapter* priv = netdev_priv(dev);
+	u32 i;
+
+	for (i = 0; i < priv->num_queues; i++) {
+		struct l3_queue_stats* qs = &priv->queues[i].stats;
+		u64 rx_packets, rx_bytes, tx_packets, tx_bytes;
+		unsigned int start;
+
+		do {
+			start = u64_stats_fetch_begin(&qs->syncp);
+			rx_packets = qs->rx_packets;
+			rx_bytes = qs->rx_bytes;
+			tx_packets = qs->tx_packets;
+			tx_bytes = qs->tx_bytes;
+		} while (u64_stats_fetch_retry(&qs->syncp, start));
+
+		stats->rx_packets += rx_packets;
+		stats->rx_bytes += rx_bytes;
+		stats->tx_packets += tx_packets;
+		stats->tx_bytes += tx_bytes;
 	}
+
+	stats->rx_dropped = l3_event_sum(priv, L3_EV_XDP_DOORBELL_FULL) +
+		l3_event_sum(priv, L3_EV_RX_NO_BUFFER) +
+		l3_event_sum(priv, L3_EV_RX_OVERSIZE) +
+		l3_event_sum(priv, L3_EV_RX_SKB_ALLOC);
+	stats->tx_dropped = l3_event_sum(priv, L3_EV_TX_DOORBELL_FULL) +
+		l3_event_sum(priv, L3_EV_XDP_TX_ERR);
 }
 
 /*
- * ndo_start_xmit - Transmit a packet
+ * ethtool Statistics
  *
  * PURPOSE:
- * Called by the network stack to transmit a packet.
- * In this loopback driver, we queue the packet to workqueue for processing.
- *
- * PARAMETERS:
- * @skb: Socket buffer containing packet to transmit
- * @dev: Network device
- *
- * RETURNS:
- * NETDEV_TX_OK on success, NETDEV_TX_BUSY if queue full
- *
- * OPERATION:
- * 1. Place skb in TX ring (for completion tracking by NAPI)
- * 2. Copy skb data to temporary buffer
- * 3. Create work item with copied data
- * 4. Queue to workqueue (ring doorbell)
- * 5. Workqueue will copy data to RX ring, trigger fake IRQ, schedule NAPI
+ * "ethtool -S" shows, in this order:
+ * - the page_pool counters summed over all queues. Fast-path allocations
+ *   (alloc_fast) are pool hits, alloc_slow are misses that went to the
+ *   page allocator, and the recycle_* counters show pages coming back.
+ *   Without CONFIG_PAGE_POOL_STATS this block is absent
+ * - the drop/stall counters
+ * - per latency stage: sample count, p50/p99/p99.9 and max (bucket upper
+ *   bounds in ns, see l3_lat_percentile)
+ * - per queue: current and peak ring occupancy, fake IRQs raised
  */
-static netdev_tx_t l3_napi_start_xmit(struct sk_buff* skb, struct net_device* dev)
+#define L3_LAT_ETHTOOL_FIELDS   5       /* samples, p50, p99, p999, max */
+#define L3_QUEUE_ETHTOOL_FIELDS 6       /* rx/tx/doorbell used, rx/doorbell max, irqs */
+
+static int l3_get_sset_count(struct net_device* dev, int sset)
 {
 	struct l3_napi_adapter* priv = netdev_priv(dev);
-	struct l3_loopback_item* item;
-	unsigned char* data_copy;
-	u32 tx_entry;
-	unsigned long flags;
-	ktime_t ts_xmit = ktime_get();
 
-#if TIMING_DEBUG
-	printk(KERN_INFO "l3loop: ndo_start_xmit called, skb len=%u\n", skb->len);
-#endif
+	switch (sset) {
+	case ETH_SS_STATS:
+		return page_pool_ethtool_stats_get_count() + L3_NUM_EVENTS +
+			L3_LAT_NUM_STAGES * L3_LAT_ETHTOOL_FIELDS +
+			priv->num_queues * L3_QUEUE_ETHTOOL_FIELDS;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
 
-	spin_lock_irqsave(&priv->lock, flags);
+static void l3_get_strings(struct net_device* dev, u32 sset, u8* data)
+{
+	struct l3_napi_adapter* priv = netdev_priv(dev);
+	u32 i;
 
-	tx_entry = priv->cur_tx % NUM_DESC;
+	switch (sset) {
+	case ETH_SS_STATS:
+		data = page_pool_ethtool_stats_get_strings(data);
 
-	/* Check if TX ring has space */
-	if (priv->tx_ring[tx_entry].skb) {
-		netif_stop_queue(dev);
-		spin_unlock_irqrestore(&priv->lock, flags);
-		return NETDEV_TX_BUSY;
-	}
+		for (i = 0; i < L3_NUM_EVENTS; i++)
+			ethtool_puts(&data, l3_event_names[i]);
 
-	/* Place in TX ring for completion tracking */
-	priv->tx_ring[tx_entry].skb = skb_get(skb);  /* Keep reference for NAPI cleanup */
-	wmb();
-	priv->tx_ring[tx_entry].status = L3_OWN_CPU;
-	priv->cur_tx++;
+		for (i = 0; i < L3_LAT_NUM_STAGES; i++) {
+			ethtool_sprintf(&data, "lat_%s_samples", l3_lat_stage_names[i]);
+			ethtool_sprintf(&data, "lat_%s_p50_ns", l3_lat_stage_names[i]);
+			ethtool_sprintf(&data, "lat_%s_p99_ns", l3_lat_stage_names[i]);
+			ethtool_sprintf(&data, "lat_%s_p999_ns", l3_lat_stage_names[i]);
+			ethtool_sprintf(&data, "lat_%s_max_ns", l3_lat_stage_names[i]);
+		}
 
-	spin_unlock_irqrestore(&priv->lock, flags);
+		for (i = 0; i < priv->num_queues; i++) {
+			ethtool_sprintf(&data, "q%u_rx_ring_used", i);
+			ethtool_sprintf(&data, "q%u_tx_ring_used", i);
+			ethtool_sprintf(&data, "q%u_doorbell_used", i);
+			ethtool_sprintf(&data, "q%u_rx_ring_used_max", i);
+			ethtool_sprintf(&data, "q%u_doorbell_used_max", i);
+			ethtool_sprintf(&data, "q%u_irqs", i);
+		}
+		break;
+	}
+}
 
-	/*
-	 * DOORBELL: Queue packet to workqueue for loopback processing
-	 *
-	 * Copy skb data and queue to workqueue.
-	 * This simulates packet being sent to hardware and looped back.
-	 */
+static void l3_get_ethtool_stats(struct net_device* dev,
+	struct ethtool_stats* stats, u64* data)
+{
+	struct l3_napi_adapter* priv = netdev_priv(dev);
+	u64 hist[L3_LAT_BUCKETS];
+	u32 i;
 
-	 /* Allocate temporary buffer for packet data */
-	data_copy = kmalloc(skb->len, GFP_ATOMIC);
-	if (!data_copy) {
-		/* Out of memory, drop packet */
-		dev_kfree_skb_any(skb);
-		return NETDEV_TX_OK;
-	}
+#ifdef CONFIG_PAGE_POOL_STATS
+	{
+		struct page_pool_stats pp_stats = {};
 
-	/* Copy skb data */
-	skb_copy_bits(skb, 0, data_copy, skb->len);
+		/* Pools only exist while the device is up */
+		for (i = 0; i < priv->num_queues; i++) {
+			if (priv->queues[i].page_pool)
+				page_pool_get_stats(priv->queues[i].page_pool, &pp_stats);
+		}
 
-	/* Allocate work item */
-	item = kmalloc(sizeof(*item), GFP_ATOMIC);
-	if (!item) {
-		/* Out of memory, drop packet */
-		kfree(data_copy);
-		dev_kfree_skb_any(skb);
-		return NETDEV_TX_OK;
+		data = page_pool_ethtool_stats_get(data, &pp_stats);
 	}
+#endif
 
-	/* Initialize work item */
-	INIT_WORK(&item->work, l3_loopback_work);
-	item->priv = priv;
-	item->data = data_copy;
-	item->len = skb->len;
-	item->ts_queued = ts_xmit;
+	for (i = 0; i < L3_NUM_EVENTS; i++)
+		*data++ = l3_event_sum(priv, i);
 
-	/* Queue work (ring doorbell) */
-	queue_work(priv->doorbell_wq, &item->work);
+	for (i = 0; i < L3_LAT_NUM_STAGES; i++) {
+		u64 total = l3_lat_sum(priv, i, hist);
 
-#if TIMING_DEBUG
-	printk(KERN_INFO "l3loop: ndo_start_xmit queued packet to workqueue\n");
-#endif
+		*data++ = total;
+		*data++ = l3_lat_percentile(hist, total, 500);
+		*data++ = l3_lat_percentile(hist, total, 990);
+		*data++ = l3_lat_percentile(hist, total, 999);
+		*data++ = l3_lat_max(hist);
+	}
 
-	/* Consume original skb (we've copied the data) */
-	dev_consume_skb_any(skb);
+	for (i = 0; i < priv->num_queues; i++) {
+		struct l3_queue* q = &priv->queues[i];
 
-	return NETDEV_TX_OK;
+		*data++ = l3_rx_used(q);
+		*data++ = l3_tx_used(q);
+		*data++ = l3_db_used(q);
+		*data++ = READ_ONCE(q->rx_used_max);
+		*data++ = READ_ONCE(q->db_used_max);
+		*data++ = READ_ONCE(q->irqs);
+	}
 }
 
 /*
- * ndo_open - Open the network device
+ * ethtool Ring Parameters
  *
  * PURPOSE:
- * Called when device is brought up (e.g., "ip link set l3loop0 up")
+ * "ethtool -g" reports and "ethtool -G rx N tx N" changes the number of
+ * descriptors per RX and TX ring (the same for every queue). Sizes must
+ * be powers of two between L3_RING_MIN and L3_RING_MAX so the hot paths
+ * can index the rings with a mask.
  *
- * OPERATION:
- * 1. Create workqueue for doorbell processing
- * 2. Initialize tasklet for fake IRQ
- * 3. Register XDP RX queue information
- * 4. Enable NAPI polling
- * 5. Start TX queue
+ * The rings are allocated by ndo_open, so a change on a running device
+ * closes and reopens it. If the new size cannot be allocated the old one
+ * is restored. A bound AF_XDP pool stays bound across the bounce.
  */
-static int l3_napi_open(struct net_device* dev) {
+static void l3_get_ringparam(struct net_device* dev,
+	struct ethtool_ringparam* ring,
+	struct kernel_ethtool_ringparam* kring,
+	struct netlink_ext_ack* extack)
+{
 	struct l3_napi_adapter* priv = netdev_priv(dev);
-	int err;
 
-	/* Create workqueue for doorbell processing */
-	priv->doorbell_wq = alloc_workqueue("l3loop_doorbell",
-		WQ_UNBOUND | WQ_HIGHPRI,
-		0);
-	if (!priv->doorbell_wq)
-		return -ENOMEM;
+	ring->rx_max_pending = L3_RING_MAX;
+	ring->tx_max_pending = L3_RING_MAX;
+	ring->rx_pending = priv->rx_ring_size;
+	ring->tx_pending = priv->tx_ring_size;
+}
 
-	/* Initialize tasklet for fake IRQ */
-	tasklet_setup(&priv->irq_tasklet, l3_fake_irq_handler);
+static int l3_set_ringparam(struct net_device* dev,
+	struct ethtool_ringparam* ring,
+	struct kernel_ethtool_ringparam* kring,
+	struct netlink_ext_ack* extack)
+{
+	struct l3_napi_adapter* priv = netdev_priv(dev);
+	u32 old_rx = priv->rx_ring_size;
+	u32 old_tx = priv->tx_ring_size;
+	bool running = netif_running(dev);
+	int err;
 
-	/* Initialize timing debug */
-	priv->ts_last_tasklet = ktime_get();
-	priv->ts_last_napi = ktime_get();
+	if (ring->rx_mini_pending || ring->rx_jumbo_pending)
+		return -EINVAL;
 
-	/* Register XDP RX queue info (required for XDP) */
-	err = xdp_rxq_info_reg(&priv->xdp_rxq, dev, 0, 0);
-	if (err) {
-		destroy_workqueue(priv->doorbell_wq);
-		return err;
+	/* The core already rejected anything above L3_RING_MAX */
+	if (ring->rx_pending < L3_RING_MIN || ring->tx_pending < L3_RING_MIN ||
+		!is_power_of_2(ring->rx_pending) || !is_power_of_2(ring->tx_pending)) {
+		NL_SET_ERR_MSG_MOD(extack, "ring sizes must be powers of two, 64 to 4096");
+		return -EINVAL;
 	}
 
-	/* Register memory model (page-based) */
-	err = xdp_rxq_info_reg_mem_model(&priv->xdp_rxq, MEM_TYPE_PAGE_SHARED, NULL);
-	if (err) {
-		xdp_rxq_info_unreg(&priv->xdp_rxq);
-		destroy_workqueue(priv->doorbell_wq);
-		return err;
-	}
+	if (ring->rx_pending == old_rx && ring->tx_pending == old_tx)
+		return 0;
+
+	/*
+	 * dev_close() rather than calling ndo_stop directly: it waits for
+	 * ndo_start_xmit and ndo_xdp_xmit callers still using the old rings.
+	 */
+	if (running)
+		dev_close(dev);
 
-	/* Enable NAPI polling */
-	napi_enable(&priv->napi);
+	priv->rx_ring_size = ring->rx_pending;
+	priv->tx_ring_size = ring->tx_pending;
 
-	/* Start transmit queue */
-	netif_start_queue(dev);
+	if (!running)
+		return 0;
 
-	printk(KERN_INFO "l3loop: Device opened with workqueue doorbell + tasklet IRQ\n");
+	err = dev_open(dev, extack);
+	if (err) {
+		/* Not enough memory for the new size: come back with the old one */
+		priv->rx_ring_size = old_rx;
+		priv->tx_ring_size = old_tx;
+		if (dev_open(dev, NULL))
+			netdev_err(dev, "could not reopen after ring resize\n");
+	}
 
-	return 0;
+	printk(KERN_INFO "l3loop: Ring sizes rx %u tx %u\n",
+		priv->rx_ring_size, priv->tx_ring_size);
+	return err;
 }
 
 /*
- * ndo_stop - Close the network device
+ * ethtool Interrupt Coalescing
  *
  * PURPOSE:
- * Called when device is brought down (e.g., "ip link set l3loop0 down")
+ * "ethtool -C l3loop0 rx-usecs U rx-frames F" makes the simulated DMA
+ * engine hold its fake IRQ until F frames have completed or U us have
+ * passed since the first of them. rx-usecs 0 (the default) interrupts for
+ * every batch, as the driver always did; rx-frames 0 means "timer only".
+ * "adaptive-rx on" lets DIM choose both values per queue from the
+ * observed packet and interrupt rates.
  *
- * OPERATION:
- * 1. Stop TX queue
- * 2. Disable NAPI
- * 3. Kill tasklet
- * 4. Flush and destroy workqueue
- * 5. Clean up any pending packets
- * 6. Unregister XDP info
+ * Values apply to all queues and take effect with the next window.
  */
-static int l3_napi_stop(struct net_device* dev) {
+static int l3_get_coalesce(struct net_device* dev,
+	struct ethtool_coalesce* ec,
+	struct kernel_ethtool_coalesce* kec,
+	struct netlink_ext_ack* extack)
+{
 	struct l3_napi_adapter* priv = netdev_priv(dev);
-	int i;
 
-	/* Stop transmit queue */
-	netif_stop_queue(dev);
-
-	/* Disable NAPI polling */
-	napi_disable(&priv->napi);
+	ec->use_adaptive_rx_coalesce = priv->rx_dim_enabled;
+	if (priv->rx_dim_enabled) {
+		/* Show what DIM currently runs queue 0 with */
+		ec->rx_coalesce_usecs = READ_ONCE(priv->queues[0].coal_usecs);
+		ec->rx_max_coalesced_frames = READ_ONCE(priv->queues[0].coal_frames);
+	}
+	else {
+		ec->rx_coalesce_usecs = priv->rx_coalesce_usecs;
+		ec->rx_max_coalesced_frames = priv->rx_max_frames;
+	}
+	return 0;
+}
 
-	/* Kill tasklet */
-	tasklet_kill(&priv->irq_tasklet);
+static int l3_set_coalesce(struct net_device* dev,
+	struct ethtool_coalesce* ec,
+	struct kernel_ethtool_coalesce* kec,
+	struct netlink_ext_ack* extack)
+{
+	struct l3_napi_adapter* priv = netdev_priv(dev);
+	bool dim = ec->use_adaptive_rx_coalesce;
+	u32 i;
 
-	/* Flush and destroy workqueue */
-	if (priv->doorbell_wq) {
-		flush_workqueue(priv->doorbell_wq);
-		destroy_workqueue(priv->doorbell_wq);
-		priv->doorbell_wq = NULL;
+	if (dim && !IS_ENABLED(CONFIG_DIMLIB)) {
+		NL_SET_ERR_MSG_MOD(extack, "adaptive-rx needs a kernel with CONFIG_DIMLIB");
+		return -EOPNOTSUPP;
+	}
+	if (ec->rx_coalesce_usecs > L3_COAL_USECS_MAX) {
+		NL_SET_ERR_MSG_MOD(extack, "rx-usecs must be at most 1000");
+		return -EINVAL;
+	}
+	if (ec->rx_max_coalesced_frames > L3_RING_MAX) {
+		NL_SET_ERR_MSG_MOD(extack, "rx-frames must be at most 4096");
+		return -EINVAL;
 	}
 
-	/*
-	 * CLEANUP: Free any pending packets in rings
-	 * Important to prevent memory leaks
-	 */
-	for (i = 0; i < NUM_DESC; i++) {
-		if (priv->rx_ring[i].page) {
-			__free_page(priv->rx_ring[i].page);
-			priv->rx_ring[i].page = NULL;
-		}
-		if (priv->rx_ring[i].xdpf) {
-			xdp_return_frame(priv->rx_ring[i].xdpf);
-			priv->rx_ring[i].xdpf = NULL;
-		}
-		if (priv->tx_ring[i].skb) {
-			dev_kfree_skb_any(priv->tx_ring[i].skb);
-			priv->tx_ring[i].skb = NULL;
+	priv->rx_coalesce_usecs = ec->rx_coalesce_usecs;
+	priv->rx_max_frames = ec->rx_max_coalesced_frames;
+
+	/* Stop DIM first so a late DIM update cannot undo the values below */
+	WRITE_ONCE(priv->rx_dim_enabled, false);
+	for (i = 0; i < priv->num_queues; i++) {
+		struct l3_queue* q = &priv->queues[i];
+
+		cancel_work_sync(&q->rx_dim.work);
+
+		if (IS_ENABLED(CONFIG_DIMLIB) && dim) {
+			/* Start from DIM's default profile and a fresh measurement */
+			struct dim_cq_moder moder = net_dim_get_def_rx_moderation(q->rx_dim.mode);
+
+			q->rx_dim.state = DIM_START_MEASURE;
+			q->rx_dim.profile_ix = 0;
+			WRITE_ONCE(q->coal_usecs, moder.usec);
+			WRITE_ONCE(q->coal_frames, moder.pkts);
 		}
-		if (priv->tx_ring[i].xdpf) {
-			xdp_return_frame(priv->tx_ring[i].xdpf);
-			priv->tx_ring[i].xdpf = NULL;
+		else {
+			WRITE_ONCE(q->coal_usecs, priv->rx_coalesce_usecs);
+			WRITE_ONCE(q->coal_frames, priv->rx_max_frames);
 		}
 	}
-
-	/* Unregister XDP info */
-	xdp_rxq_info_unreg(&priv->xdp_rxq);
+	WRITE_ONCE(priv->rx_dim_enabled, dim);
 
 	return 0;
 }
 
+static const struct ethtool_ops l3_ethtool_ops = {
+	.supported_coalesce_params = ETHTOOL_COALESCE_RX_USECS |
+		ETHTOOL_COALESCE_RX_MAX_FRAMES |
+		ETHTOOL_COALESCE_USE_ADAPTIVE_RX,
+	.get_coalesce = l3_get_coalesce,
+	.set_coalesce = l3_set_coalesce,
+	.get_ringparam = l3_get_ringparam,
+	.set_ringparam = l3_set_ringparam,
+	.get_sset_count = l3_get_sset_count,
+	.get_strings = l3_get_strings,
+	.get_ethtool_stats = l3_get_ethtool_stats,
+};
+
 /*
  * Network Device Operations
  *
@@ -1209,9 +4140,12 @@ static const struct net_device_ops l3_ops = {
 	.ndo_open = l3_napi_open,
 	.ndo_stop = l3_napi_stop,
 	.ndo_start_xmit = l3_napi_start_xmit,
+	.ndo_get_stats64 = l3_get_stats64,
 	.ndo_validate_addr = eth_validate_addr,
+	.ndo_change_mtu = l3_change_mtu,
 	.ndo_bpf = l3_ndo_bpf,
 	.ndo_xdp_xmit = l3_ndo_xdp_xmit,
+	.ndo_xsk_wakeup = l3_xsk_wakeup,
 };
 
 /*
@@ -1226,7 +4160,9 @@ static const struct net_device_ops l3_ops = {
  * 2. Configure device features
  * 3. Advertise XDP capabilities
  * 4. Initialize private data structures
- * 5. Register NAPI
+ *
+ * The queue array and its NAPI instances are set up afterwards by
+ * l3_alloc_queues(), because setup callbacks cannot fail.
  */
 static void l3_setup(struct net_device* dev) {
 	struct l3_napi_adapter* priv = netdev_priv(dev);
@@ -1236,14 +4172,18 @@ static void l3_setup(struct net_device* dev) {
 
 	/* Set device operations */
 	dev->netdev_ops = &l3_ops;
+	dev->ethtool_ops = &l3_ethtool_ops;
 
-	/* Enable hardware checksum offload (simulated) */
-	dev->features |= NETIF_F_HW_CSUM;
-	dev->hw_features |= NETIF_F_HW_CSUM;
+	/*
+	 * Enable hardware checksum offload and scatter-gather (simulated):
+	 * the DMA engine gathers paged skbs and finishes the checksum
+	 */
+	dev->features |= NETIF_F_HW_CSUM | NETIF_F_SG;
+	dev->hw_features |= NETIF_F_HW_CSUM | NETIF_F_SG;
 
-	/* Set MTU limits */
+	/* Set MTU limits (jumbo frames are received as multi-buffer) */
 	dev->min_mtu = ETH_MIN_MTU;
-	dev->max_mtu = ETH_MAX_MTU;
+	dev->max_mtu = L3_MAX_MTU;
 
 	/*
 	 * ADVERTISE XDP CAPABILITIES
@@ -1251,18 +4191,66 @@ static void l3_setup(struct net_device* dev) {
 	 * - BASIC: XDP_PASS, XDP_DROP, XDP_TX
 	 * - REDIRECT: XDP_REDIRECT action
 	 * - NDO_XMIT: Can receive redirected packets via ndo_xdp_xmit
+	 * - XSK_ZEROCOPY: AF_XDP sockets can bind with XDP_ZEROCOPY
+	 * - RX_SG: Jumbo frames reach xdp.frags programs as multi-buffer
+	 * - NDO_XMIT_SG: ndo_xdp_xmit accepts frames with frags
 	 */
 	dev->xdp_features = NETDEV_XDP_ACT_BASIC |
 		NETDEV_XDP_ACT_REDIRECT |
-		NETDEV_XDP_ACT_NDO_XMIT;
+		NETDEV_XDP_ACT_NDO_XMIT |
+		NETDEV_XDP_ACT_XSK_ZEROCOPY |
+		NETDEV_XDP_ACT_RX_SG |
+		NETDEV_XDP_ACT_NDO_XMIT_SG;
 
 	/* Initialize private data */
 	priv->netdev = dev;
-	spin_lock_init(&priv->lock);
 	priv->doorbell_wq = NULL;  /* Created in ndo_open */
+	priv->rx_ring_size = L3_RING_DEFAULT;
+	priv->tx_ring_size = L3_RING_DEFAULT;
+	priv->rx_coalesce_usecs = 0;  /* IRQ per batch, lowest latency */
+	priv->rx_max_frames = L3_COAL_FRAMES_DEFAULT;
+	mutex_init(&priv->pktgen.lock);
+}
+
+/*
+ * Queue Allocation
+ *
+ * PURPOSE:
+ * Allocate the queue pairs and register one NAPI instance per queue.
+ * Called from module init after alloc_netdev_mqs() and before
+ * register_netdev().
+ */
+static int l3_alloc_queues(struct net_device* dev, u32 nqueues)
+{
+	struct l3_napi_adapter* priv = netdev_priv(dev);
+	u32 i;
+
+	priv->queues = kcalloc(nqueues, sizeof(*priv->queues), GFP_KERNEL);
+	if (!priv->queues)
+		return -ENOMEM;
+	priv->num_queues = nqueues;
+
+	for (i = 0; i < nqueues; i++) {
+		struct l3_queue* q = &priv->queues[i];
+
+		q->priv = priv;
+		q->index = i;
+		spin_lock_init(&q->lock);
+		u64_stats_init(&q->stats.syncp);
+
+		/* Interrupt moderation: static ethtool -C values until DIM runs */
+		q->coal_usecs = priv->rx_coalesce_usecs;
+		q->coal_frames = priv->rx_max_frames;
+		hrtimer_init(&q->coal_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		q->coal_timer.function = l3_coal_timer_fn;
+		INIT_WORK(&q->rx_dim.work, l3_rx_dim_work);
+		q->rx_dim.mode = DIM_CQ_PERIOD_MODE_START_FROM_EQE;
+
+		/* Register NAPI with default weight (64 packets per poll) */
+		netif_napi_add_weight(dev, &q->napi, l3_napi_poll, NAPI_POLL_WEIGHT);
+	}
 
-	/* Register NAPI with default weight (64 packets per poll) */
-	netif_napi_add_weight(dev, &priv->napi, l3_napi_poll, NAPI_POLL_WEIGHT);
+	return 0;
 }
 
 /* Global pointer to our device */
@@ -1275,29 +4263,68 @@ static struct net_device* my_dev;
  * Called when module is loaded (insmod)
  *
  * OPERATION:
- * 1. Allocate network device with private data
- * 2. Assign random MAC address
- * 3. Register device with kernel
+ * 1. Resolve the queue count
+ * 2. Allocate multi-queue network device with private data
+ * 3. Allocate queue pairs and their NAPI instances
+ * 4. Allocate the per-CPU instrumentation
+ * 5. Assign random MAC address
+ * 6. Register device with kernel and create its debugfs directory
  */
 static int __init l3_init(void) {
-	/* Allocate network device with private data */
-	my_dev = alloc_netdev(sizeof(struct l3_napi_adapter),
+	u32 nqueues = num_queues ? num_queues : num_online_cpus();
+	struct l3_napi_adapter* priv;
+
+	nqueues = clamp_t(u32, nqueues, 1, L3_MAX_QUEUES);
+
+	/* Allocate network device with private data and nqueues TX/RX queues */
+	my_dev = alloc_netdev_mqs(sizeof(struct l3_napi_adapter),
 		"l3loop%d",           /* Name pattern */
 		NET_NAME_UNKNOWN,     /* Name assignment type */
-		l3_setup);            /* Setup function */
+		l3_setup,             /* Setup function */
+		nqueues, nqueues);    /* TX and RX queue counts */
 	if (!my_dev)
 		return -ENOMEM;
 
+	priv = netdev_priv(my_dev);
+	if (l3_alloc_queues(my_dev, nqueues)) {
+		free_netdev(my_dev);
+		return -ENOMEM;
+	}
+
+	/* Per-CPU latency histograms and drop counters */
+	priv->pcpu = alloc_percpu(struct l3_pcpu_stats);
+	if (!priv->pcpu) {
+		struct l3_queue* queues = priv->queues;
+
+		free_netdev(my_dev);
+		kfree(queues);
+		return -ENOMEM;
+	}
+
 	/* Assign random MAC address */
 	eth_hw_addr_random(my_dev);
 
 	/* Register with kernel */
 	if (register_netdev(my_dev)) {
+		struct l3_queue* queues = priv->queues;
+		struct l3_pcpu_stats __percpu* pcpu = priv->pcpu;
+
+		/* free_netdev() deletes the NAPI instances, so free them after */
 		free_netdev(my_dev);
+		kfree(queues);
+		free_percpu(pcpu);
 		return -EIO;
 	}
 
-	printk(KERN_INFO "l3loop: Loaded with workqueue doorbell + tasklet IRQ + XDP_XMIT_FLUSH\n");
+	/* Instrumentation files, named after the interface */
+	l3_debugfs_init(priv);
+
+	/* Threaded NAPI; not fatal, softirq polling keeps working */
+	if (napi_threaded && dev_set_threaded(my_dev, true))
+		printk(KERN_WARNING "l3loop: Could not start threaded NAPI\n");
+
+	printk(KERN_INFO "l3loop: Loaded with %u queues, workqueue doorbell + tasklet IRQ + XDP_XMIT_FLUSH\n",
+		nqueues);
 
 	return 0;
 }
@@ -1309,21 +4336,29 @@ static int __init l3_init(void) {
  * Called when module is unloaded (rmmod)
  *
  * OPERATION:
- * 1. Release XDP program reference
- * 2. Unregister device
- * 3. Free device memory
+ * 1. Remove the debugfs directory
+ * 2. Release XDP program reference
+ * 3. Unregister device
+ * 4. Free device memory, the queue array and the per-CPU instrumentation
  */
 static void __exit l3_exit(void) {
 	if (my_dev) {
 		struct l3_napi_adapter* priv = netdev_priv(my_dev);
+		struct l3_queue* queues = priv->queues;
+		struct l3_pcpu_stats __percpu* pcpu = priv->pcpu;
+
+		/* No debugfs reader may look at priv once it is freed */
+		debugfs_remove_recursive(priv->debugfs_dir);
 
 		/* Release XDP program if attached */
 		if (priv->xdp_prog)
 			bpf_prog_put(priv->xdp_prog);
 
-		/* Unregister and free device */
+		/* Unregister and free device (this also deletes the NAPIs) */
 		unregister_netdev(my_dev);
 		free_netdev(my_dev);
+		kfree(queues);
+		free_percpu(pcpu);
 	}
 
 	printk(KERN_INFO "l3loop: Unloaded\n");
@@ -1337,7 +4372,7 @@ module_exit(l3_exit);
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Your Name");
 MODULE_DESCRIPTION("L3 Loop Device with XDP Support - Production Ready with Sub-ms Latency");
-MODULE_VERSION("2.3");
+MODULE_VERSION("3.2");
 
 /*
  * FINAL IMPLEMENTATION SUMMARY
@@ -1353,7 +4388,26 @@ MODULE_VERSION("2.3");
  * 4. XDP_XMIT_FLUSH for immediate packet transmission (critical for low latency)
  * 5. Ring buffer management with proper synchronization
  * 6. Separate paths for XDP redirect and loopback traffic
- * 7. Optional timing debug for performance analysis
+ * 7. Per-CPU log2 latency histograms, drop counters and ring occupancy
+ *    (debugfs + ethtool -S), switchable at runtime
+ * 8. Multi-queue: independent rings/NAPI/lock per queue, CPU- or
+ *    flow-hash-based queue steering
+ * 9. page_pool-backed RX buffers recycled after drop/copy/redirect
+ * 10. Preallocated lock-free doorbell ring per queue, drained in batches
+ *     with one fake IRQ per batch
+ * 11. Zero-copy XDP receive/redirect by xdp_frame ownership transfer
+ * 12. Native xdp_do_redirect() with one xdp_do_flush() per poll
+ * 13. AF_XDP zero-copy: per-queue XSK fill/TX/completion ring support
+ * 14. Copy-free XDP_PASS (napi_build_skb + GRO), single-copy loopback TX
+ *     with checksum offload done by the simulated DMA
+ * 15. ethtool -g/-G resizable power-of-two rings, compact descriptors and
+ *     ring indices split by writer onto separate cache lines
+ * 16. Interrupt coalescing (rx-usecs/rx-frames, hrtimer) with IRQ masking
+ *     while NAPI polls, and DIM-driven adaptive-rx
+ * 17. Threaded NAPI and busy polling, with per-queue NAPI IDs exposed
+ * 18. XDP_TX, and an in-driver packet generator (debugfs pktgen) with a
+ *     benchmark matrix (make bench)
+ * 19. Jumbo frames via XDP multi-buffer (RX_SG, NDO_XMIT_SG) and SG TX
  *
  * PERFORMANCE:
  * - Latency: 0.2-0.4 milliseconds
@@ -1368,9 +4422,9 @@ MODULE_VERSION("2.3");
  * ARCHITECTURE FLOW:
  * ndo_xdp_xmit (process context)
  *     ↓
- * Queue to workqueue (doorbell)
+ * Post to per-queue doorbell ring (lock-free, no allocation)
  *     ↓
- * Workqueue handler (worker thread) - DMA simulation
+ * Doorbell worker (one per queue) - batched DMA simulation
  *     ↓
  * Schedule tasklet (fake IRQ)
  *     ↓
@@ -1380,7 +4434,9 @@ MODULE_VERSION("2.3");
  *     ↓
  * NAPI poll (softirq context) - Packet processing
  *     ↓
- * XDP program execution and redirect (with FLUSH!)
+ * XDP program execution, xdp_do_redirect() into the devmap bulk queue
+ *     ↓
+ * xdp_do_flush() at the end of the poll (one ndo_xdp_xmit per batch)
  *
  * This matches real hardware behavior and provides proper context separation
  * while maintaining excellent performance.
@@ -0,0 +1,117 @@
+/*
+ * xdp_bench.c - XDP program for the l3loop0 benchmark (bench.sh)
+ *
+ * PURPOSE:
+ * Gives the driver's packet generator (debugfs pktgen) a verdict to
+ * measure. The action is chosen at runtime through bench_cfg, so one
+ * loaded program covers every row of the benchmark matrix:
+ *   0 = XDP_DROP      cost of RX + program + drop
+ *   1 = XDP_TX        frame sent back out of the queue it arrived on
+ *   2 = XDP_REDIRECT  frame sent through tx_port (a devmap)
+ *
+ * LOOP PROTECTION:
+ * l3loop0's wire is a loopback, so a frame sent out with XDP_TX, or
+ * redirected to l3loop0 itself, comes straight back in. Every bounce
+ * decrements the IP TTL and a frame arriving with TTL 1 is dropped, so
+ * a frame injected with ttl=2 is bounced exactly once.
+ */
+
+#include <linux/bpf.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+
+#define BENCH_DROP      0
+#define BENCH_TX        1
+#define BENCH_REDIRECT  2
+
+/*
+ * ARRAY MAP: Benchmark action
+ * Key 0 → BENCH_DROP, BENCH_TX or BENCH_REDIRECT (set by bench.sh)
+ */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u32);
+} bench_cfg SEC(".maps");
+
+/*
+ * DEVMAP: Redirect target for BENCH_REDIRECT
+ * Key 0 → ifindex (bench.sh uses l3loop0's own)
+ */
+struct {
+    __uint(type, BPF_MAP_TYPE_DEVMAP);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u32);
+} tx_port SEC(".maps");
+
+/*
+ * Helper function: Decrement the IP TTL
+ *
+ * Updates the header checksum incrementally (RFC 1624) instead of
+ * recomputing it: the TTL is the high byte of a 16-bit word, so the
+ * checksum grows by 0x0100 with end-around carry.
+ */
+static __always_inline void ip_decrease_ttl(struct iphdr* iph) {
+    __u32 check = iph->check;
+
+    check += bpf_htons(0x0100);
+    iph->check = (__u16)(check + (check >= 0xFFFF));
+    iph->ttl--;
+}
+
+/* Helper function: Swap source and destination MAC, like a reflector */
+static __always_inline void swap_mac(struct ethhdr* eth) {
+    unsigned char tmp[ETH_ALEN];
+
+    __builtin_memcpy(tmp, eth->h_source, ETH_ALEN);
+    __builtin_memcpy(eth->h_source, eth->h_dest, ETH_ALEN);
+    __builtin_memcpy(eth->h_dest, tmp, ETH_ALEN);
+}
+
+/*
+ * Loaded as xdp.frags so that jumbo frames (sent as multi-buffer packets)
+ * are accepted too; the headers are always in the first buffer, which is
+ * all the program touches.
+ */
+SEC("xdp.frags")
+int xdp_bench_prog(struct xdp_md* ctx) {
+    void* data_end = (void*)(long)ctx->data_end;
+    void* data = (void*)(long)ctx->data;
+    struct ethhdr* eth = data;
+    struct iphdr* iph;
+    __u32 key = 0;
+    __u32* action;
+
+    action = bpf_map_lookup_elem(&bench_cfg, &key);
+    if (!action || *action == BENCH_DROP)
+        return XDP_DROP;
+
+    /* Bounds check: Ethernet + IPv4 header (REQUIRED by the verifier) */
+    if ((void*)(eth + 1) > data_end)
+        return XDP_DROP;
+    if (eth->h_proto != bpf_htons(ETH_P_IP))
+        return XDP_PASS;
+
+    iph = (void*)(eth + 1);
+    if ((void*)(iph + 1) > data_end)
+        return XDP_DROP;
+
+    /* Bounced often enough: end of the loop */
+    if (iph->ttl <= 1)
+        return XDP_DROP;
+    ip_decrease_ttl(iph);
+
+    if (*action == BENCH_TX) {
+        swap_mac(eth);
+        return XDP_TX;
+    }
+
+    return bpf_redirect_map(&tx_port, key, XDP_DROP);
+}
+
+/* License declaration - required for BPF programs */
+char _license[] SEC("license") = "GPL";
@@ -49,16 +49,14 @@ struct {
  * @mac2_val: Second MAC address stored as 64-bit value
  * @return: 1 if equal, 0 if different
  *
- * Note: #pragma unroll tells the compiler to unroll the loop for performance
+ * One 32-bit and one 16-bit load per address instead of six byte
+ * compares (unaligned packet loads are fine on arm64 and x86)
  */
 static inline int mac_equals(unsigned char* mac1, __u64 mac2_val) {
     unsigned char* mac2 = (unsigned char*)&mac2_val;
-#pragma unroll
-    for (int i = 0; i < ETH_ALEN; i++) {
-        if (mac1[i] != mac2[i])
-            return 0;
-    }
-    return 1;
+
+    return ((*(__u32*)mac1 ^ *(__u32*)mac2) |
+            (*(__u16*)(mac1 + 4) ^ *(__u16*)(mac2 + 4))) == 0;
 }
 
 /*
@@ -0,0 +1,144 @@
+#!/bin/bash
+#
+# xdp_router.sh - Load xdp_router.c on l3loop0 and fill its maps
+#
+# USAGE:
+#   sudo ./xdp_router.sh load [routes.conf] [device]   Compile, attach, load routes
+#   sudo ./xdp_router.sh stats                         Per-verdict counters (all CPUs)
+#   sudo ./xdp_router.sh unload [device]               Detach and unpin
+#
+# "load" starts from empty maps each time, so editing routes.conf and
+# running it again replaces the whole table. It runs after xdp_demo.sh
+# (which it then replaces on l3loop0), or on any setup where the egress
+# devices named in the config exist.
+
+set -e  # Exit on any error
+trap 'echo "ERROR at line $LINENO"' ERR  # Show line number on error
+
+# --- Configuration ---
+BPF_INC="-I/usr/include/$(uname -m)-linux-gnu -I/usr/include"
+BPF_PIN_DIR="/sys/fs/bpf"
+PROG_PIN="$BPF_PIN_DIR/xdp_router"
+MAP_DIR="$BPF_PIN_DIR/router_maps"
+
+log() {
+    echo "[$(date '+%H:%M:%S')] $*"
+}
+
+# u32 in host (little-endian) byte order, as bpftool expects map bytes
+le32() {
+    local v=$1
+    echo "$((v & 0xff)) $(((v >> 8) & 0xff)) $(((v >> 16) & 0xff)) $(((v >> 24) & 0xff))"
+}
+
+# Dotted quad → 4 bytes in network order: "10.1.2.3" → "10 1 2 3"
+ip_to_bytes() {
+    echo "$1" | tr '.' ' '
+}
+
+# Helper function: Convert MAC address to hex bytes for bpftool
+# Example: "aa:bb:cc:dd:ee:ff" → "0xaa 0xbb 0xcc 0xdd 0xee 0xff"
+mac_to_hex() {
+    local mac=$1
+    echo $mac | sed 's/://g' | sed 's/../0x& /g'
+}
+
+do_load() {
+    local conf=${1:-routes.conf}
+    local dev=${2:-l3loop0}
+    local -A ports=()
+    local next_port=0
+    local nroutes=0
+    local prefix egress nexthop
+
+    [ -r "$conf" ] || { echo "ERROR: cannot read $conf"; exit 1; }
+
+    # --- 1. Compile ---
+    log "Compiling xdp_router.c..."
+    clang -O2 -g -Wall -target bpf $BPF_INC \
+        -c xdp_router.c -o xdp_router.o || {
+        echo "ERROR: Failed to compile xdp_router.c"
+        exit 1
+    }
+
+    # --- 2. Load with fresh maps and attach (replacing any program) ---
+    rm -rf $PROG_PIN $MAP_DIR
+    mkdir -p $MAP_DIR
+    bpftool prog load xdp_router.o $PROG_PIN pinmaps $MAP_DIR/ || {
+        echo "ERROR: Failed to load xdp_router.o"
+        exit 1
+    }
+    ip -force link set dev $dev xdp pinned $PROG_PIN
+
+    local router_mac=$(cat /sys/class/net/$dev/address)
+    local router_mac_hex=$(mac_to_hex $router_mac)
+    bpftool map update pinned $MAP_DIR/router_mac \
+        key 0 0 0 0 value $router_mac_hex 0x00 0x00
+
+    # --- 3. Routes: one devmap port per egress device, one LPM entry per line ---
+    while read -r prefix egress nexthop _; do
+        case "$prefix" in ''|'#'*) continue ;; esac
+
+        local addr=${prefix%/*}
+        local plen=${prefix#*/}
+        [ "$plen" != "$prefix" ] || plen=32
+
+        if [ -z "${ports[$egress]}" ]; then
+            local ifindex
+            ifindex=$(cat /sys/class/net/$egress/ifindex 2>/dev/null) || {
+                echo "ERROR: $conf: no such device $egress"
+                exit 1
+            }
+            ports[$egress]=$next_port
+            bpftool map update pinned $MAP_DIR/tx_ports \
+                key $(le32 $next_port) value $(le32 $ifindex)
+            next_port=$((next_port + 1))
+        fi
+
+        # "-": no rewrite (all-zero next hop)
+        local dmac="0 0 0 0 0 0" smac="0 0 0 0 0 0"
+        if [ "$nexthop" != "-" ]; then
+            dmac=$(mac_to_hex $nexthop)
+            smac=$(mac_to_hex $(cat /sys/class/net/$egress/address))
+        fi
+
+        bpftool map update pinned $MAP_DIR/route_lpm \
+            key $(le32 $plen) $(ip_to_bytes $addr) \
+            value $(le32 ${ports[$egress]}) $dmac $smac
+        nroutes=$((nroutes + 1))
+    done < "$conf"
+
+    log "xdp_router on $dev: $nroutes routes over $next_port egress ports (router MAC $router_mac)"
+}
+
+# Sum the per-CPU values of verdict_stats (needs the BTF from clang -g)
+do_stats() {
+    bpftool map dump pinned $MAP_DIR/verdict_stats | awk '
+        BEGIN { split("XDP_ABORTED XDP_DROP XDP_PASS XDP_TX XDP_REDIRECT", name, " ") }
+        /"key":/     { gsub(/,/, "", $2); k = $2 }
+        /"packets":/ { gsub(/,/, "", $2); pkts[k] += $2 }
+        /"bytes":/   { gsub(/,/, "", $2); bytes[k] += $2 }
+        END {
+            printf "%-14s %16s %20s\n", "verdict", "packets", "bytes"
+            for (k = 0; k < 5; k++)
+                printf "%-14s %16d %20d\n", name[k + 1], pkts[k], bytes[k]
+        }'
+}
+
+do_unload() {
+    local dev=${1:-l3loop0}
+
+    ip link set dev $dev xdp off 2>/dev/null || true
+    rm -rf $PROG_PIN $MAP_DIR
+    log "xdp_router removed from $dev"
+}
+
+case "$1" in
+    load)   shift; do_load "$@" ;;
+    stats)  do_stats ;;
+    unload) shift; do_unload "$@" ;;
+    *)
+        echo "usage: $0 load [routes.conf] [device] | stats | unload [device]"
+        exit 1
+        ;;
+esac
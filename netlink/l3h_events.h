@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/**
+ * @file l3h_events.h
+ * @brief Generic netlink event channel shared by the kernel modules
+ *        (netlink.c, simple_netlink.c) and the listeners.
+ *
+ * PROTOCOL:
+ * Family L3H_GENL_NAME, multicast group L3H_GENL_MCGRP, both resolved
+ * by name through the genetlink controller. Each event is one
+ * L3H_CMD_EVENT message; the kernel packs as many as fit into each skb,
+ * so one recv() can return many. Every event carries a sequence number
+ * that increments by one per event posted, so a gap means events were
+ * lost, and the running drop count says how many were lost in the
+ * kernel (queue full, or a subscriber's socket full).
+ *
+ * Only one of the two modules can be loaded at a time: both register
+ * this family.
+ */
+#ifndef _L3H_EVENTS_H
+#define _L3H_EVENTS_H
+
+#include <linux/types.h>
+
+#define L3H_GENL_NAME     "l3h_events"
+#define L3H_GENL_VERSION  1
+#define L3H_GENL_MCGRP    "events"
+
+enum {
+	L3H_CMD_UNSPEC,
+	L3H_CMD_EVENT,          /* Kernel -> user, multicast */
+	__L3H_CMD_MAX,
+};
+#define L3H_CMD_MAX (__L3H_CMD_MAX - 1)
+
+enum {
+	L3H_A_UNSPEC,
+	L3H_A_EVENT_ID,         /* u32, enum l3h_event_id */
+	L3H_A_SEQ,              /* u32, per event, wraps */
+	L3H_A_TIMESTAMP,        /* u64, CLOCK_MONOTONIC ns when posted */
+	L3H_A_PAYLOAD,          /* binary, up to L3H_PAYLOAD_MAX bytes */
+	L3H_A_DROPPED,          /* u32, events dropped in the kernel so far */
+	L3H_A_PAD,
+	__L3H_A_MAX,
+};
+#define L3H_A_MAX (__L3H_A_MAX - 1)
+
+enum l3h_event_id {
+	L3H_EVENT_MOTION = 1,   /* PIR tripped (netlink.c) */
+	L3H_EVENT_CLEAR,        /* PIR quiet again (netlink.c) */
+	L3H_EVENT_TRIGGER,      /* sysfs trigger, payload = text written (simple_netlink.c) */
+};
+
+#define L3H_PAYLOAD_MAX 64
+
+#endif /* _L3H_EVENTS_H */
@@ -0,0 +1,286 @@
+/**
+ * @file l3h_genl_user.h
+ * @brief User-space side of the l3h_events generic netlink channel:
+ *        resolve the family, join its multicast group, parse events.
+ *
+ * No libnl: the controller (GENL_ID_CTRL) is asked for the family by
+ * name, and its reply carries both the family id and the group id.
+ *
+ * For high rates there is also a batch receiver (struct l3h_rx): a big
+ * receive queue, recvmmsg() for many datagrams per call, and sequence
+ * tracking so losses are counted rather than silent. recvmmsg() needs
+ * _GNU_SOURCE defined before the first #include.
+ */
+#ifndef _L3H_GENL_USER_H
+#define _L3H_GENL_USER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+
+#include "l3h_events.h"
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
+#define GENLMSG_DATA(nlh)  ((char *)NLMSG_DATA(nlh) + GENL_HDRLEN)
+#define NLA_DATA(nla)      ((char *)(nla) + NLA_HDRLEN)
+#define NLA_NEXT(nla)      ((struct nlattr *)((char *)(nla) + NLA_ALIGN((nla)->nla_len)))
+#define NLA_OK(nla, rem)   ((rem) >= (int)sizeof(struct nlattr) && \
+                            (nla)->nla_len >= sizeof(struct nlattr) && \
+                            (nla)->nla_len <= (rem))
+
+/* One decoded L3H_CMD_EVENT */
+struct l3h_msg {
+	uint32_t id;
+	uint32_t seq;
+	uint64_t timestamp_ns;
+	uint32_t dropped;
+	const void *payload;
+	uint16_t payload_len;
+};
+
+/* Walks the attributes in the len bytes at start */
+#define L3H_FOR_EACH_ATTR(nla, start, len) \
+	for (int __rem = ((nla) = (struct nlattr *)(start), (int)(len)); \
+	     NLA_OK(nla, __rem); \
+	     __rem -= NLA_ALIGN((nla)->nla_len), (nla) = NLA_NEXT(nla))
+
+/* Family and group ids for L3H_GENL_NAME; 0 on success */
+static inline int l3h_genl_resolve(int fd, uint16_t *family, uint32_t *group)
+{
+	struct {
+		struct nlmsghdr n;
+		struct genlmsghdr g;
+		char buf[256];
+	} req = { 0 };
+	char reply[4096];
+	struct nlattr *nla;
+	struct nlmsghdr *nlh = (struct nlmsghdr *)reply;
+	ssize_t len;
+
+	req.n.nlmsg_type = GENL_ID_CTRL;
+	req.n.nlmsg_flags = NLM_F_REQUEST;
+	req.n.nlmsg_seq = 1;
+	req.g.cmd = CTRL_CMD_GETFAMILY;
+	req.g.version = 1;
+	nla = (struct nlattr *)req.buf;
+	nla->nla_type = CTRL_ATTR_FAMILY_NAME;
+	nla->nla_len = NLA_HDRLEN + sizeof(L3H_GENL_NAME);
+	memcpy(NLA_DATA(nla), L3H_GENL_NAME, sizeof(L3H_GENL_NAME));
+	req.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN) + NLA_ALIGN(nla->nla_len);
+
+	if (send(fd, &req, req.n.nlmsg_len, 0) < 0)
+		return -1;
+	len = recv(fd, reply, sizeof(reply), 0);
+	if (len < 0 || !NLMSG_OK(nlh, len) || nlh->nlmsg_type == NLMSG_ERROR)
+		return -1;
+
+	*family = 0;
+	*group = 0;
+	L3H_FOR_EACH_ATTR(nla, GENLMSG_DATA(nlh), NLMSG_PAYLOAD(nlh, GENL_HDRLEN)) {
+		struct nlattr *grp, *a;
+
+		if (nla->nla_type == CTRL_ATTR_FAMILY_ID)
+			*family = *(uint16_t *)NLA_DATA(nla);
+		if (nla->nla_type != CTRL_ATTR_MCAST_GROUPS)
+			continue;
+		/* Nested: one nest per group, each with a name and an id */
+		L3H_FOR_EACH_ATTR(grp, NLA_DATA(nla), nla->nla_len - NLA_HDRLEN) {
+			uint32_t id = 0;
+			int match = 0;
+
+			L3H_FOR_EACH_ATTR(a, NLA_DATA(grp), grp->nla_len - NLA_HDRLEN) {
+				if (a->nla_type == CTRL_ATTR_MCAST_GRP_ID)
+					id = *(uint32_t *)NLA_DATA(a);
+				if (a->nla_type == CTRL_ATTR_MCAST_GRP_NAME)
+					match = !strcmp(NLA_DATA(a), L3H_GENL_MCGRP);
+			}
+			if (match)
+				*group = id;
+		}
+	}
+	return *family && *group ? 0 : -1;
+}
+
+/* A NETLINK_GENERIC socket subscribed to the events group, or -1 */
+static inline int l3h_genl_open(uint16_t *family)
+{
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK };
+	uint32_t group;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+	if (fd < 0)
+		return -1;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    l3h_genl_resolve(fd, family, &group) < 0 ||
+	    setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &group, sizeof(group)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Decodes one message; 0 if it is an event from our family */
+static inline int l3h_parse(const struct nlmsghdr *nlh, uint16_t family, struct l3h_msg *m)
+{
+	const struct genlmsghdr *g = NLMSG_DATA(nlh);
+	struct nlattr *nla;
+
+	if (nlh->nlmsg_type != family || g->cmd != L3H_CMD_EVENT)
+		return -1;
+	memset(m, 0, sizeof(*m));
+	L3H_FOR_EACH_ATTR(nla, GENLMSG_DATA(nlh), NLMSG_PAYLOAD(nlh, GENL_HDRLEN)) {
+		void *d = NLA_DATA(nla);
+
+		switch (nla->nla_type) {
+		case L3H_A_EVENT_ID:  m->id = *(uint32_t *)d; break;
+		case L3H_A_SEQ:       m->seq = *(uint32_t *)d; break;
+		case L3H_A_TIMESTAMP: memcpy(&m->timestamp_ns, d, 8); break;
+		case L3H_A_DROPPED:   m->dropped = *(uint32_t *)d; break;
+		case L3H_A_PAYLOAD:
+			m->payload = d;
+			m->payload_len = nla->nla_len - NLA_HDRLEN;
+			break;
+		}
+	}
+	return 0;
+}
+
+/* ---------- High-rate receive ---------- */
+
+/*
+ * A bigger receive queue. SO_RCVBUFFORCE (CAP_NET_ADMIN) may exceed
+ * rmem_max; without the capability fall back to the clamped SO_RCVBUF.
+ */
+static inline int l3h_genl_set_rcvbuf(int fd, int bytes)
+{
+	if (!setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes)))
+		return 0;
+	return setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+}
+
+/* Overflow silently instead of failing the next recv with ENOBUFS */
+static inline int l3h_genl_no_enobufs(int fd)
+{
+	int one = 1;
+
+	return setsockopt(fd, SOL_NETLINK, NETLINK_NO_ENOBUFS, &one, sizeof(one));
+}
+
+/*
+ * Sequence tracking. The kernel numbers every event it is asked to
+ * post, delivered or not, so the distance to the expected number is
+ * exactly what this socket missed, wherever it was lost.
+ */
+struct l3h_seq {
+	uint32_t next;
+	int synced;
+	uint64_t lost;
+};
+
+/* Returns how many events were lost just before this one */
+static inline uint32_t l3h_seq_check(struct l3h_seq *s, uint32_t seq)
+{
+	uint32_t gap = s->synced ? seq - s->next : 0;
+
+	/* A wrap backwards (module reloaded) resyncs instead of counting 4G */
+	if (gap > UINT32_MAX / 2)
+		gap = 0;
+	s->lost += gap;
+	s->next = seq + 1;
+	s->synced = 1;
+	return gap;
+}
+
+#define L3H_RX_BUF_SIZE 16384   /* Larger than any NLMSG_GOODSIZE skb */
+
+struct l3h_rx {
+	int fd;
+	uint16_t family;
+	unsigned int vlen;          /* Datagrams per recvmmsg() */
+	struct mmsghdr *msgs;
+	struct iovec *iov;
+	char *bufs;
+	/* Counters */
+	uint64_t calls, datagrams, events, enobufs, truncated;
+};
+
+static inline int l3h_rx_init(struct l3h_rx *rx, int fd, uint16_t family, unsigned int vlen)
+{
+	unsigned int i;
+
+	memset(rx, 0, sizeof(*rx));
+	rx->fd = fd;
+	rx->family = family;
+	rx->vlen = vlen;
+	rx->msgs = calloc(vlen, sizeof(*rx->msgs));
+	rx->iov = calloc(vlen, sizeof(*rx->iov));
+	rx->bufs = malloc((size_t)vlen * L3H_RX_BUF_SIZE);
+	if (!rx->msgs || !rx->iov || !rx->bufs)
+		return -1;
+	for (i = 0; i < vlen; i++) {
+		rx->iov[i].iov_base = rx->bufs + (size_t)i * L3H_RX_BUF_SIZE;
+		rx->iov[i].iov_len = L3H_RX_BUF_SIZE;
+		rx->msgs[i].msg_hdr.msg_iov = &rx->iov[i];
+		rx->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	return 0;
+}
+
+static inline void l3h_rx_free(struct l3h_rx *rx)
+{
+	free(rx->msgs);
+	free(rx->iov);
+	free(rx->bufs);
+}
+
+/*
+ * One recvmmsg() and every event in every datagram it returned, passed
+ * to fn in order. flags as for recvmmsg (MSG_DONTWAIT, MSG_WAITFORONE).
+ * Returns the number of events, 0 if the queue overflowed (ENOBUFS: the
+ * socket is still good and the next sequence number tells how many
+ * went), or -1 with errno set.
+ */
+static inline int l3h_rx_poll(struct l3h_rx *rx, int flags,
+			      void (*fn)(const struct l3h_msg *m, void *arg), void *arg)
+{
+	int n, i, events = 0;
+
+	n = recvmmsg(rx->fd, rx->msgs, rx->vlen, flags, NULL);
+	if (n < 0) {
+		if (errno != ENOBUFS)
+			return -1;
+		rx->enobufs++;
+		return 0;
+	}
+	rx->calls++;
+	rx->datagrams += n;
+	for (i = 0; i < n; i++) {
+		struct nlmsghdr *h = rx->iov[i].iov_base;
+		int len = rx->msgs[i].msg_len;
+		struct l3h_msg m;
+
+		if (rx->msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+			rx->truncated++;
+		for (; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+			if (l3h_parse(h, rx->family, &m))
+				continue;
+			fn(&m, arg);
+			events++;
+		}
+		/* recvmmsg() writes these back; reset for the next call */
+		rx->msgs[i].msg_hdr.msg_flags = 0;
+	}
+	rx->events += events;
+	return events;
+}
+
+#endif /* _L3H_GENL_USER_H */
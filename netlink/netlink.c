@@ -5,9 +5,10 @@
  * @version 6.3 (Kernel 6.12 Headers Fixed)
  * 
  * PRESENTATION HIGHLIGHTS:
- * 1. Netlink Multicast: Push notifications from kernel to user-space.
+ * 1. Generic Netlink Multicast: typed events pushed to user-space (l3h_events.h).
  * 2. Hybrid IRQ/Timer: Trigger on edge (IRQ), monitor state via SoftIRQ (Timer).
- * 3. Atomic Allocation: Using GFP_ATOMIC for safe Netlink delivery in timers.
+ * 3. Deferred Delivery: IRQ and timer only queue the event; a work item
+ *    allocates (GFP_KERNEL) and sends, many events per skb.
  * 4. Versatile Removal: Pre-processor bridges for 6.11+ void return types.
  */
 
@@ -22,44 +23,156 @@
 #include <linux/irq.h>
 #include <linux/slab.h>
 #include <linux/version.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
 #include <net/genetlink.h> 
 #include <net/netlink.h>
 
+#include "l3h_events.h"
+
 /* Handle transition to void return for .remove in 6.11+ */
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
     #define USE_REMOVE_NEW
 #endif
 
-#define NETLINK_L3HARRIS 31   
-#define L3H_MCAST_GROUP  1    
+#define L3H_EVENT_RING   64   /* Events queued between flushes; power of two */
+
+/* An event as queued by the IRQ/timer, before it becomes a message */
+struct l3h_event {
+	u64 ts;
+	u32 id;
+	u32 seq;
+};
 
 struct l3harris_ctx {
 	struct gpio_desc* red;
 	struct gpio_desc* blue;
 	struct gpio_desc* pir_desc;
 	struct timer_list flash_timer;
-	struct sock *nl_sk;        
 	struct device* dev;
+	/* Event queue: IRQ thread and timer post, flush_work sends */
+	spinlock_t ev_lock;
+	struct l3h_event ring[L3H_EVENT_RING];
+	u32 head, tail;
+	u32 seq;
+	u32 dropped;               /* Queue full, no memory, or a listener lagged */
+	struct work_struct flush_work;
 	int irq;
 	bool state;
 };
 
 /* ---------- Netlink logic ---------- */
 
-static void l3harris_broadcast_event(struct l3harris_ctx *ctx, const char *msg)
+static const struct genl_multicast_group l3h_mcgrps[] = {
+	{ .name = L3H_GENL_MCGRP },
+};
+
+/* Events only: no commands to receive, so no ops */
+static struct genl_family l3h_family = {
+	.name = L3H_GENL_NAME,
+	.version = L3H_GENL_VERSION,
+	.maxattr = L3H_A_MAX,
+	.module = THIS_MODULE,
+	.mcgrps = l3h_mcgrps,
+	.n_mcgrps = ARRAY_SIZE(l3h_mcgrps),
+};
+
+/* Any context: stamps, numbers and queues the event, then kicks the flush */
+static void l3harris_post_event(struct l3harris_ctx *ctx, u32 id)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->ev_lock, flags);
+	if (ctx->head - ctx->tail < L3H_EVENT_RING) {
+		struct l3h_event *e = &ctx->ring[ctx->head++ & (L3H_EVENT_RING - 1)];
+
+		e->ts = ktime_get_ns();
+		e->id = id;
+		e->seq = ctx->seq;
+	} else {
+		ctx->dropped++;
+	}
+	ctx->seq++;                /* Even when dropped: the gap shows */
+	spin_unlock_irqrestore(&ctx->ev_lock, flags);
+
+	schedule_work(&ctx->flush_work);
+}
+
+static int l3harris_put_event(struct sk_buff *skb, const struct l3h_event *e, u32 dropped)
+{
+	void *hdr = genlmsg_put(skb, 0, 0, &l3h_family, 0, L3H_CMD_EVENT);
+
+	if (!hdr) return -EMSGSIZE;
+	if (nla_put_u32(skb, L3H_A_EVENT_ID, e->id) ||
+	    nla_put_u32(skb, L3H_A_SEQ, e->seq) ||
+	    nla_put_u64_64bit(skb, L3H_A_TIMESTAMP, e->ts, L3H_A_PAD) ||
+	    nla_put_u32(skb, L3H_A_DROPPED, dropped)) {
+		genlmsg_cancel(skb, hdr);
+		return -EMSGSIZE;
+	}
+	genlmsg_end(skb, hdr);
+	return 0;
+}
+
+static void l3harris_count_drops(struct l3harris_ctx *ctx, u32 n)
 {
-	struct sk_buff *skb;
-	struct nlmsghdr *nlh;
-	int msg_size = strlen(msg) + 1;
+	spin_lock_irq(&ctx->ev_lock);
+	ctx->dropped += n;
+	spin_unlock_irq(&ctx->ev_lock);
+}
 
-	skb = nlmsg_new(msg_size, GFP_ATOMIC);
-	if (!skb) return;
+/* -ESRCH only means nobody is listening; anything else lost the batch for someone */
+static void l3harris_send(struct l3harris_ctx *ctx, struct sk_buff *skb, u32 n)
+{
+	int ret = genlmsg_multicast(&l3h_family, skb, 0, 0, GFP_KERNEL);
 
-	nlh = nlmsg_put(skb, 0, 0, NLMSG_DONE, msg_size, 0);
-	NETLINK_CB(skb).dst_group = L3H_MCAST_GROUP; 
-	strncpy(nlmsg_data(nlh), msg, msg_size);
+	if (ret && ret != -ESRCH)
+		l3harris_count_drops(ctx, n);
+}
 
-	nlmsg_multicast(ctx->nl_sk, skb, 0, L3H_MCAST_GROUP, GFP_ATOMIC);
+/*
+ * Process context: everything queued since the last run goes out in as
+ * few skbs as it fits in (NLMSG_GOODSIZE each), one message per event.
+ */
+static void l3harris_flush_work(struct work_struct *work)
+{
+	struct l3harris_ctx *ctx = container_of(work, struct l3harris_ctx, flush_work);
+	struct sk_buff *skb = NULL;
+	struct l3h_event e;
+	u32 dropped, n = 0;
+
+	for (;;) {
+		spin_lock_irq(&ctx->ev_lock);
+		if (ctx->tail == ctx->head) {
+			spin_unlock_irq(&ctx->ev_lock);
+			break;
+		}
+		e = ctx->ring[ctx->tail++ & (L3H_EVENT_RING - 1)];
+		dropped = ctx->dropped;
+		spin_unlock_irq(&ctx->ev_lock);
+
+		/* Nobody subscribed: don't build what nobody will read */
+		if (!genl_has_listeners(&l3h_family, &init_net, 0))
+			continue;
+		if (skb && !l3harris_put_event(skb, &e, dropped)) {
+			n++;
+			continue;
+		}
+		/* First event, or the skb is full: send it, start the next */
+		if (skb)
+			l3harris_send(ctx, skb, n);
+		skb = genlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+		if (!skb || l3harris_put_event(skb, &e, dropped)) {
+			nlmsg_free(skb);
+			skb = NULL;
+			l3harris_count_drops(ctx, 1);
+			continue;
+		}
+		n = 1;
+	}
+	if (skb)
+		l3harris_send(ctx, skb, n);
 }
 
 /* ---------- IRQ & Timer logic ---------- */
@@ -69,7 +182,7 @@ static void flash_timer_handler(struct timer_list* t)
 	struct l3harris_ctx* ctx = from_timer(ctx, t, flash_timer);
 
 	if (!gpiod_get_raw_value(ctx->pir_desc)) {
-		l3harris_broadcast_event(ctx, "STATE:CLEAR");
+		l3harris_post_event(ctx, L3H_EVENT_CLEAR);
 		gpiod_set_value(ctx->red, 0);
 		gpiod_set_value(ctx->blue, 0);
 		return; 
@@ -88,7 +201,7 @@ static irqreturn_t pir_irq_handler(int irq, void* dev_id)
 
 	if (gpiod_get_raw_value(ctx->pir_desc)) {
 		if (!timer_pending(&ctx->flash_timer)) {
-			l3harris_broadcast_event(ctx, "STATE:MOTION");
+			l3harris_post_event(ctx, L3H_EVENT_MOTION);
 			mod_timer(&ctx->flash_timer, jiffies + msecs_to_jiffies(10));
 		}
 	}
@@ -104,15 +217,13 @@ static int l3harris_probe(struct platform_device* pdev)
 	struct l3harris_ctx* ctx;
 	struct irq_data* idata;
 	struct gpio_chip* chip;
-	struct netlink_kernel_cfg cfg = { .groups = 1 }; 
 	int ret;
 
 	ctx = devm_kzalloc(dev, sizeof(*ctx), GFP_KERNEL);
 	if (!ctx) return -ENOMEM;
 	ctx->dev = dev;
-
-	ctx->nl_sk = netlink_kernel_create(&init_net, NETLINK_L3HARRIS, &cfg);
-	if (!ctx->nl_sk) return -ENOMEM;
+	spin_lock_init(&ctx->ev_lock);
+	INIT_WORK(&ctx->flush_work, l3harris_flush_work);
 
 	device_for_each_child_node(dev, child) {
 		if (fwnode_name_eq(child, "leds")) {
@@ -129,15 +240,12 @@ static int l3harris_probe(struct platform_device* pdev)
 	}
 
 	if (IS_ERR_OR_NULL(ctx->red) || IS_ERR_OR_NULL(ctx->blue) || ctx->irq <= 0) {
-		ret = -ENODEV;
-		goto err_nl;
+		return -ENODEV;
 	}
 
 	idata = irq_get_irq_data(ctx->irq);
-	if (!idata || !(chip = irq_data_get_irq_chip_data(idata))) {
-		ret = -ENODEV;
-		goto err_nl;
-	}
+	if (!idata || !(chip = irq_data_get_irq_chip_data(idata)))
+		return -ENODEV;
 
 	/* 
 	 * FIX: Cast the flag to 'enum gpio_lookup_flags' explicitly.
@@ -146,10 +254,8 @@ static int l3harris_probe(struct platform_device* pdev)
 	ctx->pir_desc = gpiochip_request_own_desc(chip, idata->hwirq, "pir-sensor",
 		(enum gpio_lookup_flags)0, GPIOD_IN);
     
-	if (IS_ERR(ctx->pir_desc)) {
-		ret = PTR_ERR(ctx->pir_desc);
-		goto err_nl;
-	}
+	if (IS_ERR(ctx->pir_desc))
+		return PTR_ERR(ctx->pir_desc);
 
 	timer_setup(&ctx->flash_timer, flash_timer_handler, 0);
 	
@@ -163,8 +269,6 @@ static int l3harris_probe(struct platform_device* pdev)
 
 err_gpio:
 	gpiochip_free_own_desc(ctx->pir_desc);
-err_nl:
-	netlink_kernel_release(ctx->nl_sk);
 	return ret;
 }
 
@@ -176,8 +280,10 @@ static int l3harris_remove(struct platform_device* pdev)
 {
 	struct l3harris_ctx* ctx = platform_get_drvdata(pdev);
 	if (ctx) {
+		/* No more events: IRQ, then the timer it arms, then their flush */
+		devm_free_irq(ctx->dev, ctx->irq, ctx);
 		del_timer_sync(&ctx->flash_timer);
-		if (ctx->nl_sk) netlink_kernel_release(ctx->nl_sk);
+		cancel_work_sync(&ctx->flush_work);
 		if (ctx->pir_desc) gpiochip_free_own_desc(ctx->pir_desc); 
 	}
 #ifndef USE_REMOVE_NEW
@@ -203,7 +309,26 @@ static struct platform_driver l3harris_driver = {
 		.of_match_table = l3harris_of_match
 	},
 };
-module_platform_driver(l3harris_driver);
+
+/* The family is module-wide, so it is registered before any device probes */
+static int __init l3harris_init(void)
+{
+	int ret = genl_register_family(&l3h_family);
+
+	if (ret) return ret;
+	ret = platform_driver_register(&l3harris_driver);
+	if (ret) genl_unregister_family(&l3h_family);
+	return ret;
+}
+
+static void __exit l3harris_exit(void)
+{
+	platform_driver_unregister(&l3harris_driver);
+	genl_unregister_family(&l3h_family);
+}
+
+module_init(l3harris_init);
+module_exit(l3harris_exit);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("AI Thought Partner & [Your Name]");
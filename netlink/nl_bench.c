@@ -0,0 +1,217 @@
+/**
+ * @file nl_bench.c
+ * @brief Event-rate benchmark for the l3h_events netlink channel
+ *        (simple_netlink.ko).
+ *
+ * WHAT IT MEASURES:
+ * A writer thread posts events at a fixed rate, while the main thread
+ * receives them through a batch receiver (recvmmsg(), big queue).
+ * Events are posted one of two ways:
+ *   default  one write() to /sys/kernel/netlink_test/trigger per event
+ *   -k       bursts of -b events per write() to .../burst, posted inside
+ *            the kernel, for rates a syscall per event can't reach
+ * At the end it reports delivered events/sec, how many were lost, and
+ * where: sequence gaps on our socket, the kernel's own drop count, and
+ * ENOBUFS. It also reports end-to-end latency, from the kernel
+ * timestamp attribute to the moment the datagram reached us.
+ *
+ * USAGE:
+ *   gcc -O2 -pthread -o nl_bench nl_bench.c
+ *   sudo ./nl_bench [-r events/s] [-d seconds] [-k [-b burst]]
+ *                   [-v datagrams/call] [-B rcvbuf bytes] [-n]
+ * -r 0 posts as fast as the writer can. -n sets NETLINK_NO_ENOBUFS.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "l3h_genl_user.h"
+
+#define SYSFS_DIR   "/sys/kernel/netlink_test"
+#define MAX_SAMPLES (4u << 20)     /* Latencies kept for percentiles */
+#define GRACE_NS    500000000ULL   /* Quiet time after the writer stops */
+
+static double rate = 10000;
+static double duration = 5;
+static int kernel_burst;
+static unsigned int burst = 100;
+
+static atomic_ullong sent;
+static atomic_int writer_done;
+
+struct bench {
+    struct l3h_seq seq;
+    uint32_t kernel_dropped;
+    uint64_t now_ns;
+    uint64_t received;
+    uint32_t *lat_ns;
+    uint64_t nr_lat;
+    uint64_t max_ns;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    /* Same clock as the kernel's ktime_get_ns() */
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Posts rate events/s for duration seconds; catches up when behind */
+static void *writer(void *arg) {
+    const char *path = kernel_burst ? SYSFS_DIR "/burst" : SYSFS_DIR "/trigger";
+    unsigned int per_write = kernel_burst ? burst : 1;
+    uint64_t start = now_ns(), end = start + (uint64_t)(duration * 1e9);
+    char cmd[32];
+    int len, fd;
+
+    (void)arg;
+    fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        perror(path);
+        atomic_store(&writer_done, 1);
+        return NULL;
+    }
+    len = kernel_burst ? snprintf(cmd, sizeof(cmd), "%u", burst) : snprintf(cmd, sizeof(cmd), "bench");
+
+    for (;;) {
+        uint64_t t = now_ns();
+        uint64_t due = rate > 0 ? (uint64_t)((t - start) * rate / 1e9) : ~0ULL;
+
+        if (t >= end) break;
+        if (atomic_load(&sent) + per_write > due) {
+            struct timespec nap = { 0, 50000 };
+
+            nanosleep(&nap, NULL);
+            continue;
+        }
+        if (pwrite(fd, cmd, len, 0) < 0) {
+            perror("write");
+            break;
+        }
+        atomic_fetch_add(&sent, per_write);
+    }
+    close(fd);
+    atomic_store(&writer_done, 1);
+    return NULL;
+}
+
+static void on_event(const struct l3h_msg *m, void *arg) {
+    struct bench *b = arg;
+    uint64_t lat = b->now_ns > m->timestamp_ns ? b->now_ns - m->timestamp_ns : 0;
+
+    if (m->id != L3H_EVENT_TRIGGER) return;
+    l3h_seq_check(&b->seq, m->seq);
+    b->kernel_dropped = m->dropped;
+    b->received++;
+    if (lat > b->max_ns) b->max_ns = lat;
+    if (b->nr_lat < MAX_SAMPLES) b->lat_ns[b->nr_lat++] = lat > UINT32_MAX ? UINT32_MAX : lat;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double pct_us(const struct bench *b, double p) {
+    if (!b->nr_lat) return 0;
+    return b->lat_ns[(uint64_t)(p / 100 * (b->nr_lat - 1))] / 1e3;
+}
+
+int main(int argc, char **argv) {
+    int opt, fd, no_enobufs = 0, rcvbuf = 32 << 20;
+    unsigned int vlen = 64;
+    uint64_t start, stop, last_rx;
+    uint32_t dropped_at_start = 0;
+    struct bench b = { 0 };
+    struct l3h_rx rx;
+    uint16_t family;
+    pthread_t thr;
+    double secs;
+
+    while ((opt = getopt(argc, argv, "r:d:kb:v:B:n")) != -1) {
+        switch (opt) {
+        case 'r': rate = atof(optarg); break;
+        case 'd': duration = atof(optarg); break;
+        case 'k': kernel_burst = 1; break;
+        case 'b': burst = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+        case 'v': vlen = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+        case 'B': rcvbuf = atoi(optarg); break;
+        case 'n': no_enobufs = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-r rate] [-d secs] [-k [-b burst]] [-v vlen] [-B bytes] [-n]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    fd = l3h_genl_open(&family);
+    if (fd < 0) {
+        perror("l3h_events family (is simple_netlink loaded?)");
+        return 1;
+    }
+    if (l3h_genl_set_rcvbuf(fd, rcvbuf) < 0) perror("SO_RCVBUF");
+    if (no_enobufs && l3h_genl_no_enobufs(fd) < 0) perror("NETLINK_NO_ENOBUFS");
+    b.lat_ns = malloc(MAX_SAMPLES * sizeof(*b.lat_ns));
+    if (!b.lat_ns || l3h_rx_init(&rx, fd, family, vlen) < 0) {
+        perror("malloc");
+        return 1;
+    }
+
+    start = last_rx = now_ns();
+    if (pthread_create(&thr, NULL, writer, NULL)) {
+        perror("pthread_create");
+        return 1;
+    }
+
+    /* Receive until the writer is done and the channel has gone quiet */
+    for (;;) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        uint64_t before = b.received;
+
+        if (poll(&pfd, 1, 50) < 0) break;
+        b.now_ns = now_ns();
+        if (pfd.revents && l3h_rx_poll(&rx, MSG_DONTWAIT, on_event, &b) < 0 && errno != EAGAIN) {
+            perror("recvmmsg");
+            break;
+        }
+        if (b.received == 1 && before == 0) dropped_at_start = b.kernel_dropped;
+        if (b.received != before) last_rx = b.now_ns;
+        if (atomic_load(&writer_done) && now_ns() - last_rx > GRACE_NS) break;
+    }
+    stop = last_rx;
+    pthread_join(thr, NULL);
+
+    secs = (stop - start) / 1e9;
+    qsort(b.lat_ns, b.nr_lat, sizeof(*b.lat_ns), cmp_u32);
+
+    printf("mode:      %s, target %.0f events/s for %.1f s\n",
+           kernel_burst ? "kernel burst" : "sysfs write", rate, duration);
+    printf("posted:    %llu\n", (unsigned long long)atomic_load(&sent));
+    printf("received:  %llu (%.0f events/s over %.2f s)\n",
+           (unsigned long long)b.received, secs > 0 ? b.received / secs : 0, secs);
+    printf("lost:      %llu (seq gaps %llu, kernel dropped %u, ENOBUFS %llu, truncated %llu)\n",
+           (unsigned long long)(atomic_load(&sent) > b.received ? atomic_load(&sent) - b.received : 0),
+           (unsigned long long)b.seq.lost, b.kernel_dropped - dropped_at_start,
+           (unsigned long long)rx.enobufs, (unsigned long long)rx.truncated);
+    printf("batching:  %.1f events/datagram, %.1f datagrams/recvmmsg\n",
+           rx.datagrams ? (double)rx.events / rx.datagrams : 0,
+           rx.calls ? (double)rx.datagrams / rx.calls : 0);
+    printf("latency:   p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+           pct_us(&b, 50), pct_us(&b, 99), pct_us(&b, 99.9), b.max_ns / 1e3);
+
+    l3h_rx_free(&rx);
+    free(b.lat_ns);
+    close(fd);
+    return 0;
+}
@@ -1,53 +1,143 @@
+#define _GNU_SOURCE         /* recvmmsg() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <linux/netlink.h>
 
-#define NETLINK_USER 31
-#define MY_GROUP 1
+#include "l3h_genl_user.h"
 
-int main() {
-    int sock_fd;
-    struct sockaddr_nl src_addr;
+#define RX_BUF_SIZE 16384
+
+/*
+ * Usage: nl_listener           print every event (one recvmsg() each)
+ *        nl_listener -m [-v N] [-B bytes] [-n]
+ *            batch mode: N datagrams per recvmmsg() (default 64), a
+ *            receive queue of 'bytes' (default 8 MB, SO_RCVBUFFORCE
+ *            when allowed), -n to set NETLINK_NO_ENOBUFS. Prints one
+ *            line per second instead of per event.
+ */
+
+struct stats {
+    struct l3h_seq seq;
+    uint32_t kernel_dropped;
+};
+
+static void count_event(const struct l3h_msg *m, void *arg) {
+    struct stats *st = arg;
+
+    l3h_seq_check(&st->seq, m->seq);
+    st->kernel_dropped = m->dropped;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int batch_mode(int sock_fd, uint16_t family, unsigned int vlen, int rcvbuf, int no_enobufs) {
+    struct l3h_rx rx;
+    struct stats st = { 0 };
+    uint64_t last_events = 0, last_lost = 0;
+    double last = now_s();
+
+    if (l3h_genl_set_rcvbuf(sock_fd, rcvbuf) < 0) perror("SO_RCVBUF");
+    if (no_enobufs && l3h_genl_no_enobufs(sock_fd) < 0) perror("NETLINK_NO_ENOBUFS");
+    if (l3h_rx_init(&rx, sock_fd, family, vlen) < 0) {
+        perror("malloc");
+        return -1;
+    }
+
+    printf("Batch mode: %u datagrams per call, %d byte queue%s\n",
+           vlen, rcvbuf, no_enobufs ? ", no ENOBUFS" : "");
+    while (1) {
+        double t;
+
+        /* Block for the first datagram, then take whatever else is queued */
+        if (l3h_rx_poll(&rx, MSG_WAITFORONE, count_event, &st) < 0) {
+            perror("recvmmsg");
+            break;
+        }
+        t = now_s();
+        if (t - last < 1.0) continue;
+        printf("%8.0f events/s | lost %llu (+%llu) | kernel dropped %u | "
+               "ENOBUFS %llu | %.1f events/call\n",
+               (rx.events - last_events) / (t - last),
+               (unsigned long long)st.seq.lost,
+               (unsigned long long)(st.seq.lost - last_lost), st.kernel_dropped,
+               (unsigned long long)rx.enobufs,
+               rx.calls ? (double)rx.events / rx.calls : 0.0);
+        fflush(stdout);
+        last = t;
+        last_events = rx.events;
+        last_lost = st.seq.lost;
+    }
+    l3h_rx_free(&rx);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int sock_fd, opt, batch = 0, no_enobufs = 0, rcvbuf = 8 << 20;
+    unsigned int vlen = 64;
+    uint16_t family;
     struct nlmsghdr *nlh;
     struct iovec iov;
     struct msghdr msg;
 
-    sock_fd = socket(PF_NETLINK, SOCK_RAW, NETLINK_USER);
-    if (sock_fd < 0) return -1;
-
-    memset(&src_addr, 0, sizeof(src_addr));
-    src_addr.nl_family = AF_NETLINK;
-    src_addr.nl_pid = getpid();
-    /* Correct Group Mask for Group 1: (1 << (1 - 1)) = 1 */
-    src_addr.nl_groups = (1 << (MY_GROUP - 1));
+    while ((opt = getopt(argc, argv, "mv:B:n")) != -1) {
+        switch (opt) {
+        case 'm': batch = 1; break;
+        case 'v': vlen = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+        case 'B': rcvbuf = atoi(optarg); break;
+        case 'n': no_enobufs = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-m [-v datagrams] [-B bytes] [-n]]\n", argv[0]);
+            return 1;
+        }
+    }
 
-    if (bind(sock_fd, (struct sockaddr *)&src_addr, sizeof(src_addr)) < 0) {
-        perror("Bind failed");
+    /* Generic netlink: family and group are looked up by name */
+    sock_fd = l3h_genl_open(&family);
+    if (sock_fd < 0) {
+        perror("l3h_events family");
         return -1;
     }
+    if (batch) return batch_mode(sock_fd, family, vlen, rcvbuf, no_enobufs);
 
-    nlh = (struct nlmsghdr *)malloc(NLMSG_SPACE(1024));
-    memset(nlh, 0, NLMSG_SPACE(1024));
+    nlh = (struct nlmsghdr *)malloc(RX_BUF_SIZE);
+    memset(nlh, 0, RX_BUF_SIZE);
 
     iov.iov_base = (void *)nlh;
-    iov.iov_len = NLMSG_SPACE(1024);
+    iov.iov_len = RX_BUF_SIZE;
 
     memset(&msg, 0, sizeof(msg));
     msg.msg_iov = &iov;
     msg.msg_iovlen = 1;
 
-    printf("Waiting for kernel message on Group %d...\n", MY_GROUP);
+    printf("Waiting for kernel messages on %s/%s...\n", L3H_GENL_NAME, L3H_GENL_MCGRP);
 
     while (1) {
         ssize_t ret = recvmsg(sock_fd, &msg, 0);
-        if (ret > 0) {
-            printf("Received: %s\n", (char *)NLMSG_DATA(nlh));
+        struct nlmsghdr *h;
+        struct l3h_msg ev;
+
+        /* The queue overflowed: the next sequence number shows how far */
+        if (ret < 0 && errno == ENOBUFS) {
+            printf("[ENOBUFS] receive queue overflowed, resyncing\n");
+            continue;
+        }
+        /* Several events per datagram: walk every message in it */
+        for (h = nlh; ret > 0 && NLMSG_OK(h, ret); h = NLMSG_NEXT(h, ret)) {
+            if (l3h_parse(h, family, &ev)) continue;
+            printf("Received: seq %u t=%llu ns: %.*s\n", ev.seq,
+                   (unsigned long long)ev.timestamp_ns, (int)ev.payload_len,
+                   ev.payload ? (const char *)ev.payload : "");
         }
     }
 
     return 0;
 }
-
@@ -3,11 +3,14 @@
  * @brief User-space listener for L3Harris Netlink broadcasts.
  * 
  * PRESENTATION NOTES:
- * 1. Protocol: USES NETLINK_USER (31) to match the kernel driver.
- * 2. Multicast: Binds to Group 1 to receive broadcast events.
+ * 1. Protocol: Generic netlink family "l3h_events" (l3h_events.h), looked
+ *    up by name, so no protocol number has to match the kernel driver.
+ * 2. Multicast: Joins the family's "events" group to receive broadcasts.
  * 3. Blocking: The recvmsg() call sleeps efficiently until the kernel speaks.
+ * 4. Batching: One recvmsg() may return many events; walk them all.
  */
 
+#define _GNU_SOURCE         /* recvmmsg() in l3h_genl_user.h */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,44 +18,34 @@
 #include <sys/socket.h>
 #include <linux/netlink.h>
 
-/* Must match the kernel driver defines */
-#define NETLINK_L3HARRIS 31
-#define L3H_MCAST_GROUP  1
+#include "l3h_genl_user.h"
+
+#define RX_BUF_SIZE 16384   /* Room for a whole NLMSG_GOODSIZE batch */
 
 int main() {
     int sock_fd;
-    struct sockaddr_nl src_addr, dest_addr;
+    uint16_t family;
+    struct sockaddr_nl dest_addr;
     struct nlmsghdr *nlh = NULL;
     struct iovec iov;
     struct msghdr msg;
+    uint32_t next_seq = 0;
+    int synced = 0;
 
-    /* 1. Create a Netlink Socket */
-    sock_fd = socket(PF_NETLINK, SOCK_RAW, NETLINK_L3HARRIS);
+    /* 1. + 2. Socket, family lookup and group membership */
+    sock_fd = l3h_genl_open(&family);
     if (sock_fd < 0) {
-        perror("Socket creation failed");
-        return -1;
-    }
-
-    /* 2. Set up Source Address (Our app) */
-    memset(&src_addr, 0, sizeof(src_addr));
-    src_addr.nl_family = AF_NETLINK;
-    src_addr.nl_pid = getpid(); /* Our unique ID */
-    /* Bind to the multicast group mask: (1 << (group_id - 1)) */
-    src_addr.nl_groups = (1 << (L3H_MCAST_GROUP - 1));
-
-    if (bind(sock_fd, (struct sockaddr *)&src_addr, sizeof(src_addr)) < 0) {
-        perror("Bind failed");
-        close(sock_fd);
+        perror("l3h_events family not available (module loaded?)");
         return -1;
     }
 
     /* 3. Prepare the Buffer for incoming messages */
-    nlh = (struct nlmsghdr *)malloc(NLMSG_SPACE(1024));
-    memset(nlh, 0, NLMSG_SPACE(1024));
+    nlh = (struct nlmsghdr *)malloc(RX_BUF_SIZE);
+    memset(nlh, 0, RX_BUF_SIZE);
 
     memset(&iov, 0, sizeof(iov));
     iov.iov_base = (void *)nlh;
-    iov.iov_len = NLMSG_SPACE(1024);
+    iov.iov_len = RX_BUF_SIZE;
 
     memset(&msg, 0, sizeof(msg));
     msg.msg_name = (void *)&dest_addr;
@@ -61,21 +54,37 @@ int main() {
     msg.msg_iovlen = 1;
 
     printf("--- L3Harris Event Monitor ---\n");
-    printf("Listening for Kernel events on Group %d...\n", L3H_MCAST_GROUP);
+    printf("Listening for Kernel events on %s/%s...\n", L3H_GENL_NAME, L3H_GENL_MCGRP);
 
     /* 4. Infinite Loop: Wait for Kernel Broadcasts */
     while (1) {
         ssize_t ret = recvmsg(sock_fd, &msg, 0);
-        if (ret > 0) {
-            /* Print the data payload (skipping the Netlink header) */
-            char *payload = (char *)NLMSG_DATA(nlh);
-            
-            if (strcmp(payload, "STATE:MOTION") == 0) {
-                printf("[NOTIFICATION] %-15s | Motion Triggered! LEDs Flashing.\n", payload);
-            } else if (strcmp(payload, "STATE:CLEAR") == 0) {
-                printf("[NOTIFICATION] %-15s | Area Secure. LEDs Off.\n", payload);
+        struct nlmsghdr *h;
+        struct l3h_msg ev;
+
+        /* Overflowed while we were printing: the next seq shows the gap */
+        if (ret < 0 && errno == ENOBUFS) {
+            printf("[ENOBUFS] receive queue overflowed, resyncing\n");
+            continue;
+        }
+        if (ret <= 0) continue;
+        for (h = nlh; NLMSG_OK(h, ret); h = NLMSG_NEXT(h, ret)) {
+            if (l3h_parse(h, family, &ev)) continue;
+
+            /* A jump in the sequence means events never reached us */
+            if (synced && ev.seq != next_seq)
+                printf("[GAP] %u event(s) lost (kernel dropped %u so far)\n",
+                       ev.seq - next_seq, ev.dropped);
+            next_seq = ev.seq + 1;
+            synced = 1;
+
+            if (ev.id == L3H_EVENT_MOTION) {
+                printf("[NOTIFICATION] seq %-6u %-12s | Motion Triggered! LEDs Flashing.\n", ev.seq, "STATE:MOTION");
+            } else if (ev.id == L3H_EVENT_CLEAR) {
+                printf("[NOTIFICATION] seq %-6u %-12s | Area Secure. LEDs Off.\n", ev.seq, "STATE:CLEAR");
             } else {
-                printf("[EVENT] Received: %s\n", payload);
+                printf("[EVENT] seq %u id %u: %.*s\n", ev.seq, ev.id,
+                       (int)ev.payload_len, ev.payload ? (const char *)ev.payload : "");
             }
         }
     }
@@ -3,6 +3,12 @@
  * @file netlink_test.c
  * @author AI Thought Partner & [Your Name]
  * @brief Unified Sysfs-to-Netlink Broadcast Fix for Kernel 6.12+
+ *
+ * Each write to /sys/kernel/netlink_test/trigger becomes one
+ * L3H_EVENT_TRIGGER on the l3h_events generic netlink family
+ * (l3h_events.h), with the text written as its payload. The write only
+ * queues the event; a work item sends whatever has queued up, packing
+ * many events per skb.
  */
 
 #include <linux/module.h>
@@ -11,94 +17,225 @@
 #include <linux/sysfs.h>
 #include <linux/slab.h>
 #include <linux/version.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
 #include <net/netlink.h>
 #include <net/genetlink.h>
 
-#define NETLINK_USER 31    /* Custom protocol family */
-#define MY_GROUP     1     /* Multicast group ID */
+#include "l3h_events.h"
+
+#define EVENT_RING 256     /* Queued events; power of two */
+
+struct test_event {
+    u64 ts;
+    u32 seq;
+    u16 len;
+    u8 payload[L3H_PAYLOAD_MAX];
+};
 
-static struct sock* nl_sk = NULL;
 static struct kobject* test_kobj;
 
+/* Writers queue under ev_lock; event_work is the only consumer */
+static DEFINE_SPINLOCK(ev_lock);
+static struct test_event* ring;
+static u32 ring_head, ring_tail;
+static u32 ev_seq;
+static u32 ev_dropped;     /* Queue full, no memory, or a listener fell behind */
+
+static const struct genl_multicast_group test_mcgrps[] = {
+    { .name = L3H_GENL_MCGRP },
+};
+
+static struct genl_family test_family = {
+    .name = L3H_GENL_NAME,
+    .version = L3H_GENL_VERSION,
+    .maxattr = L3H_A_MAX,
+    .module = THIS_MODULE,
+    .mcgrps = test_mcgrps,
+    .n_mcgrps = ARRAY_SIZE(test_mcgrps),
+};
+
+static void count_drops(u32 n) {
+    spin_lock(&ev_lock);
+    ev_dropped += n;
+    spin_unlock(&ev_lock);
+}
+
+/* One L3H_CMD_EVENT message appended to skb */
+static int put_event(struct sk_buff* skb, const struct test_event* e, u32 dropped) {
+    void* hdr = genlmsg_put(skb, 0, 0, &test_family, 0, L3H_CMD_EVENT);
+
+    if (!hdr) return -EMSGSIZE;
+    if (nla_put_u32(skb, L3H_A_EVENT_ID, L3H_EVENT_TRIGGER) ||
+        nla_put_u32(skb, L3H_A_SEQ, e->seq) ||
+        nla_put_u64_64bit(skb, L3H_A_TIMESTAMP, e->ts, L3H_A_PAD) ||
+        nla_put(skb, L3H_A_PAYLOAD, e->len, e->payload) ||
+        nla_put_u32(skb, L3H_A_DROPPED, dropped)) {
+        genlmsg_cancel(skb, hdr);
+        return -EMSGSIZE;
+    }
+    genlmsg_end(skb, hdr);
+    return 0;
+}
+
+/**
+ * send_batch() - Multicasts one skb of n events.
+ * -ESRCH just means no subscribers; any other error means at least one
+ * subscriber's receive queue was full and it missed the whole batch.
+ */
+static void send_batch(struct sk_buff* skb, u32 n) {
+    int res = genlmsg_multicast(&test_family, skb, 0, 0, GFP_KERNEL);
+
+    if (res && res != -ESRCH) {
+        count_drops(n);
+        pr_debug("netlink_test: batch of %u not delivered: %d\n", n, res);
+    }
+}
+
+/**
+ * flush_events() - Drains the queue into as few skbs as it takes.
+ * Runs in a kworker, so it can sleep and allocate with GFP_KERNEL.
+ */
+static void flush_events(struct work_struct* work) {
+    struct sk_buff* skb = NULL;
+    struct test_event e;
+    u32 dropped, n = 0;
+
+    for (;;) {
+        spin_lock(&ev_lock);
+        if (ring_tail == ring_head) {
+            spin_unlock(&ev_lock);
+            break;
+        }
+        e = ring[ring_tail++ & (EVENT_RING - 1)];
+        dropped = ev_dropped;
+        spin_unlock(&ev_lock);
+
+        if (!genl_has_listeners(&test_family, &init_net, 0)) continue;
+        if (skb && !put_event(skb, &e, dropped)) {
+            n++;
+            continue;
+        }
+        if (skb) send_batch(skb, n);
+        skb = genlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+        if (!skb || put_event(skb, &e, dropped)) {
+            nlmsg_free(skb);
+            skb = NULL;
+            count_drops(1);
+            continue;
+        }
+        n = 1;
+    }
+    if (skb) send_batch(skb, n);
+}
+
+static DECLARE_WORK(event_work, flush_events);
+
 /**
- * broadcast_event() - Sends a Netlink multicast message.
- * Fix: Explicitly sets dst_group and uses the raw group ID for nlmsg_multicast.
+ * post_event() - Queues one event, numbered and stamped now.
+ * The sequence number advances even for a dropped event, so listeners
+ * see the gap.
  */
-static void broadcast_event(const char* msg) {
-    struct sk_buff* skb;
-    struct nlmsghdr* nlh;
-    int msg_size = strlen(msg) + 1;
-    int res;
-
-    /* Create the socket buffer. Use GFP_KERNEL as sysfs stores can sleep. */
-    skb = nlmsg_new(msg_size, GFP_KERNEL);
-    if (!skb) return;
-
-    /* Initialize Netlink header */
-    nlh = nlmsg_put(skb, 0, 0, NLMSG_DONE, msg_size, 0);
-
-    /* MANDATORY: Set the destination group in the Control Block (CB) */
-    NETLINK_CB(skb).dst_group = MY_GROUP;
-
-    /* Copy the payload */
-    strncpy(nlmsg_data(nlh), msg, msg_size);
-
-    /**
-     * nlmsg_multicast() params:
-     * 1. The socket
-     * 2. The buffer (skb)
-     * 3. portid (0 to skip no one)
-     * 4. group (The raw group ID, e.g., 1)
-     * 5. allocation flags
-     */
-    res = nlmsg_multicast(nl_sk, skb, 0, MY_GROUP, GFP_KERNEL);
-
-    if (res < 0)
-        pr_err("netlink_test: Send failed with error %d\n", res);
-    else
-        pr_info("netlink_test: Broadcasted '%s' to group %d\n", msg, MY_GROUP);
+static void post_event(const char* msg, size_t len) {
+    spin_lock(&ev_lock);
+    if (ring_head - ring_tail < EVENT_RING) {
+        struct test_event* e = &ring[ring_head++ & (EVENT_RING - 1)];
+
+        e->ts = ktime_get_ns();
+        e->seq = ev_seq;
+        e->len = min_t(size_t, len, L3H_PAYLOAD_MAX);
+        memcpy(e->payload, msg, e->len);
+    } else {
+        ev_dropped++;
+    }
+    ev_seq++;
+    spin_unlock(&ev_lock);
+
+    schedule_work(&event_work);
 }
 
 /* Handler for: echo "msg" > /sys/kernel/netlink_test/trigger */
 static ssize_t trigger_store(struct kobject* kobj, struct kobj_attribute* attr,
     const char* buf, size_t count) {
-    char kbuf[128];
+    /* The text as written, minus echo's newline; binary-safe on the wire */
+    post_event(buf, count && buf[count - 1] == '\n' ? count - 1 : count);
+    return count;
+}
 
-    /* Sanitize and format the message */
-    snprintf(kbuf, sizeof(kbuf), "DATA: %.*s", (int)min(count, sizeof(kbuf) - 10), buf);
+static struct kobj_attribute trigger_attribute = __ATTR_WO(trigger);
 
-    broadcast_event(kbuf);
+/*
+ * Handler for: echo N > /sys/kernel/netlink_test/burst
+ * Posts N events back to back from here, for rates one write() per
+ * event cannot reach (see nl_bench -k). The payload is "burst".
+ */
+#define BURST_MAX 1000000
+
+static ssize_t burst_store(struct kobject* kobj, struct kobj_attribute* attr,
+    const char* buf, size_t count) {
+    unsigned int i, n;
+    int ret = kstrtouint(buf, 0, &n);
+
+    if (ret) return ret;
+    if (n > BURST_MAX) return -EINVAL;
+    for (i = 0; i < n; i++) {
+        post_event("burst", 5);
+        /* Let the flush run if it is waiting for this CPU */
+        cond_resched();
+    }
     return count;
 }
 
-static struct kobj_attribute trigger_attribute = __ATTR_WO(trigger);
+static struct kobj_attribute burst_attribute = __ATTR_WO(burst);
+
+static struct attribute* test_attrs[] = {
+    &trigger_attribute.attr,
+    &burst_attribute.attr,
+    NULL,
+};
+
+static const struct attribute_group test_group = {
+    .attrs = test_attrs,
+};
 
 static int __init netlink_test_init(void) {
-    /* Set groups = 1 to enable multicasting for this protocol */
-    struct netlink_kernel_cfg cfg = { .groups = 1 };
+    int ret;
 
-    nl_sk = netlink_kernel_create(&init_net, NETLINK_USER, &cfg);
-    if (!nl_sk) return -ENOMEM;
+    ring = kcalloc(EVENT_RING, sizeof(*ring), GFP_KERNEL);
+    if (!ring) return -ENOMEM;
+
+    /* Family and its multicast group, resolved by name from user space */
+    ret = genl_register_family(&test_family);
+    if (ret) {
+        kfree(ring);
+        return ret;
+    }
 
     test_kobj = kobject_create_and_add("netlink_test", kernel_kobj);
     if (!test_kobj) {
-        netlink_kernel_release(nl_sk);
+        genl_unregister_family(&test_family);
+        kfree(ring);
         return -ENOMEM;
     }
 
-    if (sysfs_create_file(test_kobj, &trigger_attribute.attr)) {
+    if (sysfs_create_group(test_kobj, &test_group)) {
         kobject_put(test_kobj);
-        netlink_kernel_release(nl_sk);
+        genl_unregister_family(&test_family);
+        kfree(ring);
         return -ENOMEM;
     }
 
-    pr_info("netlink_test: Ready on /sys/kernel/netlink_test/trigger\n");
+    pr_info("netlink_test: Ready on /sys/kernel/netlink_test/{trigger,burst}\n");
     return 0;
 }
 
 static void __exit netlink_test_exit(void) {
     if (test_kobj) kobject_put(test_kobj);
-    if (nl_sk) netlink_kernel_release(nl_sk);
+    /* The trigger is gone; send or drop what it queued */
+    flush_work(&event_work);
+    genl_unregister_family(&test_family);
+    kfree(ring);
     pr_info("netlink_test: Unloaded\n");
 }
 